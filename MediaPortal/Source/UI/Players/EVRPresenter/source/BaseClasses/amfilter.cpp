@@ -539,9 +539,7 @@ CBaseFilter::Stop()
         }
     }
 
-#ifdef DXMPERF
     PERFLOG_STOP( m_pName ? m_pName : L"CBaseFilter", (IBaseFilter *) this, m_State );
-#endif // DXMPERF
 
     m_State = State_Stopped;
     return hr;
@@ -579,9 +577,7 @@ CBaseFilter::Pause()
     }
 
 
-#ifdef DXMPERF
     PERFLOG_PAUSE( m_pName ? m_pName : L"CBaseFilter", (IBaseFilter *) this, m_State );
-#endif // DXMPERF
 
     m_State = State_Paused;
     return S_OK;
@@ -633,9 +629,7 @@ CBaseFilter::Run(REFERENCE_TIME tStart)
         }
     }
 
-#ifdef DXMPERF
     PERFLOG_RUN( m_pName ? m_pName : L"CBaseFilter", (IBaseFilter *) this, tStart, m_State );
-#endif // DXMPERF
 
     m_State = State_Running;
     return S_OK;
@@ -1384,21 +1378,21 @@ CEnumMediaTypes::Next(ULONG cMediaTypes,          // place this many types...
            scope it will delete the memory we have just copied. The function
            we use is CreateMediaType which allocates a task memory block */
 
-        /*  Transfer across the format block manually to save an allocate
-            and free on the format block and generally go faster */
+        /*  Transfer across the format block to save an allocate and free
+            on a task allocated block and generally go faster. A format
+            block kept inside cmt is copied to task memory here, this is
+            where it crosses the COM boundary */
 
         *ppMediaTypes = (AM_MEDIA_TYPE *)CoTaskMemAlloc(sizeof(AM_MEDIA_TYPE));
         if (*ppMediaTypes == NULL) {
             break;
         }
 
-        /*  Do a regular copy */
-        **ppMediaTypes = cmt;
-
-        /*  Make sure the destructor doesn't free these */
-        cmt.pbFormat = NULL;
-        cmt.cbFormat = NULL;
-        cmt.pUnk     = NULL;
+        if (FAILED(cmt.Detach(*ppMediaTypes))) {
+            CoTaskMemFree((PVOID)*ppMediaTypes);
+            *ppMediaTypes = NULL;
+            break;
+        }
 
 
         ppMediaTypes++;
@@ -2688,9 +2682,7 @@ CBaseOutputPin::Deliver(IMediaSample * pSample)
         return VFW_E_NOT_CONNECTED;
     }
 
-#ifdef DXMPERF
     PERFLOG_DELIVER( m_pName ? m_pName : L"CBaseOutputPin", (IPin *) this, (IPin  *) m_pInputPin, pSample, &m_mt );
-#endif // DXMPERF
 
     return m_pInputPin->Receive(pSample);
 }
@@ -2960,9 +2952,7 @@ CBaseInputPin::Receive(IMediaSample *pSample)
         return hr;
     }
 
-#ifdef DXMPERF
     PERFLOG_RECEIVE( m_pName ? m_pName : L"CBaseInputPin", (IPin *) m_Connected, (IPin *) this, pSample, &m_mt );
-#endif // DXMPERF
 
 
     /* Check for IMediaSample2 */
@@ -4738,32 +4728,32 @@ HRESULT CBaseAllocator::GetBuffer(__deref_out IMediaSample **ppBuffer,
     UNREFERENCED_PARAMETER(pEndTime);
     UNREFERENCED_PARAMETER(dwFlags);
     CMediaSample *pSample;
+    BOOL bCommitted;
 
     *ppBuffer = NULL;
     for (;;)
     {
-        {  // scope for lock
-            CAutoLock cObjectLock(this);
-
-            /* Check we are committed */
-            if (!m_bCommitted) {
-                return VFW_E_NOT_COMMITTED;
-            }
-            pSample = (CMediaSample *) m_lFree.RemoveHead();
-            if (pSample == NULL) {
-                SetWaiting();
-            }
-        }
-
-        /* If we didn't get a sample then wait for the list to signal */
-
+        /* Take a sample if we are committed - no lock needed */
+        pSample = m_lFree.RemoveHeadCommitted(&bCommitted);
         if (pSample) {
             break;
         }
+        if (!bCommitted) {
+            return VFW_E_NOT_COMMITTED;
+        }
         if (dwFlags & AM_GBF_NOWAIT) {
             return VFW_E_TIMEOUT;
         }
+
+        /* The list is empty: park until a sample is released. Check
+           again after announcing the wait, a sample may have come back
+           before the releasing thread could see m_lWaiting */
+
         ASSERT(m_hSem != NULL);
+        SetWaiting();
+        if (m_lFree.GetCount() != 0 || !m_lFree.IsCommitted()) {
+            NotifySample();
+        }
         WaitForSingleObject(m_hSem, INFINITE);
     }
 
@@ -4777,9 +4767,7 @@ HRESULT CBaseAllocator::GetBuffer(__deref_out IMediaSample **ppBuffer,
     pSample->m_cRef = 1;
     *ppBuffer = pSample;
 
-#ifdef DXMPERF
     PERFLOG_GETBUFFER( (IMemAllocator *) this, pSample );
-#endif // DXMPERF
 
     return NOERROR;
 }
@@ -4793,27 +4781,28 @@ CBaseAllocator::ReleaseBuffer(IMediaSample * pSample)
     CheckPointer(pSample,E_POINTER);
     ValidateReadPtr(pSample,sizeof(IMediaSample));
 
-#ifdef DXMPERF
     PERFLOG_RELBUFFER( (IMemAllocator *) this, pSample );
-#endif // DXMPERF
 
 
     BOOL bRelease = FALSE;
-    {
-        CAutoLock cal(this);
 
-        /* Put back on the free list */
+    /* Put back on the free list */
 
-        m_lFree.Add((CMediaSample *)pSample);
-        if (m_lWaiting != 0) {
-            NotifySample();
-        }
+    LONG lState = m_lFree.Add((CMediaSample *)pSample);
+    if (m_lWaiting != 0) {
+        NotifySample();
+    }
 
-        // if there is a pending Decommit, then we need to complete it by
-        // calling Free() when the last buffer is placed on the free list
+    // if there is a pending Decommit, then we need to complete it by
+    // calling Free() when the last buffer is placed on the free list.
+    // lState only equals m_lAllocated if the list is not committed, so we
+    // just take the lock for the last buffer after a Decommit (Decommit
+    // may still be about to set m_bDecommitInProgress, so check again)
 
-        LONG l1 = m_lFree.GetCount();
-        if (m_bDecommitInProgress && (l1 == m_lAllocated)) {
+    if (lState == m_lAllocated) {
+        CAutoLock cal(this);
+        if (m_bDecommitInProgress && !m_bCommitted &&
+            m_lFree.GetCount() == m_lAllocated) {
             Free();
             m_bDecommitInProgress = FALSE;
             bRelease = TRUE;
@@ -4872,9 +4861,12 @@ void
 CBaseAllocator::NotifySample()
 {
     if (m_lWaiting != 0) {
-        ASSERT(m_hSem != NULL);
-        ReleaseSemaphore(m_hSem, m_lWaiting, 0);
-        m_lWaiting = 0;
+        // only the thread that takes the count may release the waiters
+        LONG lWaiting = InterlockedExchange(&m_lWaiting, 0);
+        if (lWaiting != 0) {
+            ASSERT(m_hSem != NULL);
+            ReleaseSemaphore(m_hSem, lWaiting, 0);
+        }
     }
 }
 
@@ -4901,6 +4893,7 @@ CBaseAllocator::Commit()
         // between Decommit and the last free, so the buffer size cannot have
         // changed. And because some of the buffers are not free yet, he
         // cannot re-alloc anyway.
+        m_lFree.Open();
         return NOERROR;
     }
 
@@ -4912,6 +4905,9 @@ CBaseAllocator::Commit()
         m_bCommitted = FALSE;
         return hr;
     }
+
+    // GetBuffer can take samples from now on
+    m_lFree.Open();
     AddRef();
     return NOERROR;
 }
@@ -4932,9 +4928,10 @@ CBaseAllocator::Decommit()
 
         /* No more GetBuffer calls will succeed */
         m_bCommitted = FALSE;
+        int nFree = m_lFree.Close();
 
         // are any buffers outstanding?
-        if (m_lFree.GetCount() < m_lAllocated) {
+        if (nFree < m_lAllocated) {
             // please complete the decommit when last buffer is freed
             m_bDecommitInProgress = TRUE;
         } else {
@@ -4988,25 +4985,6 @@ CBaseAllocator::Alloc(void)
     return NOERROR;
 }
 
-/*  Implement CBaseAllocator::CSampleList::Remove(pSample)
-    Removes pSample from the list
-*/
-void
-CBaseAllocator::CSampleList::Remove(__inout CMediaSample * pSample)
-{
-    CMediaSample **pSearch;
-    for (pSearch = &m_List;
-         *pSearch != NULL;
-         pSearch = &(CBaseAllocator::NextSample(*pSearch))) {
-       if (*pSearch == pSample) {
-           *pSearch = CBaseAllocator::NextSample(pSample);
-           CBaseAllocator::NextSample(pSample) = NULL;
-           m_nOnList--;
-           return;
-       }
-    }
-    DbgBreak("Couldn't find sample in list");
-}
 
 //=====================================================================
 //=====================================================================
@@ -5027,7 +5005,10 @@ CMemAllocator::CMemAllocator(
     __inout_opt LPUNKNOWN pUnk,
     __inout HRESULT *phr)
     : CBaseAllocator(pName, pUnk, phr, TRUE, TRUE),
-    m_pBuffer(NULL)
+    m_pBuffer(NULL),
+    m_cbArena(0),
+    m_bLargePages(FALSE),
+    m_bUseLargePages(FALSE)
 {
 }
 
@@ -5037,7 +5018,10 @@ CMemAllocator::CMemAllocator(
     __inout_opt LPUNKNOWN pUnk,
     __inout HRESULT *phr)
     : CBaseAllocator(pName, pUnk, phr, TRUE, TRUE),
-    m_pBuffer(NULL)
+    m_pBuffer(NULL),
+    m_cbArena(0),
+    m_bLargePages(FALSE),
+    m_bUseLargePages(FALSE)
 {
 }
 #endif
@@ -5101,13 +5085,83 @@ CMemAllocator::SetProperties(
     if (lRemainder != 0) {
         lSize = lSize - lRemainder + pRequest->cbAlign;
     }
-    pActual->cbBuffer = m_lSize = (lSize - pRequest->cbPrefix);
+    lSize -= pRequest->cbPrefix;
 
+    // Only a real change makes Commit rebuild the samples; renegotiating
+    // the same properties keeps the samples and their memory
+    if (m_pBuffer == NULL ||
+        m_lSize != lSize ||
+        m_lCount != pRequest->cBuffers ||
+        m_lAlignment != pRequest->cbAlign ||
+        m_lPrefix != pRequest->cbPrefix) {
+        m_bChanged = TRUE;
+    }
+
+    pActual->cbBuffer = m_lSize = lSize;
     pActual->cBuffers = m_lCount = pRequest->cBuffers;
     pActual->cbAlign = m_lAlignment = pRequest->cbAlign;
     pActual->cbPrefix = m_lPrefix = pRequest->cbPrefix;
 
-    m_bChanged = TRUE;
+    return NOERROR;
+}
+
+
+// Takes effect when the arena is next allocated; an arena we already have
+// is kept as it is.
+void
+CMemAllocator::SetUseLargePages(BOOL bUseLargePages)
+{
+    CAutoLock cObjectLock(this);
+    m_bUseLargePages = bUseLargePages;
+}
+
+
+//  Buffers are spaced at least a cache line apart, and a page apart when
+//  they are this big, unless that breaks the requested alignment
+#define MEMALLOC_CACHE_LINE          64
+#define MEMALLOC_PAGE_ALIGN_MIN      (64 * 1024)
+
+//  Set once the OS refused large pages, so we don't ask again
+static LONG g_lLargePagesFailed = FALSE;
+
+// allocates the block for the buffers. If the owner allowed it we try large
+// pages for blocks of at least one large page; that needs the
+// SeLockMemoryPrivilege, which most processes don't have, so we only try
+// until it fails once.
+//
+// object locked by caller
+HRESULT
+CMemAllocator::AllocArena(SIZE_T cbArena)
+{
+    ASSERT(m_pBuffer == NULL);
+
+    SIZE_T cbLargePage = GetLargePageMinimum();
+    if (m_bUseLargePages && cbLargePage != 0 && cbArena >= cbLargePage &&
+        !g_lLargePagesFailed) {
+        SIZE_T cbLarge = (cbArena + cbLargePage - 1) & ~(cbLargePage - 1);
+        m_pBuffer = (PBYTE)VirtualAlloc(NULL,
+                        cbLarge,
+                        MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES,
+                        PAGE_READWRITE);
+        if (m_pBuffer != NULL) {
+            m_cbArena = cbLarge;
+            m_bLargePages = TRUE;
+            return NOERROR;
+        }
+        DbgLog((LOG_MEMORY, 2, TEXT("Large pages not available (%d)"), GetLastError()));
+        g_lLargePagesFailed = TRUE;
+    }
+
+    m_pBuffer = (PBYTE)VirtualAlloc(NULL,
+                    cbArena,
+                    MEM_COMMIT,
+                    PAGE_READWRITE);
+
+    if (m_pBuffer == NULL) {
+        return E_OUTOFMEMORY;
+    }
+    m_cbArena = cbArena;
+    m_bLargePages = FALSE;
     return NOERROR;
 }
 
@@ -5136,10 +5190,8 @@ CMemAllocator::Alloc(void)
     }
     ASSERT(hr == S_OK); // we use this fact in the loop below
 
-    /* Free the old resources */
-    if (m_pBuffer) {
-        ReallyFree();
-    }
+    /* Free the old samples, the memory may be reused below */
+    FreeSamples();
 
     /* Make sure we've got reasonable values */
     if ( m_lSize < 0 || m_lPrefix < 0 || m_lCount < 0 ) {
@@ -5165,28 +5217,59 @@ CMemAllocator::Alloc(void)
         }
     }
 
+    ASSERT(lAlignedSize % m_lAlignment == 0);
+
+    /* Space the buffers so that no two share a cache line (or a page for
+       big buffers), and start the data after the prefix on such a boundary
+       too. Only done for power of 2 alignments with a prefix that keeps
+       the start of each buffer aligned, so the agreed alignment holds */
+
+    LONG lStride = lAlignedSize;
+    LONG lLead = 0;
+    if ((m_lAlignment & (m_lAlignment - 1)) == 0 &&
+        (m_lPrefix & (m_lAlignment - 1)) == 0) {
+
+        SYSTEM_INFO SysInfo;
+        GetSystemInfo(&SysInfo);
+
+        LONG lBoundary = max(m_lAlignment, MEMALLOC_CACHE_LINE);
+        if (lAlignedSize >= MEMALLOC_PAGE_ALIGN_MIN) {
+            lBoundary = max(lBoundary, (LONG)SysInfo.dwPageSize);
+        }
+        LONG lNewStride = (lAlignedSize + lBoundary - 1) & ~(lBoundary - 1);
+        if (lNewStride >= lAlignedSize) {
+            lStride = lNewStride;
+            lLead = (lBoundary - (m_lPrefix & (lBoundary - 1))) & (lBoundary - 1);
+        }
+    }
+
     /* Create the contiguous memory block for the samples
        making sure it's properly aligned (64K should be enough!)
     */
-    ASSERT(lAlignedSize % m_lAlignment == 0);
-
-    LONGLONG lToAllocate = m_lCount * (LONGLONG)lAlignedSize;
+    LONGLONG lToAllocate = lLead + m_lCount * (LONGLONG)lStride;
 
     /*  Check overflow */
     if (lToAllocate > MAXLONG) {
         return E_OUTOFMEMORY;
     }
 
-    m_pBuffer = (PBYTE)VirtualAlloc(NULL,
-                    (LONG)lToAllocate,
-                    MEM_COMMIT,
-                    PAGE_READWRITE);
-
+    /* Reuse the arena if the buffers fit and it isn't much too big */
+    if (m_pBuffer &&
+        ((SIZE_T)lToAllocate > m_cbArena || (SIZE_T)lToAllocate < m_cbArena / 2)) {
+        ReallyFree();
+    }
     if (m_pBuffer == NULL) {
-        return E_OUTOFMEMORY;
+        hr = AllocArena((SIZE_T)lToAllocate);
+        if (FAILED(hr)) {
+            return hr;
+        }
+        DbgLog((LOG_MEMORY, 1, TEXT("Allocated arena: %Iu bytes%s"),
+                m_cbArena, m_bLargePages ? TEXT(" (large pages)") : TEXT("")));
+    } else {
+        DbgLog((LOG_MEMORY, 1, TEXT("Reusing arena: %Iu bytes"), m_cbArena));
     }
 
-    LPBYTE pNext = m_pBuffer;
+    LPBYTE pNext = m_pBuffer + lLead;
     CMediaSample *pSample;
 
     ASSERT(m_lAllocated == 0);
@@ -5195,7 +5278,7 @@ CMemAllocator::Alloc(void)
     // plus m_lPrefix bytes per sample as a prefix. We set the pointer to
     // the memory after the prefix - so that GetPointer() will return a pointer
     // to m_lSize bytes.
-    for (; m_lAllocated < m_lCount; m_lAllocated++, pNext += lAlignedSize) {
+    for (; m_lAllocated < m_lCount; m_lAllocated++, pNext += lStride) {
 
 
         pSample = new CMediaSample(
@@ -5235,10 +5318,10 @@ CMemAllocator::Free(void)
 }
 
 
-// called from the destructor (and from Alloc if changing size/count) to
-// actually free up the memory
+// called from Alloc and ReallyFree to delete the samples. The memory
+// they point into is kept.
 void
-CMemAllocator::ReallyFree(void)
+CMemAllocator::FreeSamples(void)
 {
     /* Should never be deleting this unless all buffers are freed */
 
@@ -5257,11 +5340,22 @@ CMemAllocator::ReallyFree(void)
     }
 
     m_lAllocated = 0;
+}
+
+
+// called from the destructor (and from Alloc if the arena doesn't fit) to
+// actually free up the memory
+void
+CMemAllocator::ReallyFree(void)
+{
+    FreeSamples();
 
     // free the block of buffer memory
     if (m_pBuffer) {
         EXECUTE_ASSERT(VirtualFree(m_pBuffer, 0, MEM_RELEASE));
         m_pBuffer = NULL;
+        m_cbArena = 0;
+        m_bLargePages = FALSE;
     }
 }
 
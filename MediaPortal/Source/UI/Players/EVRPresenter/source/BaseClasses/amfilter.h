@@ -1217,7 +1217,7 @@ protected:
     LONG             m_lActual;         /* Length of data in this sample */
     LONG             m_cbBuffer;        /* Size of the buffer */
     CBaseAllocator  *m_pAllocator;      /* The allocator who owns us */
-    CMediaSample     *m_pNext;          /* Chaining in free list */
+    SLIST_ENTRY      m_FreeEntry;       /* Chaining in free list */
     REFERENCE_TIME   m_Start;           /* Start sample time */
     REFERENCE_TIME   m_End;             /* End sample time */
     LONGLONG         m_MediaStart;      /* Real media start position */
@@ -1344,46 +1344,105 @@ class AM_NOVTABLE CBaseAllocator : public CUnknown,// A non delegating IUnknown
     friend class CSampleList;
 
     /*  Trick to get at protected member in CMediaSample */
-    static CMediaSample * &NextSample(__in CMediaSample *pSample)
+    static PSLIST_ENTRY FreeEntry(__in CMediaSample *pSample)
     {
-        return pSample->m_pNext;
+        return &pSample->m_FreeEntry;
     };
+    static CMediaSample *SampleFromEntry(__in PSLIST_ENTRY pEntry)
+    {
+        return CONTAINING_RECORD(pEntry, CMediaSample, m_FreeEntry);
+    };
+
+    /*  Mini list class for the free list
+
+        The samples are kept on an interlocked singly linked list (SLIST),
+        so GetBuffer and ReleaseBuffer don't need the allocator's critical
+        section. The SLIST header carries a sequence number which protects
+        the pop against the ABA problem.
 
-    /*  Mini list class for the free list */
+        The number of samples on the list and the committed state are kept
+        together in m_lState, so a sample can be reserved and the committed
+        state checked in a single interlocked operation:
+
+            RemoveHeadCommitted() first reserves a sample by decrementing
+            the count (only while committed), then pops it. Add() pushes
+            first and then increments the count. So for every reservation
+            there is at least one entry on the list and the pop can't fail.
+
+        Add() and RemoveHead() may be called at any time; Open() and
+        Close() must be called holding the allocator's critical section.
+    */
     class CSampleList
     {
     public:
-        CSampleList() : m_List(NULL), m_nOnList(0) {};
+        enum { StateCommitted = 0x40000000,
+               StateCountMask = 0x3FFFFFFF };
+
+        CSampleList() : m_lState(0) { InitializeSListHead(&m_Head); };
 #ifdef DEBUG
         ~CSampleList()
         {
-            ASSERT(m_nOnList == 0);
+            ASSERT(GetCount() == 0);
         };
 #endif
-        CMediaSample *Head() const { return m_List; };
-        CMediaSample *Next(__in CMediaSample *pSample) const { return CBaseAllocator::NextSample(pSample); };
-        int GetCount() const { return m_nOnList; };
-        void Add(__inout CMediaSample *pSample)
+        int GetCount() const { return m_lState & StateCountMask; };
+        BOOL IsCommitted() const { return (m_lState & StateCommitted) != 0; };
+
+        // Puts a sample on the list. Returns the new state; it equals the
+        // number of free samples if the list is not committed.
+        LONG Add(__inout CMediaSample *pSample)
         {
             ASSERT(pSample != NULL);
-            CBaseAllocator::NextSample(pSample) = m_List;
-            m_List = pSample;
-            m_nOnList++;
+            InterlockedPushEntrySList(&m_Head, CBaseAllocator::FreeEntry(pSample));
+            return InterlockedIncrement(&m_lState);
         };
+
+        // Takes any sample off the list, committed or not
         CMediaSample *RemoveHead()
         {
-            CMediaSample *pSample = m_List;
-            if (pSample != NULL) {
-                m_List = CBaseAllocator::NextSample(m_List);
-                m_nOnList--;
+            PSLIST_ENTRY pEntry = InterlockedPopEntrySList(&m_Head);
+            if (pEntry == NULL) {
+                return NULL;
             }
-            return pSample;
+            InterlockedDecrement(&m_lState);
+            return CBaseAllocator::SampleFromEntry(pEntry);
         };
-        void Remove(__inout CMediaSample *pSample);
 
-    public:
-        CMediaSample *m_List;
-        int           m_nOnList;
+        // Takes a sample off the list if the list is committed. Returns
+        // NULL if the list is empty or not committed (see *pbCommitted).
+        CMediaSample *RemoveHeadCommitted(__out BOOL *pbCommitted)
+        {
+            for (;;) {
+                LONG lState = m_lState;
+                *pbCommitted = (lState & StateCommitted) != 0;
+                if (!*pbCommitted || (lState & StateCountMask) == 0) {
+                    return NULL;
+                }
+                if (InterlockedCompareExchange(&m_lState, lState - 1, lState) == lState) {
+                    break;
+                }
+            }
+            PSLIST_ENTRY pEntry = InterlockedPopEntrySList(&m_Head);
+            ASSERT(pEntry != NULL);
+            return CBaseAllocator::SampleFromEntry(pEntry);
+        };
+
+        // Allows RemoveHeadCommitted to take samples
+        void Open()
+        {
+            InterlockedOr(&m_lState, StateCommitted);
+        };
+
+        // Stops RemoveHeadCommitted from taking samples. Returns the
+        // number of samples on the list at that moment.
+        int Close()
+        {
+            return InterlockedAnd(&m_lState, ~StateCommitted) & StateCountMask;
+        };
+
+    private:
+        SLIST_HEADER  m_Head;
+        volatile LONG m_lState;
     };
 protected:
 
@@ -1392,41 +1451,40 @@ protected:
     /*  Note to overriders of CBaseAllocator.
 
         We use a lazy signalling mechanism for waiting for samples.
-        This means we don't call the OS if no waits occur.
+        This means we don't call the OS if no waits occur. Neither side
+        needs the allocator's critical section.
 
         In order to implement this:
 
         1. When a new sample is added to m_lFree call NotifySample() which
-           calls ReleaseSemaphore on m_hSem with a count of m_lWaiting and
-           sets m_lWaiting to 0.
-           This must all be done holding the allocator's critical section.
+           atomically exchanges m_lWaiting with 0 and calls ReleaseSemaphore
+           on m_hSem with the old count.
 
-        2. When waiting for a sample call SetWaiting() which increments
-           m_lWaiting BEFORE leaving the allocator's critical section.
+        2. When waiting for a sample call SetWaiting() which atomically
+           increments m_lWaiting, then check m_lFree again. If a sample
+           was added (or the allocator was decommitted) in the meantime,
+           call NotifySample() yourself.
 
-        3. Actually wait by calling WaitForSingleObject(m_hSem, INFINITE)
-           having left the allocator's critical section.  The effect of
-           this is to remove 1 from the semaphore's count.  You MUST call
-           this once having incremented m_lWaiting.
+        3. Actually wait by calling WaitForSingleObject(m_hSem, INFINITE).
+           The effect of this is to remove 1 from the semaphore's count.
+           You MUST call this once having incremented m_lWaiting.
 
-        The following are then true when the critical section is not held :
+        The following are then true :
             (let nWaiting = number about to wait or waiting)
 
-            (1) if (m_lFree.GetCount() != 0) then (m_lWaiting == 0)
-            (2) m_lWaiting + Semaphore count == nWaiting
-
-        We would deadlock if
-           nWaiting != 0 &&
-           m_lFree.GetCount() != 0 &&
-           Semaphore count == 0
+            (1) m_lWaiting + Semaphore count == nWaiting
+            (2) a thread adding a sample sees m_lWaiting != 0, or the
+                waiting thread sees the sample when it checks again
 
-           But from (1) if m_lFree.GetCount() != 0 then m_lWaiting == 0 so
-           from (2) Semaphore count == nWaiting (which is non-0) so the
-           deadlock can't happen.
+        (1) holds because the count is handed over to the semaphore by the
+        thread that exchanges it with 0. (2) holds because both threads use
+        interlocked operations, which are full memory barriers, to update
+        their side before they read the other side. So a thread can't wait
+        while there is a free sample nobody will signal.
     */
 
     HANDLE m_hSem;              // For signalling
-    long m_lWaiting;            // Waiting for a free element
+    volatile long m_lWaiting;   // Waiting for a free element
     long m_lCount;              // how many buffers we have agreed to provide
     long m_lAllocated;          // how many buffers are currently allocated
     long m_lSize;               // agreed size of each buffer
@@ -1434,7 +1492,9 @@ protected:
     long m_lPrefix;             // agreed prefix (preceeds GetPointer() value)
     BOOL m_bChanged;            // Have the buffer requirements changed
 
-    // if true, we are decommitted and can't allocate memory
+    // if true, we are decommitted and can't allocate memory. Written holding
+    // the critical section together with the committed state of m_lFree,
+    // which is what GetBuffer checks.
     BOOL m_bCommitted;
     // if true, the decommit has happened, but we haven't called Free yet
     // as there are still outstanding buffers
@@ -1511,7 +1571,7 @@ public:
     void NotifySample();
 
     // Notify that we're waiting for a sample
-    void SetWaiting() { m_lWaiting++; };
+    void SetWaiting() { InterlockedIncrement(&m_lWaiting); };
 };
 
 
@@ -1528,6 +1588,16 @@ public:
 // have a Free() function, called to go into decommit state, that does
 // nothing and a ReallyFree function called from our destructor that
 // actually frees the memory.
+//
+// The memory block (arena) is also kept when SetProperties is called
+// again: with the same properties nothing is reallocated on Commit, and
+// with new properties that fit into the arena only the samples are
+// recreated. So the pages stay committed and faulted in across
+// stop/seek/start cycles. Each buffer starts on its own cache line (on
+// its own page for big buffers). Arenas of at least one large page use
+// large pages if the owner asked for them with SetUseLargePages and the
+// process may lock memory; large pages are never paged out, so they are
+// off by default.
 //=====================================================================
 //=====================================================================
 
@@ -1540,15 +1610,24 @@ class CMemAllocator : public CBaseAllocator
 protected:
 
     LPBYTE m_pBuffer;   // combined memory for all buffers
+    SIZE_T m_cbArena;   // size of the block at m_pBuffer
+    BOOL m_bLargePages; // m_pBuffer uses large pages
+    BOOL m_bUseLargePages; // AllocArena may try large pages
 
     // override to free the memory when decommit completes
     // - we actually do nothing, and save the memory until deletion.
     void Free(void);
 
-    // called from the destructor (and from Alloc if changing size/count) to
-    // actually free up the memory
+    // called from the destructor (and from Alloc if the arena is too
+    // small) to actually free up the memory
     void ReallyFree(void);
 
+    // deletes the samples but keeps the arena
+    void FreeSamples(void);
+
+    // allocates an arena of at least cbArena bytes
+    HRESULT AllocArena(SIZE_T cbArena);
+
     // overriden to allocate the memory when commit called
     HRESULT Alloc(void);
 
@@ -1560,6 +1639,9 @@ public:
 		    __in ALLOCATOR_PROPERTIES* pRequest,
 		    __out ALLOCATOR_PROPERTIES* pActual);
 
+    // allow large pages for the next arena allocated (off by default)
+    void SetUseLargePages(BOOL bUseLargePages);
+
     CMemAllocator(__in_opt LPCTSTR , __inout_opt LPUNKNOWN, __inout HRESULT *);
 #ifdef UNICODE
     CMemAllocator(__in_opt LPCSTR , __inout_opt LPUNKNOWN, __inout HRESULT *);
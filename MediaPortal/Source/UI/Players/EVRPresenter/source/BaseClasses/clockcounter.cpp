@@ -0,0 +1,37 @@
+//------------------------------------------------------------------------------
+// File: ClockCounter.cpp
+//
+// Desc: DirectShow base classes - implements the counter the base
+//       reference clock runs on.
+//
+// Copyright (c) 1992-2001 Microsoft Corporation.  All rights reserved.
+//------------------------------------------------------------------------------
+
+
+#include <streams.h>
+
+/* CClockCounter - the performance counter.  It is monotonic and its
+   frequency is fixed at boot time, so we only ask for it once.
+
+   This is kept out of refclock.cpp, so a program that defines both
+   methods itself (the clock tests) links its own counter instead */
+
+LONGLONG CClockCounter::Now()
+{
+    LARGE_INTEGER li;
+    QueryPerformanceCounter(&li);
+    return li.QuadPart;
+}
+
+LONGLONG CClockCounter::Frequency()
+{
+    static LONGLONG llFrequency = 0;
+    if (llFrequency == 0) {
+        LARGE_INTEGER li;
+        if (!QueryPerformanceFrequency(&li) || li.QuadPart == 0) {
+            li.QuadPart = 1000;
+        }
+        llFrequency = li.QuadPart;
+    }
+    return llFrequency;
+}
@@ -1918,7 +1918,9 @@ CDeferredCommand::CDeferredCommand(
 	m_DispParams(nArgs, pDispParams, phr),
 	m_pvarResult(pvarResult),
 	m_bStream(bStream),
-	m_hrResult(E_ABORT)
+	m_hrResult(E_ABORT),
+	m_iHeapIndex(-1),
+	m_llSequence(0)
 
 {
     // convert REFTIME to REFERENCE_TIME
@@ -2126,12 +2128,243 @@ CDeferredCommand::Invoke()
 
 
 
+// --- CDeferredCommandHeap methods ----------
+
+// the heap is an array where the children of entry i are at 2i+1 and 2i+2
+// and no command is due earlier than its parent
+
+CDeferredCommandHeap::CDeferredCommandHeap() :
+    m_ppCmds(NULL),
+    m_nCount(0),
+    m_nAlloc(0)
+{
+}
+
+
+CDeferredCommandHeap::~CDeferredCommandHeap()
+{
+    ASSERT(m_nCount == 0);
+    delete[] m_ppCmds;
+}
+
+
+BOOL
+CDeferredCommandHeap::IsEarlier(__in CDeferredCommand* pA, __in CDeferredCommand* pB)
+{
+    if (pA->m_time != pB->m_time) {
+        return pA->m_time < pB->m_time;
+    }
+    return pA->m_llSequence < pB->m_llSequence;
+}
+
+
+void
+CDeferredCommandHeap::Place(int i, __in CDeferredCommand* pCmd)
+{
+    m_ppCmds[i] = pCmd;
+    pCmd->m_iHeapIndex = i;
+}
+
+
+void
+CDeferredCommandHeap::SiftUp(int i)
+{
+    CDeferredCommand* pCmd = m_ppCmds[i];
+    while (i > 0) {
+        int iParent = (i - 1) / 2;
+        if (!IsEarlier(pCmd, m_ppCmds[iParent])) {
+            break;
+        }
+        Place(i, m_ppCmds[iParent]);
+        i = iParent;
+    }
+    Place(i, pCmd);
+}
+
+
+void
+CDeferredCommandHeap::SiftDown(int i)
+{
+    CDeferredCommand* pCmd = m_ppCmds[i];
+    for (;;) {
+        int iChild = 2 * i + 1;
+        if (iChild >= m_nCount) {
+            break;
+        }
+        if (iChild + 1 < m_nCount && IsEarlier(m_ppCmds[iChild + 1], m_ppCmds[iChild])) {
+            iChild++;
+        }
+        if (!IsEarlier(m_ppCmds[iChild], pCmd)) {
+            break;
+        }
+        Place(i, m_ppCmds[iChild]);
+        i = iChild;
+    }
+    Place(i, pCmd);
+}
+
+
+HRESULT
+CDeferredCommandHeap::Insert(__in CDeferredCommand* pCmd, ULONGLONG llSequence)
+{
+    ASSERT(pCmd->m_iHeapIndex == -1);
+
+    // grow the array by doubling it
+    if (m_nCount == m_nAlloc) {
+        int nAlloc = m_nAlloc ? 2 * m_nAlloc : 16;
+        CDeferredCommand** ppCmds = new CDeferredCommand*[nAlloc];
+        if (ppCmds == NULL) {
+            return E_OUTOFMEMORY;
+        }
+        if (m_nCount) {
+            CopyMemory(ppCmds, m_ppCmds, m_nCount * sizeof(CDeferredCommand*));
+        }
+        delete[] m_ppCmds;
+        m_ppCmds = ppCmds;
+        m_nAlloc = nAlloc;
+    }
+
+    pCmd->m_llSequence = llSequence;
+    m_ppCmds[m_nCount] = pCmd;
+    SiftUp(m_nCount++);
+    return S_OK;
+}
+
+
+// returns FALSE if the command is not on this heap
+
+BOOL
+CDeferredCommandHeap::Remove(__in CDeferredCommand* pCmd)
+{
+    int i = pCmd->m_iHeapIndex;
+    if (i < 0 || i >= m_nCount || m_ppCmds[i] != pCmd) {
+        return FALSE;
+    }
+    pCmd->m_iHeapIndex = -1;
+
+    // move the last entry into the hole and restore the heap order, it
+    // may have to go either way
+    if (i != --m_nCount) {
+        Place(i, m_ppCmds[m_nCount]);
+        if (i > 0 && IsEarlier(m_ppCmds[i], m_ppCmds[(i - 1) / 2])) {
+            SiftUp(i);
+        } else {
+            SiftDown(i);
+        }
+    }
+    return TRUE;
+}
+
+
+CDeferredCommand*
+CDeferredCommandHeap::RemoveHead()
+{
+    CDeferredCommand* pCmd = GetHead();
+    if (pCmd) {
+        Remove(pCmd);
+    }
+    return pCmd;
+}
+
+
+void
+CDeferredCommandHeap::PushCandidate(__inout_ecount(nCand + 1) int* piCand, int nCand, int i) const
+{
+    int j = nCand;
+    while (j > 0) {
+        int jParent = (j - 1) / 2;
+        if (!IsEarlier(m_ppCmds[i], m_ppCmds[piCand[jParent]])) {
+            break;
+        }
+        piCand[j] = piCand[jParent];
+        j = jParent;
+    }
+    piCand[j] = i;
+}
+
+
+int
+CDeferredCommandHeap::PopCandidate(__inout_ecount(nCand) int* piCand, int nCand) const
+{
+    int iFirst = piCand[0];
+    int iLast = piCand[--nCand];
+    int j = 0;
+    for (;;) {
+        int jChild = 2 * j + 1;
+        if (jChild >= nCand) {
+            break;
+        }
+        if (jChild + 1 < nCand &&
+            IsEarlier(m_ppCmds[piCand[jChild + 1]], m_ppCmds[piCand[jChild]])) {
+            jChild++;
+        }
+        if (!IsEarlier(m_ppCmds[piCand[jChild]], m_ppCmds[iLast])) {
+            break;
+        }
+        piCand[j] = piCand[jChild];
+        j = jChild;
+    }
+    if (nCand) {
+        piCand[j] = iLast;
+    }
+    return iFirst;
+}
+
+
+ULONG
+CDeferredCommandHeap::GetDue(REFERENCE_TIME tDue, __out_ecount_part(cMax, return) CDeferredCommand** ppCmds, ULONG cMax) const
+{
+    // visit the heap earliest first. The candidates are the entries whose
+    // parent has been returned; the earliest of them is the next command
+    // in order. Once that is not due nothing else is, as the children of
+    // a command are never due earlier. There is one candidate more than
+    // commands returned at most
+
+    if (m_nCount == 0 || cMax == 0) {
+        return 0;
+    }
+    if (cMax > (ULONG)m_nCount) {
+        cMax = m_nCount;
+    }
+
+    int aLocal[64];
+    int* piCand = aLocal;
+    if (cMax >= NUMELMS(aLocal)) {
+        piCand = new int[cMax + 1];
+        if (piCand == NULL) {
+            // still the earliest commands, the rest come with the next call
+            piCand = aLocal;
+            cMax = NUMELMS(aLocal) - 1;
+        }
+    }
+
+    int nCand = 0;
+    ULONG cFound = 0;
+    PushCandidate(piCand, nCand++, 0);
+    while (nCand && cFound < cMax) {
+        int i = PopCandidate(piCand, nCand--);
+        if (m_ppCmds[i]->m_time > tDue) {
+            break;
+        }
+        ppCmds[cFound++] = m_ppCmds[i];
+        for (int iChild = 2 * i + 1; iChild <= 2 * i + 2 && iChild < m_nCount; iChild++) {
+            PushCandidate(piCand, nCand++, iChild);
+        }
+    }
+
+    if (piCand != aLocal) {
+        delete[] piCand;
+    }
+    return cFound;
+}
+
+
+
 // --- CCmdQueue methods ----------
 
 
 CCmdQueue::CCmdQueue(__inout_opt HRESULT *phr) :
-    m_listPresentation(NAME("Presentation time command list")),
-    m_listStream(NAME("Stream time command list")),
+    m_llSequence(0),
     m_evDue(TRUE, phr),    // manual reset
     m_dwAdvise(0),
     m_pClock(NULL),
@@ -2142,25 +2375,16 @@ CCmdQueue::CCmdQueue(__inout_opt HRESULT *phr) :
 
 CCmdQueue::~CCmdQueue()
 {
-    // empty all our lists
+    // empty the heaps
 
-    // we hold a refcount on each, so traverse and Release each
-    // entry then RemoveAll to empty the list
-    POSITION pos = m_listPresentation.GetHeadPosition();
-
-    while(pos) {
-	CDeferredCommand* pCmd = m_listPresentation.GetNext(pos);
+    // we hold a refcount on each, so take each one off and Release it
+    CDeferredCommand* pCmd;
+    while ((pCmd = m_heapPresentation.RemoveHead()) != NULL) {
 	pCmd->Release();
     }
-    m_listPresentation.RemoveAll();
-
-    pos = m_listStream.GetHeadPosition();
-
-    while(pos) {
-	CDeferredCommand* pCmd = m_listStream.GetNext(pos);
+    while ((pCmd = m_heapStream.RemoveHead()) != NULL) {
 	pCmd->Release();
     }
-    m_listStream.RemoveAll();
 
     if (m_pClock) {
 	if (m_dwAdvise) {
@@ -2227,30 +2451,21 @@ CCmdQueue::Insert(__in CDeferredCommand* pCmd)
 {
     CAutoLock lock(&m_Lock);
 
-    // addref the item
-    pCmd->AddRef();
-
-    CGenericList<CDeferredCommand> * pList;
+    CDeferredCommandHeap * pHeap;
     if (pCmd->IsStreamTime()) {
-	pList = &m_listStream;
+	pHeap = &m_heapStream;
     } else {
-	pList = &m_listPresentation;
+	pHeap = &m_heapPresentation;
     }
-    POSITION pos = pList->GetHeadPosition();
-
-    // seek past all items that are before us
-    while (pos &&
-	(pList->GetValid(pos)->GetTime() <= pCmd->GetTime())) {
 
-	pList->GetNext(pos);
+    // commands with the same time keep the order they were queued in
+    HRESULT hr = pHeap->Insert(pCmd, m_llSequence++);
+    if (FAILED(hr)) {
+	return hr;
     }
 
-    // now at end of list or in front of items that come later
-    if (!pos) {
-	pList->AddTail(pCmd);
-    } else {
-	pList->AddBefore(pos, pCmd);
-    }
+    // addref the item
+    pCmd->AddRef();
 
     SetTimeAdvise();
     return S_OK;
@@ -2261,36 +2476,25 @@ HRESULT
 CCmdQueue::Remove(__in CDeferredCommand* pCmd)
 {
     CAutoLock lock(&m_Lock);
-    HRESULT hr = S_OK;
 
-    CGenericList<CDeferredCommand> * pList;
+    CDeferredCommandHeap * pHeap;
     if (pCmd->IsStreamTime()) {
-	pList = &m_listStream;
+	pHeap = &m_heapStream;
     } else {
-	pList = &m_listPresentation;
+	pHeap = &m_heapPresentation;
     }
-    POSITION pos = pList->GetHeadPosition();
 
-    // traverse the list
-    while (pos && (pList->GetValid(pos) != pCmd)) {
-	pList->GetNext(pos);
+    // the command knows where it is in the heap
+    if (!pHeap->Remove(pCmd)) {
+	return VFW_E_NOT_FOUND;
     }
 
-    // did we drop off the end?
-    if (!pos) {
-	hr = VFW_E_NOT_FOUND;
-    } else {
+    // Insert did an AddRef, so release it
+    pCmd->Release();
 
-	// found it - now take off list
-	pList->Remove(pos);
-
-	// Insert did an AddRef, so release it
-	pCmd->Release();
-
-	// check that timer request is still for earliest time
-	SetTimeAdvise();
-    }
-    return hr;
+    // check that timer request is still for earliest time
+    SetTimeAdvise();
+    return S_OK;
 }
 
 
@@ -2322,7 +2526,10 @@ CCmdQueue::SetSyncSource(__in_opt IReferenceClock* pClock)
 }
 
 
-// set up a timer event with the reference clock
+// set up a timer event with the reference clock. There is a single
+// advise, for the earliest time in either heap. It is only changed when
+// that time changes, so an event that has already been signalled for a
+// command that is still queued stays set
 
 void
 CCmdQueue::SetTimeAdvise(void)
@@ -2332,25 +2539,22 @@ CCmdQueue::SetTimeAdvise(void)
 	return;
     }
 
-    // reset the event whenever we are requesting a new signal
-    m_evDue.Reset();
-
     // time 0 is earliest
     CRefTime current;
 
     // find the earliest presentation time
-    POSITION pos = m_listPresentation.GetHeadPosition();
-    if (pos != NULL) {
-	current = m_listPresentation.GetValid(pos)->GetTime();
+    CDeferredCommand* pCmd = m_heapPresentation.GetHead();
+    if (pCmd != NULL) {
+	current = pCmd->GetTime();
     }
 
     // if we're running, check the stream times too
     if (m_bRunning) {
 
 	CRefTime t;
-        pos = m_listStream.GetHeadPosition();
-	if (NULL != pos) {
-	    t = m_listStream.GetValid(pos)->GetTime();
+	pCmd = m_heapStream.GetHead();
+	if (NULL != pCmd) {
+	    t = pCmd->GetTime();
 
 	    // add on stream time offset to get presentation time
 	    t += m_StreamTimeOffset;
@@ -2362,14 +2566,28 @@ CCmdQueue::SetTimeAdvise(void)
 	}
     }
 
+    // nothing to wait for - drop the advise and clear the event so that
+    // waiters block instead of spinning
+    if (current <= TimeZero) {
+	if (m_dwAdvise) {
+	    m_pClock->Unadvise(m_dwAdvise);
+	    m_dwAdvise = 0;
+	}
+	m_tCurrentAdvise = TimeZero;
+	m_evDue.Reset();
+	return;
+    }
+
     // need to change?
-    if ((current > TimeZero) && (current != m_tCurrentAdvise)) {
+    if (current != m_tCurrentAdvise) {
 	if (m_dwAdvise) {
 	    m_pClock->Unadvise(m_dwAdvise);
-	    // reset the event whenever we are requesting a new signal
-	    m_evDue.Reset();
+	    m_dwAdvise = 0;
 	}
 
+	// reset the event whenever we are requesting a new signal
+	m_evDue.Reset();
+
 	// ask for time advice - the first two params are either
 	// stream time offset and stream time or
 	// presentation time and 0. we always use the latter
@@ -2438,18 +2656,13 @@ CCmdQueue::GetDueCommand(__out CDeferredCommand ** ppCmd, long msTimeout)
 	    CDeferredCommand * pCmd = NULL;
 
 	    // check the presentation time and the
-	    // stream time list to find the earliest
-
-            POSITION pos = m_listPresentation.GetHeadPosition();
+	    // stream time heap to find the earliest
 
-	    if (NULL != pos) {
-		pCmd = m_listPresentation.GetValid(pos);
-	    }
+	    pCmd = m_heapPresentation.GetHead();
 
 	    if (m_bRunning) {
-		pos = m_listStream.GetHeadPosition();
-                if (NULL != pos) {
-                    CDeferredCommand* pStrm = m_listStream.GetValid(pos);
+                CDeferredCommand* pStrm = m_heapStream.GetHead();
+                if (NULL != pStrm) {
 
                     CRefTime t = pStrm->GetTime() + m_StreamTimeOffset;
                     if (!pCmd || (t < pCmd->GetTime())) {
@@ -2478,6 +2691,112 @@ CCmdQueue::GetDueCommand(__out CDeferredCommand ** ppCmd, long msTimeout)
 }
 
 
+// commands due at the same presentation time are run in the order they
+// were queued, whichever heap they are in
+
+BOOL
+CCmdQueue::IsDueEarlier(__in CDeferredCommand* pA, __in CDeferredCommand* pB)
+{
+    REFERENCE_TIME tA = pA->GetTime();
+    if (pA->IsStreamTime()) {
+        tA += m_StreamTimeOffset;
+    }
+    REFERENCE_TIME tB = pB->GetTime();
+    if (pB->IsStreamTime()) {
+        tB += m_StreamTimeOffset;
+    }
+    if (tA != tB) {
+        return tA < tB;
+    }
+    return pA->m_llSequence < pB->m_llSequence;
+}
+
+
+// return all commands that are due, up to cMax, earliest first. Blocks for
+// msTimeout milliseconds until at least one command is due. The clock is
+// read once, and only the due part of each heap is visited.
+//
+// returns AddRef'd objects
+
+HRESULT
+CCmdQueue::GetDueCommands(
+    __out_ecount_part(cMax, *pcFetched) CDeferredCommand ** ppCmds,
+    ULONG cMax,
+    __out ULONG * pcFetched,
+    long msTimeout)
+{
+    CheckPointer(ppCmds,E_POINTER);
+    CheckPointer(pcFetched,E_POINTER);
+
+    *pcFetched = 0;
+    if (cMax == 0) {
+	return E_INVALIDARG;
+    }
+
+    // loop until we timeout or find due commands
+    for (;;) {
+
+	{
+	    CAutoLock lock(&m_Lock);
+
+	    // if no clock, nothing is due
+	    if (m_pClock) {
+
+		CRefTime Now;
+		m_pClock->GetTime((REFERENCE_TIME*)&Now);
+
+		// the earliest due commands of each heap come out in order,
+		// merge them on presentation time
+		ULONG cFetched = m_heapPresentation.GetDue(Now, ppCmds, cMax);
+
+		// stream times are only due while running
+		if (m_bRunning && m_heapStream.GetCount()) {
+		    CDeferredCommand** ppBoth = new CDeferredCommand*[cFetched + cMax];
+		    if (ppBoth == NULL) {
+			return E_OUTOFMEMORY;
+		    }
+		    CopyMemory(ppBoth, ppCmds, cFetched * sizeof(CDeferredCommand*));
+		    CDeferredCommand** ppStream = ppBoth + cFetched;
+		    ULONG cStream = m_heapStream.GetDue(
+				    Now - m_StreamTimeOffset,
+				    ppStream,
+				    cMax);
+
+		    ULONG iPresentation = 0;
+		    ULONG iStream = 0;
+		    ULONG cMerged = 0;
+		    while (cMerged < cMax && (iPresentation < cFetched || iStream < cStream)) {
+			if (iStream == cStream ||
+			    iPresentation < cFetched &&
+			    IsDueEarlier(ppBoth[iPresentation], ppStream[iStream])) {
+			    ppCmds[cMerged++] = ppBoth[iPresentation++];
+			} else {
+			    ppCmds[cMerged++] = ppStream[iStream++];
+			}
+		    }
+		    cFetched = cMerged;
+		    delete[] ppBoth;
+		}
+
+		if (cFetched) {
+
+		    for (ULONG i = 0; i < cFetched; i++) {
+			ppCmds[i]->AddRef();
+		    }
+		    *pcFetched = cFetched;
+		    return S_OK;
+		}
+	    }
+	}
+
+	// block until the advise is signalled
+	if (WaitForSingleObject(m_evDue, msTimeout) != WAIT_OBJECT_0) {
+	    return E_ABORT;
+	}
+    }
+}
+
+
 // return a pointer to a command that will be due for a given time.
 // Pass in a stream time here. The stream time offset will be passed
 // in via the Run method.
@@ -2495,16 +2814,8 @@ CCmdQueue::GetCommandDueFor(REFERENCE_TIME rtStream, __out CDeferredCommand**ppC
     CRefTime tStream(rtStream);
 
     // find the earliest stream and presentation time commands
-    CDeferredCommand* pStream = NULL;
-    POSITION pos = m_listStream.GetHeadPosition();
-    if (NULL != pos) {
-	pStream = m_listStream.GetValid(pos);
-    }
-    CDeferredCommand* pPresent = NULL;
-    pos = m_listPresentation.GetHeadPosition();
-    if (NULL != pos) {
-	pPresent = m_listPresentation.GetValid(pos);
-    }
+    CDeferredCommand* pStream = m_heapStream.GetHead();
+    CDeferredCommand* pPresent = m_heapPresentation.GetHead();
 
     // is there a presentation time that has passed already
     if (pPresent && CheckTime(pPresent->GetTime(), FALSE)) {
@@ -2530,6 +2841,7 @@ CCmdQueue::GetCommandDueFor(REFERENCE_TIME rtStream, __out CDeferredCommand**ppC
 
 	// due before that?
 	if (pPresent->GetTime() <= tStream) {
+	    pPresent->AddRef();
 	    *ppCmd = pPresent;
 	    return S_OK;
 	}
@@ -669,6 +669,9 @@ class CDeferredCommand
     : public CUnknown,
       public IDeferredCommand
 {
+    friend class CDeferredCommandHeap;
+    friend class CCmdQueue;
+
 public:
 
     CDeferredCommand(
@@ -758,11 +761,65 @@ protected:
 
     // save retval here
     HRESULT     m_hrResult;
+
+private:
+
+    // position in the queue's heap (-1 if not queued) and the order in
+    // which we were queued, which breaks ties between equal times
+    int         m_iHeapIndex;
+    ULONGLONG   m_llSequence;
+};
+
+
+// a min-heap of CDeferredCommand objects ordered on due time, commands
+// with the same time in the order they were inserted. Each command
+// remembers its position, so it can be removed without a search. The
+// heap does not hold refcounts and is not locked - CCmdQueue does both.
+
+class CDeferredCommandHeap
+{
+public:
+    CDeferredCommandHeap();
+    ~CDeferredCommandHeap();
+
+    HRESULT Insert(__in CDeferredCommand* pCmd, ULONGLONG llSequence);
+    BOOL Remove(__in CDeferredCommand* pCmd);
+
+    // earliest command, or NULL if the heap is empty
+    CDeferredCommand* GetHead() const {
+        return m_nCount ? m_ppCmds[0] : NULL;
+    };
+
+    int GetCount() const {
+        return m_nCount;
+    };
+
+    // takes the first command off the heap, or returns NULL
+    CDeferredCommand* RemoveHead();
+
+    // fills ppCmds with the earliest commands due at or before tDue, up to
+    // cMax of them in heap order, without removing them. Returns the number
+    // of commands found. Only the part of the heap that is due is visited
+    ULONG GetDue(REFERENCE_TIME tDue, __out_ecount_part(cMax, return) CDeferredCommand** ppCmds, ULONG cMax) const;
+
+private:
+    static BOOL IsEarlier(__in CDeferredCommand* pA, __in CDeferredCommand* pB);
+
+    // candidate heap of GetDue - heap positions ordered by IsEarlier
+    void PushCandidate(__inout_ecount(nCand + 1) int* piCand, int nCand, int i) const;
+    int PopCandidate(__inout_ecount(nCand) int* piCand, int nCand) const;
+    void Place(int i, __in CDeferredCommand* pCmd);
+    void SiftUp(int i);
+    void SiftDown(int i);
+
+    CDeferredCommand** m_ppCmds;
+    int m_nCount;
+    int m_nAlloc;
 };
 
 
-// a list of CDeferredCommand objects. this is a base class providing
-// the basics of access to the list. If you want to use CDeferredCommand
+// a queue of CDeferredCommand objects. this is a base class providing
+// the basics of access to the queue. If you want to use CDeferredCommand
 // objects then your queue needs to be derived from this class.
 
 class AM_NOVTABLE CCmdQueue
@@ -847,6 +904,17 @@ public:
     // Returns an AddRef-ed object
     virtual HRESULT GetDueCommand(__out CDeferredCommand ** ppCmd, long msTimeout);
 
+    // as GetDueCommand, but returns all commands that are due, up to cMax,
+    // earliest first and in queue order for equal times, so one wake up
+    // can dispatch a whole batch. Commands due beyond cMax are returned by
+    // the next call. Each returned object
+    // is AddRef-ed and remains queued until invoked or cancelled.
+    virtual HRESULT GetDueCommands(
+        __out_ecount_part(cMax, *pcFetched) CDeferredCommand ** ppCmds,
+        ULONG cMax,
+        __out ULONG * pcFetched,
+        long msTimeout);
+
     // return the event handle that will be signalled whenever
     // there are deferred commands due for execution (when GetDueCommand
     // will not block).
@@ -893,10 +961,13 @@ protected:
     CCritSec m_Lock;
 
     // commands queued in presentation time are stored here
-    CGenericList<CDeferredCommand> m_listPresentation;
+    CDeferredCommandHeap m_heapPresentation;
 
     // commands queued in stream time are stored here
-    CGenericList<CDeferredCommand> m_listStream;
+    CDeferredCommandHeap m_heapStream;
+
+    // insertion counter, keeps commands with equal times in order
+    ULONGLONG m_llSequence;
 
     // set when any commands are due
     CAMEvent m_evDue;
@@ -904,6 +975,10 @@ protected:
     // creates an advise for the earliest time required, if any
     void SetTimeAdvise(void);
 
+    // TRUE if pA is due before pB in presentation time; commands due at
+    // the same time in the order they were queued. Needs m_Lock
+    BOOL IsDueEarlier(__in CDeferredCommand* pA, __in CDeferredCommand* pB);
+
     // advise id from reference clock (0 if no outstanding advise)
     DWORD_PTR m_dwAdvise;
 
@@ -234,6 +234,10 @@ DllInitClasses(BOOL bLoading)
         }
     }
 
+    // The classes are gone, give the list nodes they freed back
+    if (!bLoading) {
+        CBaseList::ReleaseNodePool();
+    }
 }
 
 // called by COM to determine if this dll can be unloaded
@@ -319,11 +323,13 @@ _DllEntryPoint(
     	}
 
         g_hInst = hInstance;
+        MSR_INIT();
         DllInitClasses(TRUE);
         break;
 
     case DLL_PROCESS_DETACH:
         DllInitClasses(FALSE);
+        MSR_TERMINATE();
 
 #ifdef DEBUG
         if (CBaseObject::ObjectsActive()) {
@@ -55,16 +55,14 @@ inline ULONGLONG _RDTSC( void ) {
 #define DXMPERF_AUDIOSLAVE  0x00000040
 #define DXMPERF_AUDIOBREAK  0x00000080
 
+//
+// The streaming marks (PERFLOG_DELIVER, PERFLOG_RENDERSTART, ...) only go
+// to the trace sink and are defined in perfsink.h.
+//
+
 #define PERFLOG_CTOR( name, iface )
 #define PERFLOG_DTOR( name, iface )
-#define PERFLOG_DELIVER( name, source, dest, sample, pmt )
-#define PERFLOG_RECEIVE( name, source, dest, sample, pmt )
-#define PERFLOG_RUN( name, iface, time, oldstate )
-#define PERFLOG_PAUSE( name, iface, oldstate )
-#define PERFLOG_STOP( name, iface, oldstate )
 #define PERFLOG_JOINGRAPH( name, iface, graph )
-#define PERFLOG_GETBUFFER( allocator, sample )
-#define PERFLOG_RELBUFFER( allocator, sample )
 #define PERFLOG_CONNECT( connector, connectee, status, pmt )
 #define PERFLOG_RXCONNECT( connector, connectee, status, pmt )
 #define PERFLOG_DISCONNECT( disconnector, disconnectee, status )
@@ -99,7 +97,7 @@ inline ULONGLONG _RDTSC( void ) {
     }*/
 
 #define PERFLOG_AUDIORECV(StreamTime,SampleStart,SampleStop,Discontinuity,Duration) \
-    if (PerflogEnableFlags & DXMPERF_AUDIORECV) {           \
+    if (PerflogEventEnabled(DXMPERF_AUDIORECV)) {           \
         PERFINFO_WMI_AUDIORECV  perfData;                   \
         memset( &perfData, 0, sizeof( perfData ) );         \
         perfData.header.Size = sizeof( perfData );          \
@@ -114,7 +112,7 @@ inline ULONGLONG _RDTSC( void ) {
     }
 
 #define PERFLOG_AUDIOSLAVE(MasterClock,SlaveClock,ErrorAccum,LastHighErrorSeen,LastLowErrorSeen) \
-    if (PerflogEnableFlags & DXMPERF_AUDIOSLAVE) {          \
+    if (PerflogEventEnabled(DXMPERF_AUDIOSLAVE)) {          \
         PERFINFO_WMI_AUDIOSLAVE perfData;                   \
         memset( &perfData, 0, sizeof( perfData ) );         \
         perfData.header.Size = sizeof( perfData );          \
@@ -129,7 +127,7 @@ inline ULONGLONG _RDTSC( void ) {
     }
 
 #define PERFLOG_AUDIOADDBREAK(IterNextWrite,OffsetNextWrite,IterWrite,OffsetWrite) \
-    if (PerflogEnableFlags & DXMPERF_AUDIOBREAK) {              \
+    if (PerflogEventEnabled(DXMPERF_AUDIOBREAK)) {              \
         PERFINFO_WMI_AUDIOADDBREAK perfData;                    \
         memset( &perfData, 0, sizeof( perfData ) );             \
         perfData.header.Size = sizeof( perfData );              \
@@ -143,7 +141,7 @@ inline ULONGLONG _RDTSC( void ) {
     }
 
 #define PERFLOG_VIDEOREND( sampletime, clocktime, psample ) \
-    if (PerflogEnableFlags & DXMPERF_VIDEOREND) { \
+    if (PerflogEventEnabled(DXMPERF_VIDEOREND)) { \
         PERFINFO_WMI_AVREND perfData; \
         memset( &perfData, 0, sizeof( perfData ) ); \
         perfData.header.Size = sizeof( perfData ); \
@@ -156,7 +154,7 @@ inline ULONGLONG _RDTSC( void ) {
     }
 
 #define PERFLOG_AUDIOGLITCH( instance, glitchtype, currenttime, previoustime ) \
-    if (PerflogEnableFlags & DXMPERF_AUDIOGLITCH) { \
+    if (PerflogEventEnabled(DXMPERF_AUDIOGLITCH)) { \
         PERFINFO_WMI_AUDIOGLITCH perfData; \
         memset( &perfData, 0, sizeof( perfData ) ); \
         perfData.header.Size = sizeof( perfData ); \
@@ -204,7 +202,7 @@ inline ULONGLONG _RDTSC( void ) {
 */
 
 #define PERFLOG_AUDIOBREAK( nextwrite, writepos, msecs )  \
-    if (PerflogEnableFlags & AUDIOBREAK_BIT) { \
+    if (PerflogEventEnabled(AUDIOBREAK_BIT)) { \
         PERFINFO_WMI_AUDIOBREAK    perfData; \
         memset( &perfData, 0, sizeof( perfData ) ); \
         perfData.header.Size  = sizeof( perfData ); \
@@ -0,0 +1,489 @@
+//------------------------------------------------------------------------------
+// File: Measure.cpp
+//
+// Desc: DirectShow base classes - implements the performance measurement
+//       functions declared in measure.h.
+//
+// Copyright (c) 1992-2001 Microsoft Corporation.  All rights reserved.
+//------------------------------------------------------------------------------
+
+
+#include <streams.h>
+#define STRSAFE_NO_DEPRECATE
+#include <strsafe.h>
+#include <intrin.h>
+#include <math.h>
+
+// How it works
+//
+// Every thread that calls a probe gets a block with a counter for each
+// incident id.  Only the owning thread writes to its block, so a probe is
+// a handful of plain stores: no locks, no interlocked operations and no
+// cache lines shared with other threads.  Readers add the blocks up.
+//
+// A block has a sequence count which the owner makes odd while it updates
+// a counter and even again afterwards.  A reader copies a counter and
+// tries again if the count was odd or changed in the meantime.
+//
+// Msr_Reset cannot clear the counters of other threads, so each incident
+// has an epoch which Msr_Reset increments.  A counter remembers the epoch
+// it was last written in; the owner clears it when it sees a new epoch
+// and readers ignore it until then.
+//
+// A block remembers a handle to its owner.  When a thread needs a block
+// it first looks for one whose owner has exited and carries on counting
+// into that, so the statistics of threads that have exited are still
+// reported and there are never more blocks (about 40KB each) than threads
+// that were probing at the same time.  We don't use thread detach
+// notifications or fiber local storage callbacks for this: the base
+// classes turn the former off and the latter would call into a module
+// that may have been unloaded.
+//
+// Msr_Terminate frees the blocks, and is called when the module unloads.
+// A thread's pointer to its block is only good for the generation it was
+// attached in, so a thread that probes after Msr_Terminate gets a new
+// block instead of writing to freed memory.
+
+#define MSR_BUCKETS     64      // 32 power of two buckets for each sign
+
+struct MsrCounter {
+    LONG lEpoch;                // g_lMsrEpoch[id] when last written
+    LONG lSmallest;
+    LONG lLargest;
+    LONGLONG llCount;
+    LONGLONG llSum;
+    double dSumSq;
+    LONGLONG llStart;           // counter at the last Start or Note, 0 if none
+    LONG lBuckets[MSR_BUCKETS];
+};
+
+struct MsrThreadBlock {
+    MsrThreadBlock *pNext;
+    HANDLE hOwner;              // signalled when the owner has exited
+    volatile LONG lSequence;    // odd while the owner updates a counter
+    MsrCounter Counters[MSR_MAX_INCIDENTS];
+};
+
+static TCHAR g_szMsrNames[MSR_MAX_INCIDENTS][MSR_MAX_NAME] = { TEXT("Scratch pad") };
+static volatile LONG g_cMsrIncidents = 1;       // id 0 is the scratch pad
+static volatile LONG g_lMsrEpoch[MSR_MAX_INCIDENTS];
+static volatile LONG g_lMsrRunning = TRUE;
+static MsrThreadBlock * volatile g_pMsrBlocks = NULL;
+static volatile LONG g_lMsrGeneration = 1;      // incremented by Msr_Terminate
+static SRWLOCK g_MsrRegisterLock = SRWLOCK_INIT;
+static SRWLOCK g_MsrBlockLock = SRWLOCK_INIT;   // serialises attaching threads
+static LONGLONG g_llMsrFrequency = 0;           // performance counter ticks per second
+
+static __declspec(thread) MsrThreadBlock *t_pMsrBlock = NULL;
+static __declspec(thread) LONG t_lMsrGeneration = 0;   // of t_pMsrBlock
+
+
+static void MsrInitFrequency()
+{
+    if (g_llMsrFrequency == 0) {
+        LARGE_INTEGER li;
+        QueryPerformanceFrequency(&li);
+        g_llMsrFrequency = li.QuadPart;
+    }
+}
+
+// Give the calling thread its block of counters, preferably one that a
+// thread which has exited left behind
+
+static MsrThreadBlock *MsrAttachThread()
+{
+    HANDLE hThread;
+    if (!DuplicateHandle(GetCurrentProcess(), GetCurrentThread(),
+                         GetCurrentProcess(), &hThread, SYNCHRONIZE, FALSE, 0)) {
+        return NULL;
+    }
+
+    AcquireSRWLockExclusive(&g_MsrBlockLock);
+    MsrInitFrequency();
+
+    MsrThreadBlock *pBlock = NULL;
+    for (MsrThreadBlock *p = g_pMsrBlocks; p; p = p->pNext) {
+        if (WaitForSingleObject(p->hOwner, 0) == WAIT_OBJECT_0) {
+            pBlock = p;
+            break;
+        }
+    }
+
+    if (pBlock) {
+        // Keep the counters, but the pending starts were the old owner's
+        CloseHandle(pBlock->hOwner);
+        for (int i = 0; i < MSR_MAX_INCIDENTS; i++) {
+            pBlock->Counters[i].llStart = 0;
+        }
+    } else {
+        pBlock = (MsrThreadBlock *)VirtualAlloc(
+            NULL, sizeof(MsrThreadBlock), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+        if (pBlock == NULL) {
+            ReleaseSRWLockExclusive(&g_MsrBlockLock);
+            CloseHandle(hThread);
+            return NULL;
+        }
+        // Readers walk the list without the lock
+        pBlock->pNext = g_pMsrBlocks;
+        InterlockedExchangePointer((PVOID volatile *)&g_pMsrBlocks, pBlock);
+    }
+    pBlock->hOwner = hThread;
+    t_pMsrBlock = pBlock;
+    t_lMsrGeneration = g_lMsrGeneration;
+
+    ReleaseSRWLockExclusive(&g_MsrBlockLock);
+    return pBlock;
+}
+
+static __forceinline MsrThreadBlock *MsrGetBlock(int Id)
+{
+    if (!g_lMsrRunning || (unsigned)Id >= MSR_MAX_INCIDENTS) {
+        return NULL;
+    }
+    // Also true for a thread that has no block yet
+    if (t_lMsrGeneration != g_lMsrGeneration) {
+        return MsrAttachThread();
+    }
+    return t_pMsrBlock;
+}
+
+static __forceinline LONGLONG MsrNow()
+{
+    LARGE_INTEGER li;
+    QueryPerformanceCounter(&li);
+    return li.QuadPart;
+}
+
+// Buckets are ordered by value.  The upper half holds 0 and then one
+// bucket per power of two; the lower half mirrors it for -1 and below.
+
+static __forceinline int MsrBucket(LONG lValue)
+{
+    DWORD dwMagnitude = lValue < 0 ? (DWORD)(-(lValue + 1)) : (DWORD)lValue;
+    DWORD dwLog2 = 0;
+    int iBucket = 0;
+    if (_BitScanReverse(&dwLog2, dwMagnitude)) {
+        iBucket = min((int)dwLog2 + 1, MSR_BUCKETS / 2 - 1);
+    }
+    return lValue < 0 ? MSR_BUCKETS / 2 - 1 - iBucket : MSR_BUCKETS / 2 + iBucket;
+}
+
+// The largest value in a bucket
+
+static LONG MsrBucketValue(int iBucket)
+{
+    if (iBucket >= MSR_BUCKETS / 2) {
+        const int i = iBucket - MSR_BUCKETS / 2;
+        return i == 0 ? 0 : (LONG)((1UL << i) - 1);
+    }
+    const int i = MSR_BUCKETS / 2 - 1 - iBucket;
+    return i == 0 ? -1 : -(LONG)(1UL << (i - 1)) - 1;
+}
+
+static void MsrRecord(MsrThreadBlock *pBlock, int Id, LONG lValue)
+{
+    MsrCounter *pCounter = &pBlock->Counters[Id];
+    pBlock->lSequence++;
+    _WriteBarrier();
+
+    const LONG lEpoch = g_lMsrEpoch[Id];
+    if (pCounter->lEpoch != lEpoch) {
+        pCounter->llCount = 0;
+        pCounter->llSum = 0;
+        pCounter->dSumSq = 0.0;
+        ZeroMemory(pCounter->lBuckets, sizeof(pCounter->lBuckets));
+        pCounter->lEpoch = lEpoch;
+    }
+
+    if (pCounter->llCount == 0 || lValue < pCounter->lSmallest) {
+        pCounter->lSmallest = lValue;
+    }
+    if (pCounter->llCount == 0 || lValue > pCounter->lLargest) {
+        pCounter->lLargest = lValue;
+    }
+    pCounter->llCount++;
+    pCounter->llSum += lValue;
+    pCounter->dSumSq += (double)lValue * lValue;
+    pCounter->lBuckets[MsrBucket(lValue)]++;
+
+    _WriteBarrier();
+    pBlock->lSequence++;
+}
+
+static LONG MsrMicroseconds(LONGLONG llTicks)
+{
+    const LONGLONG llMicroseconds = llMulDiv(llTicks, 1000000, g_llMsrFrequency, 0);
+    return llMicroseconds > MAXLONG ? MAXLONG : (LONG)llMicroseconds;
+}
+
+
+// Called when the module loads.  Everything else is set up on first use,
+// so modules with their own entry point can do without it.
+
+void WINAPI Msr_Init(void)
+{
+    AcquireSRWLockExclusive(&g_MsrBlockLock);
+    MsrInitFrequency();
+    ReleaseSRWLockExclusive(&g_MsrBlockLock);
+}
+
+
+// Free the counters.  Called when the module unloads; no probes may run
+// during this.  Threads that probe afterwards start with a new block.
+
+void WINAPI Msr_Terminate(void)
+{
+    AcquireSRWLockExclusive(&g_MsrBlockLock);
+    MsrThreadBlock *pBlock = (MsrThreadBlock *)InterlockedExchangePointer(
+                                 (PVOID volatile *)&g_pMsrBlocks, NULL);
+    InterlockedIncrement(&g_lMsrGeneration);
+    ReleaseSRWLockExclusive(&g_MsrBlockLock);
+
+    while (pBlock) {
+        MsrThreadBlock *pNext = pBlock->pNext;
+        CloseHandle(pBlock->hOwner);
+        VirtualFree(pBlock, 0, MEM_RELEASE);
+        pBlock = pNext;
+    }
+    t_pMsrBlock = NULL;
+}
+
+
+// Registering a name twice returns the same id, so that all instances of
+// a filter count into one incident.  When the table is full we return the
+// scratch pad.
+
+int WINAPI Msr_Register(__in LPTSTR Incident)
+{
+    int Id = 0;
+    AcquireSRWLockExclusive(&g_MsrRegisterLock);
+    for (int i = 1; i < g_cMsrIncidents; i++) {
+        if (lstrcmp(g_szMsrNames[i], Incident) == 0) {
+            Id = i;
+            break;
+        }
+    }
+    if (Id == 0 && g_cMsrIncidents < MSR_MAX_INCIDENTS) {
+        Id = g_cMsrIncidents;
+        (void)StringCchCopy(g_szMsrNames[Id], MSR_MAX_NAME, Incident);
+        InterlockedIncrement(&g_cMsrIncidents);     // publishes the name
+    }
+    ReleaseSRWLockExclusive(&g_MsrRegisterLock);
+    return Id;
+}
+
+
+void WINAPI Msr_Reset(int Id)
+{
+    if ((unsigned)Id < MSR_MAX_INCIDENTS) {
+        InterlockedIncrement(&g_lMsrEpoch[Id]);
+    }
+}
+
+
+void WINAPI Msr_Control(int iAction)
+{
+    switch (iAction) {
+    case MSR_RESET_ALL:
+        for (int i = 0; i < MSR_MAX_INCIDENTS; i++) {
+            InterlockedIncrement(&g_lMsrEpoch[i]);
+        }
+        break;
+    case MSR_PAUSE:
+        InterlockedExchange(&g_lMsrRunning, FALSE);
+        break;
+    case MSR_RUN:
+        InterlockedExchange(&g_lMsrRunning, TRUE);
+        break;
+    }
+}
+
+
+// The start times are only ever looked at by the owning thread, so they
+// are written outside the sequence count
+
+void WINAPI Msr_Start(int Id)
+{
+    MsrThreadBlock *pBlock = MsrGetBlock(Id);
+    if (pBlock) {
+        pBlock->Counters[Id].llStart = MsrNow();
+    }
+}
+
+
+void WINAPI Msr_Stop(int Id)
+{
+    MsrThreadBlock *pBlock = MsrGetBlock(Id);
+    if (pBlock && pBlock->Counters[Id].llStart != 0) {
+        const LONGLONG llElapsed = MsrNow() - pBlock->Counters[Id].llStart;
+        pBlock->Counters[Id].llStart = 0;
+        MsrRecord(pBlock, Id, MsrMicroseconds(llElapsed));
+    }
+}
+
+
+void WINAPI Msr_Note(int Id)
+{
+    MsrThreadBlock *pBlock = MsrGetBlock(Id);
+    if (pBlock) {
+        const LONGLONG llNow = MsrNow();
+        if (pBlock->Counters[Id].llStart != 0) {
+            MsrRecord(pBlock, Id, MsrMicroseconds(llNow - pBlock->Counters[Id].llStart));
+        }
+        pBlock->Counters[Id].llStart = llNow;
+    }
+}
+
+
+void WINAPI Msr_Integer(int Id, int n)
+{
+    MsrThreadBlock *pBlock = MsrGetBlock(Id);
+    if (pBlock) {
+        MsrRecord(pBlock, Id, n);
+    }
+}
+
+
+// Copy a counter of another thread's block consistently
+
+static void MsrReadCounter(const MsrThreadBlock *pBlock, int Id, __out MsrCounter *pCounter)
+{
+    for (;;) {
+        const LONG lSequence = pBlock->lSequence;
+        if (lSequence & 1) {
+            YieldProcessor();
+            continue;
+        }
+        _ReadBarrier();
+        CopyMemory(pCounter, &pBlock->Counters[Id], sizeof(MsrCounter));
+        _ReadBarrier();
+        if (pBlock->lSequence == lSequence) {
+            return;
+        }
+    }
+}
+
+static LONG MsrPercentile(const LONGLONG *pllBuckets, LONGLONG llCount, int iPercent)
+{
+    LONGLONG llRank = (llCount * iPercent + 99) / 100;
+    if (llRank < 1) {
+        llRank = 1;
+    }
+    LONGLONG llSeen = 0;
+    for (int i = 0; i < MSR_BUCKETS; i++) {
+        llSeen += pllBuckets[i];
+        if (llSeen >= llRank) {
+            return MsrBucketValue(i);
+        }
+    }
+    return MsrBucketValue(MSR_BUCKETS - 1);
+}
+
+
+int WINAPI Msr_Snapshot(__out_ecount_opt(nMax) MSR_STATS *pStats, int nMax)
+{
+    const int cIncidents = g_cMsrIncidents;
+    if (pStats == NULL) {
+        return cIncidents;
+    }
+
+    for (int Id = 0; Id < min(nMax, cIncidents); Id++) {
+        MSR_STATS *pS = &pStats[Id];
+        ZeroMemory(pS, sizeof(MSR_STATS));
+        (void)StringCchCopy(pS->szName, MSR_MAX_NAME, g_szMsrNames[Id]);
+
+        const LONG lEpoch = g_lMsrEpoch[Id];
+        LONGLONG llSum = 0;
+        double dSumSq = 0.0;
+        LONGLONG llBuckets[MSR_BUCKETS] = { 0 };
+
+        for (const MsrThreadBlock *pBlock = g_pMsrBlocks; pBlock; pBlock = pBlock->pNext) {
+            MsrCounter Counter;
+            MsrReadCounter(pBlock, Id, &Counter);
+            if (Counter.lEpoch != lEpoch || Counter.llCount == 0) {
+                continue;
+            }
+            if (pS->llCount == 0 || Counter.lSmallest < pS->lSmallest) {
+                pS->lSmallest = Counter.lSmallest;
+            }
+            if (pS->llCount == 0 || Counter.lLargest > pS->lLargest) {
+                pS->lLargest = Counter.lLargest;
+            }
+            pS->llCount += Counter.llCount;
+            llSum += Counter.llSum;
+            dSumSq += Counter.dSumSq;
+            for (int i = 0; i < MSR_BUCKETS; i++) {
+                llBuckets[i] += Counter.lBuckets[i];
+            }
+        }
+
+        if (pS->llCount > 0) {
+            pS->dAverage = (double)llSum / pS->llCount;
+            if (pS->llCount > 1) {
+                // sqrt( (S - T**2/N) / (N-1) )
+                const double dVariance =
+                    (dSumSq - (double)llSum * llSum / pS->llCount) / (pS->llCount - 1);
+                pS->dStdDev = dVariance > 0.0 ? sqrt(dVariance) : 0.0;
+            }
+            pS->lP50 = MsrPercentile(llBuckets, pS->llCount, 50);
+            pS->lP95 = MsrPercentile(llBuckets, pS->llCount, 95);
+            pS->lP99 = MsrPercentile(llBuckets, pS->llCount, 99);
+        }
+    }
+    return cIncidents;
+}
+
+
+// Write one line to the file, or to the debug output if there is no file
+
+static void MsrWriteLine(HANDLE hFile, LPCTSTR pszLine)
+{
+    if (hFile == NULL) {
+        DbgLog((LOG_TRACE, 0, TEXT("%s"), pszLine));
+    } else {
+        TCHAR szLine[MSR_MAX_NAME + 128];
+        (void)StringCchPrintf(szLine, NUMELMS(szLine), TEXT("%s\r\n"), pszLine);
+        DWORD dwWritten;
+        WriteFile(hFile, szLine, lstrlen(szLine) * sizeof(TCHAR), &dwWritten, NULL);
+    }
+}
+
+
+void WINAPI Msr_DumpStats(HANDLE hFile)
+{
+    MSR_STATS *Stats = new MSR_STATS[MSR_MAX_INCIDENTS];
+    if (Stats == NULL) {
+        return;
+    }
+    const int cIncidents = Msr_Snapshot(Stats, MSR_MAX_INCIDENTS);
+
+    MsrWriteLine(hFile, TEXT("    Number      Average       StdDev     Smallest      Largest")
+                        TEXT("          P50          P95          P99 Incident_Name"));
+
+    for (int i = 0; i < cIncidents; i++) {
+        const MSR_STATS *pS = &Stats[i];
+        TCHAR szLine[MSR_MAX_NAME + 128];
+        if (pS->llCount == 0) {
+            (void)StringCchPrintf(szLine, NUMELMS(szLine),
+                TEXT("%10I64d     -.           -.           -.           -.      ")
+                TEXT("      -.           -.           -.       %s"),
+                pS->llCount, pS->szName);
+        } else {
+            (void)StringCchPrintf(szLine, NUMELMS(szLine),
+                TEXT("%10I64d %12d %12d %12d %12d %12d %12d %12d %s"),
+                pS->llCount, (int)pS->dAverage, (int)pS->dStdDev,
+                pS->lSmallest, pS->lLargest, pS->lP50, pS->lP95, pS->lP99,
+                pS->szName);
+        }
+        MsrWriteLine(hFile, szLine);
+    }
+    delete[] Stats;
+}
+
+
+// We keep no log of incidents, so this is the same as Msr_DumpStats
+
+void WINAPI Msr_Dump(HANDLE hFile)
+{
+    Msr_DumpStats(hFile);
+}
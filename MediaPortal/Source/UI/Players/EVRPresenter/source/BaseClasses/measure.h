@@ -102,7 +102,7 @@ Number      Average       StdDev     Smallest      Largest Incident_Name
     are mixed in with Starts and Stops their statistics will be gibberish.
 
     If you code the calls in upper case i.e. MSR_START(idMunge); then you get
-    macros which will turn into nothing unless PERF is defined.
+    macros which will turn into nothing if NO_MSR is defined (and PERF is not).
 
     You can reset the statistical counts for a given id by calling Reset(Id).
     They are reset by default at the start.
@@ -111,12 +111,35 @@ Number      Average       StdDev     Smallest      Largest Incident_Name
     The log is a circular buffer in storage (to try to minimise disk I/O).
     It overwrites the oldest entries once full.  The statistics include ALL
     incidents since the last Reset, whether still visible in the log or not.
+
+   THIS IMPLEMENTATION (measure.cpp):
+
+    The probes are cheap enough to leave in release builds, so they are on
+    unless NO_MSR is defined.  PERF still turns on the extra measurements in
+    the base classes that cost more than the probes themselves.
+
+    There is no incident log, only the statistics.  Each thread counts into
+    its own block of counters without locks or interlocked operations; the
+    blocks are added up when you ask for the statistics.  Besides the count,
+    average, standard deviation and extremes, every incident has a histogram
+    with a bucket per power of two, which gives rough percentiles.
+
+    Values are the integers passed to Msr_Integer, and times in microseconds
+    between a Start and Stop or between successive Notes on the same thread.
+
+    Msr_Snapshot copies the statistics out for a program to look at,
+    Msr_Dump and Msr_DumpStats print them in the table form above (with the
+    percentiles in extra columns).
 */
 
 #ifndef __MEASURE__
 #define __MEASURE__
 
-#ifdef PERF
+#if defined(PERF) || !defined(NO_MSR)
+#define MSR_ENABLED
+#endif
+
+#ifdef MSR_ENABLED
 #define MSR_INIT() Msr_Init()
 #define MSR_TERMINATE() Msr_Terminate()
 #define MSR_REGISTER(a) Msr_Register(a)
@@ -128,6 +151,7 @@ Number      Average       StdDev     Smallest      Largest Incident_Name
 #define MSR_INTEGER(a,b) Msr_Integer(a,b)
 #define MSR_DUMP(a) Msr_Dump(a)
 #define MSR_DUMPSTATS(a) Msr_DumpStats(a)
+#define MSR_SNAPSHOT(a,b) Msr_Snapshot(a,b)
 #else
 #define MSR_INIT() ((void)0)
 #define MSR_TERMINATE() ((void)0)
@@ -140,8 +164,12 @@ Number      Average       StdDev     Smallest      Largest Incident_Name
 #define MSR_INTEGER(a,b) ((void)0)
 #define MSR_DUMP(a) ((void)0)
 #define MSR_DUMPSTATS(a) ((void)0)
+#define MSR_SNAPSHOT(a,b) 0
 #endif
 
+#define MSR_MAX_INCIDENTS   128     // Msr_Register returns 0 beyond this
+#define MSR_MAX_NAME        64      // characters kept of an incident name
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -151,7 +179,7 @@ extern "C" {
 void WINAPI Msr_Init(void);
 
 
-// Call this last to clean up (or just let it fall off the end - who cares?)
+// Call this last to clean up (called by the DllEntry when the module unloads)
 
 void WINAPI Msr_Terminate(void);
 
@@ -206,6 +234,28 @@ void WINAPI Msr_Dump(HANDLE hFile);
 
 void WINAPI Msr_DumpStats(HANDLE hFile);
 
+
+// The statistics of one incident since it was last reset.  The percentiles
+// are approximate: each is the largest value of a power of two bucket.
+
+typedef struct tagMSR_STATS {
+    TCHAR    szName[MSR_MAX_NAME];
+    LONGLONG llCount;
+    double   dAverage;
+    double   dStdDev;
+    LONG     lSmallest;
+    LONG     lLargest;
+    LONG     lP50;
+    LONG     lP95;
+    LONG     lP99;
+} MSR_STATS;
+
+// Copy the statistics of up to nMax incidents, indexed by id, into pStats.
+// Returns the number of incidents registered, so call with nMax==0 to find
+// out how big an array to pass.
+
+int WINAPI Msr_Snapshot(__out_ecount_opt(nMax) MSR_STATS *pStats, int nMax);
+
 // Type definitions in case you want to declare a pointer to the dump functions
 // (makes it a trifle easier to do dynamic linking
 // i.e. LoadModule, GetProcAddress and call that)
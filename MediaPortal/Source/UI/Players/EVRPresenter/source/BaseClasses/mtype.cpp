@@ -37,7 +37,8 @@ CMediaType::CMediaType(const GUID * type)
 
 CMediaType::CMediaType(const AM_MEDIA_TYPE& rt, __out_opt HRESULT* phr)
 {
-    HRESULT hr = CopyMediaType(this, &rt);
+    InitMediaType();
+    HRESULT hr = Set(rt);
     if (FAILED(hr) && (NULL != phr)) {
         *phr = hr;
     }
@@ -46,7 +47,8 @@ CMediaType::CMediaType(const AM_MEDIA_TYPE& rt, __out_opt HRESULT* phr)
 
 CMediaType::CMediaType(const CMediaType& rt, __out_opt HRESULT* phr)
 {
-    HRESULT hr = CopyMediaType(this, &rt);
+    InitMediaType();
+    HRESULT hr = Set(rt);
     if (FAILED(hr) && (NULL != phr)) {
         *phr = hr;
     }
@@ -111,18 +113,43 @@ CMediaType::Set(const CMediaType& rt)
 }
 
 
+// deep copy of another media type. Our format block is reused when it has
+// the right size, otherwise the new one goes inline if it fits
+
 HRESULT
 CMediaType::Set(const AM_MEDIA_TYPE& rt)
 {
-    if (&rt != this) {
-        FreeMediaType(*this);
-        HRESULT hr = CopyMediaType(this, &rt);
-        if (FAILED(hr)) {
+    if (&rt == this) {
+        return S_OK;
+    }
+
+    if (rt.pUnk != NULL) {
+        rt.pUnk->AddRef();
+    }
+    if (pUnk != NULL) {
+        pUnk->Release();
+    }
+
+    majortype = rt.majortype;
+    subtype = rt.subtype;
+    bFixedSizeSamples = rt.bFixedSizeSamples;
+    bTemporalCompression = rt.bTemporalCompression;
+    lSampleSize = rt.lSampleSize;
+    formattype = rt.formattype;
+    pUnk = rt.pUnk;
+
+    if (cbFormat != rt.cbFormat) {
+        ResetFormatBuffer();
+        if (rt.cbFormat != 0 && AllocFormatBuffer(rt.cbFormat) == NULL) {
             return E_OUTOFMEMORY;
         }
     }
+    if (cbFormat != 0) {
+        ASSERT(rt.pbFormat != NULL);
+        CopyMemory((PVOID)pbFormat, (PVOID)rt.pbFormat, cbFormat);
+    }
 
-    return S_OK;    
+    return S_OK;
 }
 
 
@@ -207,7 +234,7 @@ CMediaType::SetFormatType(const GUID *pformattype)
 
 void CMediaType::ResetFormatBuffer()
 {
-    if (cbFormat) {
+    if (cbFormat && pbFormat != m_Format) {
         CoTaskMemFree((PVOID)pbFormat);
     }
     cbFormat = 0;
@@ -230,6 +257,15 @@ CMediaType::AllocFormatBuffer(ULONG length)
         return pbFormat;
     }
 
+    // small blocks live inside the object
+
+    if (length <= MEDIATYPE_INLINE_FORMAT) {
+        ResetFormatBuffer();
+        cbFormat = length;
+        pbFormat = m_Format;
+        return pbFormat;
+    }
+
     // allocate the new format buffer
 
     BYTE *pNewFormat = (PBYTE)CoTaskMemAlloc(length);
@@ -240,7 +276,7 @@ CMediaType::AllocFormatBuffer(ULONG length)
 
     // delete the old format
 
-    if (cbFormat != 0) {
+    if (cbFormat != 0 && pbFormat != m_Format) {
         ASSERT(pbFormat);
         CoTaskMemFree((PVOID)pbFormat);
     }
@@ -267,6 +303,20 @@ CMediaType::ReallocFormatBuffer(ULONG length)
         return pbFormat;
     }
 
+    // an inline block can simply change its length, a task allocated one
+    // that now fits is moved inline
+
+    if (length <= MEDIATYPE_INLINE_FORMAT) {
+        if (cbFormat != 0 && pbFormat != m_Format) {
+            ASSERT(pbFormat);
+            memcpy(m_Format,pbFormat,min(length,cbFormat));
+            CoTaskMemFree((PVOID)pbFormat);
+        }
+        cbFormat = length;
+        pbFormat = m_Format;
+        return pbFormat;
+    }
+
     // allocate the new format buffer
 
     BYTE *pNewFormat = (PBYTE)CoTaskMemAlloc(length);
@@ -281,7 +331,9 @@ CMediaType::ReallocFormatBuffer(ULONG length)
     if (cbFormat != 0) {
         ASSERT(pbFormat);
         memcpy(pNewFormat,pbFormat,min(length,cbFormat));
-        CoTaskMemFree((PVOID)pbFormat);
+        if (pbFormat != m_Format) {
+            CoTaskMemFree((PVOID)pbFormat);
+        }
     }
 
     cbFormat = length;
@@ -289,11 +341,41 @@ CMediaType::ReallocFormatBuffer(ULONG length)
     return pNewFormat;
 }
 
-// initialise a media type structure
+// hand the media type over to a caller that will free it with FreeMediaType
+// or DeleteMediaType, typically on the other side of a COM interface. A
+// task allocated format block is transferred, an inline one is copied.
+// If that fails pmt is left empty and we keep the type
+
+HRESULT
+CMediaType::Detach(__out AM_MEDIA_TYPE *pmt)
+{
+    CheckPointer(pmt,E_POINTER);
+
+    *pmt = *this;
+    if (cbFormat != 0 && pbFormat == m_Format) {
+        pmt->pbFormat = (PBYTE)CoTaskMemAlloc(cbFormat);
+        if (pmt->pbFormat == NULL) {
+            pmt->cbFormat = 0;
+            pmt->pUnk = NULL;
+            return E_OUTOFMEMORY;
+        }
+        CopyMemory((PVOID)pmt->pbFormat, (PVOID)m_Format, cbFormat);
+    }
+
+    cbFormat = 0;
+    pbFormat = NULL;
+    pUnk = NULL;
+    return S_OK;
+}
+
+
+// initialise a media type structure. Only the AM_MEDIA_TYPE members are
+// cleared, the inline format block is not looked at until it is used
 
 void CMediaType::InitMediaType()
 {
-    ZeroMemory((PVOID)this, sizeof(*this));
+    ASSERT(m_Format == (BYTE *) ((AM_MEDIA_TYPE *) this + 1));
+    ZeroMemory((PVOID)(AM_MEDIA_TYPE *)this, sizeof(AM_MEDIA_TYPE));
     lSampleSize = 1;
     bFixedSizeSamples = TRUE;
 }
@@ -423,7 +505,9 @@ HRESULT WINAPI CopyMediaType(__out AM_MEDIA_TYPE *pmtTarget, const AM_MEDIA_TYPE
 void WINAPI FreeMediaType(__inout AM_MEDIA_TYPE& mt)
 {
     if (mt.cbFormat != 0) {
-        CoTaskMemFree((PVOID)mt.pbFormat);
+        if (!CMediaType::HasInlineFormat(mt)) {
+            CoTaskMemFree((PVOID)mt.pbFormat);
+        }
 
         // Strictly unnecessary but tidier
         mt.cbFormat = 0;
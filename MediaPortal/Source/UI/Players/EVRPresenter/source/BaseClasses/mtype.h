@@ -13,10 +13,28 @@
 
 /* Helper class that derived pin objects can use to compare media
    types etc. Has same data members as the struct AM_MEDIA_TYPE defined
-   in the streams IDL file, but also has (non-virtual) functions */
+   in the streams IDL file, but also has (non-virtual) functions
+
+   Format blocks of up to MEDIATYPE_INLINE_FORMAT bytes, which covers a
+   VIDEOINFOHEADER2 with colour masks and a WAVEFORMATEXTENSIBLE, are kept
+   inside the object so that negotiating and copying types does not go to
+   the task allocator. Larger blocks are task allocated as before. The
+   global functions below know about the inline block, but code that
+   frees or replaces pbFormat of a CMediaType itself must go through
+   ResetFormatBuffer, SetFormat and friends, and a CMediaType handed out
+   as a task allocated AM_MEDIA_TYPE must be passed through Detach */
+
+#define MEDIATYPE_INLINE_FORMAT 128
 
 class CMediaType : public _AMMediaType {
 
+    // Must directly follow the AM_MEDIA_TYPE members, see HasInlineFormat
+
+    union {
+        BYTE m_Format[MEDIATYPE_INLINE_FORMAT];
+        LONGLONG m_FormatAlign;
+    };
+
 public:
 
     ~CMediaType();
@@ -62,6 +80,16 @@ public:
     BYTE* AllocFormatBuffer(ULONG length);
     BYTE* ReallocFormatBuffer(ULONG length);
 
+    // moves the type into an AM_MEDIA_TYPE owned by the caller, copying
+    // an inline format block to task memory, and leaves this one empty
+    HRESULT Detach(__out AM_MEDIA_TYPE *pmt);
+
+    // TRUE if the format block is the inline block of the CMediaType that
+    // mt belongs to - it must not be passed to CoTaskMemFree
+    static BOOL HasInlineFormat(const AM_MEDIA_TYPE& mt) {
+        return mt.pbFormat != NULL && mt.pbFormat == (const BYTE *) (&mt + 1);
+    };
+
     void InitMediaType();
 
     BOOL MatchesPartial(const CMediaType* ppartial) const;
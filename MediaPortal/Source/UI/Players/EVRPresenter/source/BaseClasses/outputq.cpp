@@ -12,6 +12,13 @@
 
 #include <streams.h>
 
+#ifdef DXMPERF
+#include "dxmperf.h"
+#endif // DXMPERF
+
+//  Smallest ring we create for a queued output pin
+const LONG MIN_QUEUE_SIZE = 64;
+
 
 //
 //  COutputQueue Constructor :
@@ -35,8 +42,8 @@
 //     bBatchEact - Use exact batch sizes so don't send until the
 //                  batch is full or SendAnyway() is called
 //
-//     lListSize  - If we create a thread make the list of samples queued
-//                  to the thread have this size cache
+//     lListSize  - If we create a thread make the ring of samples queued
+//                  to the thread at least this big
 //
 //     dwPriority - If we create a thread set its priority to this
 //
@@ -54,7 +61,12 @@ COutputQueue::COutputQueue(
                 m_bBatchExact(bBatchExact && (lBatchSize > 1)),
                 m_hThread(NULL),
                 m_hSem(NULL),
-                m_List(NULL),
+                m_hSemSpace(NULL),
+                m_pRing(NULL),
+                m_lRingSize(0),
+                m_lTail(0),
+                m_lHead(0),
+                m_lProducersWaiting(0),
                 m_pPin(pInputPin),
                 m_ppSamples(NULL),
                 m_lWaiting(0),
@@ -63,11 +75,21 @@ COutputQueue::COutputQueue(
                 m_bSendAnyway(FALSE),
                 m_nBatched(0),
                 m_bFlushing(FALSE),
+                m_lFlushGeneration(0),
                 m_bFlushed(TRUE),
                 m_bFlushingOpt(bFlushingOpt),
                 m_bTerminate(FALSE),
                 m_hEventPop(NULL),
-                m_hr(S_OK)
+                m_hr(S_OK),
+                m_bAdaptiveBatch(FALSE),
+                m_lMaxBatchBytes(0),
+                m_dwMaxBatchDelay(INFINITE),
+                m_lBatchBytes(0),
+                m_dwBatchStart(0),
+                m_lQueuedBytes(0),
+                m_lBatchesSent(0),
+                m_lSamplesSent(0),
+                m_llBatchDelay(0)
 {
     ASSERT(m_lBatchSize > 0);
 
@@ -110,14 +132,27 @@ COutputQueue::COutputQueue(
             *phr = AmHresultFromWin32(dwError);
             return;
         }
-        m_List = new CSampleList(NAME("Sample Queue List"),
-                                 lListSize,
-                                 FALSE         // No lock
-                                );
-        if (m_List == NULL) {
+        m_hSemSpace = CreateSemaphore(NULL, 0, 0x7FFFFFFF, NULL);
+        if (m_hSemSpace == NULL) {
+            DWORD dwError = GetLastError();
+            *phr = AmHresultFromWin32(dwError);
+            return;
+        }
+
+        //  The ring must hold a few batches plus the special packets
+
+        m_lRingSize = MIN_QUEUE_SIZE;
+        while (m_lRingSize < lListSize || m_lRingSize < 2 * m_lBatchSize) {
+            m_lRingSize *= 2;
+        }
+        m_pRing = new QueueSlot[m_lRingSize];
+        if (m_pRing == NULL) {
             *phr = E_OUTOFMEMORY;
             return;
         }
+        for (LONG i = 0; i < m_lRingSize; i++) {
+            m_pRing[i].lSequence = i;
+        }
 
 
         DWORD dwThreadId;
@@ -149,6 +184,9 @@ COutputQueue::COutputQueue(
 COutputQueue::~COutputQueue()
 {
     DbgLog((LOG_TRACE, 3, TEXT("COutputQueue::~COutputQueue")));
+    DbgLog((LOG_TRACE, 2, TEXT("COutputQueue sent %d samples in %d batches, average delay %d ms"),
+           m_lSamplesSent, m_lBatchesSent,
+           m_lBatchesSent ? (LONG)(m_llBatchDelay / m_lBatchesSent) : 0));
     /*  Free our pointer */
     if (m_pInputPin != NULL) {
         m_pInputPin->Release();
@@ -165,14 +203,17 @@ COutputQueue::~COutputQueue()
 
         //  The thread frees the samples when asked to terminate
 
-        ASSERT(m_List->GetCount() == 0);
-        delete m_List;
+        ASSERT(QueuedCount() == 0);
     } else {
         FreeSamples();
     }
+    delete [] m_pRing;
     if (m_hSem != NULL) {
         EXECUTE_ASSERT(CloseHandle(m_hSem));
     }
+    if (m_hSemSpace != NULL) {
+        EXECUTE_ASSERT(CloseHandle(m_hSemSpace));
+    }
     delete [] m_ppSamples;
 }
 
@@ -197,16 +238,17 @@ DWORD WINAPI COutputQueue::InitialThreadProc(__in LPVOID pv)
 //  Thread sending the samples downstream :
 //
 //  When there is nothing to do the thread sets m_lWaiting (while
-//  holding the critical section) and then waits for m_hSem to be
-//  set (not holding the critical section)
+//  holding the critical section), checks the ring once more and then
+//  waits for m_hSem to be set (not holding the critical section)
 //
 DWORD COutputQueue::ThreadProc()
 {
     while (TRUE) {
         BOOL          bWait = FALSE;
+        DWORD         dwWait = INFINITE;
         IMediaSample *pSample;
         LONG          lNumberToSend; // Local copy
-        NewSegmentPacket* ppacket;
+        QueueSlot     packet;
 
         //
         //  Get a batch of samples and send it if possible
@@ -226,40 +268,64 @@ DWORD COutputQueue::ThreadProc()
                     SetEvent(m_evFlushComplete);
                 }
 
-                //  Get a sample off the list
+                //  Get a sample off the ring
 
-                pSample = m_List->RemoveHead();
+                pSample = RemoveHead(&packet);
 		// inform derived class we took something off the queue
 		if (m_hEventPop) {
                     //DbgLog((LOG_TRACE,3,TEXT("Queue: Delivered  SET EVENT")));
 		    SetEvent(m_hEventPop);
 		}
 
+                //  A producer that checked m_hr before a flush may queue
+                //  its packet after the flush - drop it
+
+                if (pSample != NULL && IsStalePacket(packet)) {
+                    if (!IsSpecialSample(pSample)) {
+                        pSample->Release();
+                    }
+                    continue;
+                }
+
                 if (pSample != NULL &&
                     !IsSpecialSample(pSample)) {
 
                     //  If its just a regular sample just add it to the batch
                     //  and exit the loop if the batch is full
 
+                    if (m_nBatched == 0) {
+                        m_dwBatchStart = packet.dwQueued;
+                    }
                     m_ppSamples[m_nBatched++] = pSample;
-                    if (m_nBatched == m_lBatchSize) {
+                    m_lBatchBytes += packet.lBytes;
+                    if (m_nBatched == m_lBatchSize || IsBatchDue()) {
                         break;
                     }
                 } else {
 
                     //  If there was nothing in the queue and there's nothing
                     //  to send (either because there's nothing or the batch
-                    //  isn't full) then prepare to wait
+                    //  isn't full or, for adaptive batching, isn't due yet)
+                    //  then prepare to wait
 
                     if (pSample == NULL &&
-                        (m_bBatchExact || m_nBatched == 0)) {
+                        (m_nBatched == 0 ||
+                         (m_bAdaptiveBatch ? !IsBatchDue() : m_bBatchExact))) {
 
                         //  Tell other thread to set the event when there's
                         //  something do to
 
                         ASSERT(m_lWaiting == 0);
-                        m_lWaiting++;
+                        InterlockedExchange(&m_lWaiting, 1);
                         bWait      = TRUE;
+
+                        //  Wake up when the oldest sample is due
+
+                        if (m_bAdaptiveBatch && m_nBatched != 0 &&
+                            m_dwMaxBatchDelay != INFINITE) {
+                            DWORD dwAge = timeGetTime() - m_dwBatchStart;
+                            dwWait = dwAge < m_dwMaxBatchDelay ? m_dwMaxBatchDelay - dwAge : 0;
+                        }
                     } else {
 
                         //  We break out of the loop on SEND_PACKET unless
@@ -269,18 +335,7 @@ DWORD COutputQueue::ThreadProc()
                             continue;
                         }
 
-                        if (pSample == NEW_SEGMENT) {
-                            // now we need the parameters - we are
-                            // guaranteed that the next packet contains them
-                            ppacket = (NewSegmentPacket *) m_List->RemoveHead();
-			    // we took something off the queue
-			    if (m_hEventPop) {
-                    	        //DbgLog((LOG_TRACE,3,TEXT("Queue: Delivered  SET EVENT")));
-		    	        SetEvent(m_hEventPop);
-			    }
-
-                            ASSERT(ppacket);
-                        }
+                        //  NEW_SEGMENT has its parameters in packet,
                         //  EOS_PACKET falls through here and we exit the loop
                         //  In this way it acts like SEND_PACKET
                     }
@@ -292,13 +347,29 @@ DWORD COutputQueue::ThreadProc()
                 // it up to date inside the critical section
                 lNumberToSend = m_nBatched;  // Local copy
                 m_nBatched = 0;
+                m_lBatchBytes = 0;
+
+                if (lNumberToSend != 0) {
+                    m_lBatchesSent++;
+                    m_lSamplesSent += lNumberToSend;
+                    m_llBatchDelay += timeGetTime() - m_dwBatchStart;
+                }
             }
         }
 
-        //  Wait for some more data
+        //  Wait for some more data.  Producers don't take the critical
+        //  section, so look once more - a packet may have been queued
+        //  before the producer could see m_lWaiting
 
         if (bWait) {
-            DbgWaitForSingleObject(m_hSem);
+            if (QueuedCount() == 0 &&
+                WaitForSingleObject(m_hSem, dwWait) == WAIT_OBJECT_0) {
+                //  A producer woke us up
+            } else if (InterlockedExchange(&m_lWaiting, 0) == 0) {
+                //  A producer has already released the semaphore, take
+                //  the count away again
+                DbgWaitForSingleObject(m_hSem);
+            }
             continue;
         }
 
@@ -312,6 +383,7 @@ DWORD COutputQueue::ThreadProc()
 
         if (lNumberToSend != 0) {
             long nProcessed;
+            PERFLOG_QUEUEDEPTH( this, QueuedCount() );
             if (m_hr == S_OK) {
                 ASSERT(!m_bFlushed);
                 HRESULT hr = m_pInputPin->ReceiveMultiple(m_ppSamples,
@@ -364,8 +436,7 @@ DWORD COutputQueue::ThreadProc()
         }
 
         if (pSample == NEW_SEGMENT) {
-            m_pPin->NewSegment(ppacket->tStart, ppacket->tStop, ppacket->dRate);
-            delete ppacket;
+            m_pPin->NewSegment(packet.Segment.tStart, packet.Segment.tStop, packet.Segment.dRate);
         }
     }
 }
@@ -383,8 +454,7 @@ void COutputQueue::SendAnyway()
         m_bSendAnyway = FALSE;
 
     } else {
-        CAutoLock lck(this);
-        QueueSample(SEND_PACKET);
+        QueueSample(SEND_PACKET, 0);
         NotifyThread();
     }
 }
@@ -403,29 +473,27 @@ COutputQueue::NewSegment(
             m_pPin->NewSegment(tStart, tStop, dRate);
         }
     } else {
-        if (m_hr == S_OK) {
-            //
-            // we need to queue the new segment to appear in order in the
-            // data, but we need to pass parameters to it. Rather than
-            // take the hit of wrapping every single sample so we can tell
-            // special ones apart, we queue special pointers to indicate
-            // special packets, and we guarantee (by holding the
-            // critical section) that the packet immediately following a
-            // NEW_SEGMENT value is a NewSegmentPacket containing the
-            // parameters.
-            NewSegmentPacket * ppack = new NewSegmentPacket;
-            if (ppack == NULL) {
+        LONG lGeneration;
+        {
+            CAutoLock lck(this);
+            if (m_hr != S_OK) {
                 return;
             }
-            ppack->tStart = tStart;
-            ppack->tStop = tStop;
-            ppack->dRate = dRate;
-
-            CAutoLock lck(this);
-            QueueSample(NEW_SEGMENT);
-            QueueSample( (IMediaSample*) ppack);
-            NotifyThread();
+            lGeneration = m_lFlushGeneration;
         }
+
+        //
+        // we need to queue the new segment to appear in order in the
+        // data, but we need to pass parameters to it. The special
+        // NEW_SEGMENT pointer is queued in the same ring slot as its
+        // parameters.
+        NewSegmentPacket pack;
+        pack.tStart = tStart;
+        pack.tStop = tStop;
+        pack.dRate = dRate;
+
+        QueueSample(NEW_SEGMENT, lGeneration, &pack);
+        NotifyThread();
     }
 }
 
@@ -435,8 +503,8 @@ COutputQueue::NewSegment(
 //
 void COutputQueue::EOS()
 {
-    CAutoLock lck(this);
     if (!IsQueued()) {
+        CAutoLock lck(this);
         if (m_bBatchExact) {
             SendAnyway();
         }
@@ -449,11 +517,17 @@ void COutputQueue::EOS()
             }
         }
     } else {
-        if (m_hr == S_OK) {
+        LONG lGeneration;
+        {
+            CAutoLock lck(this);
+            if (m_hr != S_OK) {
+                return;
+            }
             m_bFlushed = FALSE;
-            QueueSample(EOS_PACKET);
-            NotifyThread();
+            lGeneration = m_lFlushGeneration;
         }
+        QueueSample(EOS_PACKET, lGeneration);
+        NotifyThread();
     }
 }
 
@@ -473,6 +547,11 @@ void COutputQueue::BeginFlush()
 
             m_bFlushing = TRUE;
 
+            //  Packets queued by producers that are still on their way
+            //  into the ring belong to the data being flushed
+
+            m_lFlushGeneration++;
+
             //  Make sure we discard all samples from now on
 
             if (m_hr == S_OK) {
@@ -550,20 +629,159 @@ void COutputQueue::EndFlush()
     m_hr = S_OK;
 }
 
+//  The queue ring
+//
+//  Packets are passed to the thread through a bounded ring of QueueSlots.
+//  Any number of threads may queue packets without holding the critical
+//  section; only the thread removes them.  Each slot carries a sequence
+//  number: slot (pos % m_lRingSize) is free for the producer at position
+//  pos when its sequence is pos, holds a packet when it is pos + 1 and is
+//  free for the next round when it is pos + m_lRingSize.
+//
+//  A producer claims a position by advancing m_lTail, fills the slot and
+//  then publishes it by setting the sequence.  The order of the packets
+//  is the order in which the positions were claimed.
+//
+//  Producers check m_hr under the critical section but queue without it,
+//  so BeginFlush can run in between.  Each packet therefore carries the
+//  flush generation the producer saw, and the thread drops packets of an
+//  older generation instead of delivering them after the flush.
+
+//  COutputQueue::TryQueueSample
+//
+//  Put a packet on the ring.  Returns FALSE if the ring is full
+
+BOOL COutputQueue::TryQueueSample(IMediaSample *pSample, LONG lGeneration,
+                                  __in_opt const NewSegmentPacket *pSegment)
+{
+    LONG lBytes = 0;
+    if (m_bAdaptiveBatch && !IsSpecialSample(pSample)) {
+        lBytes = pSample->GetActualDataLength();
+    }
+
+    LONG pos = m_lTail;
+    QueueSlot *pSlot;
+
+    while (TRUE) {
+        pSlot = &m_pRing[pos & (m_lRingSize - 1)];
+        LONG diff = pSlot->lSequence - pos;
+
+        if (diff == 0) {
+            //  The slot is free - try to claim it
+            LONG prev = InterlockedCompareExchange(&m_lTail, pos + 1, pos);
+            if (prev == pos) {
+                break;
+            }
+            pos = prev;
+        } else if (diff < 0) {
+            //  The thread has not taken the packet of the last round yet
+            return FALSE;
+        } else {
+            //  Another producer got there first
+            pos = m_lTail;
+        }
+    }
+
+    pSlot->pSample = pSample;
+    if (pSegment) {
+        pSlot->Segment = *pSegment;
+    }
+    pSlot->lBytes = lBytes;
+    pSlot->dwQueued = timeGetTime();
+    pSlot->lGeneration = lGeneration;
+    if (lBytes) {
+        InterlockedExchangeAdd(&m_lQueuedBytes, lBytes);
+    }
+
+    //  Publish the packet (full barrier)
+    InterlockedExchange(&pSlot->lSequence, pos + 1);
+    return TRUE;
+}
+
+//  COutputQueue::RemoveHead
+//
+//  Take the next packet off the ring - only called by the thread (or when
+//  there is no thread any more).  Returns NULL if the ring is empty,
+//  otherwise the packet's sample and, in pPacket, a copy of its slot
+
+IMediaSample *COutputQueue::RemoveHead(__out_opt QueueSlot *pPacket)
+{
+    LONG pos = m_lHead;
+    QueueSlot *pSlot = &m_pRing[pos & (m_lRingSize - 1)];
+
+    if (pSlot->lSequence != pos + 1) {
+        return NULL;
+    }
+    MemoryBarrier();
+
+    IMediaSample *pSample = pSlot->pSample;
+    if (pPacket) {
+        pPacket->pSample = pSample;
+        if (pSample == NEW_SEGMENT) {
+            pPacket->Segment = pSlot->Segment;
+        }
+        pPacket->lBytes = pSlot->lBytes;
+        pPacket->dwQueued = pSlot->dwQueued;
+        pPacket->lGeneration = pSlot->lGeneration;
+    }
+
+    //  The bytes leave the ring - the thread adds them to the batch or
+    //  drops the sample
+    if (pSlot->lBytes) {
+        InterlockedExchangeAdd(&m_lQueuedBytes, -pSlot->lBytes);
+    }
+
+    //  Hand the slot back to the producers for the next round
+    InterlockedExchange(&pSlot->lSequence, pos + m_lRingSize);
+    InterlockedExchange(&m_lHead, pos + 1);
+
+    //  Let a producer waiting for space try again
+    if (m_lProducersWaiting) {
+        LONG lWaiting = InterlockedExchange(&m_lProducersWaiting, 0);
+        if (lWaiting) {
+            ReleaseSemaphore(m_hSemSpace, lWaiting, NULL);
+        }
+    }
+    return pSample;
+}
+
 //  COutputQueue::QueueSample
 //
 //  private method to Send a sample to the output queue
-//  The critical section MUST be held when this is called
+//  The critical section must NOT be held when this is called, because
+//  we may have to wait for the thread to make room
 
-void COutputQueue::QueueSample(IMediaSample *pSample)
+void COutputQueue::QueueSample(IMediaSample *pSample, LONG lGeneration,
+                               __in_opt const NewSegmentPacket *pSegment)
 {
-    if (NULL == m_List->AddTail(pSample)) {
-        if (!IsSpecialSample(pSample)) {
-            pSample->Release();
+    while (!TryQueueSample(pSample, lGeneration, pSegment)) {
+
+        //  The ring is full.  Announce that we are waiting and try once
+        //  more in case the thread made room before it saw us.  A surplus
+        //  count on the semaphore only costs an extra round trip
+
+        InterlockedIncrement(&m_lProducersWaiting);
+        if (TryQueueSample(pSample, lGeneration, pSegment)) {
+            break;
         }
+        NotifyThread();
+        DbgWaitForSingleObject(m_hSemSpace);
     }
 }
 
+//  COutputQueue::IsStalePacket
+//
+//  Samples, EOS and NEW_SEGMENT packets queued before the last BeginFlush
+//  are dropped.  SEND_PACKET and RESET_PACKET are always processed
+
+BOOL COutputQueue::IsStalePacket(const QueueSlot &Packet)
+{
+    if (Packet.pSample == SEND_PACKET || Packet.pSample == RESET_PACKET) {
+        return FALSE;
+    }
+    return Packet.lGeneration != m_lFlushGeneration;
+}
+
 //
 //  COutputQueue::Receive()
 //
@@ -572,6 +790,10 @@ void COutputQueue::QueueSample(IMediaSample *pSample)
 //
 //  On return the sample will have been Release()'d
 //
+//  If we have a thread this blocks while the queue ring is full, so a
+//  slow downstream pin throttles the caller instead of letting the queue
+//  grow without limit
+//
 
 HRESULT COutputQueue::Receive(IMediaSample *pSample)
 {
@@ -590,6 +812,8 @@ HRESULT COutputQueue::Receive(IMediaSample *pSample)
 //
 //  On return all samples will have been Release()'d
 //
+//  Like Receive this blocks while the queue ring is full
+//
 
 HRESULT COutputQueue::ReceiveMultiple (
     __in_ecount(nSamples) IMediaSample **ppSamples,
@@ -600,10 +824,10 @@ HRESULT COutputQueue::ReceiveMultiple (
         return E_INVALIDARG;
     }
     
-    CAutoLock lck(this);
     //  Either call directly or queue up the samples
 
     if (!IsQueued()) {
+        CAutoLock lck(this);
 
         //  If we already had a bad return code then just return
 
@@ -657,6 +881,8 @@ HRESULT COutputQueue::ReceiveMultiple (
                     m_hr = m_pInputPin->ReceiveMultiple(m_ppSamples,
                                                         m_nBatched,
                                                         &nDone);
+                    m_lBatchesSent++;
+                    m_lSamplesSent += m_nBatched;
                 } else {
                     nDone = 0;
                 }
@@ -673,24 +899,46 @@ HRESULT COutputQueue::ReceiveMultiple (
         }
         return m_hr;
     } else {
-        /*  We're sending to our thread */
+        /*  We're sending to our thread.  Check the return code and
+            remember the flush generation under the lock, but don't hold
+            it for the ring - QueueSample may have to wait for room */
 
-        if (m_hr != S_OK) {
-            *nSamplesProcessed = 0;
-            DbgLog((LOG_TRACE, 3, TEXT("COutputQueue (queued) : Discarding %d samples code 0x%8.8X"),
-                    nSamples, m_hr));
-            for (int i = 0; i < nSamples; i++) {
-                ppSamples[i]->Release();
+        LONG lGeneration;
+        {
+            CAutoLock lck(this);
+            if (m_hr != S_OK) {
+                HRESULT hr = m_hr;
+                *nSamplesProcessed = 0;
+                DbgLog((LOG_TRACE, 3, TEXT("COutputQueue (queued) : Discarding %d samples code 0x%8.8X"),
+                        nSamples, hr));
+                for (int i = 0; i < nSamples; i++) {
+                    ppSamples[i]->Release();
+                }
+                return hr;
             }
-            return m_hr;
+            m_bFlushed = FALSE;
+            lGeneration = m_lFlushGeneration;
         }
-        m_bFlushed = FALSE;
         for (long i = 0; i < nSamples; i++) {
-            QueueSample(ppSamples[i]);
+            QueueSample(ppSamples[i], lGeneration);
         }
         *nSamplesProcessed = nSamples;
-        if (!m_bBatchExact ||
-            m_nBatched + m_List->GetCount() >= m_lBatchSize) {
+
+        //  While the thread is parked it does not touch m_nBatched or
+        //  m_lBatchBytes, so the counts are exact when it matters.  With
+        //  adaptive batching the age limit only runs for samples the
+        //  thread has taken into its batch, so it is woken for the first
+        //  sample of a batch; it then parks until that sample is due
+
+        if (m_bAdaptiveBatch) {
+            if (m_nBatched == 0 && m_dwMaxBatchDelay != INFINITE ||
+                m_nBatched + QueuedCount() >= m_lBatchSize ||
+                m_lMaxBatchBytes != 0 &&
+                m_lBatchBytes + m_lQueuedBytes >= m_lMaxBatchBytes) {
+                NotifyThread();
+            }
+        } else if (!m_bBatchExact ||
+            m_nBatched + QueuedCount() >= m_lBatchSize) {
             NotifyThread();
         }
         return S_OK;
@@ -703,11 +951,8 @@ void COutputQueue::Reset()
     if (!IsQueued()) {
         m_hr = S_OK;
     } else {
-        {
-            CAutoLock lck(this);
-            QueueSample(RESET_PACKET);
-            NotifyThread();
-        }
+        QueueSample(RESET_PACKET, 0);
+        NotifyThread();
         m_evFlushComplete.Wait();
     }
 }
@@ -718,7 +963,7 @@ void COutputQueue::FreeSamples()
     CAutoLock lck(this);
     if (IsQueued()) {
         while (TRUE) {
-            IMediaSample *pSample = m_List->RemoveHead();
+            IMediaSample *pSample = RemoveHead(NULL);
 	    // inform derived class we took something off the queue
 	    if (m_hEventPop) {
                 //DbgLog((LOG_TRACE,3,TEXT("Queue: Delivered  SET EVENT")));
@@ -730,20 +975,6 @@ void COutputQueue::FreeSamples()
             }
             if (!IsSpecialSample(pSample)) {
                 pSample->Release();
-            } else {
-                if (pSample == NEW_SEGMENT) {
-                    //  Free NEW_SEGMENT packet
-                    NewSegmentPacket *ppacket =
-                        (NewSegmentPacket *) m_List->RemoveHead();
-		    // inform derived class we took something off the queue
-		    if (m_hEventPop) {
-                        //DbgLog((LOG_TRACE,3,TEXT("Queue: Delivered  SET EVENT")));
-		        SetEvent(m_hEventPop);
-		    }
-
-                    ASSERT(ppacket != NULL);
-                    delete ppacket;
-                }
             }
         }
     }
@@ -751,18 +982,19 @@ void COutputQueue::FreeSamples()
         m_ppSamples[i]->Release();
     }
     m_nBatched = 0;
+    m_lBatchBytes = 0;
 }
 
 //  Notify the thread if there is something to do
 //
-//  The critical section MUST be held when this is called
+//  May be called with or without the critical section
 void COutputQueue::NotifyThread()
 {
-    //  Optimize - no need to signal if it's not waiting
+    //  Optimize - no need to signal if it's not waiting.  Only the
+    //  caller that clears m_lWaiting releases the semaphore
     ASSERT(IsQueued());
-    if (m_lWaiting) {
-        ReleaseSemaphore(m_hSem, m_lWaiting, NULL);
-        m_lWaiting = 0;
+    if (m_lWaiting && InterlockedExchange(&m_lWaiting, 0)) {
+        ReleaseSemaphore(m_hSem, 1, NULL);
     }
 }
 
@@ -779,17 +1011,13 @@ BOOL COutputQueue::IsIdle()
     //  We're idle if
     //      there is no thread (!IsQueued()) OR
     //      the thread is waiting for more work  (m_lWaiting != 0)
+    //      and nothing has been queued since
     //  AND
     //      there's nothing in the current batch (m_nBatched == 0)
 
-    if (IsQueued() && m_lWaiting == 0 || m_nBatched != 0) {
+    if (IsQueued() && (m_lWaiting == 0 || QueuedCount() != 0) || m_nBatched != 0) {
         return FALSE;
     } else {
-
-        //  If we're idle it shouldn't be possible for there
-        //  to be anything on the work queue
-
-        ASSERT(!IsQueued() || m_List->GetCount() == 0);
         return TRUE;
     }
 }
@@ -799,3 +1027,55 @@ void COutputQueue::SetPopEvent(HANDLE hEvent)
 {
     m_hEventPop = hEvent;
 }
+
+//  Adaptive batching
+//
+//  Batch by size and age instead of by a fixed number of samples, so
+//  that small samples (audio, subtitles) are sent together without
+//  holding them back for long
+HRESULT COutputQueue::SetBatchPolicy(LONG lMaxBytes, DWORD dwMaxDelay)
+{
+    if (lMaxBytes < 0) {
+        return E_INVALIDARG;
+    }
+
+    //  Without a thread nobody could send an aged batch
+    if (!IsQueued()) {
+        return E_UNEXPECTED;
+    }
+
+    CAutoLock lck(this);
+    m_lMaxBatchBytes = lMaxBytes;
+    m_dwMaxBatchDelay = dwMaxDelay;
+    m_bAdaptiveBatch = TRUE;
+
+    //  The thread may have to send or wait differently now
+    NotifyThread();
+    return S_OK;
+}
+
+//  Is the current batch due to be sent?
+//
+//  The critical section MUST be held when this is called
+BOOL COutputQueue::IsBatchDue()
+{
+    if (!m_bAdaptiveBatch || m_nBatched == 0) {
+        return FALSE;
+    }
+    if (m_lMaxBatchBytes != 0 && m_lBatchBytes >= m_lMaxBatchBytes) {
+        return TRUE;
+    }
+    return m_dwMaxBatchDelay != INFINITE &&
+           timeGetTime() - m_dwBatchStart >= m_dwMaxBatchDelay;
+}
+
+void COutputQueue::GetBatchStatistics(
+    __out LONG *plBatches,
+    __out LONG *plSamples,
+    __out DWORD *pdwAvgDelay)
+{
+    CAutoLock lck(this);
+    *plBatches = m_lBatchesSent;
+    *plSamples = m_lSamplesSent;
+    *pdwAvgDelay = m_lBatchesSent ? (DWORD)(m_llBatchDelay / m_lBatchesSent) : 0;
+}
@@ -46,6 +46,8 @@ public:
             REFERENCE_TIME tStop,
             double dRate);
 
+    // With a thread, Receive and ReceiveMultiple block while the queue
+    // ring is full until the thread has made room
     HRESULT Receive(IMediaSample *pSample);
 
     // do something with these media samples
@@ -62,22 +64,36 @@ public:
     // give the class an event to fire after everything removed from the queue
     void SetPopEvent(HANDLE hEvent);
 
+    // adaptive batching (only if we have a thread) - send the batch as
+    // soon as it holds lMaxBytes bytes (0 = no limit) or its oldest sample
+    // has been queued for dwMaxDelay ms (INFINITE = no limit), or when
+    // it holds lBatchSize samples.  Replaces the bBatchExact behaviour
+    HRESULT SetBatchPolicy(LONG lMaxBytes, DWORD dwMaxDelay);
+
+    // batches and samples sent downstream so far, and the average time
+    // the oldest sample of a batch was queued (ms)
+    void GetBatchStatistics(
+            __out LONG *plBatches,
+            __out LONG *plSamples,
+            __out DWORD *pdwAvgDelay);
+
 protected:
     static DWORD WINAPI InitialThreadProc(__in LPVOID pv);
     DWORD ThreadProc();
     BOOL  IsQueued()
     {
-        return m_List != NULL;
+        return m_pRing != NULL;
     };
 
-    //  The critical section MUST be held when this is called
-    void QueueSample(IMediaSample *pSample);
-
     BOOL IsSpecialSample(IMediaSample *pSample)
     {
         return (DWORD_PTR)pSample > (DWORD_PTR)(LONG_PTR)(-16);
     };
 
+    //  Adaptive batching - is the current batch due to be sent?
+    //  The critical section MUST be held when this is called
+    BOOL IsBatchDue();
+
     //  Remove and Release() batched and queued samples
     void FreeSamples();
 
@@ -92,31 +108,74 @@ protected:
     #define RESET_PACKET     ((IMediaSample *)(LONG_PTR)(-4))  // Reset m_hr
     #define NEW_SEGMENT      ((IMediaSample *)(LONG_PTR)(-5))  // send NewSegment
 
-    // new segment packet is always followed by one of these
+    // parameters of a NEW_SEGMENT packet
     struct NewSegmentPacket {
         REFERENCE_TIME tStart;
         REFERENCE_TIME tStop;
         double dRate;
     };
 
+    // one slot of the queue ring.  pSample is a sample or one of the
+    // special packets above, NEW_SEGMENT carries its parameters in the
+    // slot so no extra allocation is needed
+    struct QueueSlot {
+        LONG volatile    lSequence;     // see RemoveHead
+        IMediaSample   * pSample;
+        NewSegmentPacket Segment;
+        LONG             lBytes;        // sample size (adaptive batching)
+        DWORD            dwQueued;      // timeGetTime() when queued
+        LONG             lGeneration;   // m_lFlushGeneration when queued
+    };
+
+    //  Queue a sample or a special packet for the thread.  Does not need
+    //  the critical section; blocks while the queue is full.  lGeneration
+    //  is the flush generation the producer saw when it checked m_hr
+    void QueueSample(IMediaSample *pSample, LONG lGeneration,
+                     __in_opt const NewSegmentPacket *pSegment = NULL);
+
+    //  Lock-free ring operations - see the comment in outputq.cpp
+    BOOL TryQueueSample(IMediaSample *pSample, LONG lGeneration,
+                        __in_opt const NewSegmentPacket *pSegment);
+    IMediaSample *RemoveHead(__out_opt QueueSlot *pPacket);
+
+    //  Is a packet from before the last BeginFlush?  The critical section
+    //  MUST be held when this is called
+    BOOL IsStalePacket(const QueueSlot &Packet);
+    LONG QueuedCount()
+    {
+        return m_lTail - m_lHead;
+    };
+
     // Remember input stuff
     IPin          * const m_pPin;
     IMemInputPin  *       m_pInputPin;
     BOOL            const m_bBatchExact;
     LONG            const m_lBatchSize;
 
-    CSampleList   *       m_List;
+    //  Bounded ring of queued packets (multiple producers, the thread
+    //  is the only consumer)
+    QueueSlot     *       m_pRing;
+    LONG                  m_lRingSize;      // power of 2
+    LONG volatile         m_lTail;          // next slot to be claimed
+    LONG volatile         m_lHead;          // next slot the thread reads
     HANDLE                m_hSem;
+    HANDLE                m_hSemSpace;      // producers wait here if full
+    LONG volatile         m_lProducersWaiting;
     CAMEvent                m_evFlushComplete;
     HANDLE                m_hThread;
     __field_ecount_opt(m_lBatchSize) IMediaSample  **      m_ppSamples;
     __range(0, m_lBatchSize)         LONG                  m_nBatched;
 
-    //  Wait optimization
-    LONG                  m_lWaiting;
+    //  Wait optimization - thread is parked on m_hSem
+    LONG volatile         m_lWaiting;
     //  Flush synchronization
     BOOL                  m_bFlushing;
 
+    //  Incremented by BeginFlush.  Producers check m_hr and read the
+    //  generation under the critical section, then queue without it, so
+    //  the thread drops packets that were queued for an older generation
+    LONG                  m_lFlushGeneration;
+
     // flushing optimization. some downstream filters have trouble
     // with the queue's flushing optimization. other rely on it
     BOOL                  m_bFlushed;
@@ -131,6 +190,19 @@ protected:
     //  Deferred 'return code'
     HRESULT volatile         m_hr;
 
+    //  Adaptive batching
+    BOOL                  m_bAdaptiveBatch;
+    LONG                  m_lMaxBatchBytes;
+    DWORD                 m_dwMaxBatchDelay;
+    LONG                  m_lBatchBytes;    // bytes in the current batch
+    DWORD                 m_dwBatchStart;   // when its oldest sample was queued
+    LONG volatile         m_lQueuedBytes;   // bytes on the ring
+
+    //  Batching statistics
+    LONG                  m_lBatchesSent;
+    LONG                  m_lSamplesSent;
+    LONGLONG              m_llBatchDelay;   // sum of the batch delays (ms)
+
     // an event that can be fired after every deliver
     HANDLE m_hEventPop;
 };
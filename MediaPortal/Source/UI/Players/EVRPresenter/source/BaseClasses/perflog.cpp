@@ -30,6 +30,12 @@ PerflogCallback (
     __in PVOID Buffer
     );
 
+VOID
+PerflogSinkTraceEvent (
+    ULONG Level,
+    __in PEVENT_TRACE_HEADER Event
+    );
+
 //
 // Event tracing function pointers.
 // We have to do this to run on down-level platforms.
@@ -109,6 +115,24 @@ void (*OnStateChanged)(void);
 TRACEHANDLE PerflogTraceHandle=NULL;
 TRACEHANDLE PerflogRegHandle;
 
+//
+// Trace sink state. PerflogSinkWriters counts the threads that are
+// writing a record, so PerflogSinkStop() knows when it may free the ring.
+//
+
+volatile LONG PerflogSinkActive = 0;
+ULONG PerflogSinkFlags = 0;
+PPERFLOG_SINK_RECORD PerflogSinkRecords = NULL;
+ULONG PerflogSinkCapacity = 0;
+volatile LONGLONG PerflogSinkWriteIndex = 0;
+volatile LONG PerflogSinkWriters = 0;
+LONGLONG PerflogSinkStartCounter = 0;
+
+C_ASSERT(sizeof(PERFLOG_SINK_RECORD) == 128);
+
+// Size of the text buffer PerflogSinkSave() fills before each WriteFile
+const INT iSINKBUFFER = 64 * 1024;
+
 // The Win32 wsprintf() function writes a maximum of 1024 characters to it's output buffer.
 // See the documentation for wsprintf()'s lpOut parameter for more information.
 const INT iDEBUGINFO = 1024; // Used to format strings
@@ -258,6 +282,8 @@ PerflogShutdown (
     VOID
     )
 {
+    PerflogSinkStop ();
+
     if (!EventTracingAvailable) {
         return;
     }
@@ -324,7 +350,11 @@ PerflogTraceEvent (
     __in PEVENT_TRACE_HEADER Event
     )
 {
-    if (!EventTracingAvailable) {
+    if (PerflogSinkEnabled()) {
+        PerflogSinkTraceEvent (0, Event);
+    }
+
+    if (!EventTracingAvailable || PerflogTraceHandle == NULL) {
         return;
     }
 
@@ -337,11 +367,415 @@ PerflogTraceEventLevel(
     __in PEVENT_TRACE_HEADER Event
     )
 {
-    if ((!EventTracingAvailable) || (Level <= PerflogModuleLevel)) {
+    if (PerflogSinkEnabled()) {
+        PerflogSinkTraceEvent (Level, Event);
+    }
+
+    if ((!EventTracingAvailable) || (PerflogTraceHandle == NULL) ||
+        (Level <= PerflogModuleLevel)) {
         return;
     }
 
     _TraceEvent (PerflogTraceHandle, Event);
 }
 
+//
+// Trace sink.
+//
+// Records are claimed by an interlocked increment of the write index and
+// written to slot (index % capacity). Start, stop and save are meant to be
+// called from one controlling thread; events may come from any thread. A
+// slot's Sequence is cleared while it is being written and set to index + 1
+// when it is complete, so the saver can skip records that are being
+// overwritten.
+//
+
+BOOL
+PerflogSinkStart (
+    ULONG Capacity,
+    ULONG EnableFlags
+    )
+{
+    LARGE_INTEGER Counter;
+    ULONG RoundedCapacity;
+
+    PerflogSinkStop ();
+
+    //
+    // The capacity is rounded up to a power of two so the slot can be
+    // found with a mask.
+    //
+
+    if (Capacity == 0 || Capacity > 0x100000) {
+        return FALSE;
+    }
+
+    for (RoundedCapacity = 1; RoundedCapacity < Capacity; RoundedCapacity <<= 1) {
+    }
+
+    PerflogSinkRecords = (PPERFLOG_SINK_RECORD) VirtualAlloc (
+        NULL,
+        RoundedCapacity * sizeof(PERFLOG_SINK_RECORD),
+        MEM_COMMIT | MEM_RESERVE,
+        PAGE_READWRITE);
+
+    if (PerflogSinkRecords == NULL) {
+        return FALSE;
+    }
+
+    QueryPerformanceCounter (&Counter);
+
+    PerflogSinkCapacity = RoundedCapacity;
+    PerflogSinkWriteIndex = 0;
+    PerflogSinkStartCounter = Counter.QuadPart;
+    PerflogSinkFlags = EnableFlags;
+
+    InterlockedExchange (&PerflogSinkActive, 1);
+    return TRUE;
+}
+
+VOID
+PerflogSinkStop (
+    VOID
+    )
+{
+    if (PerflogSinkRecords == NULL) {
+        return;
+    }
+
+    PerflogSinkFlags = 0;
+    InterlockedExchange (&PerflogSinkActive, 0);
+
+    //
+    // Wait for the writers that saw the sink enabled before we freed it.
+    //
+
+    while (PerflogSinkWriters != 0) {
+        Sleep (0);
+    }
+
+    VirtualFree (PerflogSinkRecords, 0, MEM_RELEASE);
+    PerflogSinkRecords = NULL;
+    PerflogSinkCapacity = 0;
+}
+
+//
+// Claims the next slot, or returns NULL if the sink has been stopped.
+// Every successful call must be paired with PerflogSinkCommit().
+//
+
+PPERFLOG_SINK_RECORD
+PerflogSinkClaim (
+    LONGLONG* Index
+    )
+{
+    PPERFLOG_SINK_RECORD Record;
+    LARGE_INTEGER Counter;
+
+    InterlockedIncrement (&PerflogSinkWriters);
+    if (!PerflogSinkEnabled()) {
+        InterlockedDecrement (&PerflogSinkWriters);
+        return NULL;
+    }
+
+    QueryPerformanceCounter (&Counter);
+
+    *Index = InterlockedIncrement64 (&PerflogSinkWriteIndex) - 1;
+    Record = &PerflogSinkRecords[*Index & (PerflogSinkCapacity - 1)];
+
+    Record->Sequence = 0;
+    MemoryBarrier ();
+
+    Record->Timestamp = Counter.QuadPart;
+    Record->ThreadId = GetCurrentThreadId ();
+    Record->Reserved = 0;
+    return Record;
+}
+
+VOID
+PerflogSinkCommit (
+    __in PPERFLOG_SINK_RECORD Record,
+    LONGLONG Index
+    )
+{
+    MemoryBarrier ();
+    Record->Sequence = (LONG) (Index + 1);
+    InterlockedDecrement (&PerflogSinkWriters);
+}
+
+VOID
+PerflogSinkTraceEvent (
+    ULONG Level,
+    __in PEVENT_TRACE_HEADER Event
+    )
+{
+    LONGLONG Index;
+    ULONG DataSize;
+    PPERFLOG_SINK_RECORD Record = PerflogSinkClaim (&Index);
+
+    if (Record == NULL) {
+        return;
+    }
+
+    DataSize = 0;
+    if (Event->Size > sizeof(EVENT_TRACE_HEADER)) {
+        DataSize = (ULONG) min(Event->Size - sizeof(EVENT_TRACE_HEADER),
+                               PERFLOG_SINK_MAX_DATA);
+    }
+
+    Record->Level = Level;
+    Record->Phase = 'i';
+    Record->DataSize = (UCHAR) DataSize;
+    if (Event->Flags & WNODE_FLAG_USE_GUID_PTR) {
+        Record->Guid = *(LPGUID) (ULONG_PTR) Event->GuidPtr;
+    } else {
+        Record->Guid = Event->Guid;
+    }
+    Record->Id = 0;
+    Record->Name[0] = '\0';
+    CopyMemory (Record->Data, (BYTE*) Event + sizeof(EVENT_TRACE_HEADER), DataSize);
+
+    PerflogSinkCommit (Record, Index);
+}
+
+VOID
+PerflogSinkMark (
+    __in LPCSTR Name,
+    CHAR Phase,
+    ULONGLONG Id,
+    LONGLONG Value
+    )
+{
+    LONGLONG Index;
+    PPERFLOG_SINK_RECORD Record = PerflogSinkClaim (&Index);
+
+    if (Record == NULL) {
+        return;
+    }
+
+    Record->Level = 0;
+    Record->Phase = Phase;
+    Record->DataSize = sizeof(Value);
+    Record->Guid = GUID_NULL;
+    Record->Id = Id;
+    (void)StringCchCopyA (Record->Name, NUMELMS(Record->Name), Name);
+    CopyMemory (Record->Data, &Value, sizeof(Value));
+
+    PerflogSinkCommit (Record, Index);
+}
+
+//
+// Appends formatted text to the save buffer, flushing it to the file
+// when it is nearly full.
+//
+
+HRESULT
+PerflogSinkPrint (
+    HANDLE hFile,
+    __inout_ecount(iSINKBUFFER) LPSTR Buffer,
+    __inout INT* Used,
+    __in LPCSTR Format,
+    ...
+    )
+{
+    va_list va;
+    DWORD dwWritten;
+    HRESULT hr;
+
+    if (*Used > iSINKBUFFER - 1024) {
+        if (!WriteFile (hFile, Buffer, *Used, &dwWritten, NULL)) {
+            return HRESULT_FROM_WIN32 (GetLastError ());
+        }
+        *Used = 0;
+    }
+
+    va_start (va, Format);
+    hr = StringCchVPrintfA (Buffer + *Used, iSINKBUFFER - *Used, Format, va);
+    va_end (va);
+
+    *Used += lstrlenA (Buffer + *Used);
+    return hr;
+}
+
+HRESULT
+PerflogSinkSaveJson (
+    HANDLE hFile,
+    __in_ecount(Count) PPERFLOG_SINK_RECORD Records,
+    ULONG Count,
+    LONGLONG Frequency
+    )
+{
+    LPSTR Buffer;
+    INT Used = 0;
+    DWORD dwWritten;
+    DWORD ProcessId = GetCurrentProcessId ();
+    HRESULT hr;
+
+    Buffer = new CHAR[iSINKBUFFER];
+    if (Buffer == NULL) {
+        return E_OUTOFMEMORY;
+    }
+
+    hr = PerflogSinkPrint (hFile, Buffer, &Used, "{\"traceEvents\":[\n");
+
+    for (ULONG i = 0; i < Count && SUCCEEDED(hr); i++) {
+        PPERFLOG_SINK_RECORD Record = &Records[i];
+        LONGLONG Time = llMulDiv (Record->Timestamp - PerflogSinkStartCounter,
+                                  10000000, Frequency, 0);
+
+        hr = PerflogSinkPrint (hFile, Buffer, &Used,
+            "%s{\"pid\":%u,\"tid\":%u,\"ts\":%I64d.%d,\"ph\":\"%c\",",
+            i ? ",\n" : "", ProcessId, Record->ThreadId,
+            Time / 10, (INT) (Time % 10), Record->Phase);
+        if (FAILED(hr)) {
+            break;
+        }
+
+        if (Record->Name[0] != '\0') {
+            LONGLONG Value;
+            CopyMemory (&Value, Record->Data, sizeof(Value));
+
+            //
+            // A counter is shown per object, so the object is part of its
+            // name; other marks carry the object and value as arguments.
+            //
+
+            if (Record->Phase == 'C') {
+                hr = PerflogSinkPrint (hFile, Buffer, &Used,
+                    "\"cat\":\"dshow\",\"name\":\"%s %I64X\",\"args\":{\"value\":%I64d}}",
+                    Record->Name, Record->Id, Value);
+            } else {
+                hr = PerflogSinkPrint (hFile, Buffer, &Used,
+                    "\"cat\":\"dshow\",\"name\":\"%s\",%s"
+                    "\"args\":{\"id\":\"0x%I64X\",\"value\":%I64d}}",
+                    Record->Name, Record->Phase == 'i' ? "\"s\":\"t\"," : "",
+                    Record->Id, Value);
+            }
+        } else {
+            const GUID& g = Record->Guid;
+            hr = PerflogSinkPrint (hFile, Buffer, &Used,
+                "\"cat\":\"etw\",\"s\":\"t\","
+                "\"name\":\"{%08lX-%04X-%04X-%02X%02X-%02X%02X%02X%02X%02X%02X}\","
+                "\"args\":{\"level\":%u",
+                g.Data1, g.Data2, g.Data3, g.Data4[0], g.Data4[1], g.Data4[2],
+                g.Data4[3], g.Data4[4], g.Data4[5], g.Data4[6], g.Data4[7],
+                Record->Level);
+
+            //
+            // The payload layout depends on the GUID; show it as 64 bit words
+            //
+
+            for (ULONG Offset = 0;
+                 Offset < Record->DataSize && SUCCEEDED(hr);
+                 Offset += sizeof(ULONGLONG)) {
+                ULONGLONG Word = 0;
+                CopyMemory (&Word, Record->Data + Offset,
+                            min(sizeof(Word), (ULONG) Record->DataSize - Offset));
+                hr = PerflogSinkPrint (hFile, Buffer, &Used, ",\"d%u\":\"0x%I64X\"",
+                    Offset / sizeof(ULONGLONG), Word);
+            }
+            if (SUCCEEDED(hr)) {
+                hr = PerflogSinkPrint (hFile, Buffer, &Used, "}}");
+            }
+        }
+    }
+
+    if (SUCCEEDED(hr)) {
+        hr = PerflogSinkPrint (hFile, Buffer, &Used, "\n]}\n");
+    }
+    if (SUCCEEDED(hr) && Used > 0) {
+        if (!WriteFile (hFile, Buffer, Used, &dwWritten, NULL)) {
+            hr = HRESULT_FROM_WIN32 (GetLastError ());
+        }
+    }
+
+    delete[] Buffer;
+    return hr;
+}
+
+HRESULT
+PerflogSinkSave (
+    HANDLE hFile,
+    PERFLOG_SINK_FORMAT Format
+    )
+{
+    PERFLOG_SINK_FILE_HEADER Header;
+    PPERFLOG_SINK_RECORD Records;
+    LARGE_INTEGER Frequency;
+    LONGLONG First, Last;
+    ULONG Count = 0;
+    DWORD dwWritten;
+    HRESULT hr = S_OK;
+
+    if (hFile == NULL || hFile == INVALID_HANDLE_VALUE) {
+        return E_INVALIDARG;
+    }
+
+    //
+    // Keep the ring alive while we copy it
+    //
+
+    InterlockedIncrement (&PerflogSinkWriters);
+    if (!PerflogSinkEnabled()) {
+        InterlockedDecrement (&PerflogSinkWriters);
+        return E_UNEXPECTED;
+    }
+
+    Last = PerflogSinkWriteIndex;
+    First = max(Last - (LONGLONG) PerflogSinkCapacity, 0);
+
+    Records = new PERFLOG_SINK_RECORD[(ULONG) (Last - First) + 1];
+    if (Records == NULL) {
+        InterlockedDecrement (&PerflogSinkWriters);
+        return E_OUTOFMEMORY;
+    }
+
+    //
+    // Copy the complete records, oldest first. A record that changes while
+    // we copy it is being overwritten and is dropped.
+    //
+
+    for (LONGLONG Index = First; Index < Last; Index++) {
+        const PERFLOG_SINK_RECORD* Slot =
+            &PerflogSinkRecords[Index & (PerflogSinkCapacity - 1)];
+        if (Slot->Sequence != (LONG) (Index + 1)) {
+            continue;
+        }
+        MemoryBarrier ();
+        CopyMemory (&Records[Count], (const void*) Slot, sizeof(PERFLOG_SINK_RECORD));
+        MemoryBarrier ();
+        if (Slot->Sequence == (LONG) (Index + 1)) {
+            Count++;
+        }
+    }
+
+    InterlockedDecrement (&PerflogSinkWriters);
+
+    QueryPerformanceFrequency (&Frequency);
+
+    if (Format == PERFLOG_SINK_JSON) {
+        hr = PerflogSinkSaveJson (hFile, Records, Count, Frequency.QuadPart);
+    } else {
+        ZeroMemory (&Header, sizeof(Header));
+        Header.Magic = PERFLOG_SINK_MAGIC;
+        Header.Version = PERFLOG_SINK_VERSION;
+        Header.HeaderSize = sizeof(PERFLOG_SINK_FILE_HEADER);
+        Header.RecordSize = sizeof(PERFLOG_SINK_RECORD);
+        Header.RecordCount = Count;
+        Header.ProcessId = GetCurrentProcessId ();
+        Header.Frequency = Frequency.QuadPart;
+        Header.StartCounter = PerflogSinkStartCounter;
+        Header.DroppedRecords = Last - Count;
+
+        if (!WriteFile (hFile, &Header, sizeof(Header), &dwWritten, NULL) ||
+            !WriteFile (hFile, Records, Count * sizeof(PERFLOG_SINK_RECORD),
+                        &dwWritten, NULL)) {
+            hr = HRESULT_FROM_WIN32 (GetLastError ());
+        }
+    }
+
+    delete[] Records;
+    return hr;
+}
+
 
@@ -54,3 +54,9 @@ VOID
 PerflogTraceEvent (
     __in PEVENT_TRACE_HEADER Event
     );
+
+#include "perfsink.h"
+
+// The DXMPERF_xxx flags are honoured by either consumer
+#define PerflogEventEnabled( _flags_ ) \
+    ((PerflogEnableFlags | PerflogSinkFlags) & (_flags_))
@@ -0,0 +1,166 @@
+//------------------------------------------------------------------------------
+// File: perfsink.h
+//
+// Desc: In-process trace sink for the performance logging framework.
+//
+// Copyright (c) 1992-2001 Microsoft Corporation.  All rights reserved.
+//------------------------------------------------------------------------------
+
+
+#ifndef _PERFSINK_H_
+#define _PERFSINK_H_
+
+//
+// Trace sink.
+//
+// Besides ETW, events can be captured in process: PerflogSinkStart() sets
+// up a ring buffer that receives every event passed to PerflogTraceEvent()
+// and PerflogTraceEventLevel(), plus the named events of PerflogSinkMark().
+// PerflogSinkSave() writes the buffer as Chrome trace-event JSON (load it
+// in chrome://tracing or Perfetto) or in a compact binary format, which is
+// a PERFLOG_SINK_FILE_HEADER followed by the records, oldest first.
+//
+// The binary format is stable; tools\EvrPerfDump reads it on any host by
+// the offsets below rather than through these structures. All values are
+// little endian. Readers step by HeaderSize and RecordSize, so fields may
+// be appended to either structure; any other change must increment
+// PERFLOG_SINK_VERSION.
+//
+//  PERFLOG_SINK_FILE_HEADER, 48 bytes
+//     0  Magic            4  PERFLOG_SINK_MAGIC
+//     4  Version          4  PERFLOG_SINK_VERSION
+//     8  HeaderSize       4  offset of the first record
+//    12  RecordSize       4
+//    16  RecordCount      4  records in the file
+//    20  ProcessId        4
+//    24  Frequency        8  counts per second of the timestamps
+//    32  StartCounter     8  timestamp when the sink was started
+//    40  DroppedRecords   8  overwritten or torn before they were saved
+//
+//  PERFLOG_SINK_RECORD, 128 bytes
+//     0  Timestamp        8
+//     8  Sequence         4  position in the ring + 1
+//    12  ThreadId         4
+//    16  Level            4
+//    20  Phase            1  'B', 'E', 'i' or 'C'
+//    21  DataSize         1  bytes used in Data, at most 56
+//    22  Reserved         2  0
+//    24  Guid            16  Data1, Data2, Data3, then the 8 bytes of Data4
+//    40  Id               8
+//    48  Name            24  NUL terminated; empty for ETW events
+//    72  Data            56  ETW payload, or the value of a mark as a
+//                            signed 64 bit integer
+//
+// While the sink is stopped, PerflogSinkEnabled() is a single load of a
+// global, so call sites can test it before they build an event. This
+// header is part of streams.h, so the streaming marks below are compiled
+// in whether or not DXMPERF is defined; the ETW events of dxmperf.h still
+// need DXMPERF.
+//
+
+#define PERFLOG_SINK_MAGIC      0x474C5050  // 'PPLG'
+#define PERFLOG_SINK_VERSION    1
+#define PERFLOG_SINK_MAX_NAME   24
+#define PERFLOG_SINK_MAX_DATA   56
+
+typedef enum _PERFLOG_SINK_FORMAT {
+    PERFLOG_SINK_JSON,
+    PERFLOG_SINK_BINARY
+} PERFLOG_SINK_FORMAT;
+
+typedef struct _PERFLOG_SINK_RECORD {
+    LONGLONG Timestamp;                 // QueryPerformanceCounter() value
+    volatile LONG Sequence;             // Position in the ring + 1, written last
+    ULONG ThreadId;
+    ULONG Level;                        // Level of PerflogTraceEventLevel(), else 0
+    CHAR Phase;                         // Trace-event phase: 'B', 'E', 'i' or 'C'
+    UCHAR DataSize;                     // Bytes used in Data
+    USHORT Reserved;
+    GUID Guid;                          // ETW event GUID, GUID_NULL for marks
+    ULONGLONG Id;                       // Object a mark refers to
+    CHAR Name[PERFLOG_SINK_MAX_NAME];   // Name of a mark, empty for ETW events
+    BYTE Data[PERFLOG_SINK_MAX_DATA];   // Event payload (truncated) or mark value
+} PERFLOG_SINK_RECORD, *PPERFLOG_SINK_RECORD;
+
+typedef struct _PERFLOG_SINK_FILE_HEADER {
+    ULONG Magic;                        // PERFLOG_SINK_MAGIC
+    ULONG Version;                      // PERFLOG_SINK_VERSION
+    ULONG HeaderSize;                   // sizeof(PERFLOG_SINK_FILE_HEADER)
+    ULONG RecordSize;                   // sizeof(PERFLOG_SINK_RECORD)
+    ULONG RecordCount;
+    ULONG ProcessId;
+    LONGLONG Frequency;                 // QueryPerformanceFrequency()
+    LONGLONG StartCounter;              // Counter value when the sink started
+    LONGLONG DroppedRecords;            // Overwritten before they were saved
+} PERFLOG_SINK_FILE_HEADER, *PPERFLOG_SINK_FILE_HEADER;
+
+C_ASSERT(sizeof(PERFLOG_SINK_FILE_HEADER) == 48);
+C_ASSERT(FIELD_OFFSET(PERFLOG_SINK_FILE_HEADER, Frequency) == 24);
+C_ASSERT(sizeof(PERFLOG_SINK_RECORD) == 128);
+C_ASSERT(FIELD_OFFSET(PERFLOG_SINK_RECORD, Guid) == 24);
+C_ASSERT(FIELD_OFFSET(PERFLOG_SINK_RECORD, Name) == 48);
+C_ASSERT(FIELD_OFFSET(PERFLOG_SINK_RECORD, Data) == 72);
+
+extern volatile LONG PerflogSinkActive;
+extern ULONG PerflogSinkFlags;
+
+#define PerflogSinkEnabled() (PerflogSinkActive != 0)
+
+BOOL
+PerflogSinkStart (
+    ULONG Capacity,
+    ULONG EnableFlags
+    );
+
+VOID
+PerflogSinkStop (
+    VOID
+    );
+
+HRESULT
+PerflogSinkSave (
+    HANDLE hFile,
+    PERFLOG_SINK_FORMAT Format
+    );
+
+VOID
+PerflogSinkMark (
+    __in LPCSTR Name,
+    CHAR Phase,
+    ULONGLONG Id,
+    LONGLONG Value
+    );
+
+//
+// Streaming activity only goes to the trace sink, where it shows up on the
+// timeline next to the ETW events. The id of a mark is the object it
+// happened on.
+//
+
+#define PERFLOG_SINK_MARK( name, phase, object, value ) \
+    if (PerflogSinkEnabled()) { \
+        PerflogSinkMark( (name), (phase), (ULONGLONG) (ULONG_PTR) (object), (LONGLONG) (value) ); \
+    }
+
+#define PERFLOG_DELIVER( name, source, dest, sample, pmt ) \
+    PERFLOG_SINK_MARK( "Deliver", 'i', (source), (ULONG_PTR) (sample) )
+#define PERFLOG_RECEIVE( name, source, dest, sample, pmt ) \
+    PERFLOG_SINK_MARK( "Receive", 'i', (dest), (ULONG_PTR) (sample) )
+#define PERFLOG_RUN( name, iface, time, oldstate ) \
+    PERFLOG_SINK_MARK( "Run", 'i', (iface), (time) )
+#define PERFLOG_PAUSE( name, iface, oldstate ) \
+    PERFLOG_SINK_MARK( "Pause", 'i', (iface), (oldstate) )
+#define PERFLOG_STOP( name, iface, oldstate ) \
+    PERFLOG_SINK_MARK( "Stop", 'i', (iface), (oldstate) )
+#define PERFLOG_GETBUFFER( allocator, sample ) \
+    PERFLOG_SINK_MARK( "GetBuffer", 'i', (allocator), (ULONG_PTR) (sample) )
+#define PERFLOG_RELBUFFER( allocator, sample ) \
+    PERFLOG_SINK_MARK( "ReleaseBuffer", 'i', (allocator), (ULONG_PTR) (sample) )
+#define PERFLOG_RENDERSTART( renderer, sample ) \
+    PERFLOG_SINK_MARK( "Render", 'B', (renderer), (ULONG_PTR) (sample) )
+#define PERFLOG_RENDEREND( renderer, sample ) \
+    PERFLOG_SINK_MARK( "Render", 'E', (renderer), (ULONG_PTR) (sample) )
+#define PERFLOG_QUEUEDEPTH( queue, samples ) \
+    PERFLOG_SINK_MARK( "Queue", 'C', (queue), (samples) )
+
+#endif // _PERFSINK_H_
@@ -19,8 +19,21 @@
 CPullPin::CPullPin()
   : m_pReader(NULL),
     m_pAlloc(NULL),
-    m_State(TM_Exit)
+    m_State(TM_Exit),
+    m_lMaxReadAhead(0),
+    m_lDepth(0),
+    m_lDepthLimit(0),
+    m_lIssued(0),
+    m_lDelivered(0),
+    m_lInTime(0),
+    m_llBytesRead(0),
+    m_dwStallTime(0),
+    m_dwReadTime(0),
+    m_dwProcessStart(0)
 {
+    ZeroMemory(m_pReadAhead, sizeof(m_pReadAhead));
+    ZeroMemory(m_dwIssueTime, sizeof(m_dwIssueTime));
+
 #ifdef DXMPERF
 	PERFLOG_CTOR( L"CPullPin", this );
 #endif // DXMPERF
@@ -213,6 +226,38 @@ CPullPin::Duration(__out REFERENCE_TIME* ptDuration)
     return S_OK;
 }
 
+HRESULT
+CPullPin::SetReadAhead(LONG lMaxRequests)
+{
+    if (lMaxRequests < 0 || lMaxRequests > PULLPIN_MAX_READAHEAD) {
+	return E_INVALIDARG;
+    }
+
+    CAutoLock lock(&m_AccessLock);
+    m_lMaxReadAhead = lMaxRequests;
+    return S_OK;
+}
+
+HRESULT
+CPullPin::GetReadAheadStatistics(
+    __out LONG *plDepth,
+    __out LONGLONG *pllBytes,
+    __out DWORD *pdwTime,
+    __out DWORD *pdwStallTime)
+{
+    CheckPointer(plDepth, E_POINTER);
+    CheckPointer(pllBytes, E_POINTER);
+    CheckPointer(pdwTime, E_POINTER);
+    CheckPointer(pdwStallTime, E_POINTER);
+
+    // not synchronised with the thread; the values are only indicative
+    *plDepth = m_lDepth;
+    *pllBytes = m_llBytesRead;
+    *pdwTime = m_dwProcessStart ? timeGetTime() - m_dwProcessStart : 0;
+    *pdwStallTime = m_dwStallTime;
+    return S_OK;
+}
+
 
 HRESULT
 CPullPin::StartThread()
@@ -336,12 +381,14 @@ HRESULT
 CPullPin::QueueSample(
     __inout REFERENCE_TIME& tCurrent,
     REFERENCE_TIME tAlignStop,
-    BOOL bDiscontinuity
+    BOOL bDiscontinuity,
+    BOOL bNoWait
     )
 {
     IMediaSample* pSample;
 
-    HRESULT hr = m_pAlloc->GetBuffer(&pSample, NULL, NULL, 0);
+    HRESULT hr = m_pAlloc->GetBuffer(&pSample, NULL, NULL,
+				     bNoWait ? AM_GBF_NOWAIT : 0);
     if (FAILED(hr)) {
 	return hr;
     }
@@ -355,14 +402,20 @@ CPullPin::QueueSample(
 
     pSample->SetDiscontinuity(bDiscontinuity);
 
+    // the request's position in the stream comes back with the sample,
+    // so we can put the completions back into order
+    m_dwIssueTime[m_lIssued % PULLPIN_MAX_READAHEAD] = timeGetTime();
     hr = m_pReader->Request(
 			pSample,
-			0);
+			(DWORD_PTR) m_lIssued);
     if (FAILED(hr)) {
 	pSample->Release();
 
+	ReleaseReadAhead();
 	CleanupCancelled();
 	OnError(hr);
+    } else {
+	m_lIssued++;
     }
     return hr;
 }
@@ -372,20 +425,68 @@ CPullPin::CollectAndDeliver(
     REFERENCE_TIME tStart,
     REFERENCE_TIME tStop)
 {
-    IMediaSample* pSample = NULL;   // better be sure pSample is set
-    DWORD_PTR dwUnused;
-    HRESULT hr = m_pReader->WaitForNext(
-			INFINITE,
-			&pSample,
-			&dwUnused);
-    if (FAILED(hr)) {
-	if (pSample) {
-	    pSample->Release();
+    ASSERT(m_lDelivered < m_lIssued);
+    LONG lSlot = m_lDelivered % PULLPIN_MAX_READAHEAD;
+    HRESULT hr = S_OK;
+
+    // the next sample in order may have completed already
+    BOOL bStalled = FALSE;
+    while (m_pReadAhead[lSlot] == NULL) {
+	IMediaSample* pSample = NULL;   // better be sure pSample is set
+	DWORD_PTR dwSequence = 0;
+
+	// poll first, so we know whether we have to wait for the reader
+	hr = m_pReader->WaitForNext(0, &pSample, &dwSequence);
+	if (hr == VFW_E_TIMEOUT && pSample == NULL) {
+	    bStalled = TRUE;
+	    DWORD dwWait = timeGetTime();
+	    hr = m_pReader->WaitForNext(
+			    INFINITE,
+			    &pSample,
+			    &dwSequence);
+	    m_dwStallTime += timeGetTime() - dwWait;
 	}
-    } else {
+
+	if (FAILED(hr)) {
+	    if (pSample) {
+		pSample->Release();
+	    }
+	    break;
+	}
+
+	LONG lSequence = (LONG) dwSequence;
+	ASSERT(lSequence >= m_lDelivered && lSequence < m_lIssued);
+	LONG lThisSlot = lSequence % PULLPIN_MAX_READAHEAD;
+	ASSERT(m_pReadAhead[lThisSlot] == NULL);
+	m_pReadAhead[lThisSlot] = pSample;
+	m_dwReadTime += timeGetTime() - m_dwIssueTime[lThisSlot];
+	m_llBytesRead += pSample->GetActualDataLength();
+    }
+
+    if (SUCCEEDED(hr)) {
+	IMediaSample* pSample = m_pReadAhead[lSlot];
+	m_pReadAhead[lSlot] = NULL;
+	m_lDelivered++;
+
+	// adapt the window: grow when the reader can't keep up, shrink
+	// slowly while it is ahead of us. It stays between 2 (or the limit,
+	// if that is smaller) and the limit.
+	if (bStalled) {
+	    m_lInTime = 0;
+	    if (m_lDepth < m_lDepthLimit) {
+		m_lDepth++;
+	    }
+	} else if (++m_lInTime >= PULLPIN_SHRINK_AFTER) {
+	    m_lInTime = 0;
+	    if (m_lDepth > min(2, m_lDepthLimit)) {
+		m_lDepth--;
+	    }
+	}
+
 	hr = DeliverSample(pSample, tStart, tStop);
     }
     if (FAILED(hr)) {
+	ReleaseReadAhead();
 	CleanupCancelled();
 	OnError(hr);
     }
@@ -393,6 +494,17 @@ CPullPin::CollectAndDeliver(
 
 }
 
+void
+CPullPin::ReleaseReadAhead(void)
+{
+    for (int i = 0; i < PULLPIN_MAX_READAHEAD; i++) {
+	if (m_pReadAhead[i]) {
+	    m_pReadAhead[i]->Release();
+	    m_pReadAhead[i] = NULL;
+	}
+    }
+}
+
 HRESULT
 CPullPin::DeliverSample(
     IMediaSample* pSample,
@@ -462,57 +574,71 @@ CPullPin::Process(void)
 
     DWORD dwRequest;
 
-    if (!m_bSync) {
+    // size the read-ahead window
+    LONG lMaxDepth = m_lMaxReadAhead;
+    if (lMaxDepth == 0) {
+	lMaxDepth = m_bSync ? 1 : PULLPIN_MAX_READAHEAD;
+    }
+    lMaxDepth = max(1, min(lMaxDepth, Actual.cBuffers));
+
+    m_lIssued = m_lDelivered = 0;
+    m_lDepthLimit = lMaxDepth;
+    m_lDepth = min(2, lMaxDepth);
+    m_lInTime = 0;
+    m_llBytesRead = 0;
+    m_dwStallTime = 0;
+    m_dwReadTime = 0;
+    m_dwProcessStart = timeGetTime();
+
+    if (!m_bSync || lMaxDepth > 1) {
 
 	//  Break out of the loop either if we get to the end or we're asked
 	//  to do something else
-	while (tCurrent < tAlignStop) {
+	while (tCurrent < tAlignStop || m_lDelivered < m_lIssued) {
 
 	    // Break out without calling EndOfStream if we're asked to
-	    // do something different
+	    // do something different. The requests still outstanding are
+	    // cleaned up by the thread after the flush.
 	    if (CheckRequest(&dwRequest)) {
+		ReleaseReadAhead();
 		return;
 	    }
 
-	    // queue a first sample
-	    if (Actual.cBuffers > 1) {
-
-		hr = QueueSample(tCurrent, tAlignStop, TRUE);
-		bDiscontinuity = FALSE;
+	    // fill the window. Only wait for a buffer if nothing is
+	    // outstanding: downstream may hold on to buffers until it gets
+	    // the next sample, which is one of ours.
+	    while (tCurrent < tAlignStop && m_lIssued - m_lDelivered < m_lDepth) {
 
-		if (FAILED(hr)) {
-		    return;
+		hr = QueueSample(tCurrent, tAlignStop, bDiscontinuity,
+				 m_lIssued > m_lDelivered);
+		if (hr == VFW_E_TIMEOUT) {
+		    break;
 		}
-	    }
-
-
-
-	    // loop queueing second and waiting for first..
-	    while (tCurrent < tAlignStop) {
-
-		hr = QueueSample(tCurrent, tAlignStop, bDiscontinuity);
-		bDiscontinuity = FALSE;
-
 		if (FAILED(hr)) {
+		    ReleaseReadAhead();
 		    return;
 		}
-
-		hr = CollectAndDeliver(tStart, tStop);
-		if (S_OK != hr) {
-
-		    // stop if error, or if downstream filter said
-		    // to stop.
-		    return;
-		}
+		bDiscontinuity = FALSE;
 	    }
 
-	    if (Actual.cBuffers > 1) {
-		hr = CollectAndDeliver(tStart, tStop);
-		if (FAILED(hr)) {
-		    return;
-		}
+	    // deliver the oldest
+	    hr = CollectAndDeliver(tStart, tStop);
+	    if (S_OK != hr) {
+
+		// stop if error, or if downstream filter said
+		// to stop.
+		ReleaseReadAhead();
+		return;
 	    }
 	}
+
+	DWORD dwTime = timeGetTime() - m_dwProcessStart;
+	DbgLog((LOG_TRACE, 2, TEXT("CPullPin: %d reads, %d KB/s, window %d, read latency %d ms, stalled %d of %d ms"),
+		m_lDelivered,
+		dwTime ? (LONG)(m_llBytesRead / dwTime * 1000 / 1024) : 0,
+		m_lDepth,
+		m_lDelivered ? m_dwReadTime / m_lDelivered : 0,
+		m_dwStallTime, dwTime));
     } else {
 
 	// sync version of above loop
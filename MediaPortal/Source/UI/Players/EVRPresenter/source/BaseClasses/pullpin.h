@@ -20,6 +20,16 @@
 // This is essentially for use in a MemInputPin when it finds itself
 // connected to an IAsyncReader pin instead of a pushing pin.
 //
+// Reads are pipelined: up to a window of requests is kept outstanding on
+// the reader and the samples are delivered in file order, whatever order
+// the reader completes them in. The window starts at 2 and grows by one
+// each time the pull thread has to wait for a read (up to the configured
+// maximum and the allocator's buffer count), and shrinks again after a
+// run of reads that were ready in time. See SetReadAhead.
+//
+
+#define PULLPIN_MAX_READAHEAD   16      // largest read-ahead window
+#define PULLPIN_SHRINK_AFTER    64      // reads in time before the window shrinks
 
 class CPullPin : public CAMThread
 {
@@ -29,6 +39,22 @@ class CPullPin : public CAMThread
     REFERENCE_TIME      m_tDuration;
     BOOL                m_bSync;
 
+    // read-ahead pipeline (thread only, except m_lMaxReadAhead)
+    LONG                m_lMaxReadAhead;    // configured window, 0 = default
+    LONG                m_lDepth;           // current window
+    LONG                m_lDepthLimit;      // largest window of this run
+    LONG                m_lIssued;          // requests issued by Process
+    LONG                m_lDelivered;       // samples delivered by Process
+    LONG                m_lInTime;          // reads in a row that were ready
+    IMediaSample*       m_pReadAhead[PULLPIN_MAX_READAHEAD]; // completed, not delivered
+    DWORD               m_dwIssueTime[PULLPIN_MAX_READAHEAD];
+
+    // read-ahead statistics, reset by Process
+    LONGLONG            m_llBytesRead;
+    DWORD               m_dwStallTime;      // ms spent waiting for reads
+    DWORD               m_dwReadTime;       // sum of read latencies (ms)
+    DWORD               m_dwProcessStart;
+
     enum ThreadMsg {
 	TM_Pause,       // stop pulling and wait for next message
 	TM_Start,       // start pulling
@@ -43,6 +69,9 @@ class CPullPin : public CAMThread
     // running pull method (check m_bSync)
     void Process(void);
 
+    // release the completed samples that were not delivered
+    void ReleaseReadAhead(void);
+
     // clean up any cancelled i/o after a flush
     void CleanupCancelled(void);
 
@@ -55,11 +84,15 @@ class CPullPin : public CAMThread
     // stop and close thread
     HRESULT StopThread();
 
-    // called from ProcessAsync to queue and collect requests
+    // called from ProcessAsync to queue and collect requests.
+    // QueueSample returns VFW_E_TIMEOUT if bNoWait and no buffer is free.
+    // CollectAndDeliver delivers the next sample in order, collecting
+    // (and keeping) the ones completed before it
     HRESULT QueueSample(
 		__inout REFERENCE_TIME& tCurrent,
 		REFERENCE_TIME tAlignStop,
-		BOOL bDiscontinuity);
+		BOOL bDiscontinuity,
+		BOOL bNoWait);
 
     HRESULT CollectAndDeliver(
 		REFERENCE_TIME tStart,
@@ -101,6 +134,21 @@ public:
     // the new position. Default is 0 to duration
     HRESULT Seek(REFERENCE_TIME tStart, REFERENCE_TIME tStop);
 
+    // set the largest number of outstanding read requests (at most
+    // PULLPIN_MAX_READAHEAD). 1 reads one sample at a time (with
+    // SyncReadAligned if connected with bSync). 0 is the default: as
+    // many as the allocator has buffers, but 1 if connected with bSync.
+    // Takes effect the next time the thread starts pulling.
+    HRESULT SetReadAhead(LONG lMaxRequests);
+
+    // statistics of the current (or last) run: window size, bytes read,
+    // time spent pulling and time spent waiting for reads (ms)
+    HRESULT GetReadAheadStatistics(
+		__out LONG *plDepth,
+		__out LONGLONG *pllBytes,
+		__out DWORD *pdwTime,
+		__out DWORD *pdwStallTime);
+
     // return the total duration
     HRESULT Duration(__out REFERENCE_TIME* ptDuration);
 
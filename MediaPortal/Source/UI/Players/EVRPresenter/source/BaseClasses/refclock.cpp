@@ -74,6 +74,11 @@ CBaseReferenceClock::CBaseReferenceClock( __in_opt LPCTSTR pName,
                                           __inout_opt CAMSchedule * pShed )
 : CUnknown( pName, pUnk )
 , m_rtLastGotTime(0)
+, m_llCounterBase(0)
+, m_rtBase(0)
+, m_rtSlew(0)
+, m_lStateSequence(0)
+, m_llFrequency(CClockCounter::Frequency())
 , m_TimerResolution(0)
 , m_bAbort( FALSE )
 , m_pSchedule( pShed ? pShed : new CAMSchedule(CreateEvent(NULL, FALSE, FALSE, NULL)) )
@@ -99,11 +104,12 @@ CBaseReferenceClock::CBaseReferenceClock( __in_opt LPCTSTR pName,
 
         timeBeginPeriod(m_TimerResolution);
 
-        /* Initialise our system times - the derived clock should set the right values */
-        m_dwPrevSystemTime = timeGetTime();
-        m_rtPrivateTime = (UNITS / MILLISECONDS) * m_dwPrevSystemTime;
+        /* Initialise our system times - the derived clock should set the right values.
+           We start from timeGetTime() as we always did, then run on the counter */
+        m_llCounterBase = CClockCounter::Now();
+        m_rtBase = (UNITS / MILLISECONDS) * timeGetTime();
 
-        #ifdef PERF
+        #ifdef MSR_ENABLED
             m_idGetSystemTime = MSR_REGISTER(TEXT("CBaseReferenceClock::GetTime"));
         #endif
 
@@ -135,7 +141,7 @@ CBaseReferenceClock::CBaseReferenceClock( __in_opt LPCTSTR pName,
 void CBaseReferenceClock::Restart (IN REFERENCE_TIME rtMinTime)
 {
     Lock();
-    m_rtLastGotTime = rtMinTime ;
+    InterlockedExchange64(&m_rtLastGotTime, rtMinTime);
     Unlock();
 }
 
@@ -144,20 +150,24 @@ STDMETHODIMP CBaseReferenceClock::GetTime(__out REFERENCE_TIME *pTime)
     HRESULT hr;
     if (pTime)
     {
-        REFERENCE_TIME rtNow;
-        Lock();
-        rtNow = GetPrivateTime();
-        if (rtNow > m_rtLastGotTime)
-        {
-            m_rtLastGotTime = rtNow;
-            hr = S_OK;
-        }
-        else
+        REFERENCE_TIME rtNow = GetPrivateTime();
+
+        // Advance m_rtLastGotTime without a lock.  If another thread got
+        // a later time in the meantime, we return that one.
+        REFERENCE_TIME rtLast = InterlockedCompareExchange64(&m_rtLastGotTime, 0, 0);
+        hr = S_FALSE;
+        while (rtNow > rtLast)
         {
-            hr = S_FALSE;
+            const REFERENCE_TIME rtPrev = InterlockedCompareExchange64(&m_rtLastGotTime, rtNow, rtLast);
+            if (rtPrev == rtLast)
+            {
+                rtLast = rtNow;
+                hr = S_OK;
+                break;
+            }
+            rtLast = rtPrev;
         }
-        *pTime = m_rtLastGotTime;
-        Unlock();
+        *pTime = rtLast;
         MSR_INTEGER(m_idGetSystemTime, LONG((*pTime) / (UNITS/MILLISECONDS)) );
 
 #ifdef DXMPERF
@@ -229,25 +239,66 @@ STDMETHODIMP CBaseReferenceClock::Unadvise(DWORD_PTR dwAdviseCookie)
 }
 
 
-REFERENCE_TIME CBaseReferenceClock::GetPrivateTime()
+/* Works out the private time at a counter value.  On return *prtSlew
+   is the part of the correction that has not been slewed in yet */
+
+REFERENCE_TIME CBaseReferenceClock::CounterToTime(
+    LONGLONG llCounter,
+    LONGLONG llCounterBase,
+    REFERENCE_TIME rtBase,
+    __inout REFERENCE_TIME *prtSlew) const
 {
-    CAutoLock cObjectLock(this);
+    LONGLONG llElapsed = llCounter - llCounterBase;
+    if (llElapsed < 0) {
+        llElapsed = 0;      // Counter read before the state was rebased
+    }
 
+    // Split the multiplication so it can't overflow
+    const REFERENCE_TIME rtElapsed = (llElapsed / m_llFrequency) * UNITS +
+                                     (llElapsed % m_llFrequency) * UNITS / m_llFrequency;
+
+    // Slew in the correction, but never faster than 1/SLEW_RATE_DIVISOR
+    // of the elapsed time.  That keeps the clock monotonic.
+    const REFERENCE_TIME rtMaxSlew = rtElapsed / SLEW_RATE_DIVISOR;
+    REFERENCE_TIME rtSlewed = *prtSlew;
+    if (rtSlewed > rtMaxSlew) {
+        rtSlewed = rtMaxSlew;
+    } else if (rtSlewed < -rtMaxSlew) {
+        rtSlewed = -rtMaxSlew;
+    }
+    *prtSlew -= rtSlewed;
+
+    return rtBase + rtElapsed + rtSlewed;
+}
 
-    /* If the clock has wrapped then the current time will be less than
-     * the last time we were notified so add on the extra milliseconds
-     *
-     * The time period is long enough so that the likelihood of
-     * successive calls spanning the clock cycle is not considered.
-     */
 
-    DWORD dwTime = timeGetTime();
+REFERENCE_TIME CBaseReferenceClock::GetPrivateTime()
+{
+    LONGLONG llCounterBase;
+    REFERENCE_TIME rtBase;
+    REFERENCE_TIME rtSlew;
+    LONG lSequence;
+
+    // Take a consistent copy of the clock state.  SetTimeDelta makes the
+    // sequence odd while it changes the state.
+    for (;;)
     {
-        m_rtPrivateTime += Int32x32To64(UNITS / MILLISECONDS, (DWORD)(dwTime - m_dwPrevSystemTime));
-        m_dwPrevSystemTime = dwTime;
+        lSequence = m_lStateSequence;
+        if (lSequence & 1) {
+            YieldProcessor();
+            continue;
+        }
+        MemoryBarrier();
+        llCounterBase = m_llCounterBase;
+        rtBase = m_rtBase;
+        rtSlew = m_rtSlew;
+        MemoryBarrier();
+        if (m_lStateSequence == lSequence) {
+            break;
+        }
     }
 
-    return m_rtPrivateTime;
+    return CounterToTime(CClockCounter::Now(), llCounterBase, rtBase, &rtSlew);
 }
 
 
@@ -287,10 +338,11 @@ STDMETHODIMP CBaseReferenceClock::SetTimeDelta(const REFERENCE_TIME & TimeDelta)
     }
 
     // Sev == 0 => > 2 second delta!
+    const REFERENCE_TIME rtPrivateTime = CBaseReferenceClock::GetPrivateTime();
     DbgLog((LOG_TIMING, Severity < 0 ? 0 : Severity,
         TEXT("Sev %2i: CSystemClock::SetTimeDelta(%8ld us) %lu -> %lu ms."),
-        Severity, usDelta, DWORD(ConvertToMilliseconds(m_rtPrivateTime)),
-        DWORD(ConvertToMilliseconds(TimeDelta+m_rtPrivateTime)) ));
+        Severity, usDelta, DWORD(ConvertToMilliseconds(rtPrivateTime)),
+        DWORD(ConvertToMilliseconds(TimeDelta+rtPrivateTime)) ));
 
     // Don't want the DbgBreak to fire when running stress on debug-builds.
     #ifdef BREAK_ON_SEVERE_TIME_DELTA
@@ -302,7 +354,29 @@ STDMETHODIMP CBaseReferenceClock::SetTimeDelta(const REFERENCE_TIME & TimeDelta)
 #endif
 
     CAutoLock cObjectLock(this);
-    m_rtPrivateTime += TimeDelta;
+
+    // Rebase the state to now, so the time is continuous, then add the
+    // correction.  Readers retry while the sequence is odd.
+    const LONGLONG llNow = CClockCounter::Now();
+    REFERENCE_TIME rtSlew = m_rtSlew;
+    const REFERENCE_TIME rtNow = CounterToTime(llNow, m_llCounterBase, m_rtBase, &rtSlew);
+
+    InterlockedIncrement(&m_lStateSequence);
+    m_llCounterBase = llNow;
+    m_rtBase = rtNow;
+    m_rtSlew = rtSlew + TimeDelta;
+
+    // Don't let the pending correction grow beyond MAX_SLEW_DELTA - jump
+    // by the rest, as we always did
+    if (m_rtSlew > MAX_SLEW_DELTA) {
+        m_rtBase += m_rtSlew - MAX_SLEW_DELTA;
+        m_rtSlew = MAX_SLEW_DELTA;
+    } else if (m_rtSlew < -MAX_SLEW_DELTA) {
+        m_rtBase += m_rtSlew + MAX_SLEW_DELTA;
+        m_rtSlew = -MAX_SLEW_DELTA;
+    }
+    InterlockedIncrement(&m_lStateSequence);
+
     // If time goes forwards, and we have advises, then we need to
     // trigger the thread so that it can re-evaluate its wait time.
     // Since we don't want the cost of the thread switches if the change
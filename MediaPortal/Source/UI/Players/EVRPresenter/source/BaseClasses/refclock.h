@@ -24,6 +24,26 @@ inline LONGLONG WINAPI ConvertToMilliseconds(const REFERENCE_TIME& RT)
     return (RT / (UNITS / MILLISECONDS));
 }
 
+/* The counter the base clock runs on.  Everything platform specific
+   about reading the time is kept in here: Now() must be monotonic and
+   Frequency() must not change while the system is running.  It is
+   defined in clockcounter.cpp.
+ */
+
+class CClockCounter
+{
+public:
+    static LONGLONG Now();                      /* Current count */
+    static LONGLONG Frequency();                /* Counts per second */
+};
+
+/* SetTimeDelta slews in at most this much of the pending correction,
+   anything beyond is applied at once */
+const REFERENCE_TIME MAX_SLEW_DELTA = 50 * (UNITS / MILLISECONDS);
+/* While slewing, the clock runs at most 1/SLEW_RATE_DIVISOR faster or
+   slower than the counter */
+const LONGLONG SLEW_RATE_DIVISOR = 16;
+
 /* This class hierarchy will support an IReferenceClock interface so
    that an audio card (or other externally driven clock) can update the
    system wide clock that everyone uses.
@@ -131,9 +151,13 @@ public:
     // The important point about GetPrivateTime() is it's allowed to go
     // backwards.  Our GetTime() will keep returning the LastGotTime
     // until GetPrivateTime() catches up.
+    // The base implementation runs on CClockCounter and does not take
+    // the clock's lock.
     virtual REFERENCE_TIME GetPrivateTime();
 
-    /* Provide a method for correcting drift */
+    /* Provide a method for correcting drift.  Small corrections are
+       slewed in gradually (see MAX_SLEW_DELTA), so the clock does not
+       jump */
     STDMETHODIMP SetTimeDelta( const REFERENCE_TIME& TimeDelta );
 
     CAMSchedule * GetSchedule() const { return m_pSchedule; }
@@ -149,13 +173,31 @@ public:
     );
 
 private:
-    REFERENCE_TIME m_rtPrivateTime;     // Current best estimate of time
-    DWORD          m_dwPrevSystemTime;  // Last vaule we got from timeGetTime
-    REFERENCE_TIME m_rtLastGotTime;     // Last time returned by GetTime
+    // The private time is a function of the counter:
+    //
+    //   time = m_rtBase + elapsed + slewed
+    //
+    // where elapsed is the counter time since m_llCounterBase and slewed
+    // is the part of m_rtSlew that has been applied so far (at most
+    // elapsed / SLEW_RATE_DIVISOR).  The state only changes in
+    // SetTimeDelta.  Readers take a consistent copy without a lock: the
+    // writer makes m_lStateSequence odd while it changes the state.
+    LONGLONG       m_llCounterBase;     // Counter value at m_rtBase
+    REFERENCE_TIME m_rtBase;            // Private time at m_llCounterBase
+    REFERENCE_TIME m_rtSlew;            // Correction still to be slewed in
+    LONG volatile  m_lStateSequence;
+    LONGLONG       m_llFrequency;       // CClockCounter::Frequency()
+
+    REFERENCE_TIME CounterToTime( LONGLONG llCounter,
+                                  LONGLONG llCounterBase,
+                                  REFERENCE_TIME rtBase,
+                                  __inout REFERENCE_TIME *prtSlew ) const;
+
+    REFERENCE_TIME volatile m_rtLastGotTime;    // Last time returned by GetTime
     REFERENCE_TIME m_rtNextAdvise;      // Time of next advise
     UINT           m_TimerResolution;
 
-#ifdef PERF
+#ifdef MSR_ENABLED
     int m_idGetSystemTime;
 #endif
 
@@ -12,6 +12,10 @@
 #include <limits.h>         // Standard data type limit definitions
 #include <measure.h>        // Used for time critical log functions
 
+#ifdef DXMPERF
+#include "dxmperf.h"
+#endif // DXMPERF
+
 #pragma warning(disable:4355)
 
 //  Helper function for clamping time differences
@@ -996,10 +1000,14 @@ HRESULT CBaseRenderer::Render(IMediaSample *pMediaSample)
 
     // Time how long the rendering takes
 
+    PERFLOG_RENDERSTART( (IBaseFilter *) this, pMediaSample );
+
     OnRenderStart(pMediaSample);
     DoRenderSample(pMediaSample);
     OnRenderEnd(pMediaSample);
 
+    PERFLOG_RENDEREND( (IBaseFilter *) this, pMediaSample );
+
     return NOERROR;
 }
 
@@ -1776,11 +1784,13 @@ CBaseVideoRenderer::CBaseVideoRenderer(
     CBaseRenderer(RenderClass,pName,pUnk,phr),
     m_cFramesDropped(0),
     m_cFramesDrawn(0),
-    m_bSupplierHandlingQuality(FALSE)
+    m_bSupplierHandlingQuality(FALSE),
+    m_iRenderBoundEnter(RENDER_BOUND_ENTER),
+    m_iRenderBoundLeave(RENDER_BOUND_LEAVE)
 {
     ResetStreamingTimes();
 
-#ifdef PERF
+#ifdef MSR_ENABLED
     m_idTimeStamp       = MSR_REGISTER(TEXT("Frame time stamp"));
     m_idEarliness       = MSR_REGISTER(TEXT("Earliness fudge"));
     m_idTarget          = MSR_REGISTER(TEXT("Target (mSec)"));
@@ -1800,7 +1810,7 @@ CBaseVideoRenderer::CBaseVideoRenderer(
     m_idDuration        = MSR_REGISTER(TEXT("Duration"));
     m_idThrottle        = MSR_REGISTER(TEXT("Audio-video throttle wait"));
     // m_idDebug           = MSR_REGISTER(TEXT("Debug stuff"));
-#endif // PERF
+#endif // MSR_ENABLED
 } // Constructor
 
 
@@ -1845,14 +1855,16 @@ HRESULT CBaseVideoRenderer::ResetStreamingTimes()
     m_trRenderLast = 0;
     m_trWaitAvg = 0;
     m_tRenderStart = 0;
+    m_iRenderHistory = 0;
+    m_nRenderHistory = 0;
+    m_trRenderPredicted = 0;
+    m_bRenderBound = FALSE;
     m_cFramesDrawn = 0;
     m_cFramesDropped = 0;
-    m_iTotAcc = 0;
-    m_iSumSqAcc = 0;
-    m_iSumSqFrameTime = 0;
+    m_SyncOffsetStats.Reset();
+    m_FrameTimeStats.Reset();
     m_trFrame = 0;          // hygeine - not really needed
     m_trLate = 0;           // hygeine - not really needed
-    m_iSumFrameTime = 0;
     m_nNormal = 0;
     m_trEarliness = 0;
     m_trTarget = -300000;  // 30mSec early
@@ -1955,12 +1967,11 @@ void CBaseVideoRenderer::PreparePerformanceData(int trLate, int trFrame)
 
 
 // update the statistics:
-// m_iTotAcc, m_iSumSqAcc, m_iSumSqFrameTime, m_iSumFrameTime, m_cFramesDrawn
-// Note that because the properties page reports using these variables,
-// 1. We need to be inside a critical section
-// 2. They must all be updated together.  Updating the sums here and the count
-// elsewhere can result in imaginary jitter (i.e. attempts to find square roots
-// of negative numbers) in the property page code.
+// m_SyncOffsetStats, m_FrameTimeStats, m_cFramesDrawn
+// The statistics objects allow one writer at a time, so we need to be
+// inside a critical section.  The property page reads them without locks;
+// each keeps its own count, so the deviations are always consistent with
+// the observations they were computed from.
 
 void CBaseVideoRenderer::RecordFrameLateness(int trLate, int trFrame)
 {
@@ -1988,8 +1999,7 @@ void CBaseVideoRenderer::RecordFrameLateness(int trLate, int trFrame)
     // The very first frame often has a invalid time, so don't
     // count it into the statistics.   (???)
     if (m_cFramesDrawn>1) {
-        m_iTotAcc += tLate;
-        m_iSumSqAcc += (tLate*tLate);
+        m_SyncOffsetStats.Add(tLate);
     }
 
     // calculate inter-frame time.  Doesn't make sense for first frame
@@ -2001,9 +2011,7 @@ void CBaseVideoRenderer::RecordFrameLateness(int trLate, int trFrame)
         // a very long inter-frame time) and it overflows at 2**31/10**7
         // or about 215 seconds i.e. 3min 35sec
         if (tFrame>1000||tFrame<0) tFrame = 1000;
-        m_iSumSqFrameTime += tFrame*tFrame;
-        ASSERT(m_iSumSqFrameTime>=0);
-        m_iSumFrameTime += tFrame;
+        m_FrameTimeStats.Add(tFrame);
     }
     ++m_cFramesDrawn;
 
@@ -2036,6 +2044,7 @@ void CBaseVideoRenderer::OnDirectRender(IMediaSample *pMediaSample)
     m_trRenderLast = 5000000;  // If we mode switch, we do NOT want this
                                // to inhibit the new average getting going!
                                // so we set it to half a second
+    m_nRenderHistory = 0;
     // MSR_INTEGER(m_idRenderAvg, m_trRenderAvg/10000);
     RecordFrameLateness(m_trLate, m_trFrame);
     ThrottleWait();
@@ -2055,24 +2064,72 @@ void CBaseVideoRenderer::OnRenderStart(IMediaSample *pMediaSample)
 
 
 // Called directly after drawing an image.  We calculate the time spent in the
-// drawing code and if this doesn't appear to have any odd looking spikes in
-// it then we add it to the current average draw time.  Measurement spikes may
-// occur if the drawing thread is interrupted and switched to somewhere else.
+// drawing code and record it.
 
 void CBaseVideoRenderer::OnRenderEnd(IMediaSample *pMediaSample)
+{
+    int tr = (timeGetTime() - m_tRenderStart)*10000;   // convert mSec->UNITS
+    RecordRenderTime(tr);
+    ThrottleWait();
+} // OnRenderEnd
+
+
+// If a render time doesn't appear to have any odd looking spikes in it then
+// we add it to the current average draw time and the history the next one
+// is predicted from.  Measurement spikes may occur if the drawing thread is
+// interrupted and switched to somewhere else.
+
+void CBaseVideoRenderer::RecordRenderTime(int tr)
 {
     // The renderer time can vary erratically if we are interrupted so we do
     // some smoothing to help get more sensible figures out but even that is
     // not enough as figures can go 9,10,9,9,83,9 and we must disregard 83
 
-    int tr = (timeGetTime() - m_tRenderStart)*10000;   // convert mSec->UNITS
     if (tr < m_trRenderAvg*2 || tr < 2 * m_trRenderLast) {
         // DO_MOVING_AVG(m_trRenderAvg, tr);
         m_trRenderAvg = (tr + (AVGPERIOD-1)*m_trRenderAvg)/AVGPERIOD;
+
+        m_trRenderHistory[m_iRenderHistory] = tr;
+        m_iRenderHistory = (m_iRenderHistory + 1) % RENDER_HISTORY;
+        if (m_nRenderHistory < RENDER_HISTORY) {
+            m_nRenderHistory++;
+        }
     }
     m_trRenderLast = tr;
-    ThrottleWait();
-} // OnRenderEnd
+} // RecordRenderTime
+
+
+// Predict how long drawing this sample will take.  We take the mean of the
+// recent render times and add their mean deviation, so that content whose
+// cost jumps about is treated as costly.  The samples we get are
+// uncompressed, so their data length says nothing about the cost of
+// drawing them; a derived renderer that knows better can override this.
+// Until we have measured anything we fall back on the moving average.
+
+int CBaseVideoRenderer::PredictRenderTime(IMediaSample *pMediaSample)
+{
+    UNREFERENCED_PARAMETER(pMediaSample);
+
+    const int n = m_nRenderHistory;
+    if (n == 0) {
+        return m_trRenderAvg;
+    }
+
+    LONGLONG llSum = 0;
+    for (int i = 0; i < n; i++) {
+        llSum += m_trRenderHistory[i];
+    }
+    const int trMean = (int)(llSum / n);
+
+    int trDev = 0;
+    for (int i = 0; i < n; i++) {
+        const int d = m_trRenderHistory[i] - trMean;
+        trDev += d < 0 ? -d : d;
+    }
+    trDev /= n;
+
+    return trMean + trDev;
+} // PredictRenderTime
 
 
 STDMETHODIMP CBaseVideoRenderer::SetSink( IQualityControl * piqc)
@@ -2372,6 +2429,19 @@ HRESULT CBaseVideoRenderer::ShouldDrawSampleNow(IMediaSample *pMediaSample,
         }
     }
 
+    // Is the time we spend drawing a large enough share of the frame time
+    // for dropping frames here to help?  We go by the predicted cost of
+    // this frame, and use hysteresis: we start treating rendering as the
+    // bottleneck above a third of the inter-frame time, but only stop
+    // below a quarter.  Without it a cost near the threshold makes us
+    // alternate between dropping and catching up.
+    m_trRenderPredicted = PredictRenderTime(pMediaSample);
+    if (m_bRenderBound) {
+        m_bRenderBound = (m_iRenderBoundLeave*m_trRenderPredicted > m_trFrameAvg);
+    } else {
+        m_bRenderBound = (m_iRenderBoundEnter*m_trRenderPredicted > m_trFrameAvg);
+    }
+
     MSR_INTEGER(m_idEarliness, m_trEarliness/10000);
     MSR_INTEGER(m_idRenderAvg, m_trRenderAvg/10000);
     MSR_INTEGER(m_idFrameAvg, m_trFrameAvg/10000);
@@ -2429,9 +2499,9 @@ HRESULT CBaseVideoRenderer::ShouldDrawSampleNow(IMediaSample *pMediaSample,
 
     // We will DRAW this frame IF...
     if (
-          // ...the time we are spending drawing is a small fraction of the total
-          // observed inter-frame time so that dropping it won't help much.
-          (3*m_trRenderAvg <= m_trFrameAvg)
+          // ...the time we expect to spend drawing is a small fraction of the
+          // total observed inter-frame time so that dropping it won't help much.
+          !m_bRenderBound
 
          // ...or our supplier is NOT handling things and the next frame would
          // be less timely than this one or our supplier CLAIMS to be handling
@@ -2696,12 +2766,10 @@ STDMETHODIMP CBaseVideoRenderer::get_AvgSyncOffset(__out int *piAvg)
     }
 
     // Note that we didn't gather the stats on the first frame
-    // so we use m_cFramesDrawn-1 here
-    if (m_cFramesDrawn<=1) {
-        *piAvg = 0;
-    } else {
-        *piAvg = (int)(m_iTotAcc / (m_cFramesDrawn-1));
-    }
+    LONGLONG llCount;
+    double dMean, dVariance;
+    m_SyncOffsetStats.GetStatistics(&llCount, &dMean, &dVariance);
+    *piAvg = (int)dMean;
     return NOERROR;
 } // get_AvgSyncOffset
 
@@ -2752,10 +2820,8 @@ int isqrt(int x)
 //  statistics
 //
 HRESULT CBaseVideoRenderer::GetStdDev(
-    int nSamples,
-    __out int *piResult,
-    LONGLONG llSumSq,
-    LONGLONG iTot
+    const CStreamingStats &Stats,
+    __out int *piResult
 )
 {
     CheckPointer(piResult,E_POINTER);
@@ -2766,38 +2832,67 @@ HRESULT CBaseVideoRenderer::GetStdDev(
         return NOERROR;
     }
 
-    // If S is the Sum of the Squares of observations and
-    //    T the Total (i.e. sum) of the observations and there were
-    //    N observations, then an estimate of the standard deviation is
-    //      sqrt( (S - T**2/N) / (N-1) )
+    // The statistics keep a running mean and sum of squared differences
+    // from it, so unlike (S - T**2/N) / (N-1) from raw sums the variance
+    // does not lose precision as the sums grow.  The observations are
+    // clamped to +-1000 mSec, so the variance fits an int.
 
-    if (nSamples<=1) {
+    LONGLONG llCount;
+    double dMean, dVariance;
+    Stats.GetStatistics(&llCount, &dMean, &dVariance);
+    if (llCount<=1) {
         *piResult = 0;
     } else {
-        LONGLONG x;
-        // First frames have invalid stamps, so we get no stats for them
-        // So we need 2 frames to get 1 datum, so N is cFramesDrawn-1
-
-        // so we use m_cFramesDrawn-1 here
-        x = llSumSq - llMulDiv(iTot, iTot, nSamples, 0);
-        x = x / (nSamples-1);
-        ASSERT(x>=0);
-        *piResult = isqrt((LONG)x);
+        ASSERT(dVariance>=0);
+        *piResult = isqrt((int)(dVariance + 0.5));
     }
     return NOERROR;
 }
 
+HRESULT CBaseVideoRenderer::GetPercentiles(
+    const CStreamingStats &Stats,
+    __out int *piP50,
+    __out int *piP95,
+    __out int *piP99
+)
+{
+    CheckPointer(piP50,E_POINTER);
+    CheckPointer(piP95,E_POINTER);
+    CheckPointer(piP99,E_POINTER);
+
+    *piP50 = Stats.GetPercentile(50);
+    *piP95 = Stats.GetPercentile(95);
+    *piP99 = Stats.GetPercentile(99);
+    return NOERROR;
+}
+
+// Percentiles of the sync offset of the frames drawn since streaming started
+
+HRESULT CBaseVideoRenderer::GetSyncOffsetPercentiles(
+    __out int *piP50,
+    __out int *piP95,
+    __out int *piP99)
+{
+    return GetPercentiles(m_SyncOffsetStats, piP50, piP95, piP99);
+}
+
+// Percentiles of the inter-frame time of the frames drawn since streaming started
+
+HRESULT CBaseVideoRenderer::GetFrameTimePercentiles(
+    __out int *piP50,
+    __out int *piP95,
+    __out int *piP99)
+{
+    return GetPercentiles(m_FrameTimeStats, piP50, piP95, piP99);
+}
+
 // Set *piDev to the standard deviation in mSec of the sync offset
 // of each frame since streaming started.
 
 STDMETHODIMP CBaseVideoRenderer::get_DevSyncOffset(__out int *piDev)
 {
     // First frames have invalid stamps, so we get no stats for them
-    // So we need 2 frames to get 1 datum, so N is cFramesDrawn-1
-    return GetStdDev(m_cFramesDrawn - 1,
-                     piDev,
-                     m_iSumSqAcc,
-                     m_iTotAcc);
+    return GetStdDev(m_SyncOffsetStats, piDev);
 } // get_DevSyncOffset
 
 
@@ -2808,11 +2903,7 @@ STDMETHODIMP CBaseVideoRenderer::get_Jitter(__out int *piJitter)
 {
     // First frames have invalid stamps, so we get no stats for them
     // So second frame gives invalid inter-frame time
-    // So we need 3 frames to get 1 datum, so N is cFramesDrawn-2
-    return GetStdDev(m_cFramesDrawn - 2,
-                     piJitter,
-                     m_iSumSqFrameTime,
-                     m_iSumFrameTime);
+    return GetStdDev(m_FrameTimeStats, piJitter);
 } // get_Jitter
 
 
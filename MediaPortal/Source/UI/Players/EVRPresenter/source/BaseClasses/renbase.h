@@ -247,6 +247,15 @@ public:
 #define DO_MOVING_AVG(avg,obs) (avg = (1024*obs + (AVGPERIOD-1)*avg)/AVGPERIOD)
 // Spot the bug in this macro - I can't. but it doesn't work!
 
+// the number of recent render times the render cost is predicted from
+#define RENDER_HISTORY 8
+
+// rendering becomes the bottleneck when the predicted render time exceeds
+// 1/RENDER_BOUND_ENTER of the frame time, and stops being it when the
+// prediction falls below 1/RENDER_BOUND_LEAVE of it
+#define RENDER_BOUND_ENTER 3
+#define RENDER_BOUND_LEAVE 4
+
 class CBaseVideoRenderer : public CBaseRenderer,    // Base renderer class
                            public IQualProp,        // Property page guff
                            public IQualityControl   // Allow throttling
@@ -315,6 +324,22 @@ protected:
     int m_tRenderStart;             // Just before we started drawing (mSec)
                                     // derived from timeGetTime.
 
+    // The average alone follows content with a varying render cost too
+    // slowly and too eagerly at the same time: one cheap frame in a run of
+    // expensive ones is enough to stop us dropping.  So we also keep the
+    // last few render times, predict the cost of the next frame from their
+    // mean and spread (PredictRenderTime), and only change our mind about
+    // whether rendering is the bottleneck when the prediction has moved
+    // well past the threshold.
+    int m_trRenderHistory[RENDER_HISTORY];  // Recent blt times
+    int m_iRenderHistory;           // Next slot to record into
+    int m_nRenderHistory;           // Slots recorded (up to RENDER_HISTORY)
+    int m_trRenderPredicted;        // Predicted blt time for this frame
+    BOOL m_bRenderBound;            // Drawing takes enough of the frame time
+                                    // that dropping here will help
+    int m_iRenderBoundEnter;        // RENDER_BOUND_ENTER unless a derived
+    int m_iRenderBoundLeave;        // renderer knows better
+
     // When frames are dropped we will play the next frame as early as we can.
     // If it was a false alarm and the machine is fast we slide gently back to
     // normal timing.  To do this, we record the offset showing just how early
@@ -344,7 +369,7 @@ protected:
     int m_trFrameAvg;               // Average inter-frame time
     int m_trDuration;               // duration of last frame.
 
-#ifdef PERF
+#ifdef MSR_ENABLED
     // Performance logging identifiers
     int m_idTimeStamp;              // MSR_id for frame time stamp
     int m_idEarliness;              // MSR_id for earliness fudge
@@ -361,15 +386,15 @@ protected:
     int m_idThrottle;               // MSR_id for audio-video throttling
     //int m_idDebug;                  // MSR_id for trace style debugging
     //int m_idSendQuality;          // MSR_id for timing the notifications per se
-#endif // PERF
-    REFERENCE_TIME m_trRememberStampForPerf;  // original time stamp of frame
-                                              // with no earliness fudges etc.
-#ifdef PERF
-    REFERENCE_TIME m_trRememberFrameForPerf;  // time when previous frame rendered
 
     // debug...
     int m_idFrameAvg;
     int m_idWaitAvg;
+#endif // MSR_ENABLED
+    REFERENCE_TIME m_trRememberStampForPerf;  // original time stamp of frame
+                                              // with no earliness fudges etc.
+#ifdef PERF
+    REFERENCE_TIME m_trRememberFrameForPerf;  // time when previous frame rendered
 #endif
 
     // PROPERTY PAGE
@@ -380,14 +405,12 @@ protected:
     int m_cFramesDrawn;             // Frames since streaming started seen BY THE
                                     // RENDERER (some may be dropped upstream)
 
-    // Next two support average sync offset and standard deviation of sync offset.
-    LONGLONG m_iTotAcc;                  // Sum of accuracies in mSec
-    LONGLONG m_iSumSqAcc;           // Sum of squares of (accuracies in mSec)
+    // Average, standard deviation and percentiles of the sync offset.
+    CStreamingStats m_SyncOffsetStats;  // Accuracies in mSec
 
-    // Next two allow jitter calculation.  Jitter is std deviation of frame time.
+    // Jitter is the standard deviation of the inter-frame time.
     REFERENCE_TIME m_trLastDraw;    // Time of prev frame (for inter-frame times)
-    LONGLONG m_iSumSqFrameTime;     // Sum of squares of (inter-frame time in mSec)
-    LONGLONG m_iSumFrameTime;            // Sum of inter-frame times in mSec
+    CStreamingStats m_FrameTimeStats;   // Inter-frame times in mSec
 
     // To get performance statistics on frame rate, jitter etc, we need
     // to record the lateness and inter-frame time.  What we actually need are the
@@ -423,6 +446,7 @@ public:
 
     void OnRenderStart(IMediaSample *pMediaSample);
     void OnRenderEnd(IMediaSample *pMediaSample);
+    void RecordRenderTime(int tr);
     void OnWaitStart();
     void OnWaitEnd();
     HRESULT OnStartStreaming();
@@ -433,6 +457,7 @@ public:
 
     void PreparePerformanceData(int trLate, int trFrame);
     virtual void RecordFrameLateness(int trLate, int trFrame);
+    virtual int PredictRenderTime(IMediaSample *pMediaSample);
     virtual void OnDirectRender(IMediaSample *pMediaSample);
     virtual HRESULT ResetStreamingTimes();
     BOOL ScheduleSample(IMediaSample *pMediaSample);
@@ -447,15 +472,22 @@ public:
     //  Do estimates for standard deviations for per-frame
     //  statistics
     //
-    //  *piResult = (llSumSq - iTot * iTot / m_cFramesDrawn - 1) /
-    //                            (m_cFramesDrawn - 2)
-    //  or 0 if m_cFramesDrawn <= 3
+    //  *piResult = sqrt(sample variance of Stats)
+    //  or 0 if there are fewer than 2 observations
     //
     HRESULT GetStdDev(
-        int nSamples,
-        __out int *piResult,
-        LONGLONG llSumSq,
-        LONGLONG iTot
+        const CStreamingStats &Stats,
+        __out int *piResult
+    );
+
+    // Median, 95th and 99th percentile in mSec since streaming started
+    HRESULT GetSyncOffsetPercentiles(__out int *piP50, __out int *piP95, __out int *piP99);
+    HRESULT GetFrameTimePercentiles(__out int *piP50, __out int *piP95, __out int *piP99);
+    HRESULT GetPercentiles(
+        const CStreamingStats &Stats,
+        __out int *piP50,
+        __out int *piP95,
+        __out int *piP99
     );
 public:
 
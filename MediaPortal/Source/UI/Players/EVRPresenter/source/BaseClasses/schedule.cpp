@@ -19,43 +19,33 @@
 
 CAMSchedule::CAMSchedule( HANDLE ev )
 : CBaseObject(TEXT("CAMSchedule"))
-, head(&z, 0), z(0, MAX_TIME)
+, m_ppHeap(0), m_dwHeapSize(0)
+, m_ppPackets(0), m_dwPacketCount(0), m_dwPacketsSize(0)
+, m_ppCookies(0), m_dwCookiesSize(0)
 , m_dwNextCookie(0), m_dwAdviseCount(0)
 , m_pAdviseCache(0), m_dwCacheCount(0)
 , m_ev( ev )
 {
-    head.m_dwAdviseCookie = z.m_dwAdviseCookie = 0;
 }
 
 CAMSchedule::~CAMSchedule()
 {
     m_Serialize.Lock();
 
-    // Delete cache
-    CAdvisePacket * p = m_pAdviseCache;
-    while (p)
-    {
-        CAdvisePacket *const p_next = p->m_next;
-        delete p;
-        p = p_next;
-    }
-
     ASSERT( m_dwAdviseCount == 0 );
-    // Better to be safe than sorry
     if ( m_dwAdviseCount > 0 )
     {
         DumpLinkedList();
-        while ( !head.m_next->IsZ() )
-        {
-            head.DeleteNext();
-            --m_dwAdviseCount;
-        }
     }
 
-    // If, in the debug version, we assert twice, it means, not only
-    // did we have left over advises, but we have also let m_dwAdviseCount
-    // get out of sync. with the number of advises actually on the list.
-    ASSERT( m_dwAdviseCount == 0 );
+    // All packets, whether scheduled or pooled, are in m_ppPackets
+    for ( DWORD i = 0; i < m_dwPacketCount; i++ )
+    {
+        delete m_ppPackets[i];
+    }
+    delete [] m_ppPackets;
+    delete [] m_ppHeap;
+    delete [] m_ppCookies;
 
     m_Serialize.Unlock();
 }
@@ -70,8 +60,8 @@ DWORD CAMSchedule::GetAdviseCount()
 
 REFERENCE_TIME CAMSchedule::GetNextAdviseTime()
 {
-    CAutoLock lck(&m_Serialize); // Need to stop the linked list from changing
-    return head.m_next->m_rtEventTime;
+    CAutoLock lck(&m_Serialize); // Need to stop the heap from changing
+    return m_dwAdviseCount ? m_ppHeap[0]->m_rtEventTime : MAX_TIME;
 }
 
 DWORD_PTR CAMSchedule::AddAdvisePacket
@@ -80,7 +70,7 @@ DWORD_PTR CAMSchedule::AddAdvisePacket
 , HANDLE h, BOOL periodic
 )
 {
-    // Since we use MAX_TIME as a sentry, we can't afford to
+    // Since we use MAX_TIME to say "nothing scheduled", we can't afford to
     // schedule a notification at MAX_TIME
     ASSERT( time1 < MAX_TIME );
     DWORD_PTR Result;
@@ -88,21 +78,13 @@ DWORD_PTR CAMSchedule::AddAdvisePacket
 
     m_Serialize.Lock();
 
-    if (m_pAdviseCache)
-    {
-        p = m_pAdviseCache;
-        m_pAdviseCache = p->m_next;
-        --m_dwCacheCount;
-    }
-    else
-    {
-        p = new CAdvisePacket();
-    }
+    p = NewPacket();
     if (p)
     {
         p->m_rtEventTime = time1; p->m_rtPeriod = time2;
         p->m_hNotify = h; p->m_bPeriodic = periodic;
         Result = AddAdvisePacket( p );
+        if (Result == 0) Delete( p );
     }
     else Result = 0;
 
@@ -114,36 +96,27 @@ DWORD_PTR CAMSchedule::AddAdvisePacket
 HRESULT CAMSchedule::Unadvise(DWORD_PTR dwAdviseCookie)
 {
     HRESULT hr = S_FALSE;
-    CAdvisePacket * p_prev = &head;
-    CAdvisePacket * p_n;
+
     m_Serialize.Lock();
-    while ( p_n = p_prev->Next() ) // The Next() method returns NULL when it hits z
+
+    // Only scheduled packets are in the cookie table.  If the advise has
+    // fired already we don't find it, even if its packet has been reused.
+    CAdvisePacket *const p = FindCookie( dwAdviseCookie );
+    if ( p )
     {
-        if ( p_n->m_dwAdviseCookie == dwAdviseCookie )
-        {
-            Delete( p_prev->RemoveNext() );
-            --m_dwAdviseCount;
-            hr = S_OK;
-	    // Having found one cookie that matches, there should be no more
-            #ifdef DEBUG
-	       while (p_n = p_prev->Next())
-               {
-                   ASSERT(p_n->m_dwAdviseCookie != dwAdviseCookie);
-                   p_prev = p_n;
-               }
-            #endif
-            break;
-        }
-        p_prev = p_n;
-    };
+        RemoveAt( p->m_dwHeapIndex );
+        Delete( p );
+        hr = S_OK;
+    }
+
     m_Serialize.Unlock();
     return hr;
 }
 
 REFERENCE_TIME CAMSchedule::Advise( const REFERENCE_TIME & rtTime )
 {
-    REFERENCE_TIME  rtNextTime;
-    CAdvisePacket * pAdvise;
+    REFERENCE_TIME  rtNextTime = MAX_TIME;
+    DWORD_PTR       dwNextCookie = 0;
 
     DbgLog((LOG_TIMING, 2,
         TEXT("CAMSchedule::Advise( %lu ms )"), ULONG(rtTime / (UNITS / MILLISECONDS))));
@@ -155,10 +128,14 @@ REFERENCE_TIME CAMSchedule::Advise( const REFERENCE_TIME & rtTime )
     #endif
 
     //  Note - DON'T cache the difference, it might overflow 
-    while ( rtTime >= (rtNextTime = (pAdvise=head.m_next)->m_rtEventTime) &&
-            !pAdvise->IsZ() )
+    while ( m_dwAdviseCount > 0 )
     {
-        ASSERT(pAdvise->m_dwAdviseCookie); // If this is zero, its the head or the tail!!
+        CAdvisePacket *const pAdvise = m_ppHeap[0];
+        rtNextTime = pAdvise->m_rtEventTime;
+        dwNextCookie = pAdvise->m_dwAdviseCookie;
+        if ( rtTime < rtNextTime ) break;
+
+        ASSERT(pAdvise->m_dwAdviseCookie);
 
         ASSERT(pAdvise->m_hNotify != INVALID_HANDLE_VALUE);
 
@@ -166,21 +143,28 @@ REFERENCE_TIME CAMSchedule::Advise( const REFERENCE_TIME & rtTime )
         {
             ReleaseSemaphore(pAdvise->m_hNotify,1,NULL);
             pAdvise->m_rtEventTime += pAdvise->m_rtPeriod;
-            ShuntHead();
+
+            // Reposition the root - it can only have moved down
+            ASSERT( pAdvise->m_rtEventTime < MAX_TIME );
+            SiftDown( 0 );
+            DbgLog((LOG_TIMING, 2, TEXT("Periodic advise %lu, shunted to %lu"),
+                pAdvise->m_dwAdviseCookie, (pAdvise->m_rtEventTime / (UNITS / MILLISECONDS)) ));
         }
         else
         {
             ASSERT( pAdvise->m_bPeriodic == FALSE );
             EXECUTE_ASSERT(SetEvent(pAdvise->m_hNotify));
-            --m_dwAdviseCount;
-            Delete( head.RemoveNext() );
+            RemoveAt( 0 );
+            Delete( pAdvise );
         }
 
+        rtNextTime = MAX_TIME;
+        dwNextCookie = 0;
     }
 
     DbgLog((LOG_TIMING, 3,
             TEXT("CAMSchedule::Advise() Next time stamp: %lu ms, for advise %lu."),
-            DWORD(rtNextTime / (UNITS / MILLISECONDS)), pAdvise->m_dwAdviseCookie ));
+            DWORD(rtNextTime / (UNITS / MILLISECONDS)), dwNextCookie ));
 
     return rtNextTime;
 }
@@ -192,72 +176,243 @@ DWORD_PTR CAMSchedule::AddAdvisePacket( __inout CAdvisePacket * pPacket )
     ASSERT(pPacket->m_rtEventTime >= 0 && pPacket->m_rtEventTime < MAX_TIME);
     ASSERT(CritCheckIn(&m_Serialize));
 
-    CAdvisePacket * p_prev = &head;
-    CAdvisePacket * p_n;
-
-    const DWORD_PTR Result = pPacket->m_dwAdviseCookie = ++m_dwNextCookie;
-    // This relies on the fact that z is a sentry with a maximal m_rtEventTime
-    for(;;p_prev = p_n)
+    if ( m_dwAdviseCount == m_dwHeapSize && !GrowHeap() )
     {
-        p_n = p_prev->m_next;
-        if ( p_n->m_rtEventTime >= pPacket->m_rtEventTime ) break;
+        return 0;
+    }
+    if ( 2 * (m_dwAdviseCount + 1) > m_dwCookiesSize && !GrowCookies() )
+    {
+        return 0;
     }
-    p_prev->InsertAfter( pPacket );
-    ++m_dwAdviseCount;
+
+    // Never hand out 0, that means failure.  After the serial wrapped
+    // (only possible with a 32 bit DWORD_PTR) skip cookies that are
+    // still scheduled.
+    DWORD_PTR Result;
+    do
+    {
+        Result = ++m_dwNextCookie;
+    } while ( Result == 0 || FindCookie( Result ) );
+    pPacket->m_dwAdviseCookie = Result;
+    InsertCookie( pPacket );
+
+    Place( pPacket, m_dwAdviseCount++ );
+    SiftUp( pPacket->m_dwHeapIndex );
 
     DbgLog((LOG_TIMING, 2, TEXT("Added advise %lu, for thread 0x%02X, scheduled at %lu"),
     	pPacket->m_dwAdviseCookie, GetCurrentThreadId(), (pPacket->m_rtEventTime / (UNITS / MILLISECONDS)) ));
 
     // If packet added at the head, then clock needs to re-evaluate wait time.
-    if ( p_prev == &head ) SetEvent( m_ev );
+    if ( pPacket->m_dwHeapIndex == 0 ) SetEvent( m_ev );
 
     return Result;
 }
 
-void CAMSchedule::Delete( __inout CAdvisePacket * pPacket )
+// Doubles the size of the heap
+BOOL CAMSchedule::GrowHeap()
 {
-    if ( m_dwCacheCount >= dwCacheMax ) delete pPacket;
-    else
+    const DWORD dwNewSize = m_dwHeapSize ? 2 * m_dwHeapSize : 16;
+    CAdvisePacket ** ppNew = new CAdvisePacket * [dwNewSize];
+    if (ppNew == NULL)
     {
-        m_Serialize.Lock();
-        pPacket->m_next = m_pAdviseCache;
-        m_pAdviseCache = pPacket;
-        ++m_dwCacheCount;
-        m_Serialize.Unlock();
+        return FALSE;
     }
+    if (m_ppHeap)
+    {
+        CopyMemory( ppNew, m_ppHeap, m_dwAdviseCount * sizeof(CAdvisePacket *) );
+        delete [] m_ppHeap;
+    }
+    m_ppHeap = ppNew;
+    m_dwHeapSize = dwNewSize;
+    return TRUE;
 }
 
+// Moves element i up until its parent expires no later than it does
+void CAMSchedule::SiftUp( DWORD i )
+{
+    CAdvisePacket *const pPacket = m_ppHeap[i];
+    while ( i > 0 )
+    {
+        const DWORD parent = (i - 1) / 2;
+        if ( m_ppHeap[parent]->m_rtEventTime <= pPacket->m_rtEventTime ) break;
+        Place( m_ppHeap[parent], i );
+        i = parent;
+    }
+    Place( pPacket, i );
+}
 
-// Takes the head of the list & repositions it
-void CAMSchedule::ShuntHead()
+// Moves element i down until its children expire no earlier than it does
+void CAMSchedule::SiftDown( DWORD i )
 {
-    CAdvisePacket * p_prev = &head;
-    CAdvisePacket * p_n;
+    CAdvisePacket *const pPacket = m_ppHeap[i];
+    for (;;)
+    {
+        DWORD child = 2 * i + 1;
+        if ( child >= m_dwAdviseCount ) break;
+        if ( child + 1 < m_dwAdviseCount &&
+             m_ppHeap[child + 1]->m_rtEventTime < m_ppHeap[child]->m_rtEventTime )
+        {
+            child++;
+        }
+        if ( pPacket->m_rtEventTime <= m_ppHeap[child]->m_rtEventTime ) break;
+        Place( m_ppHeap[child], i );
+        i = child;
+    }
+    Place( pPacket, i );
+}
 
-    m_Serialize.Lock();
-    CAdvisePacket *const pPacket = head.m_next;
+// Takes element i out of the heap; the last element takes its place.
+// Its cookie is no longer valid after this.
+void CAMSchedule::RemoveAt( DWORD i )
+{
+    ASSERT( i < m_dwAdviseCount );
 
-    // This will catch both an empty list,
-    // and if somehow a MAX_TIME time gets into the list
-    // (which would also break this method).
-    ASSERT( pPacket->m_rtEventTime < MAX_TIME );
+    CAdvisePacket *const pPacket = m_ppHeap[i];
+    pPacket->m_dwHeapIndex = dwNotScheduled;
+    RemoveCookie( pPacket->m_dwAdviseCookie );
 
-    // This relies on the fact that z is a sentry with a maximal m_rtEventTime
-    for(;;p_prev = p_n)
+    const DWORD last = --m_dwAdviseCount;
+    if ( i != last )
     {
-        p_n = p_prev->m_next;
-        if ( p_n->m_rtEventTime > pPacket->m_rtEventTime ) break;
+        Place( m_ppHeap[last], i );
+        if ( i > 0 && m_ppHeap[i]->m_rtEventTime < m_ppHeap[(i - 1) / 2]->m_rtEventTime )
+        {
+            SiftUp( i );
+        }
+        else
+        {
+            SiftDown( i );
+        }
     }
-    // If p_prev == pPacket then we're already in the right place
-    if (p_prev != pPacket)
+}
+
+// Doubles the size of the cookie table and re-inserts the scheduled packets
+BOOL CAMSchedule::GrowCookies()
+{
+    const DWORD dwNewSize = m_dwCookiesSize ? 2 * m_dwCookiesSize : 32;
+    CAdvisePacket ** ppNew = new CAdvisePacket * [dwNewSize];
+    if (ppNew == NULL)
     {
-        head.m_next = pPacket->m_next;
-        (p_prev->m_next = pPacket)->m_next = p_n;
+        return FALSE;
     }
-    #ifdef DEBUG
-        DbgLog((LOG_TIMING, 2, TEXT("Periodic advise %lu, shunted to %lu"),
-    	    pPacket->m_dwAdviseCookie, (pPacket->m_rtEventTime / (UNITS / MILLISECONDS)) ));
-    #endif
+    ZeroMemory( ppNew, dwNewSize * sizeof(CAdvisePacket *) );
+
+    delete [] m_ppCookies;
+    m_ppCookies = ppNew;
+    m_dwCookiesSize = dwNewSize;
+
+    for ( DWORD i = 0; i < m_dwAdviseCount; i++ )
+    {
+        InsertCookie( m_ppHeap[i] );
+    }
+    return TRUE;
+}
+
+// Returns the scheduled packet with this cookie, or NULL
+CAMSchedule::CAdvisePacket * CAMSchedule::FindCookie( DWORD_PTR dwCookie )
+{
+    if ( dwCookie == 0 || m_dwCookiesSize == 0 )
+    {
+        return NULL;
+    }
+
+    // Cookies are consecutive numbers, so they spread evenly over the table
+    const DWORD dwMask = m_dwCookiesSize - 1;
+    for ( DWORD i = DWORD(dwCookie) & dwMask; m_ppCookies[i]; i = (i + 1) & dwMask )
+    {
+        if ( m_ppCookies[i]->m_dwAdviseCookie == dwCookie )
+        {
+            return m_ppCookies[i];
+        }
+    }
+    return NULL;
+}
+
+// Adds a packet to the cookie table.  The table must have room.
+void CAMSchedule::InsertCookie( __in CAdvisePacket * pPacket )
+{
+    const DWORD dwMask = m_dwCookiesSize - 1;
+    DWORD i = DWORD(pPacket->m_dwAdviseCookie) & dwMask;
+    while ( m_ppCookies[i] )
+    {
+        i = (i + 1) & dwMask;
+    }
+    m_ppCookies[i] = pPacket;
+}
+
+// Removes a cookie from the table.  The following entries of the probe
+// sequence are moved back, so lookups never need tombstones.
+void CAMSchedule::RemoveCookie( DWORD_PTR dwCookie )
+{
+    const DWORD dwMask = m_dwCookiesSize - 1;
+    DWORD i = DWORD(dwCookie) & dwMask;
+    while ( m_ppCookies[i]->m_dwAdviseCookie != dwCookie )
+    {
+        i = (i + 1) & dwMask;
+    }
+
+    for ( DWORD j = (i + 1) & dwMask; m_ppCookies[j]; j = (j + 1) & dwMask )
+    {
+        // An entry may fill the gap at i if its home slot is not in (i, j]
+        const DWORD dwHome = DWORD(m_ppCookies[j]->m_dwAdviseCookie) & dwMask;
+        if ( ((j - dwHome) & dwMask) >= ((j - i) & dwMask) )
+        {
+            m_ppCookies[i] = m_ppCookies[j];
+            i = j;
+        }
+    }
+    m_ppCookies[i] = NULL;
+}
+
+// Gets a packet from the pool, or allocates a new one
+CAMSchedule::CAdvisePacket * CAMSchedule::NewPacket()
+{
+    ASSERT(CritCheckIn(&m_Serialize));
+
+    if (m_pAdviseCache)
+    {
+        CAdvisePacket *const p = m_pAdviseCache;
+        m_pAdviseCache = p->m_next;
+        --m_dwCacheCount;
+        return p;
+    }
+
+    if ( m_dwPacketCount == m_dwPacketsSize )
+    {
+        const DWORD dwNewSize = m_dwPacketsSize ? 2 * m_dwPacketsSize : 16;
+        CAdvisePacket ** ppNew = new CAdvisePacket * [dwNewSize];
+        if (ppNew == NULL)
+        {
+            return NULL;
+        }
+        if (m_ppPackets)
+        {
+            CopyMemory( ppNew, m_ppPackets, m_dwPacketCount * sizeof(CAdvisePacket *) );
+            delete [] m_ppPackets;
+        }
+        m_ppPackets = ppNew;
+        m_dwPacketsSize = dwNewSize;
+    }
+
+    CAdvisePacket *const p = new CAdvisePacket();
+    if (p)
+    {
+        p->m_dwHeapIndex = dwNotScheduled;
+        p->m_dwAdviseCookie = 0;
+        m_ppPackets[m_dwPacketCount++] = p;
+    }
+    return p;
+}
+
+// Returns a packet to the pool
+void CAMSchedule::Delete( __inout CAdvisePacket * pPacket )
+{
+    ASSERT( pPacket->m_dwHeapIndex == dwNotScheduled );
+
+    m_Serialize.Lock();
+    pPacket->m_next = m_pAdviseCache;
+    m_pAdviseCache = pPacket;
+    ++m_dwCacheCount;
     m_Serialize.Unlock();
 }
 
@@ -266,17 +421,13 @@ void CAMSchedule::ShuntHead()
 void CAMSchedule::DumpLinkedList()
 {
     m_Serialize.Lock();
-    int i=0;
     DbgLog((LOG_TIMING, 1, TEXT("CAMSchedule::DumpLinkedList() this = 0x%p"), this));
-    for ( CAdvisePacket * p = &head
-        ; p
-        ; p = p->m_next         , i++
-        )	
+    for ( DWORD i = 0; i < m_dwAdviseCount; i++ )
     {
-        DbgLog((LOG_TIMING, 1, TEXT("Advise List # %lu, Cookie %d,  RefTime %lu"),
+        DbgLog((LOG_TIMING, 1, TEXT("Advise Heap # %lu, Cookie %d,  RefTime %lu"),
             i,
-	    p->m_dwAdviseCookie,
-	    p->m_rtEventTime / (UNITS / MILLISECONDS)
+	    m_ppHeap[i]->m_dwAdviseCookie,
+	    m_ppHeap[i]->m_rtEventTime / (UNITS / MILLISECONDS)
             ));
     }
     m_Serialize.Unlock();
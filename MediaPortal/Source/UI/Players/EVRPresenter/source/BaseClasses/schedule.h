@@ -34,67 +34,50 @@ public:
     HANDLE GetEvent() const { return m_ev; }
 
 private:
-    // We define the nodes that will be used in our singly linked list
-    // of advise packets.  The list is ordered by time, with the
-    // elements that will expire first at the front.
+    // We define the advise packets that are kept in a binary heap,
+    // ordered by time, with the element that will expire first at the
+    // root.  Packets are never deleted while the schedule exists; free
+    // packets are kept in a pool for future use.
     class CAdvisePacket
     {
     public:
         CAdvisePacket()
         {}
 
-        CAdvisePacket * m_next;
+        CAdvisePacket * m_next;             // Next free packet in the pool
         DWORD_PTR       m_dwAdviseCookie;
         REFERENCE_TIME  m_rtEventTime;      // Time at which event should be set
         REFERENCE_TIME  m_rtPeriod;         // Periodic time
         HANDLE          m_hNotify;          // Handle to event or semephore
         BOOL            m_bPeriodic;        // TRUE => Periodic event
-
-        CAdvisePacket( __inout_opt CAdvisePacket * next, LONGLONG time ) : m_next(next), m_rtEventTime(time)
-        {}
-
-        void InsertAfter( __inout CAdvisePacket * p )
-        {
-            p->m_next = m_next;
-            m_next    = p;
-        }
-
-        int IsZ() const // That is, is it the node that represents the end of the list
-        { return m_next == 0; }
-
-        CAdvisePacket * RemoveNext()
-        {
-            CAdvisePacket *const next = m_next;
-            CAdvisePacket *const new_next = next->m_next;
-            m_next = new_next;
-            return next;
-        }
-
-        void DeleteNext()
-        {
-            delete RemoveNext();
-        }
-
-        CAdvisePacket * Next() const
-        {
-            CAdvisePacket * result = m_next;
-            if (result->IsZ()) result = 0;
-            return result;
-        }
+        DWORD           m_dwHeapIndex;      // Index in m_ppHeap, or dwNotScheduled
 
         DWORD_PTR Cookie() const
         { return m_dwAdviseCookie; }
     };
 
-    // Structure is:
-    // head -> elmt1 -> elmt2 -> z -> null
-    // So an empty list is:       head -> z -> null
-    // Having head & z as links makes insertaion,
-    // deletion and shunting much easier.
-    CAdvisePacket   head, z;            // z is both a tail and a sentry
+    enum { dwNotScheduled = 0xFFFFFFFF };
+
+    // The heap: m_ppHeap[0] expires first, the children of element i
+    // are 2i+1 and 2i+2.  m_dwAdviseCount elements are in use.
+    CAdvisePacket ** m_ppHeap;
+    DWORD            m_dwHeapSize;      // Allocated size of m_ppHeap
 
-    volatile DWORD_PTR  m_dwNextCookie;     // Strictly increasing
-    volatile DWORD  m_dwAdviseCount;    // Number of elements on list
+    // All packets we have allocated
+    CAdvisePacket ** m_ppPackets;
+    DWORD            m_dwPacketCount;   // Number of packets allocated
+    DWORD            m_dwPacketsSize;   // Allocated size of m_ppPackets
+
+    // Cookies are a plain serial number, as wide as a DWORD_PTR, so a
+    // stale cookie can only match again after the serial wrapped.  The
+    // scheduled packets are found by cookie in a hash table (open
+    // addressing, linear probing).  Its size is a power of 2 and at least
+    // twice the number of scheduled packets, empty entries are NULL.
+    CAdvisePacket ** m_ppCookies;
+    DWORD            m_dwCookiesSize;
+
+    volatile DWORD_PTR  m_dwNextCookie;     // Last cookie handed out
+    volatile DWORD  m_dwAdviseCount;    // Number of elements in the heap
 
     CCritSec        m_Serialize;
 
@@ -103,17 +86,29 @@ private:
     // Event that we should set if the packed added above will be the next to fire.
     const HANDLE m_ev;
 
-    // A Shunt is where we have changed the first element in the
-    // list and want it re-evaluating (i.e. repositioned) in
-    // the list.
-    void ShuntHead();
+    // Heap maintenance
+    BOOL GrowHeap();
+    void SiftUp( DWORD i );
+    void SiftDown( DWORD i );
+    void RemoveAt( DWORD i );
+    void Place( __inout CAdvisePacket * pPacket, DWORD i )
+    {
+        m_ppHeap[i] = pPacket;
+        pPacket->m_dwHeapIndex = i;
+    }
+
+    // Cookie table maintenance
+    BOOL GrowCookies();
+    CAdvisePacket * FindCookie( DWORD_PTR dwCookie );
+    void InsertCookie( __in CAdvisePacket * pPacket );
+    void RemoveCookie( DWORD_PTR dwCookie );
 
-    // Rather than delete advise packets, we cache them for future use
+    // Rather than delete advise packets, we pool them for future use
     CAdvisePacket * m_pAdviseCache;
     DWORD           m_dwCacheCount;
-    enum { dwCacheMax = 5 };             // Don't bother caching more than five
 
-    void Delete( __inout CAdvisePacket * pLink );// This "Delete" will cache the Link
+    CAdvisePacket * NewPacket();            // From the pool, or a new one
+    void Delete( __inout CAdvisePacket * pLink );// This "Delete" will pool the Link
 
 // Attributes and methods for debugging
 public:
@@ -224,8 +224,17 @@ CSourceStream::CSourceStream(
     __inout CSource *ps,
     __in_opt LPCWSTR pPinName)
     : CBaseOutputPin(pObjectName, ps, ps->pStateLock(), phr, pPinName),
-      m_pFilter(ps) {
-
+      m_pFilter(ps),
+      m_nFillWorkers(0),
+      m_hSemFill(NULL),
+      m_hFilled(NULL),
+      m_lFillStop(FALSE),
+      m_lNextFill(0),
+      m_lIssued(0),
+      m_lDelivered(0) {
+
+     ZeroMemory(m_hFillThreads, sizeof(m_hFillThreads));
+     ZeroMemory(m_FillSlots, sizeof(m_FillSlots));
      *phr = m_pFilter->AddPin(this);
 }
 
@@ -236,8 +245,17 @@ CSourceStream::CSourceStream(
     __inout CSource *ps,
     __in_opt LPCWSTR pPinName)
     : CBaseOutputPin(pObjectName, ps, ps->pStateLock(), phr, pPinName),
-      m_pFilter(ps) {
-
+      m_pFilter(ps),
+      m_nFillWorkers(0),
+      m_hSemFill(NULL),
+      m_hFilled(NULL),
+      m_lFillStop(FALSE),
+      m_lNextFill(0),
+      m_lIssued(0),
+      m_lDelivered(0) {
+
+     ZeroMemory(m_hFillThreads, sizeof(m_hFillThreads));
+     ZeroMemory(m_FillSlots, sizeof(m_FillSlots));
      *phr = m_pFilter->AddPin(this);
 }
 #endif
@@ -462,6 +480,13 @@ HRESULT CSourceStream::DoBufferProcessingLoop(void) {
 
     OnThreadStartPlay();
 
+    if (m_nFillWorkers > 0) {
+        if (SUCCEEDED(StartFillWorkers())) {
+            return DoPipelinedBufferProcessingLoop();
+        }
+        DbgLog((LOG_ERROR, 1, TEXT("Could not start fill workers, filling on the stream thread")));
+    }
+
     do {
 	while (!CheckRequest(&com)) {
 
@@ -520,3 +545,221 @@ HRESULT CSourceStream::DoBufferProcessingLoop(void) {
     return S_FALSE;
 }
 
+
+//
+// SetFillWorkers
+//
+// Sets the number of threads that fill buffers, 0 to fill them on the
+// stream thread. Can't be changed while the worker thread exists.
+HRESULT CSourceStream::SetFillWorkers(int nWorkers) {
+
+    CAutoLock lock(m_pFilter->pStateLock());
+
+    if (nWorkers < 0 || nWorkers > SOURCE_MAX_FILL_WORKERS) {
+        return E_INVALIDARG;
+    }
+    if (ThreadExists()) {
+        return VFW_E_WRONG_STATE;
+    }
+    m_nFillWorkers = nWorkers;
+    return NOERROR;
+}
+
+
+//
+// FillWorkerProc
+//
+// Fill worker: takes the next buffer handed out by the stream thread,
+// fills it and marks its slot as filled.
+DWORD WINAPI CSourceStream::FillWorkerProc(__in LPVOID pv) {
+
+    CSourceStream *pThis = (CSourceStream *) pv;
+
+    for (;;) {
+        WaitForSingleObject(pThis->m_hSemFill, INFINITE);
+        if (pThis->m_lFillStop) {
+            break;
+        }
+
+        // buffers are handed out in sequence and each one releases the
+        // semaphore once, so there is a slot for every sequence we take
+        LONG lSequence = InterlockedIncrement(&pThis->m_lNextFill) - 1;
+        FillSlot &Slot = pThis->m_FillSlots[lSequence % SOURCE_PIPELINE_DEPTH];
+
+        Slot.hr = pThis->FillBufferPipelined(Slot.pSample, lSequence);
+        InterlockedExchange(&Slot.lFilled, TRUE);
+        SetEvent(pThis->m_hFilled);
+    }
+    return 0;
+}
+
+
+//
+// StartFillWorkers
+//
+HRESULT CSourceStream::StartFillWorkers(void) {
+
+    ASSERT(m_hSemFill == NULL);
+
+    m_lFillStop = FALSE;
+    m_lNextFill = 0;
+    m_lIssued = 0;
+    m_lDelivered = 0;
+
+    m_hSemFill = CreateSemaphore(NULL, 0, SOURCE_PIPELINE_DEPTH + SOURCE_MAX_FILL_WORKERS, NULL);
+    m_hFilled = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (m_hSemFill == NULL || m_hFilled == NULL) {
+        StopFillWorkers();
+        return E_OUTOFMEMORY;
+    }
+
+    for (int i = 0; i < m_nFillWorkers; i++) {
+        DWORD dwThreadId;
+        m_hFillThreads[i] = CreateThread(NULL, 0, FillWorkerProc, this, 0, &dwThreadId);
+        if (m_hFillThreads[i] == NULL) {
+            StopFillWorkers();
+            return E_OUTOFMEMORY;
+        }
+    }
+    return NOERROR;
+}
+
+
+//
+// StopFillWorkers
+//
+// Tells the workers to exit and waits for them (a worker that is filling
+// finishes that buffer first), then releases the samples that were not
+// delivered.
+void CSourceStream::StopFillWorkers(void) {
+
+    InterlockedExchange(&m_lFillStop, TRUE);
+
+    int nThreads = 0;
+    HANDLE ahThreads[SOURCE_MAX_FILL_WORKERS];
+    for (int i = 0; i < SOURCE_MAX_FILL_WORKERS; i++) {
+        if (m_hFillThreads[i]) {
+            ahThreads[nThreads++] = m_hFillThreads[i];
+            m_hFillThreads[i] = NULL;
+        }
+    }
+    if (nThreads) {
+        ReleaseSemaphore(m_hSemFill, nThreads, NULL);
+        WaitForMultipleObjects(nThreads, ahThreads, TRUE, INFINITE);
+        for (int i = 0; i < nThreads; i++) {
+            CloseHandle(ahThreads[i]);
+        }
+    }
+
+    for (; m_lDelivered < m_lIssued; m_lDelivered++) {
+        FillSlot &Slot = m_FillSlots[m_lDelivered % SOURCE_PIPELINE_DEPTH];
+        Slot.pSample->Release();
+        Slot.pSample = NULL;
+    }
+
+    if (m_hSemFill) {
+        CloseHandle(m_hSemFill);
+        m_hSemFill = NULL;
+    }
+    if (m_hFilled) {
+        CloseHandle(m_hFilled);
+        m_hFilled = NULL;
+    }
+}
+
+
+//
+// DoPipelinedBufferProcessingLoop
+//
+// Hands buffers to the fill workers and delivers the filled samples in
+// order. Commands are checked between deliveries and while waiting for
+// a worker, so they are handled as promptly as in the serial loop.
+HRESULT CSourceStream::DoPipelinedBufferProcessingLoop(void) {
+
+    Command com;
+
+    do {
+	while (!CheckRequest(&com)) {
+
+	    // keep the workers busy. Only wait for a buffer when there is
+	    // nothing else to do, the samples we hold may be needed to get
+	    // one back from downstream
+	    while (m_lIssued - m_lDelivered < SOURCE_PIPELINE_DEPTH) {
+		IMediaSample *pSample;
+		HRESULT hr = GetDeliveryBuffer(&pSample, NULL, NULL,
+				m_lIssued > m_lDelivered ? AM_GBF_NOWAIT : 0);
+		if (FAILED(hr)) {
+		    break;
+		}
+
+		FillSlot &Slot = m_FillSlots[m_lIssued % SOURCE_PIPELINE_DEPTH];
+		Slot.pSample = pSample;
+		Slot.lFilled = FALSE;
+		m_lIssued++;
+		ReleaseSemaphore(m_hSemFill, 1, NULL);
+	    }
+
+	    if (m_lIssued == m_lDelivered) {
+                Sleep(1);
+		continue;	// go round again. Perhaps the error will go away
+			    // or the allocator is decommited & we will be asked to
+			    // exit soon.
+	    }
+
+	    // wait for the oldest sample, or a command
+	    FillSlot &Slot = m_FillSlots[m_lDelivered % SOURCE_PIPELINE_DEPTH];
+	    if (!Slot.lFilled) {
+		HANDLE ahWait[2] = { m_hFilled, GetRequestHandle() };
+		WaitForMultipleObjects(2, ahWait, FALSE, INFINITE);
+		continue;
+	    }
+
+	    IMediaSample *pSample = Slot.pSample;
+	    HRESULT hr = Slot.hr;
+	    Slot.pSample = NULL;
+	    m_lDelivered++;
+
+	    if (hr == S_OK) {
+		hr = Deliver(pSample);
+                pSample->Release();
+
+                // downstream filter returns S_FALSE if it wants us to
+                // stop or an error if it's reporting an error.
+                if(hr != S_OK)
+                {
+                  DbgLog((LOG_TRACE, 2, TEXT("Deliver() returned %08x; stopping"), hr));
+                  StopFillWorkers();
+                  return S_OK;
+                }
+
+	    } else if (hr == S_FALSE) {
+                // derived class wants us to stop pushing data
+		pSample->Release();
+		StopFillWorkers();
+		DeliverEndOfStream();
+		return S_OK;
+	    } else {
+                // derived class encountered an error
+                pSample->Release();
+		DbgLog((LOG_ERROR, 1, TEXT("Error %08lX from FillBuffer!!!"), hr));
+		StopFillWorkers();
+                DeliverEndOfStream();
+                m_pFilter->NotifyEvent(EC_ERRORABORT, hr, 0);
+                return hr;
+	    }
+	}
+
+        // For all commands sent to us there must be a Reply call!
+
+	if (com == CMD_RUN || com == CMD_PAUSE) {
+	    Reply(NOERROR);
+	} else if (com != CMD_STOP) {
+	    Reply((DWORD) E_UNEXPECTED);
+	    DbgLog((LOG_ERROR, 1, TEXT("Unexpected command!!!")));
+	}
+    } while (com != CMD_STOP);
+
+    StopFillWorkers();
+    return S_FALSE;
+}
+
@@ -85,6 +85,15 @@ protected:
 // Use this class to manage a stream of data that comes from a
 // pin.
 // Uses a worker thread to put data on the pin.
+//
+// Optionally (see SetFillWorkers) the buffers are filled by a number of
+// fill worker threads while the stream thread delivers them: the stream
+// thread gets the buffers, hands them to the workers in order and
+// delivers the filled samples strictly in that order.
+
+#define SOURCE_MAX_FILL_WORKERS 8   // most fill worker threads
+#define SOURCE_PIPELINE_DEPTH   16  // most samples being filled or waiting for delivery
+
 class CSourceStream : public CAMThread, public CBaseOutputPin {
 public:
 
@@ -123,6 +132,25 @@ protected:
     virtual HRESULT OnThreadDestroy(void) {return NOERROR;};
     virtual HRESULT OnThreadStartPlay(void) {return NOERROR;};
 
+    // *
+    // * Pipelined filling
+    // *
+    // * SetFillWorkers(n) with n > 0 makes DoBufferProcessingLoop fill the
+    // * buffers on n worker threads. The workers call FillBufferPipelined,
+    // * concurrently, so only use this if your FillBuffer allows that.
+    // * lSequence counts the samples from the start of the loop; sample
+    // * lSequence is delivered after all samples before it, so derive
+    // * anything order dependent (time stamps) from it. Returning S_FALSE or
+    // * an error ends the stream after the samples before it are delivered.
+    // * Call SetFillWorkers before the pin is activated.
+    // *
+
+    HRESULT SetFillWorkers(int nWorkers);
+    virtual HRESULT FillBufferPipelined(IMediaSample *pSamp, LONG lSequence) {
+        UNREFERENCED_PARAMETER(lSequence);
+        return FillBuffer(pSamp);
+    };
+
     // *
     // * Worker Thread
     // *
@@ -148,6 +176,32 @@ protected:
 
     virtual HRESULT DoBufferProcessingLoop(void);    // the loop executed whilst running
 
+    // DoBufferProcessingLoop with fill workers (see SetFillWorkers)
+    HRESULT DoPipelinedBufferProcessingLoop(void);
+
+private:
+    struct FillSlot {
+        IMediaSample *pSample;      // buffer handed to a worker
+        HRESULT hr;                 // result of FillBufferPipelined
+        volatile LONG lFilled;      // hr is valid
+    };
+
+    int m_nFillWorkers;             // configured worker count, 0 = no workers
+    HANDLE m_hFillThreads[SOURCE_MAX_FILL_WORKERS];
+    HANDLE m_hSemFill;              // a count for each buffer handed out
+    HANDLE m_hFilled;               // set when a worker has filled a buffer
+    volatile LONG m_lFillStop;      // workers should exit
+    volatile LONG m_lNextFill;      // next sequence a worker takes
+    LONG m_lIssued;                 // buffers handed out (stream thread)
+    LONG m_lDelivered;              // samples delivered (stream thread)
+    FillSlot m_FillSlots[SOURCE_PIPELINE_DEPTH];
+
+    HRESULT StartFillWorkers(void);
+    void StopFillWorkers(void);
+    static DWORD WINAPI FillWorkerProc(__in LPVOID pv);
+
+protected:
+
 
     // *
     // * AM_MEDIA_TYPE support
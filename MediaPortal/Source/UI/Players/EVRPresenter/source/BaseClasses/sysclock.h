@@ -12,7 +12,7 @@
 #define __SYSTEMCLOCK__
 
 //
-// Base clock.  Uses timeGetTime ONLY
+// Base clock.  Uses the performance counter (CClockCounter) ONLY
 // Uses most of the code in the base reference clock.
 // Provides GetTime
 //
@@ -24,11 +24,16 @@ CTransformFilter::CTransformFilter(__in_opt LPCTSTR pName,
     m_pOutput(NULL),
     m_bEOSDelivered(FALSE),
     m_bQualityChanged(FALSE),
-    m_bSampleSkipped(FALSE)
+    m_bSampleSkipped(FALSE),
+    m_bPassThroughAllowed(FALSE),
+    m_llBytesCopied(0),
+    m_llBytesPassed(0),
+    m_dwStreamingStart(0),
+    m_dwStreamingTime(0)
 {
-#ifdef PERF
+#ifdef MSR_ENABLED
     RegisterPerfId();
-#endif //  PERF
+#endif //  MSR_ENABLED
 }
 
 #ifdef UNICODE
@@ -40,11 +45,16 @@ CTransformFilter::CTransformFilter(__in_opt LPCSTR pName,
     m_pOutput(NULL),
     m_bEOSDelivered(FALSE),
     m_bQualityChanged(FALSE),
-    m_bSampleSkipped(FALSE)
+    m_bSampleSkipped(FALSE),
+    m_bPassThroughAllowed(FALSE),
+    m_llBytesCopied(0),
+    m_llBytesPassed(0),
+    m_dwStreamingStart(0),
+    m_dwStreamingTime(0)
 {
-#ifdef PERF
+#ifdef MSR_ENABLED
     RegisterPerfId();
-#endif //  PERF
+#endif //  MSR_ENABLED
 }
 #endif
 
@@ -322,6 +332,23 @@ CTransformFilter::Receive(IMediaSample *pSample)
 
     ASSERT (m_pOutput != NULL) ;
 
+    // Let the derived class forward the sample without a copy
+    if (m_bPassThroughAllowed &&
+        !(pProps->dwSampleFlags & AM_SAMPLE_TYPECHANGED)) {
+
+        hr = PassThrough(pSample);
+        if (FAILED(hr)) {
+            DbgLog((LOG_TRACE,1,TEXT("Error from pass through")));
+            return hr;
+        }
+        if (hr == S_OK) {
+            m_llBytesPassed += pSample->GetActualDataLength();
+            hr = m_pOutput->m_pInputPin->Receive(pSample);
+            m_bSampleSkipped = FALSE;	// last thing no longer dropped
+            return hr;
+        }
+    }
+
     // Set up the output sample
     hr = InitializeOutputSample(pSample, &pOutSample);
 
@@ -346,6 +373,7 @@ CTransformFilter::Receive(IMediaSample *pSample)
         // sample should not be delivered; we only deliver the sample if it's
         // really S_OK (same as NOERROR, of course.)
         if (hr == NOERROR) {
+            m_llBytesCopied += pOutSample->GetActualDataLength();
     	    hr = m_pOutput->m_pInputPin->Receive(pOutSample);
             m_bSampleSkipped = FALSE;	// last thing no longer dropped
         } else {
@@ -377,6 +405,65 @@ CTransformFilter::Receive(IMediaSample *pSample)
 }
 
 
+// Input samples can be delivered downstream if the output pin uses the
+// same allocator, or if the input buffers are writable, at least as big
+// as the output allocator's, aligned at least as much as it requires and
+// have at least its prefix
+
+BOOL
+CTransformFilter::CanPassThroughAllocators()
+{
+    IMemAllocator *pInAlloc = m_pInput->m_pAllocator;
+    IMemAllocator *pOutAlloc = m_pOutput->m_pAllocator;
+    if (pInAlloc == NULL || pOutAlloc == NULL) {
+        return FALSE;
+    }
+    if (IsEqualObject(pInAlloc, pOutAlloc)) {
+        return TRUE;
+    }
+
+    // Upstream may still read a read-only sample after delivering it, so
+    // it must not end up in a downstream filter that writes to it
+    if (m_pInput->IsReadOnly()) {
+        return FALSE;
+    }
+
+    ALLOCATOR_PROPERTIES InProps, OutProps;
+    if (FAILED(pInAlloc->GetProperties(&InProps)) ||
+        FAILED(pOutAlloc->GetProperties(&OutProps))) {
+        return FALSE;
+    }
+    return OutProps.cbAlign > 0 &&
+           InProps.cbBuffer >= OutProps.cbBuffer &&
+           InProps.cbAlign % OutProps.cbAlign == 0 &&
+           InProps.cbPrefix >= OutProps.cbPrefix;
+}
+
+
+HRESULT
+CTransformFilter::GetTransferStatistics(
+    __out LONGLONG *pllBytesCopied,
+    __out LONGLONG *pllBytesPassed,
+    __out DWORD *pdwTime)
+{
+    CheckPointer(pllBytesCopied, E_POINTER);
+    CheckPointer(pllBytesPassed, E_POINTER);
+    CheckPointer(pdwTime, E_POINTER);
+
+    // not synchronised with Receive; the values are only indicative
+    *pllBytesCopied = m_llBytesCopied;
+    *pllBytesPassed = m_llBytesPassed;
+    if (m_dwStreamingStart == 0) {
+        *pdwTime = 0;
+    } else if (m_State == State_Stopped) {
+        *pdwTime = m_dwStreamingTime;
+    } else {
+        *pdwTime = timeGetTime() - m_dwStreamingStart;
+    }
+    return S_OK;
+}
+
+
 // Return S_FALSE to mean "pass the note on upstream"
 // Return NOERROR (Same as S_OK)
 // to mean "I've done something about it, don't pass it on"
@@ -480,6 +567,13 @@ CTransformFilter::Stop()
 	m_State = State_Stopped;
 	m_bEOSDelivered = FALSE;
     }
+
+    m_dwStreamingTime = timeGetTime() - m_dwStreamingStart;
+    if (m_dwStreamingTime > 0 && (m_llBytesCopied > 0 || m_llBytesPassed > 0)) {
+        DbgLog((LOG_TRACE, 2, TEXT("Transform: copied %d KB/s, passed through %d KB/s"),
+                (LONG)(m_llBytesCopied * 1000 / 1024 / m_dwStreamingTime),
+                (LONG)(m_llBytesPassed * 1000 / 1024 / m_dwStreamingTime)));
+    }
     return hr;
 }
 
@@ -520,6 +614,12 @@ CTransformFilter::Pause()
 	    // to know about starting and stopping streaming
             CAutoLock lck2(&m_csReceive);
 	    hr = StartStreaming();
+
+            m_bPassThroughAllowed = CanPassThroughAllocators();
+            m_llBytesCopied = 0;
+            m_llBytesPassed = 0;
+            m_dwStreamingStart = timeGetTime();
+            m_dwStreamingTime = 0;
 	}
 	if (SUCCEEDED(hr)) {
 	    hr = CBaseFilter::Pause();
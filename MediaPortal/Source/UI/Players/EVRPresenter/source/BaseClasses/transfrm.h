@@ -196,6 +196,14 @@ public:
 #endif
     ~CTransformFilter();
 
+    // bytes transformed into output buffers and passed through since
+    // streaming last started, and how long it has streamed (ms). Kept in
+    // release builds too, so a filter can report them itself.
+    HRESULT GetTransferStatistics(
+                __out LONGLONG *pllBytesCopied,
+                __out LONGLONG *pllBytesPassed,
+                __out DWORD *pdwTime);
+
     // =================================================================
     // ----- override these bits ---------------------------------------
     // =================================================================
@@ -245,6 +253,21 @@ public:
     // chance to customize the transform process
     virtual HRESULT Receive(IMediaSample *pSample);
 
+    // override to forward samples downstream without copying them.
+    // Called by Receive before getting an output buffer, if the input
+    // samples can be delivered on the output pin (see
+    // CanPassThroughAllocators). Rewrite the properties of pSample as
+    // needed and return S_OK to deliver it as it is, or S_FALSE to
+    // transform it into an output buffer as usual. Samples that change
+    // the media type are always transformed.
+    virtual HRESULT PassThrough(IMediaSample *pSample) { return S_FALSE; }
+
+    // TRUE if input samples may be delivered on the output pin: both
+    // pins use the same allocator, or the input buffers are writable and
+    // meet the output allocator's size, alignment and prefix. Checked
+    // when streaming starts.
+    virtual BOOL CanPassThroughAllocators();
+
     // Standard setup for output sample
     HRESULT InitializeOutputSample(IMediaSample *pSample, __deref_out IMediaSample **ppOutSample);
 
@@ -257,24 +280,32 @@ public:
                         REFERENCE_TIME tStop,
                         double dRate);
 
-#ifdef PERF
+#ifdef MSR_ENABLED
     // Override to register performance measurement with a less generic string
     // You should do this to avoid confusion with other filters
     virtual void RegisterPerfId()
          {m_idTransform = MSR_REGISTER(TEXT("Transform"));}
-#endif // PERF
+#endif // MSR_ENABLED
 
 
 // implementation details
 
 protected:
 
-#ifdef PERF
+#ifdef MSR_ENABLED
     int m_idTransform;                 // performance measuring id
 #endif
     BOOL m_bEOSDelivered;              // have we sent EndOfStream
     BOOL m_bSampleSkipped;             // Did we just skip a frame
     BOOL m_bQualityChanged;            // Have we degraded?
+    BOOL m_bPassThroughAllowed;        // PassThrough may be used
+
+    // bytes transformed into output buffers and passed through since
+    // streaming started (see GetTransferStatistics), logged when it stops
+    LONGLONG m_llBytesCopied;
+    LONGLONG m_llBytesPassed;
+    DWORD m_dwStreamingStart;
+    DWORD m_dwStreamingTime;           // set when streaming stops
 
     // critical section protecting filter state.
 
@@ -270,9 +270,9 @@ CTransInPlaceFilter::CTransInPlaceFilter
    : CTransformFilter(pName, pUnk, clsid),
      m_bModifiesData(bModifiesData)
 {
-#ifdef PERF
+#ifdef MSR_ENABLED
     RegisterPerfId();
-#endif //  PERF
+#endif //  MSR_ENABLED
 
 } // constructor
 
@@ -287,9 +287,9 @@ CTransInPlaceFilter::CTransInPlaceFilter
    : CTransformFilter(pName, pUnk, clsid),
      m_bModifiesData(bModifiesData)
 {
-#ifdef PERF
+#ifdef MSR_ENABLED
     RegisterPerfId();
-#endif //  PERF
+#endif //  MSR_ENABLED
 
 } // constructor
 #endif
@@ -567,7 +567,9 @@ __out_opt IMediaSample * CTransInPlaceFilter::Copy(IMediaSample *pSource)
             }
             ASSERT(lDestSize == 0 || pSourceBuffer != NULL && pDestBuffer != NULL);
 
-            CopyMemory( (PVOID) pDestBuffer, (PVOID) pSourceBuffer, lDataLength );
+            // The copy goes downstream and is not read by us again, so
+            // keep it out of the cache
+            CopyMemoryStreaming( (PVOID) pDestBuffer, (PVOID) pSourceBuffer, lDataLength );
         }
     }
 
@@ -199,12 +199,12 @@ public:
     // static CCOMObject * CreateInstance(LPUNKNOWN, HRESULT *);
 
 
-#ifdef PERF
+#ifdef MSR_ENABLED
     // Override to register performance measurement with a less generic string
     // You should do this to avoid confusion with other filters
     virtual void RegisterPerfId()
          {m_idTransInPlace = MSR_REGISTER(TEXT("TransInPlace"));}
-#endif // PERF
+#endif // MSR_ENABLED
 
 
 // implementation details
@@ -213,9 +213,9 @@ protected:
 
     __out_opt IMediaSample * CTransInPlaceFilter::Copy(IMediaSample *pSource);
 
-#ifdef PERF
+#ifdef MSR_ENABLED
     int m_idTransInPlace;                 // performance measuring id
-#endif // PERF
+#endif // MSR_ENABLED
     bool  m_bModifiesData;                // Does this filter change the data?
 
     // these hold our input and output pins
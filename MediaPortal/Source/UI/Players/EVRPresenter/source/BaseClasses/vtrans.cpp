@@ -22,9 +22,9 @@ CVideoTransformFilter::CVideoTransformFilter
     , m_itrAvgDecode(300000)    // 30mSec - probably allows skipping
     , m_bQualityChanged(FALSE)
 {
-#ifdef PERF
+#ifdef MSR_ENABLED
     RegisterPerfId();
-#endif //  PERF
+#endif //  MSR_ENABLED
 }
 
 
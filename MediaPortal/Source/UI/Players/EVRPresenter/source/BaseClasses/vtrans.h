@@ -49,7 +49,7 @@ class CVideoTransformFilter : public CTransformFilter
     // virtual HRESULT EndFlush(void);
     // virtual HRESULT NewSegment
     //     (REFERENCE_TIME tStart,REFERENCE_TIME tStop,double dRate);
-#ifdef PERF
+#ifdef MSR_ENABLED
 
     // If you override this - ensure that you register all these ids
     // as well as any of your own,
@@ -108,7 +108,7 @@ class CVideoTransformFilter : public CTransformFilter
 
     BOOL m_bSkipping;           // we are skipping to the next type 1 frame
 
-#ifdef PERF
+#ifdef MSR_ENABLED
     int m_idFrameType;          // MSR id Frame type.  1=Key, 2="non-key"
     int m_idSkip;               // MSR id skipping
     int m_idLate;               // MSR id lateness
@@ -2696,7 +2696,9 @@ STDAPI ConvertVideoInfoToVideoInfo2(__inout AM_MEDIA_TYPE *pmt)
     pVideoInfo2->dwPictAspectRatioX = (DWORD)pVideoInfo2->bmiHeader.biWidth;
     pVideoInfo2->dwPictAspectRatioY = (DWORD)abs(pVideoInfo2->bmiHeader.biHeight);
     pmt->formattype = FORMAT_VideoInfo2;
-    CoTaskMemFree(pmt->pbFormat);
+    if (!CMediaType::HasInlineFormat(*pmt)) {
+        CoTaskMemFree(pmt->pbFormat);
+    }
     pmt->pbFormat = (PBYTE)pvNew;
     pmt->cbFormat += sizeof(VIDEOINFOHEADER2) - sizeof(VIDEOINFOHEADER);
     return S_OK;
@@ -40,6 +40,13 @@
    without danger of creating a dangling reference if the original cache goes
    away.
 
+   Behind the caches all nodes come from one node pool (see CNode::operator
+   new).  The pool carves nodes out of 64K slabs and keeps the free ones on
+   an interlocked singly linked list, so a list whose cache is exhausted
+   still gets a node with a single pop instead of a heap allocation, without
+   any locking shared between lists.  ReleaseNodePool gives slabs with no
+   nodes in use back to the system.
+
    Questionable design decisions:
    1. Retaining the warts for compatibility
    2. Keeping an element count -i.e. counting whenever we do anything
@@ -52,6 +59,142 @@
 
 #include <streams.h>
 
+/*  Node pool
+
+    Slabs are allocated with VirtualAlloc, so they are aligned on the
+    allocation granularity (64K) and the slab of a node can be found by
+    masking its address.  The free nodes are kept on g_NodePoolFree; a free
+    node's memory is used as its SLIST_ENTRY.  A zero filled SLIST_HEADER is
+    an empty list, so the statics need no initialisation.  g_NodePoolLock
+    serialises growing and trimming the pool, never allocating or freeing a
+    node.
+*/
+#define NODEPOOL_SLABSIZE   0x10000
+
+struct CNodeSlab {
+    CNodeSlab *pNext;           // Next slab of the pool
+    LONG lNodes;                // Number of nodes in this slab
+    LONG lFree;                 // Free nodes, counted by ReleaseNodePool
+};
+
+static SLIST_HEADER g_NodePoolFree;
+static SRWLOCK g_NodePoolLock = SRWLOCK_INIT;
+static CNodeSlab *g_pNodeSlabs = NULL;
+
+static inline SIZE_T NodeStride()
+{
+    return (sizeof(CBaseList::CNode) + MEMORY_ALLOCATION_ALIGNMENT - 1) &
+           ~(SIZE_T)(MEMORY_ALLOCATION_ALIGNMENT - 1);
+}
+
+static inline CNodeSlab *SlabOfNode(__in void *pv)
+{
+    return (CNodeSlab *)((ULONG_PTR)pv & ~(ULONG_PTR)(NODEPOOL_SLABSIZE - 1));
+}
+
+/*  Add a slab of free nodes to the pool. Returns FALSE if we are out of
+    memory. Another thread may have added one while we waited for the lock,
+    then we don't need to */
+static BOOL AddNodeSlab()
+{
+    BOOL bAdded = TRUE;
+
+    AcquireSRWLockExclusive(&g_NodePoolLock);
+    if (QueryDepthSList(&g_NodePoolFree) == 0) {
+        CNodeSlab *pSlab = (CNodeSlab *)VirtualAlloc(NULL,
+                                                     NODEPOOL_SLABSIZE,
+                                                     MEM_COMMIT,
+                                                     PAGE_READWRITE);
+        if (pSlab == NULL) {
+            bAdded = FALSE;
+        } else {
+            SIZE_T cbStride = NodeStride();
+            SIZE_T cbHeader = (sizeof(CNodeSlab) + cbStride - 1) / cbStride * cbStride;
+            pSlab->lNodes = (LONG)((NODEPOOL_SLABSIZE - cbHeader) / cbStride);
+            pSlab->pNext = g_pNodeSlabs;
+            g_pNodeSlabs = pSlab;
+
+            LPBYTE pNode = (LPBYTE)pSlab + cbHeader;
+            for (LONG i = 0; i < pSlab->lNodes; i++, pNode += cbStride) {
+                InterlockedPushEntrySList(&g_NodePoolFree, (PSLIST_ENTRY)pNode);
+            }
+        }
+    }
+    ReleaseSRWLockExclusive(&g_NodePoolLock);
+    return bAdded;
+}
+
+void *CBaseList::CNode::operator new(size_t cb)
+{
+    ASSERT(cb <= NodeStride());
+    UNREFERENCED_PARAMETER(cb);
+
+    PSLIST_ENTRY pEntry;
+    while ((pEntry = InterlockedPopEntrySList(&g_NodePoolFree)) == NULL) {
+        if (!AddNodeSlab()) {
+            return NULL;
+        }
+    }
+    return pEntry;
+}
+
+void CBaseList::CNode::operator delete(__in_opt void *pv)
+{
+    if (pv != NULL) {
+        InterlockedPushEntrySList(&g_NodePoolFree, (PSLIST_ENTRY)pv);
+    }
+}
+
+/*  Free the slabs all of whose nodes are on the pool's free list.
+    Nodes freed while we are counting are not seen, which just means
+    their slab is kept until the next call */
+LONG CBaseList::ReleaseNodePool()
+{
+    AcquireSRWLockExclusive(&g_NodePoolLock);
+
+    PSLIST_ENTRY pList = InterlockedFlushSList(&g_NodePoolFree);
+    PSLIST_ENTRY pEntry;
+    CNodeSlab *pSlab;
+
+    for (pSlab = g_pNodeSlabs; pSlab != NULL; pSlab = pSlab->pNext) {
+        pSlab->lFree = 0;
+    }
+    for (pEntry = pList; pEntry != NULL; pEntry = pEntry->Next) {
+        SlabOfNode(pEntry)->lFree++;
+    }
+
+    /* Put back the nodes of the slabs we keep */
+    while (pList != NULL) {
+        pEntry = pList;
+        pList = pList->Next;
+        pSlab = SlabOfNode(pEntry);
+        if (pSlab->lFree != pSlab->lNodes) {
+            InterlockedPushEntrySList(&g_NodePoolFree, pEntry);
+        }
+    }
+
+    /* Unlink and free the others */
+    LONG lReleased = 0;
+    LONG lKept = 0;
+    CNodeSlab **ppSlab = &g_pNodeSlabs;
+    while (*ppSlab != NULL) {
+        pSlab = *ppSlab;
+        if (pSlab->lFree == pSlab->lNodes) {
+            *ppSlab = pSlab->pNext;
+            EXECUTE_ASSERT(VirtualFree(pSlab, 0, MEM_RELEASE));
+            lReleased++;
+        } else {
+            ppSlab = &pSlab->pNext;
+            lKept++;
+        }
+    }
+
+    ReleaseSRWLockExclusive(&g_NodePoolLock);
+
+    DbgLog((LOG_MEMORY, 2, TEXT("Node pool: released %d slabs, kept %d"), lReleased, lKept));
+    return lKept;
+}
+
 /* set cursor to the position of each element of list in turn  */
 #define INTERNALTRAVERSELIST(list, cursor)               \
 for ( cursor = (list).GetHeadPositionI()           \
@@ -116,6 +116,12 @@ public:
 
         /* Set the pointer to the object for this node */
         void SetData(__in void *p) { m_pObject = p; };
+
+
+        /* Nodes are allocated from a pool shared by all lists, so
+           allocating a node is normally a single interlocked pop */
+        static void *operator new(size_t cb);
+        static void operator delete(__in_opt void *pv);
     };
 
     class CNodeCache
@@ -205,6 +211,12 @@ public:
     void RemoveAll();
 
 
+    /* Give the memory of unused nodes in the shared node pool back
+       to the system. Nodes held in the caches of the lists are kept.
+       Returns the number of slabs that are still in use */
+    static LONG ReleaseNodePool();
+
+
     /* Return a cursor which identifies the first element of *this */
     __out_opt POSITION GetHeadPositionI() const;
 
@@ -11,6 +11,8 @@
 #include <streams.h>
 #define STRSAFE_NO_DEPRECATE
 #include <strsafe.h>
+#include <intrin.h>
+#include <immintrin.h>
 
 
 // --- CAMEvent -----------------------
@@ -457,6 +459,400 @@ HRESULT AMSafeMemMoveOffset(
 }
 
 
+// --- CStreamingStats -----------------------
+
+CStreamingStats::CStreamingStats() :
+    m_lSequence(0),
+    m_llCount(0),
+    m_dMean(0.0),
+    m_dM2(0.0)
+{
+    ZeroMemory((void *)m_lBuckets, sizeof(m_lBuckets));
+}
+
+void CStreamingStats::Reset()
+{
+    InterlockedIncrement(&m_lSequence);
+    m_llCount = 0;
+    m_dMean = 0.0;
+    m_dM2 = 0.0;
+    ZeroMemory((void *)m_lBuckets, sizeof(m_lBuckets));
+    InterlockedIncrement(&m_lSequence);
+}
+
+void CStreamingStats::Add(LONG lValue)
+{
+    InterlockedIncrement(&m_lSequence);
+
+    m_llCount++;
+    const double dDelta = lValue - m_dMean;
+    m_dMean += dDelta / m_llCount;
+    m_dM2 += dDelta * (lValue - m_dMean);
+
+    // we are the only writer
+    m_lBuckets[BucketIndex(lValue)]++;
+
+    InterlockedIncrement(&m_lSequence);
+}
+
+void CStreamingStats::GetStatistics(
+    __out LONGLONG *pllCount,
+    __out double *pdMean,
+    __out double *pdVariance) const
+{
+    LONGLONG llCount;
+    double dMean, dM2;
+    for (;;) {
+        const LONG lSequence = m_lSequence;
+        if (lSequence & 1) {
+            YieldProcessor();
+            continue;
+        }
+        MemoryBarrier();
+        llCount = m_llCount;
+        dMean = m_dMean;
+        dM2 = m_dM2;
+        MemoryBarrier();
+        if (m_lSequence == lSequence) {
+            break;
+        }
+    }
+
+    *pllCount = llCount;
+    *pdMean = dMean;
+    *pdVariance = llCount > 1 ? dM2 / (llCount - 1) : 0.0;
+}
+
+LONG CStreamingStats::GetPercentile(int iPercent) const
+{
+    LONG lCounts[2 * STATS_HALF_BUCKETS];
+    LONGLONG llTotal = 0;
+    for (int i = 0; i < 2 * STATS_HALF_BUCKETS; i++) {
+        lCounts[i] = m_lBuckets[i];
+        llTotal += lCounts[i];
+    }
+    if (llTotal == 0) {
+        return 0;
+    }
+
+    // the smallest value at least iPercent of the observations are
+    // less than or equal to
+    LONGLONG llRank = (llTotal * iPercent + 99) / 100;
+    if (llRank < 1) {
+        llRank = 1;
+    }
+    LONGLONG llSeen = 0;
+    for (int i = 0; i < 2 * STATS_HALF_BUCKETS; i++) {
+        llSeen += lCounts[i];
+        if (llSeen >= llRank) {
+            return BucketValue(i);
+        }
+    }
+    return BucketValue(2 * STATS_HALF_BUCKETS - 1);
+}
+
+// Buckets are ordered by value: the negative half first, then the
+// positive half starting at 0.  Within a half, magnitudes below
+// STATS_SUB_BUCKETS have a bucket each and larger ones share
+// STATS_SUB_BUCKETS buckets per power of two.
+int CStreamingStats::BucketIndex(LONG lValue)
+{
+    // -1 goes in the first negative bucket, so negative magnitudes
+    // start at 0 as well
+    DWORD dwMagnitude = lValue < 0 ? (DWORD)(-(lValue + 1)) : (DWORD)lValue;
+    if (dwMagnitude >= (1UL << STATS_MAX_LOG2)) {
+        dwMagnitude = (1UL << STATS_MAX_LOG2) - 1;
+    }
+
+    int iBucket;
+    if (dwMagnitude < STATS_SUB_BUCKETS) {
+        iBucket = (int)dwMagnitude;
+    } else {
+        DWORD dwLog2;
+        _BitScanReverse(&dwLog2, dwMagnitude);
+        const int iShift = (int)dwLog2 - STATS_SUB_BUCKETS_LOG2;
+        iBucket = STATS_SUB_BUCKETS * (iShift + 1) +
+                  (int)((dwMagnitude >> iShift) & (STATS_SUB_BUCKETS - 1));
+    }
+
+    return lValue < 0 ? STATS_HALF_BUCKETS - 1 - iBucket
+                      : STATS_HALF_BUCKETS + iBucket;
+}
+
+// The value a bucket stands for: the middle of its range
+LONG CStreamingStats::BucketValue(int iBucket)
+{
+    const BOOL bNegative = iBucket < STATS_HALF_BUCKETS;
+    const int i = bNegative ? STATS_HALF_BUCKETS - 1 - iBucket
+                            : iBucket - STATS_HALF_BUCKETS;
+
+    LONG lMagnitude;
+    if (i < STATS_SUB_BUCKETS) {
+        lMagnitude = i;
+    } else {
+        const int iShift = i / STATS_SUB_BUCKETS - 1;
+        const LONG lLow = (LONG)(STATS_SUB_BUCKETS + i % STATS_SUB_BUCKETS) << iShift;
+        lMagnitude = lLow + ((1L << iShift) - 1) / 2;
+    }
+    return bNegative ? -lMagnitude - 1 : lMagnitude;
+}
+
+
+// --- CopyMemoryStreaming -----------------------
+
+#define COPY_MAX_CHUNKS         4       // calling thread plus up to 3 workers
+#define COPY_CHUNK_ALIGNMENT    4096
+
+enum {
+    COPY_KERNEL_UNKNOWN = 0,
+    COPY_KERNEL_MEMCPY,
+    COPY_KERNEL_SSE2,
+    COPY_KERNEL_AVX
+};
+
+static volatile LONG g_lCopyKernel = COPY_KERNEL_UNKNOWN;
+static LONG g_lCopyChunks = 1;
+
+struct CopyTask {
+    BYTE *pDst;
+    const BYTE *pSrc;
+    size_t cb;
+    LONG lKernel;
+};
+
+// The workers serve one copy at a time, the one that set g_lCopyBusy.
+// Worker i copies g_CopyTasks[i + 1] each time g_hCopyStart[i] is set.
+static volatile LONG g_lCopyBusy = FALSE;
+static volatile LONG g_lCopyExit = FALSE;
+static volatile LONG g_lCopyRemaining = 0;      // workers still copying
+static LONG g_nCopyWorkers = 0;
+static HANDLE g_hCopyWorkers[COPY_MAX_CHUNKS - 1];
+static HANDLE g_hCopyStart[COPY_MAX_CHUNKS - 1];
+static HANDLE g_hCopyDone = NULL;               // set by the last worker
+static CopyTask g_CopyTasks[COPY_MAX_CHUNKS];
+
+// Pick the widest streaming store the processor and the OS support
+static LONG GetCopyKernel()
+{
+    LONG lKernel = g_lCopyKernel;
+    if (lKernel != COPY_KERNEL_UNKNOWN) {
+        return lKernel;
+    }
+
+    lKernel = COPY_KERNEL_MEMCPY;
+    if (IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE)) {
+        lKernel = COPY_KERNEL_SSE2;
+    }
+
+    // AVX also needs the OS to save the YMM registers (OSXSAVE and XCR0)
+    int info[4];
+    __cpuid(info, 1);
+    if ((info[2] & (1 << 27)) && (info[2] & (1 << 28)) &&
+        (_xgetbv(0) & 6) == 6) {
+        lKernel = COPY_KERNEL_AVX;
+    }
+
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    g_lCopyChunks = max(1, min(COPY_MAX_CHUNKS, (LONG)si.dwNumberOfProcessors));
+
+    // publishes g_lCopyChunks as well
+    InterlockedExchange(&g_lCopyKernel, lKernel);
+    return lKernel;
+}
+
+// Copy with 16 byte non-temporal stores. Only the destination needs to
+// be aligned, the source is read with unaligned loads.
+static void CopyStreamSSE2(BYTE *pDst, const BYTE *pSrc, size_t cb)
+{
+    size_t cbHead = min(cb, (16 - ((ULONG_PTR)pDst & 15)) & 15);
+    CopyMemory(pDst, pSrc, cbHead);
+    pDst += cbHead;
+    pSrc += cbHead;
+    cb -= cbHead;
+
+    for (; cb >= 64; cb -= 64, pDst += 64, pSrc += 64) {
+        __m128i x0 = _mm_loadu_si128((const __m128i *)pSrc);
+        __m128i x1 = _mm_loadu_si128((const __m128i *)(pSrc + 16));
+        __m128i x2 = _mm_loadu_si128((const __m128i *)(pSrc + 32));
+        __m128i x3 = _mm_loadu_si128((const __m128i *)(pSrc + 48));
+        _mm_stream_si128((__m128i *)pDst, x0);
+        _mm_stream_si128((__m128i *)(pDst + 16), x1);
+        _mm_stream_si128((__m128i *)(pDst + 32), x2);
+        _mm_stream_si128((__m128i *)(pDst + 48), x3);
+    }
+    _mm_sfence();
+
+    CopyMemory(pDst, pSrc, cb);
+}
+
+// As CopyStreamSSE2, with 32 byte stores
+static void CopyStreamAVX(BYTE *pDst, const BYTE *pSrc, size_t cb)
+{
+    size_t cbHead = min(cb, (32 - ((ULONG_PTR)pDst & 31)) & 31);
+    CopyMemory(pDst, pSrc, cbHead);
+    pDst += cbHead;
+    pSrc += cbHead;
+    cb -= cbHead;
+
+    for (; cb >= 128; cb -= 128, pDst += 128, pSrc += 128) {
+        __m256i y0 = _mm256_loadu_si256((const __m256i *)pSrc);
+        __m256i y1 = _mm256_loadu_si256((const __m256i *)(pSrc + 32));
+        __m256i y2 = _mm256_loadu_si256((const __m256i *)(pSrc + 64));
+        __m256i y3 = _mm256_loadu_si256((const __m256i *)(pSrc + 96));
+        _mm256_stream_si256((__m256i *)pDst, y0);
+        _mm256_stream_si256((__m256i *)(pDst + 32), y1);
+        _mm256_stream_si256((__m256i *)(pDst + 64), y2);
+        _mm256_stream_si256((__m256i *)(pDst + 96), y3);
+    }
+    _mm_sfence();
+    _mm256_zeroupper();
+
+    CopyMemory(pDst, pSrc, cb);
+}
+
+static void CopyStream(const CopyTask *pTask)
+{
+    if (pTask->lKernel == COPY_KERNEL_AVX) {
+        CopyStreamAVX(pTask->pDst, pTask->pSrc, pTask->cb);
+    } else {
+        CopyStreamSSE2(pTask->pDst, pTask->pSrc, pTask->cb);
+    }
+}
+
+static DWORD WINAPI CopyWorkerProc(__in LPVOID pv)
+{
+    const LONG i = (LONG)(LONG_PTR)pv;
+
+    for (;;) {
+        WaitForSingleObject(g_hCopyStart[i], INFINITE);
+        if (g_lCopyExit) {
+            break;
+        }
+        CopyStream(&g_CopyTasks[i + 1]);
+        if (InterlockedDecrement(&g_lCopyRemaining) == 0) {
+            SetEvent(g_hCopyDone);
+        }
+    }
+    return 0;
+}
+
+// Exits and closes the workers. The caller owns them (g_lCopyBusy).
+static void CloseCopyWorkers()
+{
+    InterlockedExchange(&g_lCopyExit, TRUE);
+    for (LONG i = 0; i < g_nCopyWorkers; i++) {
+        SetEvent(g_hCopyStart[i]);
+    }
+    if (g_nCopyWorkers > 0) {
+        WaitForMultipleObjects(g_nCopyWorkers, g_hCopyWorkers, TRUE, INFINITE);
+    }
+    for (LONG i = 0; i < g_nCopyWorkers; i++) {
+        CloseHandle(g_hCopyWorkers[i]);
+        CloseHandle(g_hCopyStart[i]);
+    }
+    g_nCopyWorkers = 0;
+    if (g_hCopyDone) {
+        CloseHandle(g_hCopyDone);
+        g_hCopyDone = NULL;
+    }
+    g_lCopyExit = FALSE;
+}
+
+// Starts the workers unless they are running. The caller owns them.
+static BOOL StartCopyWorkers()
+{
+    if (g_nCopyWorkers > 0) {
+        return TRUE;
+    }
+
+    g_hCopyDone = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (g_hCopyDone == NULL) {
+        return FALSE;
+    }
+    for (LONG i = 0; i < g_lCopyChunks - 1; i++) {
+        g_hCopyStart[i] = CreateEvent(NULL, FALSE, FALSE, NULL);
+        if (g_hCopyStart[i] == NULL) {
+            CloseCopyWorkers();
+            return FALSE;
+        }
+        DWORD dwThreadId;
+        g_hCopyWorkers[i] = CreateThread(NULL, 0, CopyWorkerProc, (LPVOID)(LONG_PTR)i, 0, &dwThreadId);
+        if (g_hCopyWorkers[i] == NULL) {
+            CloseHandle(g_hCopyStart[i]);
+            CloseCopyWorkers();
+            return FALSE;
+        }
+        g_nCopyWorkers++;
+    }
+    return TRUE;
+}
+
+void WINAPI StopCopyWorkers()
+{
+    while (InterlockedCompareExchange(&g_lCopyBusy, TRUE, FALSE) != FALSE) {
+        Sleep(1);
+    }
+    CloseCopyWorkers();
+    InterlockedExchange(&g_lCopyBusy, FALSE);
+}
+
+void WINAPI CopyMemoryStreaming(
+    __out_bcount(count) void * dst,
+    __in_bcount(count) const void * src,
+    __in size_t count)
+{
+    const LONG lKernel = count < COPY_STREAMING_THRESHOLD ?
+                         COPY_KERNEL_MEMCPY : GetCopyKernel();
+    if (lKernel == COPY_KERNEL_MEMCPY) {
+        CopyMemory(dst, src, count);
+        return;
+    }
+
+    // Another thread that has the workers copies as much at a time, so
+    // this one does not wait for them but copies on its own
+    LONG nChunks = count < COPY_PARALLEL_THRESHOLD ? 1 : g_lCopyChunks;
+    if (nChunks > 1 &&
+        InterlockedCompareExchange(&g_lCopyBusy, TRUE, FALSE) != FALSE) {
+        nChunks = 1;
+    } else if (nChunks > 1 && !StartCopyWorkers()) {
+        InterlockedExchange(&g_lCopyBusy, FALSE);
+        nChunks = 1;
+    }
+
+    if (nChunks == 1) {
+        CopyTask Task = { (BYTE *)dst, (const BYTE *)src, count, lKernel };
+        CopyStream(&Task);
+        return;
+    }
+
+    // Split on page boundaries of the destination; the last chunk takes
+    // whatever is left
+    const size_t cbChunk = (count / nChunks + COPY_CHUNK_ALIGNMENT - 1) &
+                           ~(size_t)(COPY_CHUNK_ALIGNMENT - 1);
+    size_t cbOffset = 0;
+    for (LONG i = 0; i < nChunks; i++) {
+        g_CopyTasks[i].pDst = (BYTE *)dst + cbOffset;
+        g_CopyTasks[i].pSrc = (const BYTE *)src + cbOffset;
+        g_CopyTasks[i].cb = (i == nChunks - 1) ? count - cbOffset :
+                                                 min(cbChunk, count - cbOffset);
+        g_CopyTasks[i].lKernel = lKernel;
+        cbOffset += g_CopyTasks[i].cb;
+    }
+
+    // Hand all but the first chunk to the workers
+    g_lCopyRemaining = nChunks - 1;
+    for (LONG i = 1; i < nChunks; i++) {
+        SetEvent(g_hCopyStart[i - 1]);
+    }
+
+    CopyStream(&g_CopyTasks[0]);
+
+    WaitForSingleObject(g_hCopyDone, INFINITE);
+    InterlockedExchange(&g_lCopyBusy, FALSE);
+}
+
+
 #ifdef DEBUG
 /******************************Public*Routine******************************\
 * Debug CCritSec helpers
@@ -246,37 +246,107 @@ public:
 // CQueue
 //
 // Implements a simple Queue ADT.  The queue contains a finite number of
-// objects, access to which is controlled by a semaphore.  The semaphore
-// is created with an initial count (N).  Each time an object is added
-// a call to WaitForSingleObject is made on the semaphore's handle.  When
-// this function returns a slot has been reserved in the queue for the new
-// object.  If no slots are available the function blocks until one becomes
-// available.  Each time an object is removed from the queue ReleaseSemaphore
-// is called on the semaphore's handle, thus freeing a slot in the queue.
-// If no objects are present in the queue the function blocks until an
-// object has been added.
+// objects (at least N, the size is rounded up to a power of 2) kept in a
+// ring of slots.  Putting and getting are lock-free: each slot carries a
+// sequence number which tells whether it is free or holds an object for
+// the current round, and the next put and get positions are claimed with
+// an interlocked compare-exchange.  The two positions live on separate
+// cache lines so producers and consumers don't contend for one line.
+//
+// PutQueueObject blocks while the queue is full and GetQueueObject blocks
+// while it is empty.  A blocked thread spins for a short while and then
+// parks on a semaphore.  The semaphores are only signalled if a thread is
+// parked, so the common case makes no kernel calls at all.  The parking
+// handshake is the one used by CBaseAllocator: announce the wait with an
+// interlocked increment, check the ring again, and wait on the semaphore
+// exactly once; whoever exchanges the waiting count with 0 releases that
+// many waiters.
+//
+// TryPutQueueObject and TryGetQueueObject never block.
 
 #define DEFAULT_QUEUESIZE   2
+#define QUEUE_SPIN_COUNT    256     // polls before a blocked thread parks
+#define QUEUE_CACHE_LINE    64
 
 template <class T> class CQueue {
 private:
-    HANDLE          hSemPut;        // Semaphore controlling queue "putting"
-    HANDLE          hSemGet;        // Semaphore controlling queue "getting"
-    CRITICAL_SECTION CritSect;      // Thread seriallization
-    int             nMax;           // Max objects allowed in queue
-    int             iNextPut;       // Array index of next "PutMsg"
-    int             iNextGet;       // Array index of next "GetMsg"
-    T              *QueueObjects;   // Array of objects (ptr's to void)
+    struct Slot {
+        volatile LONG lSequence;    // position this slot is free (or full) for
+        T             Object;
+    };
+
+    // The put and get positions are written by different threads; keep
+    // them (and the waiting counts next to them) on separate cache lines.
+    BYTE            Pad0[QUEUE_CACHE_LINE];
+    volatile LONG   lNextPut;       // Position of next "PutMsg"
+    volatile LONG   lPutWaiting;    // Putters parked on hSemPut
+    BYTE            Pad1[QUEUE_CACHE_LINE - 2 * sizeof(LONG)];
+    volatile LONG   lNextGet;       // Position of next "GetMsg"
+    volatile LONG   lGetWaiting;    // Getters parked on hSemGet
+    BYTE            Pad2[QUEUE_CACHE_LINE - 2 * sizeof(LONG)];
+
+    HANDLE          hSemPut;        // Parked putters wait here
+    HANDLE          hSemGet;        // Parked getters wait here
+    LONG            lMask;          // Ring size - 1
+    Slot           *QueueObjects;   // Ring of objects (ptr's to void)
 
     void Initialize(int n) {
-        iNextPut = iNextGet = 0;
-        nMax = n;
-        InitializeCriticalSection(&CritSect);
-        hSemPut = CreateSemaphore(NULL, n, n, NULL);
-        hSemGet = CreateSemaphore(NULL, 0, n, NULL);
-        QueueObjects = new T[n];
+        LONG lSize = 1;
+        while (lSize < n) {
+            lSize <<= 1;
+        }
+        lMask = lSize - 1;
+        lNextPut = lNextGet = 0;
+        lPutWaiting = lGetWaiting = 0;
+        hSemPut = CreateSemaphore(NULL, 0, 0x7FFFFFFF, NULL);
+        hSemGet = CreateSemaphore(NULL, 0, 0x7FFFFFFF, NULL);
+        QueueObjects = new Slot[lSize];
+        for (LONG i = 0; i < lSize; i++) {
+            QueueObjects[i].lSequence = i;
+        }
+    }
+
+    // Releases the threads parked on hSem
+    static void Wake(volatile LONG *plWaiting, HANDLE hSem) {
+        if (*plWaiting != 0) {
+            LONG lWaiting = InterlockedExchange(plWaiting, 0);
+            if (lWaiting != 0) {
+                ReleaseSemaphore(hSem, lWaiting, NULL);
+            }
+        }
+    }
+
+    // A put (get) can go ahead, or must at least retry, when the slot at the
+    // next position is free (full) for this round or another thread took it
+    BOOL CanPut() const {
+        LONG lPos = lNextPut;
+        return QueueObjects[lPos & lMask].lSequence - lPos >= 0;
+    }
+
+    BOOL CanGet() const {
+        LONG lPos = lNextGet;
+        return QueueObjects[lPos & lMask].lSequence - (lPos + 1) >= 0;
     }
 
+    // Spins, then parks until a put (get) may succeed. Called after the
+    // Try function failed; the caller tries again when we return.
+    void Wait(BOOL bPut) {
+        volatile LONG *plWaiting = bPut ? &lPutWaiting : &lGetWaiting;
+        HANDLE hSem = bPut ? hSemPut : hSemGet;
+
+        for (int i = 0; i < QUEUE_SPIN_COUNT; i++) {
+            if (bPut ? CanPut() : CanGet()) {
+                return;
+            }
+            YieldProcessor();
+        }
+
+        InterlockedIncrement(plWaiting);
+        if (bPut ? CanPut() : CanGet()) {
+            Wake(plWaiting, hSem);
+        }
+        WaitForSingleObject(hSem, INFINITE);
+    }
 
 public:
     CQueue(int n) {
@@ -289,52 +359,131 @@ public:
 
     ~CQueue() {
         delete [] QueueObjects;
-        DeleteCriticalSection(&CritSect);
         CloseHandle(hSemPut);
         CloseHandle(hSemGet);
     }
 
-    T GetQueueObject() {
-        int iSlot;
-        T Object;
-        LONG lPrevious;
+    BOOL TryGetQueueObject(__out T *pObject) {
+        LONG lPos = lNextGet;
+        for (;;) {
+            Slot *pSlot = &QueueObjects[lPos & lMask];
+            LONG lDiff = pSlot->lSequence - (lPos + 1);
+
+            if (lDiff == 0) {
+                LONG lPrev = InterlockedCompareExchange(&lNextGet, lPos + 1, lPos);
+                if (lPrev == lPos) {
+                    *pObject = pSlot->Object;
+
+                    // Hand the slot to the putters of the next round, and
+                    // release anyone waiting for space
+                    InterlockedExchange(&pSlot->lSequence, lPos + lMask + 1);
+                    Wake(&lPutWaiting, hSemPut);
+                    return TRUE;
+                }
+                lPos = lPrev;
+            } else if (lDiff < 0) {
+                return FALSE;           // empty
+            } else {
+                lPos = lNextGet;        // another getter took it
+            }
+        }
+    }
 
-        // Wait for someone to put something on our queue, returns straight
-        // away is there is already an object on the queue.
-        //
-        WaitForSingleObject(hSemGet, INFINITE);
+    BOOL TryPutQueueObject(T Object) {
+        LONG lPos = lNextPut;
+        for (;;) {
+            Slot *pSlot = &QueueObjects[lPos & lMask];
+            LONG lDiff = pSlot->lSequence - lPos;
+
+            if (lDiff == 0) {
+                LONG lPrev = InterlockedCompareExchange(&lNextPut, lPos + 1, lPos);
+                if (lPrev == lPos) {
+                    pSlot->Object = Object;
+
+                    // Publish the object and release anyone waiting for it
+                    InterlockedExchange(&pSlot->lSequence, lPos + 1);
+                    Wake(&lGetWaiting, hSemGet);
+                    return TRUE;
+                }
+                lPos = lPrev;
+            } else if (lDiff < 0) {
+                return FALSE;           // full
+            } else {
+                lPos = lNextPut;        // another putter took it
+            }
+        }
+    }
 
-        EnterCriticalSection(&CritSect);
-        iSlot = iNextGet++ % nMax;
-        Object = QueueObjects[iSlot];
-        LeaveCriticalSection(&CritSect);
+    T GetQueueObject() {
+        T Object;
 
-        // Release anyone waiting to put an object onto our queue as there
-        // is now space available in the queue.
+        // Returns straight away if there is already an object on the queue,
+        // otherwise waits for someone to put something on it.
         //
-        ReleaseSemaphore(hSemPut, 1L, &lPrevious);
+        while (!TryGetQueueObject(&Object)) {
+            Wait(FALSE);
+        }
         return Object;
     }
 
     void PutQueueObject(T Object) {
-        int iSlot;
-        LONG lPrevious;
-
-        // Wait for someone to get something from our queue, returns straight
-        // away is there is already an empty slot on the queue.
+        // Returns straight away if there is already an empty slot on the
+        // queue, otherwise waits for someone to get something from it.
         //
-        WaitForSingleObject(hSemPut, INFINITE);
+        while (!TryPutQueueObject(Object)) {
+            Wait(TRUE);
+        }
+    }
+};
 
-        EnterCriticalSection(&CritSect);
-        iSlot = iNextPut++ % nMax;
-        QueueObjects[iSlot] = Object;
-        LeaveCriticalSection(&CritSect);
 
-        // Release anyone waiting to remove an object from our queue as there
-        // is now an object available to be removed.
-        //
-        ReleaseSemaphore(hSemGet, 1L, &lPrevious);
-    }
+// Running statistics of a stream of integer observations (typically
+// times in mSec): count, mean and variance by Welford's method, which
+// stays accurate however many observations there are, and a histogram
+// with logarithmic buckets for percentiles.  Memory use is fixed.
+//
+// There must be only one writer (Add, Reset) at a time; it takes no
+// locks.  Readers may run on any thread.  The count, mean and variance
+// are published through a sequence count: the writer makes it odd while
+// it updates them and even again afterwards, and a reader retries if it
+// saw an odd count or the count changed while it copied.  Percentiles
+// are computed from a copy of the bucket counts, which may be an
+// observation or two out of step with each other - fine for reporting.
+//
+// The histogram has STATS_SUB_BUCKETS buckets per power of two of the
+// magnitude, for each sign, so a percentile is within 1/8 of the true
+// value.  Magnitudes from 1 << STATS_MAX_LOG2 up go in the last bucket.
+
+#define STATS_SUB_BUCKETS_LOG2 2
+#define STATS_SUB_BUCKETS   (1 << STATS_SUB_BUCKETS_LOG2)
+#define STATS_MAX_LOG2      20
+#define STATS_HALF_BUCKETS  (STATS_SUB_BUCKETS * (STATS_MAX_LOG2 - 1))
+
+class CStreamingStats
+{
+public:
+    CStreamingStats();
+
+    void Reset();
+    void Add(LONG lValue);
+
+    // consistent snapshot; the variance is the sample variance (N-1)
+    void GetStatistics(__out LONGLONG *pllCount,
+                       __out double *pdMean,
+                       __out double *pdVariance) const;
+
+    // iPercent in 0..100; 0 if there are no observations
+    LONG GetPercentile(int iPercent) const;
+
+private:
+    static int BucketIndex(LONG lValue);
+    static LONG BucketValue(int iBucket);
+
+    volatile LONG m_lSequence;
+    LONGLONG m_llCount;
+    double m_dMean;
+    double m_dM2;               // sum of squared differences from the mean
+    volatile LONG m_lBuckets[2 * STATS_HALF_BUCKETS];
 };
 
 // Ensures that memory is not read past the length source buffer
@@ -362,6 +511,27 @@ HRESULT AMSafeMemMoveOffset(
 extern "C"
 void * __stdcall memmoveInternal(void *, const void *, size_t);
 
+// Copy a block of memory that will not be read again soon, such as a
+// video frame on its way downstream. Blocks of COPY_STREAMING_THRESHOLD
+// bytes or more are written with non-temporal stores (AVX or SSE2, chosen
+// at run time) so they do not evict the working set from the cache, and
+// blocks of COPY_PARALLEL_THRESHOLD bytes or more are split between the
+// calling thread and worker threads. Smaller blocks use CopyMemory.
+// The buffers must not overlap.
+#define COPY_STREAMING_THRESHOLD    (256 * 1024)
+#define COPY_PARALLEL_THRESHOLD     (4 * 1024 * 1024)
+
+void WINAPI CopyMemoryStreaming(
+    __out_bcount(count) void * dst,
+    __in_bcount(count) const void * src,
+    __in size_t count);
+
+// The worker threads are started by the first copy that needs them and
+// kept for the next ones. Stops them, after a copy in progress; the next
+// large copy starts them again. Call it before the module is unloaded,
+// but not from DllMain, it waits for the threads to exit.
+void WINAPI StopCopyWorkers();
+
 inline void * __cdecl memchrInternal(const void *buf, int chr, size_t cnt)
 {
 #ifdef _X86_
@@ -235,6 +235,11 @@ HRESULT D3DPresentEngine::CreateVideoSamples(IMFMediaType *pFormat, VideoSampleL
 void D3DPresentEngine::ReleaseResources()
 {
   SAFE_RELEASE(m_pTextureRepaint);
+
+  // The cached scrub frames belong to the old format.
+  m_ScrubCache.LogStatistics();
+  m_ScrubCache.Clear();
+  m_ScrubCache.ReleaseDeviceResources();
 }
 
 
@@ -335,6 +340,74 @@ HRESULT D3DPresentEngine::PresentSample(IMFSample* pSample, LONGLONG llTarget)
 }
 
 
+// Stores a downscaled copy of a frame that was presented while scrubbing.
+HRESULT D3DPresentEngine::CacheScrubFrame(IMFSample* pSample, LONGLONG hnsTime, LONGLONG hnsDuration)
+{
+  HRESULT hr = S_OK;
+
+  IMFMediaBuffer* pBuffer = NULL;
+  IDirect3DSurface9* pSurface = NULL;
+
+  AutoLock lock(m_ObjectLock);
+
+  // Revisited position, nothing to do.
+  if (m_ScrubCache.Contains(hnsTime))
+  {
+    return S_FALSE;
+  }
+
+  hr = pSample->GetBufferByIndex(0, &pBuffer);
+  if (SUCCEEDED(hr))
+  {
+    hr = MFGetService(pBuffer, MR_BUFFER_SERVICE, __uuidof(IDirect3DSurface9), (void**)&pSurface);
+  }
+  if (SUCCEEDED(hr))
+  {
+    hr = m_ScrubCache.Store(m_pDevice, pSurface, hnsTime, hnsDuration);
+  }
+
+  SAFE_RELEASE(pSurface);
+  SAFE_RELEASE(pBuffer);
+
+  return hr;
+}
+
+
+// Presents the cached frame for a scrub position. Returns S_FALSE if the position is not cached.
+HRESULT D3DPresentEngine::PresentScrubFrame(LONGLONG hnsTime)
+{
+  HRESULT hr = S_OK;
+
+  IDirect3DTexture9* pTexture = NULL;
+
+  {
+    AutoLock lock(m_ObjectLock);
+
+    hr = m_ScrubCache.Lookup(m_pDevice, hnsTime, &pTexture);
+  }
+  if (hr != S_OK)
+  {
+    return hr;
+  }
+
+  // Same size and aspect ratio as the real frames, so the layout does not change; the texture is stretched.
+  hr = m_EVRCallback->PresentSurface(m_Width, m_Height, m_ArX, m_ArY, &pTexture);
+
+  SAFE_RELEASE(pTexture);
+
+  return hr;
+}
+
+
+// Writes the scrub cache statistics to the log.
+void D3DPresentEngine::LogScrubStatistics()
+{
+  AutoLock lock(m_ObjectLock);
+
+  m_ScrubCache.LogStatistics();
+}
+
+
 // Initializes Direct3D and the Direct3D device manager.
 HRESULT D3DPresentEngine::InitializeD3D()
 {
@@ -12,6 +12,8 @@
 #include <d3d9.h>
 #include <dxva2api.h>
 
+#include "ScrubCache.h"
+
 const DWORD NUM_PRESENTER_BUFFERS = 3;
 
 class D3DPresentEngine : public SchedulerCallback
@@ -39,6 +41,11 @@ public:
   HRESULT CheckDeviceState(DeviceState *pState);
   HRESULT PresentSample(IMFSample* pSample, LONGLONG llTarget);
 
+  // Scrubbing (rate 0)
+  HRESULT CacheScrubFrame(IMFSample* pSample, LONGLONG hnsTime, LONGLONG hnsDuration);
+  HRESULT PresentScrubFrame(LONGLONG hnsTime);
+  void    LogScrubStatistics();
+
   UINT    RefreshRate() const { return m_DisplayMode.RefreshRate; }
 
 protected:
@@ -63,5 +70,7 @@ protected:
   IDirect3DDevice9Ex          *m_pDevice;
   IDirect3DDeviceManager9     *m_pDeviceManager;      // Direct3D device manager.
   IDirect3DTexture9           *m_pTextureRepaint;     // Surface for repaint requests.
+
+  ScrubCache                  m_ScrubCache;           // Downscaled frames shown while scrubbing.
 };
 
@@ -0,0 +1,84 @@
+// Copyright (C) 2007-2014 Team MediaPortal
+// http://www.team-mediaportal.com
+//
+// This file is part of MediaPortal 2
+//
+// MediaPortal 2 is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// MediaPortal 2 is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with MediaPortal 2. If not, see <http://www.gnu.org/licenses/>.
+
+#include "Deinterlace.h"
+
+// Returns TRUE if a proposed type with the given interlace mode can be presented.
+BOOL IsInterlaceModeSupported(DEINTERLACE_MODE mode, UINT32 interlaceMode)
+{
+  // Interlaced types are only accepted if the mixer is allowed to deinterlace them.
+  return (interlaceMode == MFVideoInterlace_Progressive) || (mode != DEINTERLACE_NONE);
+}
+
+
+// Returns TRUE if the mixer outputs one frame per field.
+BOOL IsFieldRateMode(DEINTERLACE_MODE mode, UINT32 inputInterlaceMode)
+{
+  if (mode != DEINTERLACE_BOB && mode != DEINTERLACE_ADAPTIVE)
+  {
+    return FALSE;
+  }
+
+  // Only frames that carry both fields are split into two output frames. Single field samples
+  // already arrive at the field rate. Mixed streams are mostly progressive (e.g. film content with
+  // repeat-field flags), so they keep the frame rate.
+  return (inputInterlaceMode == MFVideoInterlace_FieldInterleavedUpperFirst) ||
+    (inputInterlaceMode == MFVideoInterlace_FieldInterleavedLowerFirst);
+}
+
+
+// Returns the presentation rate, twice the frame rate at the field rate.
+MFRatio GetPresentationRate(const MFRatio& frameRate, BOOL bFieldRate)
+{
+  MFRatio rate = frameRate;
+  if (bFieldRate)
+  {
+    if (rate.Numerator <= MAXUINT32 / 2)
+    {
+      rate.Numerator *= 2;
+    }
+    else if (rate.Denominator % 2 == 0)
+    {
+      rate.Denominator /= 2;
+    }
+  }
+  return rate;
+}
+
+
+// Changes the deinterlacing mode.
+HRESULT ChangeDeinterlaceMode(DEINTERLACE_MODE *pMode, DEINTERLACE_MODE mode, MediaTypeCache *pCache)
+{
+  CheckPointer(pMode, E_POINTER);
+  CheckPointer(pCache, E_POINTER);
+
+  if (mode < DEINTERLACE_NONE || mode > DEINTERLACE_ADAPTIVE)
+  {
+    return E_INVALIDARG;
+  }
+
+  if (*pMode != mode)
+  {
+    *pMode = mode;
+
+    // Cached negotiation results depend on whether we accept interlaced types.
+    pCache->Clear();
+  }
+
+  return S_OK;
+}
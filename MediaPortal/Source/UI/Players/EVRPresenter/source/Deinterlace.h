@@ -0,0 +1,47 @@
+// Copyright (C) 2007-2014 Team MediaPortal
+// http://www.team-mediaportal.com
+//
+// This file is part of MediaPortal 2
+//
+// MediaPortal 2 is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// MediaPortal 2 is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with MediaPortal 2. If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "EVRPresenter.h"
+#include "MediaTypeCache.h"
+
+// Defines how interlaced video is handled. Deinterlacing is done by the mixer's video processor.
+enum DEINTERLACE_MODE
+{
+  DEINTERLACE_NONE = 0,       // Reject interlaced types (default).
+  DEINTERLACE_WEAVE,          // Weave both fields into one frame. Frames are presented at the frame rate.
+  DEINTERLACE_BOB,            // Line-double each field. Frames are presented at the field rate.
+  DEINTERLACE_ADAPTIVE        // Best mode of the driver (motion adaptive). Frames are presented at the field rate.
+};
+
+// The deinterlacing decisions of the presenter. They only depend on the mode and the interlace modes of
+// the types, so they can be tested without a presenter or a mixer.
+
+// Returns TRUE if a proposed type with the given MFVideoInterlaceMode can be presented in the mode.
+BOOL IsInterlaceModeSupported(DEINTERLACE_MODE mode, UINT32 interlaceMode);
+
+// Returns TRUE if the mixer outputs one frame per field for input of the given MFVideoInterlaceMode.
+BOOL IsFieldRateMode(DEINTERLACE_MODE mode, UINT32 inputInterlaceMode);
+
+// Returns the rate at which the frames of a stream with the given frame rate are presented.
+MFRatio GetPresentationRate(const MFRatio& frameRate, BOOL bFieldRate);
+
+// Sets *pMode to mode. The cached negotiation results depend on whether interlaced types are accepted,
+// so the cache is cleared when the mode changes. Returns E_INVALIDARG for an unknown mode.
+HRESULT ChangeDeinterlaceMode(DEINTERLACE_MODE *pMode, DEINTERLACE_MODE mode, MediaTypeCache *pCache);
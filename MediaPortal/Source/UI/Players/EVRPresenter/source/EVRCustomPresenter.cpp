@@ -26,11 +26,14 @@ m_pClock(NULL),
 m_pMixer(NULL),
 m_pMediaEventSink(NULL),
 m_pMediaType(NULL),
+m_MediaTypeHash(0),
 m_bSampleNotify(FALSE),
 m_bRepaint(FALSE),
 m_bEndStreaming(FALSE),
 m_bPrerolled(FALSE),
+m_bMixerCanDiscard(FALSE),
 m_fRate(1.0f),
+m_DeinterlaceMode(DEINTERLACE_NONE),
 m_TokenCounter(0),
 m_SampleFreeCB(this, &EVRCustomPresenter::OnSampleFree)
 {
@@ -63,6 +66,36 @@ EVRCustomPresenter::~EVRCustomPresenter()
 }
 
 
+// Sets the deinterlacing mode.
+HRESULT EVRCustomPresenter::SetDeinterlaceMode(DEINTERLACE_MODE mode)
+{
+  Log("EVRCustomPresenter::SetDeinterlaceMode (mode=%d)", mode);
+
+  CAutoLock lock(this);
+
+  return ChangeDeinterlaceMode(&m_DeinterlaceMode, mode, &m_MediaTypeCache);
+}
+
+
+// Starts the binary trace of the scheduler decisions (Evr.trace). Tracing is off by default; once
+// started, it stays on until the presenter is released.
+HRESULT EVRCustomPresenter::EnableTrace()
+{
+  CAutoLock lock(this);
+
+  if (m_Trace.IsOpen())
+  {
+    return S_OK;
+  }
+
+  HRESULT hr = m_Trace.Open();
+  CHECK_HR(hr, "EVRCustomPresenter::EnableTrace PresenterTrace::Open() failed");
+
+  m_scheduler.SetTrace(&m_Trace, &m_SamplePool);
+  return hr;
+}
+
+
 // Init EVR Presenter (called by VideoPlayer.cs)
 __declspec(dllexport) int EvrInit(IEVRCallback* callback, IDirect3DDevice9Ex* dwD3DDevice, IBaseFilter* evrFilter, HWND hwnd, EVRCustomPresenter** ppPresenterInstance)
 {
@@ -114,5 +147,98 @@ __declspec(dllexport) void EvrDeinit(EVRCustomPresenter* pPresenterInstance)
     Log("EvrDeinit: Releasing presenter 0x%x", pPresenterInstance);
     pPresenterInstance->Release();
   }
+
+  // Give the memory of the list nodes the presenter used back; slabs another presenter still uses are kept.
+  CBaseList::ReleaseNodePool();
+
+  // Stop the copy threads, they run code of this DLL. The next large copy starts them again.
+  StopCopyWorkers();
+
+  // Flush the log; the writer thread also keeps the DLL loaded while it runs.
+  StopLogWriter();
+}
+
+
+// Set the deinterlacing mode (called by VideoPlayer.cs)
+__declspec(dllexport) int EvrSetDeinterlaceMode(EVRCustomPresenter* pPresenterInstance, int mode)
+{
+  if (pPresenterInstance == NULL)
+  {
+    return E_POINTER;
+  }
+  return pPresenterInstance->SetDeinterlaceMode((DEINTERLACE_MODE)mode);
+}
+
+
+// Start tracing the scheduler decisions (called by VideoPlayer.cs)
+__declspec(dllexport) int EvrEnableTrace(EVRCustomPresenter* pPresenterInstance)
+{
+  if (pPresenterInstance == NULL)
+  {
+    return E_POINTER;
+  }
+  return pPresenterInstance->EnableTrace();
 }
 
+
+// Records kept by the perflog sink, 128 bytes each
+static const ULONG g_PerfLogCapacity = 65536;
+
+// Start capturing the base classes' perflog events and streaming marks in memory (called by VideoPlayer.cs)
+__declspec(dllexport) int EvrStartPerfLog()
+{
+  if (!PerflogSinkStart(g_PerfLogCapacity, 0xFFFFFFFF))
+  {
+    Log("EvrStartPerfLog: PerflogSinkStart() failed");
+    return E_OUTOFMEMORY;
+  }
+  return S_OK;
+}
+
+
+// Writes the captured events to Evr.<name> in the log folder
+static HRESULT SavePerfLog(TCHAR* name, PERFLOG_SINK_FORMAT format)
+{
+  HRESULT hr;
+  TCHAR fileName[MAX_PATH];
+  LogPath(fileName, name);
+
+  HANDLE hFile = CreateFile(fileName, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (hFile == INVALID_HANDLE_VALUE)
+  {
+    hr = HRESULT_FROM_WIN32(GetLastError());
+    Log("EvrSavePerfLog: could not create %s: 0x%x", fileName, hr);
+    return hr;
+  }
+
+  hr = PerflogSinkSave(hFile, format);
+  if (FAILED(hr))
+  {
+    Log("EvrSavePerfLog: PerflogSinkSave() failed: 0x%x", hr);
+  }
+  CloseHandle(hFile);
+  return hr;
+}
+
+
+// Write the captured events to Evr.perf.json and Evr.perf in the log folder and stop capturing (called by VideoPlayer.cs)
+__declspec(dllexport) int EvrSavePerfLog()
+{
+  if (!PerflogSinkEnabled())
+  {
+    return S_FALSE;
+  }
+
+  // Chrome trace-event JSON, load it in chrome://tracing or Perfetto
+  HRESULT hr = SavePerfLog("perf.json", PERFLOG_SINK_JSON);
+
+  // The binary format of perfsink.h, tools\EvrPerfDump reads it on any host
+  HRESULT hrBinary = SavePerfLog("perf", PERFLOG_SINK_BINARY);
+  if (SUCCEEDED(hr))
+  {
+    hr = hrBinary;
+  }
+
+  PerflogSinkStop();
+  return hr;
+}
@@ -26,6 +26,10 @@
 #include "AsyncCallback.h"
 #include "Scheduler.h"
 #include "SamplePool.h"
+#include "MediaTypeCache.h"
+#include "Deinterlace.h"
+#include "FrameStep.h"
+#include "PresenterTrace.h"
 #include "IEVRCallback.h"
 #include "D3DPresentEngine.h"
 
@@ -54,15 +58,6 @@ public:
     RENDER_STATE_SHUTDOWN,    // Initial state. 
   };
 
-  // Defines the presenter's state with respect to frame-stepping.
-  enum FRAMESTEP_STATE
-  {
-    FRAMESTEP_NONE,             // Not frame stepping.
-    FRAMESTEP_WAITING_START,    // Frame stepping, but the clock is not started.
-    FRAMESTEP_PENDING,          // Clock is started. Waiting for samples.
-    FRAMESTEP_SCHEDULED,        // Submitted a sample for rendering.
-    FRAMESTEP_COMPLETE          // Sample was rendered. 
-  };
 
 
   // IMFVideoPresenter Interface http://msdn.microsoft.com/en-us/library/ms700214(v=VS.85).aspx
@@ -117,6 +112,12 @@ public:
   EVRCustomPresenter(IEVRCallback* callback, IDirect3DDevice9Ex* d3DDevice, HWND hwnd, HRESULT& hr);
   virtual ~EVRCustomPresenter();
 
+  // Sets the deinterlacing mode. Takes effect with the next media type negotiation.
+  HRESULT SetDeinterlaceMode(DEINTERLACE_MODE mode);
+
+  // Starts writing the scheduler decisions to Evr.trace. Off by default.
+  HRESULT EnableTrace();
+
 protected:
   // The "active" state is started or paused.
   inline BOOL IsActive() const
@@ -146,18 +147,20 @@ protected:
   // Mixer operations
   HRESULT EVRCustomPresenter::ConfigureMixer(IMFTransform *pMixer);
   HRESULT EVRCustomPresenter::SetMixerSourceRect(IMFTransform *pMixer, const MFVideoNormalizedRect& nrcSource);
+  HRESULT EVRCustomPresenter::ConfigureDeinterlacing(IMFTransform *pMixer);
+  BOOL    EVRCustomPresenter::IsFieldRateOutput();
 
   // Helpers
   void    EVRCustomPresenter::NotifyEvent(long EventCode, LONG_PTR Param1, LONG_PTR Param2);
   float   EVRCustomPresenter::GetMaxRate(BOOL bThin);
-  BOOL    EVRCustomPresenter::AreMediaTypesEqual(IMFMediaType *pType1, IMFMediaType *pType2);
   HRESULT EVRCustomPresenter::ValidateVideoArea(const MFVideoArea& area, UINT32 width, UINT32 height);
   RECT    EVRCustomPresenter::CorrectAspectRatio(const RECT& src, const MFRatio& srcPAR, const MFRatio& destPAR);
 
   // Formats
+  HRESULT GetOptimalVideoType(IMFMediaType* pProposed, IMFMediaType **ppOptimal, UINT64 *pOptimalHash);
   HRESULT CreateOptimalVideoType(IMFMediaType* pProposed, IMFMediaType **ppOptimal);
   HRESULT CalculateOutputRectangle(IMFMediaType *pProposed, RECT *prcOutput);
-  HRESULT SetMediaType(IMFMediaType *pMediaType);
+  HRESULT SetMediaType(IMFMediaType *pMediaType, const UINT64 *pHash = NULL);
   HRESULT IsMediaTypeSupported(IMFMediaType *pMediaType);
 
   // Message Handlers
@@ -174,6 +177,8 @@ protected:
   HRESULT EVRCustomPresenter::CompleteFrameStep(IMFSample *pSample);
   HRESULT EVRCustomPresenter::CancelFrameStep();
   HRESULT EVRCustomPresenter::DeliverFrameStepSample(IMFSample *pSample);
+  BOOL    EVRCustomPresenter::IsIntermediateFrameStep();
+  HRESULT EVRCustomPresenter::SkipFrameStepOutput();
 
   // Sample Management
   void    ProcessOutputLoop();
@@ -189,19 +194,6 @@ protected:
   // Callback
   AsyncCallback<EVRCustomPresenter> m_SampleFreeCB;
 
-  // Holds information related to frame-stepping in one varible for better organization
-  struct FrameStep
-  {
-    FrameStep() : state(FRAMESTEP_NONE), steps(0), pSampleNoRef(NULL)
-    {
-    }
-
-    FRAMESTEP_STATE     state;          // Current frame-step state
-    VideoSampleList     samples;        // List of pending samples for frame-stepping
-    DWORD               steps;          // Number of steps left
-    DWORD_PTR           pSampleNoRef;   // Identifies the frame-step sample.
-  };
-
   RENDER_STATE                m_RenderState;          // Render state
   FrameStep                   m_FrameStep;            // Frame-stepping information
 
@@ -211,14 +203,18 @@ protected:
   BOOL                        m_bRepaint;             // Do we need to repaint the last sample?
   BOOL                        m_bPrerolled;           // Have we presented at least one sample?
   BOOL                        m_bEndStreaming;        // Did we reach the end of the stream?
+  BOOL                        m_bMixerCanDiscard;     // Can the mixer discard output without a sample?
 
   // Samples and scheduling
   Scheduler                   m_scheduler;            // Manages scheduling of samples
   SamplePool                  m_SamplePool;           // Pool of allocated samples
   DWORD                       m_TokenCounter;         // Counter. Incremented whenever we create new samples.
+  MediaTypeCache              m_MediaTypeCache;       // Results of previous media type negotiations
+  PresenterTrace              m_Trace;                // Binary trace of the scheduler decisions
 
   MFVideoNormalizedRect       m_nrcSource;            // Source rectangle
   float                       m_fRate;                // Playback rate
+  DEINTERLACE_MODE            m_DeinterlaceMode;      // How interlaced video is handled
 
   // Deletable objects.
   D3DPresentEngine            *m_pD3DPresentEngine;   // Rendering engine. (Never null if the constructor succeeds.)
@@ -228,5 +224,6 @@ protected:
   IMFTransform                *m_pMixer;              // The mixer 
   IMediaEventSink             *m_pMediaEventSink;     // The EVR's event-sink interface
   IMFMediaType                *m_pMediaType;          // Output media type
+  UINT64                      m_MediaTypeHash;        // MediaTypeCache::HashMediaType of m_pMediaType
 };
 
@@ -31,7 +31,7 @@
 
 // Writes a message to the log if HRESULT is < 0 and returns.
 #ifndef CHECK_HR
-#define CHECK_HR(hr, msg) if (FAILED(hr)) { Log(msg); return hr; }
+#define CHECK_HR(hr, msg) if (FAILED(hr)) { LogAtLevel(LOG_LEVEL_ERROR, msg); return hr; }
 #endif
 
 // Releases a COM pointer if the pointer is not NULL, and sets the pointer.
@@ -124,7 +124,40 @@ static const GUID MFSamplePresenter_SampleCounter = { 0xb0bb83cc, 0xf10f, 0x4e2e
 static const GUID MFSamplePresenter_SampleSwapChain = { 0xad885bd1, 0x7def, 0x414a, { 0xb5, 0xb0, 0xd3, 0xd2, 0x63, 0xd6, 0xe9, 0x6d } };
 
 #pragma warning(disable: 4995)
-// write message to EVR Log.
+
+// Severity of a log message.
+enum LOG_LEVEL
+{
+  LOG_LEVEL_DEBUG = 0,
+  LOG_LEVEL_INFO,
+  LOG_LEVEL_WARNING,
+  LOG_LEVEL_ERROR
+};
+
+// Messages below this level are removed at compile time when written with the LOG_xxx macros.
+#ifndef EVR_LOG_COMPILE_LEVEL
+#ifdef _DEBUG
+#define EVR_LOG_COMPILE_LEVEL LOG_LEVEL_DEBUG
+#else
+#define EVR_LOG_COMPILE_LEVEL LOG_LEVEL_INFO
+#endif
+#endif
+
+#define LOG_AT_LEVEL(level, fmt, ...) do { if ((level) >= EVR_LOG_COMPILE_LEVEL) LogAtLevel(level, fmt, __VA_ARGS__); } while (0)
+#define LOG_DEBUG(fmt, ...)   LOG_AT_LEVEL(LOG_LEVEL_DEBUG, fmt, __VA_ARGS__)
+#define LOG_WARNING(fmt, ...) LOG_AT_LEVEL(LOG_LEVEL_WARNING, fmt, __VA_ARGS__)
+
+// Builds the path of a file in the MP2 client log folder (Evr.<name>).
+void LogPath(TCHAR* dest, TCHAR* name);
+// write message to EVR Log. Messages are written asynchronously by a background thread.
 void Log(const char *fmt, ...);
+// write message with the given severity to EVR Log.
+void LogAtLevel(LOG_LEVEL level, const char *fmt, ...);
+// Sets the minimum severity that is written (run-time filter).
+void SetLogLevel(LOG_LEVEL level);
+// Returns the number of log records dropped because the log queue was full.
+LONG GetDroppedLogRecords();
+// Writes all pending log records and stops the writer thread. Logging again restarts it.
+void StopLogWriter();
 
 
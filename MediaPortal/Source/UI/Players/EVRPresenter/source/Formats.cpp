@@ -21,8 +21,9 @@
 #include "EVRCustomPresenter.h"
 #include "MediaType.h"
 
-// Sets or clears the presenter's media type. 
-HRESULT EVRCustomPresenter::SetMediaType(IMFMediaType *pMediaType)
+// Sets or clears the presenter's media type. pHash is the MediaTypeCache::HashMediaType of the type if
+// the caller has it, otherwise it is computed here.
+HRESULT EVRCustomPresenter::SetMediaType(IMFMediaType *pMediaType, const UINT64 *pHash)
 {
   Log("EVRCustomPresenter::SetMediaType");
 
@@ -50,9 +51,23 @@ HRESULT EVRCustomPresenter::SetMediaType(IMFMediaType *pMediaType)
     return hr;
   }
 
-  // Check if the new type is actually different.
+  UINT64 hash = 0;
+  if (pHash)
+  {
+    hash = *pHash;
+  }
+  else
+  {
+    hr = MediaTypeCache::HashMediaType(pMediaType, &hash);
+    if (FAILED(hr))
+    {
+      return hr;
+    }
+  }
+
+  // Check if the new type is actually different. A different hash settles it without comparing the types.
   // Note: This function safely handles NULL input parameters.
-  if (AreMediaTypesEqual(m_pMediaType, pMediaType))
+  if (MediaTypeCache::AreTypesEqual(m_pMediaType, m_MediaTypeHash, pMediaType, hash))
   {
     return S_OK; // Nothing more to do.
   }
@@ -104,7 +119,13 @@ HRESULT EVRCustomPresenter::SetMediaType(IMFMediaType *pMediaType)
   // Set the frame rate on the scheduler. 
   if (SUCCEEDED(videoType.GetFrameRate(pMediaType, &fps)) && (fps.Numerator != 0) && (fps.Denominator != 0))
   {
-    m_scheduler.SetFrameRate(fps);
+    // When the mixer deinterlaces to one frame per field, we present at the field rate.
+    BOOL bFieldRate = IsFieldRateOutput();
+    if (bFieldRate)
+    {
+      Log("EVRCustomPresenter::SetMediaType presenting at field rate");
+    }
+    m_scheduler.SetFrameRate(GetPresentationRate(fps, bFieldRate));
   }
   else
   {
@@ -118,6 +139,7 @@ HRESULT EVRCustomPresenter::SetMediaType(IMFMediaType *pMediaType)
   assert(pMediaType != NULL);
   m_pMediaType = pMediaType;
   m_pMediaType->AddRef();
+  m_MediaTypeHash = hash;
 
   return hr;
 }
@@ -156,10 +178,10 @@ HRESULT EVRCustomPresenter::IsMediaTypeSupported(IMFMediaType *pMediaType)
   hr = m_pD3DPresentEngine->CheckFormat(d3dFormat);
   CHECK_HR(hr, "EVRCustomPresenter::IsMediaTypeSupported D3DPresentEngine::CheckFormat() failed");
 
-  // Reject interlaced formats.
+  // Reject interlaced formats, unless the mixer is allowed to deinterlace them.
   hr = mtProposed.GetInterlaceMode(&InterlaceMode);
   CHECK_HR(hr, "EVRCustomPresenter::IsMediaTypeSupported VideoType::GetInterlaceMode() failed");
-  if (InterlaceMode != MFVideoInterlace_Progressive)
+  if (!IsInterlaceModeSupported(m_DeinterlaceMode, InterlaceMode))
   {
     hr = MF_E_INVALIDMEDIATYPE;
     CHECK_HR(hr, "EVRCustomPresenter::IsMediaTypeSupported interlaced mode");
@@ -188,6 +210,50 @@ HRESULT EVRCustomPresenter::IsMediaTypeSupported(IMFMediaType *pMediaType)
 }
 
 
+// Checks whether we support a proposed type from the mixer and converts it into the optimal type.
+// The result is cached, so repeated renegotiations with identical mixer types skip the format checks.
+// pOptimalHash receives the hash of the optimal type, which SetMediaType compares against the current type.
+HRESULT EVRCustomPresenter::GetOptimalVideoType(IMFMediaType *pProposedType, IMFMediaType **ppOptimalType, UINT64 *pOptimalHash)
+{
+  HRESULT hr = S_OK;
+  HRESULT hrSupported = S_OK;
+  UINT64  hash = 0;
+
+  LARGE_INTEGER liStart, liEnd;
+
+  *ppOptimalType = NULL;
+  *pOptimalHash = 0;
+
+  hr = MediaTypeCache::HashMediaType(pProposedType, &hash);
+  if (SUCCEEDED(hr) && (m_MediaTypeCache.Lookup(pProposedType, hash, &hrSupported, ppOptimalType, pOptimalHash) == S_OK))
+  {
+    return hrSupported;
+  }
+
+  QueryPerformanceCounter(&liStart);
+
+  hrSupported = IsMediaTypeSupported(pProposedType);
+  if (SUCCEEDED(hrSupported))
+  {
+    hrSupported = CreateOptimalVideoType(pProposedType, ppOptimalType);
+  }
+
+  QueryPerformanceCounter(&liEnd);
+
+  // Remember the verdict, also if the type was rejected. The cache hashes the optimal type for us.
+  if (FAILED(hr) ||
+      FAILED(m_MediaTypeCache.Insert(pProposedType, hash, hrSupported, *ppOptimalType, liEnd.QuadPart - liStart.QuadPart, pOptimalHash)))
+  {
+    if (SUCCEEDED(hrSupported))
+    {
+      hrSupported = MediaTypeCache::HashMediaType(*ppOptimalType, pOptimalHash);
+    }
+  }
+
+  return hrSupported;
+}
+
+
 // Converts a proposed media type from the mixer into a type that is suitable for the presenter.
 HRESULT EVRCustomPresenter::CreateOptimalVideoType(IMFMediaType* pProposedType, IMFMediaType **ppOptimalType)
 {
@@ -242,6 +308,13 @@ HRESULT EVRCustomPresenter::CreateOptimalVideoType(IMFMediaType* pProposedType,
   hr = mtOptimal.SetVideoLighting(MFVideoLighting_dim);
   CHECK_HR(hr, "EVRCustomPresenter::CreateOptimalVideoType VideoType::SetVideoLightning() failed");
 
+  // Ask for progressive output, so the mixer deinterlaces interlaced input.
+  if (m_DeinterlaceMode != DEINTERLACE_NONE)
+  {
+    hr = mtOptimal.SetInterlaceMode(MFVideoInterlace_Progressive);
+    CHECK_HR(hr, "EVRCustomPresenter::CreateOptimalVideoType VideoType::SetInterlaceMode() failed");
+  }
+
   // Set the target rect dimensions. 
   hr = mtOptimal.SetFrameDimensions(rcOutput.right, rcOutput.bottom);
   CHECK_HR(hr, "EVRCustomPresenter::CreateOptimalVideoType VideoType::SetFrameDimensions() failed");
@@ -0,0 +1,72 @@
+// Copyright (C) 2007-2014 Team MediaPortal
+// http://www.team-mediaportal.com
+//
+// This file is part of MediaPortal 2
+//
+// MediaPortal 2 is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// MediaPortal 2 is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with MediaPortal 2. If not, see <http://www.gnu.org/licenses/>.
+
+#include <mferror.h>
+
+#include "FrameStep.h"
+
+// Checks the output stream flags of the mixer.
+BOOL FrameStep::CanDiscard(IMFTransform *pMixer)
+{
+  MFT_OUTPUT_STREAM_INFO streamInfo;
+  ZeroMemory(&streamInfo, sizeof(streamInfo));
+  return SUCCEEDED(pMixer->GetOutputStreamInfo(0, &streamInfo)) &&
+    (streamInfo.dwFlags & (MFT_OUTPUT_STREAM_DISCARDABLE | MFT_OUTPUT_STREAM_LAZY_READ));
+}
+
+
+// Lets the mixer drop an intermediate frame without rendering it.
+HRESULT FrameStep::DiscardIntermediate(IMFTransform *pMixer, BOOL *pbCanDiscard)
+{
+  CheckPointer(pMixer, E_POINTER);
+  CheckPointer(pbCanDiscard, E_POINTER);
+
+  DWORD dwStatus = 0;
+
+  MFT_OUTPUT_DATA_BUFFER dataBuffer;
+  ZeroMemory(&dataBuffer, sizeof(dataBuffer));
+
+  // No sample: the mixer drops the frame.
+  dataBuffer.dwStreamID = 0;
+  dataBuffer.pSample = NULL;
+
+  HRESULT hr = pMixer->ProcessOutput(MFT_PROCESS_OUTPUT_DISCARD_WHEN_NO_BUFFER, 1, &dataBuffer, &dwStatus);
+  SAFE_RELEASE(dataBuffer.pEvents);
+
+  if (SUCCEEDED(hr))
+  {
+    steps--;
+    skipped++;
+    return S_OK;
+  }
+
+  if (hr == MF_E_TRANSFORM_NEED_MORE_INPUT)
+  {
+    return hr;
+  }
+
+  if (hr == E_INVALIDARG)
+  {
+    // The mixer does not support discarding after all.
+    Log("FrameStep::DiscardIntermediate mixer cannot discard frames, fast path disabled");
+    *pbCanDiscard = FALSE;
+  }
+
+  // Let the normal path handle the frame (and errors like a stream change).
+  return S_FALSE;
+}
@@ -0,0 +1,78 @@
+// Copyright (C) 2007-2014 Team MediaPortal
+// http://www.team-mediaportal.com
+//
+// This file is part of MediaPortal 2
+//
+// MediaPortal 2 is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// MediaPortal 2 is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with MediaPortal 2. If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "EVRPresenter.h"
+
+// Defines the presenter's state with respect to frame-stepping.
+enum FRAMESTEP_STATE
+{
+  FRAMESTEP_NONE,             // Not frame stepping.
+  FRAMESTEP_WAITING_START,    // Frame stepping, but the clock is not started.
+  FRAMESTEP_PENDING,          // Clock is started. Waiting for samples.
+  FRAMESTEP_SCHEDULED,        // Submitted a sample for rendering.
+  FRAMESTEP_COMPLETE          // Sample was rendered. 
+};
+
+// Holds information related to frame-stepping in one varible for better organization. Counting the
+// steps down to the frame that is shown does not need the presenter, so it can be tested on its own.
+struct FrameStep
+{
+  FrameStep() : state(FRAMESTEP_NONE), steps(0), pSampleNoRef(NULL), requested(0), skipped(0), startTime(0)
+  {
+  }
+
+  // Returns TRUE if the next mixer output is an intermediate frame of a multi-frame step, i.e. a frame
+  // that is never shown. When scrubbing, samples are also discarded by their time stamp, which we only
+  // know after mixing.
+  BOOL IsIntermediate(BOOL bScrubbing) const
+  {
+    return (state == FRAMESTEP_PENDING) && (steps > 1) && !bScrubbing;
+  }
+
+  // Counts a frame that reached the frame-step logic. Returns TRUE if it is the frame of the step, the
+  // one to show.
+  BOOL CountFrame()
+  {
+    if (steps > 0)
+    {
+      steps--;
+    }
+    return steps == 0;
+  }
+
+  // Returns TRUE if the mixer can drop output frames without rendering them.
+  static BOOL CanDiscard(IMFTransform *pMixer);
+
+  // Asks the mixer to discard its next output frame instead of rendering it, and counts the step.
+  // Returns S_OK if the frame was discarded, MF_E_TRANSFORM_NEED_MORE_INPUT if the mixer has no frame,
+  // and S_FALSE if the frame has to be processed the normal way. Clears *pbCanDiscard if the mixer
+  // turns out not to support discarding.
+  HRESULT DiscardIntermediate(IMFTransform *pMixer, BOOL *pbCanDiscard);
+
+  FRAMESTEP_STATE     state;          // Current frame-step state
+  VideoSampleList     samples;        // List of pending samples for frame-stepping
+  DWORD               steps;          // Number of steps left
+  DWORD_PTR           pSampleNoRef;   // Identifies the frame-step sample.
+
+  // Statistics
+  DWORD               requested;      // Number of steps requested since the last completed step
+  DWORD               skipped;        // Intermediate frames the mixer discarded without rendering
+  LONGLONG            startTime;      // QPC time of the first request
+};
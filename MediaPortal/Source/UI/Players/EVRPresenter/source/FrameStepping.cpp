@@ -23,6 +23,16 @@ HRESULT EVRCustomPresenter::PrepareFrameStep(DWORD cSteps)
 {
   HRESULT hr = S_OK;
 
+  // Statistics: measure from the first request until the step completes.
+  if (m_FrameStep.requested == 0)
+  {
+    LARGE_INTEGER liNow;
+    QueryPerformanceCounter(&liNow);
+    m_FrameStep.startTime = liNow.QuadPart;
+    m_FrameStep.skipped = 0;
+  }
+  m_FrameStep.requested += cSteps;
+
   // Cache the step count.
   m_FrameStep.steps += cSteps;
 
@@ -115,6 +125,19 @@ HRESULT EVRCustomPresenter::CompleteFrameStep(IMFSample *pSample)
   // Notify the EVR that the frame-step is complete.
   NotifyEvent(EC_STEP_COMPLETE, FALSE, 0); // FALSE = completed (not cancelled)
 
+  // Report the frame-step throughput.
+  if (m_FrameStep.requested > 0)
+  {
+    LARGE_INTEGER liNow, liFrequency;
+    QueryPerformanceCounter(&liNow);
+    QueryPerformanceFrequency(&liFrequency);
+
+    double seconds = (double)(liNow.QuadPart - m_FrameStep.startTime) / liFrequency.QuadPart;
+    Log("EVRCustomPresenter::CompleteFrameStep %u steps in %.1f ms (%.0f steps/s, %u frames discarded by the mixer)",
+      m_FrameStep.requested, seconds * 1000.0, (seconds > 0) ? m_FrameStep.requested / seconds : 0.0, m_FrameStep.skipped);
+    m_FrameStep.requested = 0;
+  }
+
   // If we are scrubbing (rate == 0), also send the "scrub time" event.
   if (IsScrubbing())
   {
@@ -145,6 +168,7 @@ HRESULT EVRCustomPresenter::CancelFrameStep()
   m_FrameStep.state = FRAMESTEP_NONE;
   m_FrameStep.steps = 0;
   m_FrameStep.pSampleNoRef = NULL;
+  m_FrameStep.requested = 0;
   // Don't clear the frame-step queue yet, because we might frame step again.
 
   if (oldState > FRAMESTEP_NONE && oldState < FRAMESTEP_COMPLETE)
@@ -166,6 +190,7 @@ HRESULT EVRCustomPresenter::DeliverFrameStepSample(IMFSample *pSample)
   if (IsScrubbing() && m_pClock && IsSampleTimePassed(m_pClock, pSample))
   {
     // Discard this sample.
+    m_scheduler.TraceDrop(pSample);
   }
   else if (m_FrameStep.state >= FRAMESTEP_SCHEDULED)
   {
@@ -180,14 +205,10 @@ HRESULT EVRCustomPresenter::DeliverFrameStepSample(IMFSample *pSample)
     // We're ready to frame-step.
 
     // Decrement the number of steps.
-    if (m_FrameStep.steps > 0)
-    {
-      m_FrameStep.steps--;
-    }
-
-    if (m_FrameStep.steps > 0)
+    if (!m_FrameStep.CountFrame())
     {
       // This is not the last step. Discard this sample.
+      m_scheduler.TraceDrop(pSample);
     }
     else if (m_FrameStep.state == FRAMESTEP_WAITING_START)
     {
@@ -228,3 +249,30 @@ HRESULT EVRCustomPresenter::DeliverFrameStepSample(IMFSample *pSample)
   return hr;
 }
 
+
+// Returns TRUE if the next mixer output is an intermediate frame of a multi-frame step, i.e. a frame
+// that DeliverFrameStepSample would discard.
+BOOL EVRCustomPresenter::IsIntermediateFrameStep()
+{
+  return m_FrameStep.IsIntermediate(IsScrubbing());
+}
+
+
+// Asks the mixer to discard its next output frame instead of rendering it into one of our samples.
+// Returns S_FALSE if the frame has to be processed the normal way.
+HRESULT EVRCustomPresenter::SkipFrameStepOutput()
+{
+  HRESULT hr = m_FrameStep.DiscardIntermediate(m_pMixer, &m_bMixerCanDiscard);
+
+  if (hr == S_OK)
+  {
+    m_bPrerolled = TRUE;
+  }
+  else if (hr == MF_E_TRANSFORM_NEED_MORE_INPUT)
+  {
+    // The mixer needs more input. We have to wait for the mixer to get more input.
+    m_bSampleNotify = FALSE;
+  }
+
+  return hr;
+}
@@ -58,25 +58,6 @@ float EVRCustomPresenter::GetMaxRate(BOOL bThin)
 }
 
 
-// Tests whether two IMFMediaType's are equal. Either pointer can be NULL.
-BOOL EVRCustomPresenter::AreMediaTypesEqual(IMFMediaType *pType1, IMFMediaType *pType2)
-{
-  if ((pType1 == NULL) && (pType2 == NULL))
-  {
-    return TRUE; // Both are NULL.
-  }
-  else if ((pType1 == NULL) || (pType2 == NULL))
-  {
-    return FALSE; // One is NULL.
-  }
-
-  DWORD dwFlags = 0;
-  HRESULT hr = pType1->IsEqual(pType2, &dwFlags);
-
-  return (hr == S_OK);
-}
-
-
 // Returns S_OK if an area is smaller than width x height. Otherwise, returns MF_E_INVALIDMEDIATYPE.
 HRESULT EVRCustomPresenter::ValidateVideoArea(const MFVideoArea& area, UINT32 width, UINT32 height)
 {
@@ -87,6 +87,8 @@ HRESULT STDMETHODCALLTYPE EVRCustomPresenter::OnClockSetRate(MFTIME hnsSystemTim
   {
     CancelFrameStep();
     m_FrameStep.samples.Clear();
+
+    m_pD3DPresentEngine->LogScrubStatistics();
   }
 
   m_fRate = fRate;
@@ -120,6 +122,12 @@ HRESULT STDMETHODCALLTYPE EVRCustomPresenter::OnClockStart(MFTIME hnsSystemTime,
     if (llClockStartOffset != PRESENTATION_CURRENT_POSITION)
     {
       Flush();
+
+      // While scrubbing, show the cached frame for the new position until the real frame arrives.
+      if (IsScrubbing())
+      {
+        (void)m_pD3DPresentEngine->PresentScrubFrame(llClockStartOffset);
+      }
     }
   }
   else
@@ -112,6 +112,9 @@ HRESULT STDMETHODCALLTYPE EVRCustomPresenter::ReleaseServicePointers()
   // Clear the media type and release related resources (surfaces, etc).
   SetMediaType(NULL);
 
+  // Negotiation results are only valid for the current mixer.
+  m_MediaTypeCache.Clear();
+
   // Release all services that were acquired from InitServicePointers.
   SAFE_RELEASE(m_pClock);
   SAFE_RELEASE(m_pMixer);
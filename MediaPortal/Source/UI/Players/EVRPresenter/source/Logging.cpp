@@ -1,18 +1,18 @@
 // Copyright (C) 2007-2014 Team MediaPortal
 // http://www.team-mediaportal.com
-// 
+//
 // This file is part of MediaPortal 2
-// 
+//
 // MediaPortal 2 is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
 // the Free Software Foundation, either version 3 of the License, or
 // (at your option) any later version.
-// 
+//
 // MediaPortal 2 is distributed in the hope that it will be useful,
 // but WITHOUT ANY WARRANTY; without even the implied warranty of
 // MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
 // GNU General Public License for more details.
-// 
+//
 // You should have received a copy of the GNU General Public License
 // along with MediaPortal 2. If not, see <http://www.gnu.org/licenses/>.
 
@@ -21,6 +21,63 @@
 
 #include "EVRPresenter.h"
 
+// Log records are passed from the calling threads to a writer thread through a bounded lock-free ring.
+// Callers only format the message and copy it into a free slot; opening the file, getting the local time
+// and writing happens on the writer thread. If the ring is full, the record is dropped and counted.
+//
+// The writer thread holds a reference on the DLL while it runs, so a FreeLibrary by the host cannot unmap
+// its code. StopLogWriter (called by EvrDeinit) drains the ring, closes the file and lets the thread drop
+// that reference again; the next log call starts a new writer.
+
+const DWORD LOG_QUEUE_SIZE = 1024;          // Number of slots, must be a power of two.
+const DWORD LOG_MESSAGE_SIZE = 1000;        // Maximum message length.
+const DWORD LOG_WRITER_IDLE_TIMEOUT = 100;  // Writer wakes up at least this often (ms).
+
+struct LogRecord
+{
+  volatile LONG sequence;                   // Slot sequence number, stored relative to the slot index (see below).
+  FILETIME      time;
+  DWORD         threadId;
+  LOG_LEVEL     level;
+  char          message[LOG_MESSAGE_SIZE];
+};
+
+static LogRecord        g_LogQueue[LOG_QUEUE_SIZE];
+static volatile LONG    g_lQueueTail = 0;       // Next slot to be claimed by a producer.
+static LONG             g_lQueueHead = 0;       // Next slot to be written (writer only).
+static volatile LONG    g_lDropped = 0;         // Records dropped because the ring was full.
+static LONG             g_lDroppedReported = 0;
+static volatile LONG    g_lLogLevel = LOG_LEVEL_INFO;    // Run-time filter, see SetLogLevel
+
+static volatile LONG    g_lInitState = 0;       // 0 = not started, 1 = starting, 2 = running, 3 = stopping
+static volatile LONG    g_lWriterIdle = 0;      // Writer is waiting for g_hWriterEvent
+static volatile LONG    g_lShutdown = 0;
+static HANDLE           g_hWriterEvent = NULL;
+static HANDLE           g_hWriterThread = NULL;
+static HMODULE          g_hWriterModule = NULL; // Reference on our DLL owned by the writer thread
+static bool             g_bWriterInitialized = false; // g_WriterLock and g_hWriterEvent exist
+static CRITICAL_SECTION g_WriterLock;           // Serializes the consumer side (writer thread vs. shutdown)
+static FILE*            g_pLogFile = NULL;
+
+static __declspec(thread) char t_Buffer[LOG_MESSAGE_SIZE];
+
+static const char* const g_LevelNames[] = { "DEBUG", "INFO ", "WARN ", "ERROR" };
+
+// Each slot carries a sequence number: a slot at position pos is free when its sequence is pos, holds a
+// published record when it is pos + 1, and becomes free for the next round with pos + LOG_QUEUE_SIZE.
+// Sequences are stored minus the slot index, so the zero-initialized ring is valid before the writer
+// thread is started.
+static inline LONG GetSequence(LONG pos)
+{
+  return g_LogQueue[pos & (LOG_QUEUE_SIZE - 1)].sequence + (pos & (LOG_QUEUE_SIZE - 1));
+}
+
+static inline void SetSequence(LONG pos, LONG sequence)
+{
+  MemoryBarrier();
+  g_LogQueue[pos & (LOG_QUEUE_SIZE - 1)].sequence = sequence - (pos & (LOG_QUEUE_SIZE - 1));
+}
+
 void LogPath(TCHAR* dest, TCHAR* name)
 {
   TCHAR folder[MAX_PATH];
@@ -28,34 +85,296 @@ void LogPath(TCHAR* dest, TCHAR* name)
   sprintf_s(dest, MAX_PATH, "%s\\Team MediaPortal\\MP2-Client\\Log\\Evr.%s", folder, name);
 }
 
+
+// Writes all records that are ready to the log file. Called with g_WriterLock held.
+static void WriteRecords()
+{
+  bool bWritten = false;
+
+  if (g_pLogFile == NULL)
+  {
+    TCHAR fileName[MAX_PATH];
+    LogPath(fileName, "log");
+    if (fopen_s(&g_pLogFile, fileName, "a+") != 0)
+    {
+      g_pLogFile = NULL;
+    }
+  }
+
+  while (true)
+  {
+    LogRecord& record = g_LogQueue[g_lQueueHead & (LOG_QUEUE_SIZE - 1)];
+
+    // The producer publishes a slot by setting its sequence to position + 1.
+    if (GetSequence(g_lQueueHead) != g_lQueueHead + 1)
+    {
+      break;
+    }
+    MemoryBarrier();
+
+    if (g_pLogFile)
+    {
+      FILETIME localTime;
+      SYSTEMTIME systemTime;
+      FileTimeToLocalFileTime(&record.time, &localTime);
+      FileTimeToSystemTime(&localTime, &systemTime);
+
+      fprintf(g_pLogFile, "%04.4d-%02.2d-%02.2d %02.2d:%02.2d:%02.2d.%03.3d [%04x] [%s] %s\n",
+        systemTime.wYear, systemTime.wMonth, systemTime.wDay,
+        systemTime.wHour, systemTime.wMinute, systemTime.wSecond,
+        systemTime.wMilliseconds,
+        record.threadId,
+        g_LevelNames[record.level],
+        record.message);
+      bWritten = true;
+    }
+
+    // Hand the slot back to the producers for the next round.
+    SetSequence(g_lQueueHead, g_lQueueHead + LOG_QUEUE_SIZE);
+    g_lQueueHead++;
+  }
+
+  LONG lDropped = g_lDropped;
+  if (lDropped != g_lDroppedReported && g_pLogFile)
+  {
+    fprintf(g_pLogFile, "[%u log records dropped, %u in total]\n", lDropped - g_lDroppedReported, lDropped);
+    g_lDroppedReported = lDropped;
+    bWritten = true;
+  }
+
+  if (bWritten)
+  {
+    fflush(g_pLogFile);
+  }
+}
+
+
+// Flushes the remaining records and closes the log file when the DLL is unloaded. The writer thread
+// pins the DLL, so it is gone by now unless the process is exiting; we must not wait for it here (loader
+// lock) and drain the ring ourselves.
+static struct LogShutdown
+{
+  ~LogShutdown()
+  {
+    if (!g_bWriterInitialized)
+    {
+      return;
+    }
+    InterlockedExchange(&g_lShutdown, 1);
+
+    EnterCriticalSection(&g_WriterLock);
+    WriteRecords();
+    if (g_pLogFile)
+    {
+      fclose(g_pLogFile);
+      g_pLogFile = NULL;
+    }
+    LeaveCriticalSection(&g_WriterLock);
+  }
+} g_LogShutdown;
+
+
+// ThreadProc of the log writer.
+static DWORD WINAPI LogWriterThreadProc(LPVOID lpParameter)
+{
+  while (!g_lShutdown)
+  {
+    EnterCriticalSection(&g_WriterLock);
+    if (!g_lShutdown)
+    {
+      WriteRecords();
+    }
+    LeaveCriticalSection(&g_WriterLock);
+
+    // Tell the producers that we need to be woken up, then check once more for records that were
+    // published before they could see the flag.
+    InterlockedExchange(&g_lWriterIdle, 1);
+    if (GetSequence(g_lQueueHead) != g_lQueueHead + 1)
+    {
+      WaitForSingleObject(g_hWriterEvent, LOG_WRITER_IDLE_TIMEOUT);
+    }
+    InterlockedExchange(&g_lWriterIdle, 0);
+  }
+
+  // Write what is left and close the file, then drop our reference on the DLL. This may unload it,
+  // so nothing of the DLL must run after FreeLibraryAndExitThread.
+  EnterCriticalSection(&g_WriterLock);
+  WriteRecords();
+  if (g_pLogFile)
+  {
+    fclose(g_pLogFile);
+    g_pLogFile = NULL;
+  }
+  LeaveCriticalSection(&g_WriterLock);
+
+  FreeLibraryAndExitThread(g_hWriterModule, 0);
+  return 0;
+}
+
+
+// Starts the writer thread on first use, or after StopLogWriter.
+static void StartLogWriter()
+{
+  if (InterlockedCompareExchange(&g_lInitState, 1, 0) != 0)
+  {
+    return; // Already running or another thread is starting or stopping it. Records wait in the ring.
+  }
+
+  if (!g_bWriterInitialized)
+  {
+    InitializeCriticalSection(&g_WriterLock);
+    g_hWriterEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    g_bWriterInitialized = true;
+  }
+
+  // The thread keeps the DLL loaded until it has exited.
+  g_lShutdown = 0;
+  g_hWriterThread = NULL;
+  if (GetModuleHandleEx(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS, (LPCTSTR)&LogWriterThreadProc, &g_hWriterModule))
+  {
+    g_hWriterThread = CreateThread(NULL, 0, LogWriterThreadProc, NULL, 0, NULL);
+    if (g_hWriterThread)
+    {
+      SetThreadPriority(g_hWriterThread, THREAD_PRIORITY_BELOW_NORMAL);
+    }
+    else
+    {
+      FreeLibrary(g_hWriterModule);
+      g_hWriterModule = NULL;
+    }
+  }
+
+  InterlockedExchange(&g_lInitState, 2);
+}
+
+
+// Stops the writer thread and waits until it has written all records. Must not be called from DllMain.
+void StopLogWriter()
+{
+  if (InterlockedCompareExchange(&g_lInitState, 3, 2) != 2)
+  {
+    return; // Not running, or another thread is starting or stopping it.
+  }
+
+  if (g_hWriterThread)
+  {
+    InterlockedExchange(&g_lShutdown, 1);
+    SetEvent(g_hWriterEvent);
+    WaitForSingleObject(g_hWriterThread, INFINITE);
+    CloseHandle(g_hWriterThread);
+    g_hWriterThread = NULL;
+  }
+
+  InterlockedExchange(&g_lInitState, 0);
+}
+
+
+// Claims a slot in the ring and publishes the message. Returns false if the ring is full.
+static bool PushRecord(LOG_LEVEL level, const char *message)
+{
+  LONG pos = g_lQueueTail;
+  LogRecord *pRecord = NULL;
+
+  while (true)
+  {
+    pRecord = &g_LogQueue[pos & (LOG_QUEUE_SIZE - 1)];
+    LONG diff = GetSequence(pos) - pos;
+
+    if (diff == 0)
+    {
+      // The slot is free; try to claim it.
+      LONG prev = InterlockedCompareExchange(&g_lQueueTail, pos + 1, pos);
+      if (prev == pos)
+      {
+        break;
+      }
+      pos = prev;
+    }
+    else if (diff < 0)
+    {
+      // The writer has not yet written the record of the previous round: the ring is full.
+      return false;
+    }
+    else
+    {
+      // Another producer claimed this slot.
+      pos = g_lQueueTail;
+    }
+  }
+
+  GetSystemTimeAsFileTime(&pRecord->time);
+  pRecord->threadId = GetCurrentThreadId();
+  pRecord->level = level;
+  strcpy_s(pRecord->message, LOG_MESSAGE_SIZE, message);
+
+  // Publish the record.
+  SetSequence(pos, pos + 1);
+  return true;
+}
+
+
+static void LogV(LOG_LEVEL level, const char *fmt, va_list ap)
+{
+  if ((LONG)level < g_lLogLevel)
+  {
+    return;
+  }
+
+  if (g_lInitState != 2)
+  {
+    StartLogWriter();
+  }
+
+  _vsnprintf_s(t_Buffer, LOG_MESSAGE_SIZE, _TRUNCATE, fmt, ap);
+
+  if (!PushRecord(level, t_Buffer))
+  {
+    InterlockedIncrement(&g_lDropped);
+    return;
+  }
+
+  // The store that published the record must be visible before we read the idle flag. Otherwise the
+  // writer may set the flag, miss our record in its final check and sleep while we skip the signal.
+  MemoryBarrier();
+
+  // Only signal the writer if it is waiting.
+  if (g_lWriterIdle && InterlockedExchange(&g_lWriterIdle, 0))
+  {
+    SetEvent(g_hWriterEvent);
+  }
+}
+
+
 // write message to EVR Log
 void Log(const char *fmt, ...)
 {
   va_list ap;
+  va_start(ap, fmt);
+  LogV(LOG_LEVEL_INFO, fmt, ap);
+  va_end(ap);
+}
 
-  char buffer[1000];
-  int tmp;
+
+// write message with the given severity to EVR Log
+void LogAtLevel(LOG_LEVEL level, const char *fmt, ...)
+{
+  va_list ap;
   va_start(ap, fmt);
-  tmp = vsprintf_s(buffer, fmt, ap);
+  LogV(level, fmt, ap);
   va_end(ap);
+}
 
-  TCHAR fileName[MAX_PATH];
-  LogPath(fileName, "log");
 
-  FILE* fp;
-  int err = fopen_s(&fp, fileName, "a+");
-  if (err == 0)
-  {
-    SYSTEMTIME systemTime;
-    GetLocalTime(&systemTime);
-    fprintf(fp, "%04.4d-%02.2d-%02.2d %02.2d:%02.2d:%02.2d.%03.3d [%04x] %s\n",
-      systemTime.wYear, systemTime.wMonth, systemTime.wDay,
-      systemTime.wHour, systemTime.wMinute, systemTime.wSecond,
-      systemTime.wMilliseconds,
-      GetCurrentThreadId(),
-      buffer);
-    fclose(fp);
-  }
+// Sets the minimum severity that is written at run-time.
+void SetLogLevel(LOG_LEVEL level)
+{
+  InterlockedExchange(&g_lLogLevel, level);
 }
 
 
+// Returns the number of records that were dropped because the log queue was full.
+LONG GetDroppedLogRecords()
+{
+  return g_lDropped;
+}
+
@@ -0,0 +1,332 @@
+// Copyright (C) 2007-2014 Team MediaPortal
+// http://www.team-mediaportal.com
+//
+// This file is part of MediaPortal 2
+//
+// MediaPortal 2 is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// MediaPortal 2 is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with MediaPortal 2. If not, see <http://www.gnu.org/licenses/>.
+
+#include <mfapi.h>
+
+#include "MediaTypeCache.h"
+
+// FNV-1a parameters
+const UINT64 FNV_OFFSET_BASIS = 0xcbf29ce484222325ULL;
+const UINT64 FNV_PRIME = 0x100000001b3ULL;
+
+// Attributes that decide whether we accept a type and how the optimal type looks like.
+// All other attributes are only checked by the IMFMediaType::IsEqual confirmation on a hash match.
+static const GUID* const g_NegotiationAttributes[] =
+{
+  &MF_MT_MAJOR_TYPE,
+  &MF_MT_SUBTYPE,
+  &MF_MT_COMPRESSED,
+  &MF_MT_FRAME_SIZE,
+  &MF_MT_FRAME_RATE,
+  &MF_MT_PIXEL_ASPECT_RATIO,
+  &MF_MT_INTERLACE_MODE,
+  &MF_MT_PAN_SCAN_ENABLED,
+  &MF_MT_PAN_SCAN_APERTURE,
+  &MF_MT_GEOMETRIC_APERTURE,
+  &MF_MT_MINIMUM_DISPLAY_APERTURE,
+  &MF_MT_SOURCE_CONTENT_HINT
+};
+
+
+static inline UINT64 HashBytes(UINT64 hash, const void *pData, size_t cb)
+{
+  const BYTE *p = (const BYTE*)pData;
+  for (size_t i = 0; i < cb; i++)
+  {
+    hash ^= p[i];
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+
+// Creates a new media type with all attributes of pType.
+static HRESULT CloneMediaType(IMFMediaType *pType, IMFMediaType **ppClone)
+{
+  IMFMediaType *pClone = NULL;
+
+  HRESULT hr = MFCreateMediaType(&pClone);
+  if (SUCCEEDED(hr))
+  {
+    hr = pType->CopyAllItems(pClone);
+  }
+  if (FAILED(hr))
+  {
+    SAFE_RELEASE(pClone);
+    return hr;
+  }
+
+  *ppClone = pClone;
+  return S_OK;
+}
+
+
+// Constructor
+MediaTypeCache::MediaTypeCache() :
+m_UseCounter(0),
+m_Hits(0),
+m_Misses(0),
+m_llMissCost(0),
+m_llSaved(0),
+m_HitsSinceLog(0)
+{
+  ZeroMemory(m_Entries, sizeof(m_Entries));
+  if (!QueryPerformanceFrequency(&m_liFrequency) || m_liFrequency.QuadPart == 0)
+  {
+    m_liFrequency.QuadPart = 1;
+  }
+}
+
+
+// Destructor
+MediaTypeCache::~MediaTypeCache()
+{
+  Clear();
+}
+
+
+// Computes a canonical hash over the negotiation attributes. The attributes are visited in a fixed
+// order, so the hash does not depend on the order in which the mixer has set them.
+HRESULT MediaTypeCache::HashMediaType(IMFMediaType *pType, UINT64 *pHash)
+{
+  CheckPointer(pType, E_POINTER);
+  CheckPointer(pHash, E_POINTER);
+
+  UINT64 hash = FNV_OFFSET_BASIS;
+
+  for (DWORD i = 0; i < ARRAY_SIZE(g_NegotiationAttributes); i++)
+  {
+    PROPVARIANT var;
+    PropVariantInit(&var);
+
+    if (FAILED(pType->GetItem(*g_NegotiationAttributes[i], &var)))
+    {
+      // A missing attribute still has to change the hash.
+      hash = HashBytes(hash, &i, sizeof(i));
+      continue;
+    }
+
+    hash = HashBytes(hash, &var.vt, sizeof(var.vt));
+    switch (var.vt)
+    {
+    case VT_UI4:
+      hash = HashBytes(hash, &var.ulVal, sizeof(var.ulVal));
+      break;
+    case VT_UI8:
+      hash = HashBytes(hash, &var.uhVal, sizeof(var.uhVal));
+      break;
+    case VT_R8:
+      hash = HashBytes(hash, &var.dblVal, sizeof(var.dblVal));
+      break;
+    case VT_CLSID:
+      hash = HashBytes(hash, var.puuid, sizeof(GUID));
+      break;
+    case VT_VECTOR | VT_UI1:
+      hash = HashBytes(hash, var.caub.pElems, var.caub.cElems);
+      break;
+    default:
+      // Strings and interfaces are not part of the negotiation attributes.
+      break;
+    }
+
+    PropVariantClear(&var);
+  }
+
+  *pHash = hash;
+  return S_OK;
+}
+
+
+// Looks up the negotiation result for a proposed type.
+HRESULT MediaTypeCache::Lookup(IMFMediaType *pProposed, UINT64 hash, HRESULT *phrSupported, IMFMediaType **ppOptimal,
+  UINT64 *pOptimalHash)
+{
+  CheckPointer(pProposed, E_POINTER);
+  CheckPointer(phrSupported, E_POINTER);
+  CheckPointer(ppOptimal, E_POINTER);
+
+  *ppOptimal = NULL;
+
+  for (DWORD i = 0; i < MEDIATYPE_CACHE_SIZE; i++)
+  {
+    Entry& entry = m_Entries[i];
+    if (entry.pProposed == NULL || entry.hash != hash)
+    {
+      continue;
+    }
+
+    // The hash only covers the negotiation attributes. Confirm that the types are really identical,
+    // because the optimal type is a copy of the complete proposed type.
+    DWORD dwFlags = 0;
+    if (entry.pProposed->IsEqual(pProposed, &dwFlags) != S_OK)
+    {
+      continue;
+    }
+
+    // The caller owns the optimal type it gets; it becomes the presenter's media type and is handed to
+    // the mixer, so never give out the cached instance.
+    if (entry.pOptimal && FAILED(CloneMediaType(entry.pOptimal, ppOptimal)))
+    {
+      continue;
+    }
+
+    entry.lastUsed = ++m_UseCounter;
+
+    *phrSupported = entry.hrSupported;
+    if (pOptimalHash)
+    {
+      *pOptimalHash = entry.optimalHash;
+    }
+
+    m_Hits++;
+    m_HitsSinceLog++;
+    if (m_Misses > 0)
+    {
+      // A hit saves us the average cost of computing a result.
+      m_llSaved += m_llMissCost / m_Misses;
+    }
+    return S_OK;
+  }
+
+  return S_FALSE;
+}
+
+
+// Stores a negotiation result. Replaces the least recently used entry if the cache is full.
+HRESULT MediaTypeCache::Insert(IMFMediaType *pProposed, UINT64 hash, HRESULT hrSupported, IMFMediaType *pOptimal, LONGLONG llCost,
+  UINT64 *pOptimalHash)
+{
+  CheckPointer(pProposed, E_POINTER);
+
+  m_Misses++;
+  m_llMissCost += llCost;
+
+  // Keep our own copies of both types, the mixer and the presenter are free to change their instances later.
+  IMFMediaType *pCopy = NULL;
+  IMFMediaType *pOptimalCopy = NULL;
+  UINT64 optimalHash = 0;
+  HRESULT hr = CloneMediaType(pProposed, &pCopy);
+  if (SUCCEEDED(hr) && pOptimal)
+  {
+    hr = CloneMediaType(pOptimal, &pOptimalCopy);
+  }
+  if (SUCCEEDED(hr) && pOptimal)
+  {
+    // The presenter compares against the optimal type whenever it is set again, hash it only once.
+    hr = HashMediaType(pOptimal, &optimalHash);
+  }
+  if (FAILED(hr))
+  {
+    SAFE_RELEASE(pCopy);
+    SAFE_RELEASE(pOptimalCopy);
+    CHECK_HR(hr, "MediaTypeCache::Insert could not copy the media types");
+  }
+
+  DWORD victim = 0;
+  for (DWORD i = 0; i < MEDIATYPE_CACHE_SIZE; i++)
+  {
+    if (m_Entries[i].pProposed == NULL)
+    {
+      victim = i;
+      break;
+    }
+    if (m_Entries[i].lastUsed < m_Entries[victim].lastUsed)
+    {
+      victim = i;
+    }
+  }
+
+  Entry& entry = m_Entries[victim];
+  SAFE_RELEASE(entry.pProposed);
+  SAFE_RELEASE(entry.pOptimal);
+
+  entry.hash = hash;
+  entry.pProposed = pCopy;
+  entry.hrSupported = hrSupported;
+  entry.lastUsed = ++m_UseCounter;
+  entry.pOptimal = pOptimalCopy;
+  entry.optimalHash = optimalHash;
+
+  if (pOptimalHash)
+  {
+    *pOptimalHash = optimalHash;
+  }
+
+  return S_OK;
+}
+
+
+// Tests whether two types are equal. Either pointer can be NULL.
+BOOL MediaTypeCache::AreTypesEqual(IMFMediaType *pType1, UINT64 hash1, IMFMediaType *pType2, UINT64 hash2)
+{
+  if ((pType1 == NULL) && (pType2 == NULL))
+  {
+    return TRUE; // Both are NULL.
+  }
+  else if ((pType1 == NULL) || (pType2 == NULL))
+  {
+    return FALSE; // One is NULL.
+  }
+  else if (pType1 == pType2)
+  {
+    return TRUE; // Same object, e.g. the current type set again.
+  }
+
+  else if (hash1 != hash2)
+  {
+    return FALSE; // The negotiation attributes differ.
+  }
+
+  // Our hash covers just the negotiation attributes, so only IsEqual can tell that the types are equal.
+  DWORD dwFlags = 0;
+  HRESULT hr = pType1->IsEqual(pType2, &dwFlags);
+
+  return (hr == S_OK);
+}
+
+
+// Forgets all entries.
+void MediaTypeCache::Clear()
+{
+  for (DWORD i = 0; i < MEDIATYPE_CACHE_SIZE; i++)
+  {
+    SAFE_RELEASE(m_Entries[i].pProposed);
+    SAFE_RELEASE(m_Entries[i].pOptimal);
+  }
+  ZeroMemory(m_Entries, sizeof(m_Entries));
+}
+
+
+// Writes the cache statistics to the log.
+void MediaTypeCache::LogStatistics()
+{
+  DWORD lookups = m_Hits + m_Misses;
+  if (lookups == 0)
+  {
+    return;
+  }
+
+  double savedMs = (double)m_llSaved * 1000.0 / m_liFrequency.QuadPart;
+  double missMs = (m_Misses > 0) ? (double)m_llMissCost * 1000.0 / m_liFrequency.QuadPart / m_Misses : 0.0;
+
+  Log("MediaTypeCache: %u hits, %u misses (hit rate %.1f%%), avg. miss cost %.3f ms, saved %.3f ms by %u hits in this negotiation",
+    m_Hits, m_Misses, 100.0 * m_Hits / lookups, missMs, savedMs, m_HitsSinceLog);
+
+  m_llSaved = 0;
+  m_HitsSinceLog = 0;
+}
@@ -0,0 +1,85 @@
+// Copyright (C) 2007-2014 Team MediaPortal
+// http://www.team-mediaportal.com
+//
+// This file is part of MediaPortal 2
+//
+// MediaPortal 2 is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// MediaPortal 2 is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with MediaPortal 2. If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "EVRPresenter.h"
+
+// Number of negotiation results we remember.
+const DWORD MEDIATYPE_CACHE_SIZE = 16;
+
+// Remembers the outcome of media type negotiation for mixer output types. Channel zapping sends
+// MFVP_MESSAGE_INVALIDATEMEDIATYPE over and over with the same proposed types, so we store the
+// IsMediaTypeSupported verdict and the optimal type for each proposal and skip the format checks
+// (including the D3D CheckDeviceType call) on a hit.
+//
+// The cache is not thread safe; it is only used while holding the presenter lock.
+class MediaTypeCache
+{
+public:
+  MediaTypeCache();
+  virtual ~MediaTypeCache();
+
+  // Looks up a proposed type. Returns S_OK on a hit and S_FALSE on a miss. On a hit, phrSupported
+  // receives the cached verdict, ppOptimal a copy of the cached optimal type (NULL if the type was rejected)
+  // and pOptimalHash, if not NULL, the hash of the optimal type.
+  HRESULT Lookup(IMFMediaType *pProposed, UINT64 hash, HRESULT *phrSupported, IMFMediaType **ppOptimal,
+    UINT64 *pOptimalHash = NULL);
+
+  // Stores the negotiation result for a proposed type. llCost is the time (QPC ticks) it took to compute.
+  // The optimal type is hashed once here; pOptimalHash, if not NULL, receives the hash.
+  HRESULT Insert(IMFMediaType *pProposed, UINT64 hash, HRESULT hrSupported, IMFMediaType *pOptimal, LONGLONG llCost,
+    UINT64 *pOptimalHash = NULL);
+
+  // Forgets all entries. Called when the D3D device was reset or the mixer changes.
+  void    Clear();
+
+  // Writes the hit rate and the time saved since the last call to the log.
+  void    LogStatistics();
+
+  // Computes a canonical hash over the attributes that take part in negotiation.
+  static HRESULT HashMediaType(IMFMediaType *pType, UINT64 *pHash);
+
+  // Tests whether two types are equal; either pointer can be NULL. hash1 and hash2 are the HashMediaType
+  // of the types, kept by the caller so that they are computed once per type. Equal types always hash
+  // alike, so different hashes prove that the types differ. Equal hashes never prove that they are
+  // equal: only the same object or IMFMediaType::IsEqual make them equal.
+  static BOOL AreTypesEqual(IMFMediaType *pType1, UINT64 hash1, IMFMediaType *pType2, UINT64 hash2);
+
+private:
+  struct Entry
+  {
+    UINT64        hash;
+    IMFMediaType  *pProposed;     // The mixer's type; used to confirm a hash match.
+    IMFMediaType  *pOptimal;      // Our own copy of the optimal type. Never handed out, so never modified.
+    UINT64        optimalHash;    // HashMediaType of pOptimal.
+    HRESULT       hrSupported;    // Result of IsMediaTypeSupported / CreateOptimalVideoType.
+    DWORD         lastUsed;       // Value of m_UseCounter at the last access (for LRU replacement).
+  };
+
+  Entry         m_Entries[MEDIATYPE_CACHE_SIZE];
+  DWORD         m_UseCounter;
+
+  // Statistics
+  LARGE_INTEGER m_liFrequency;
+  DWORD         m_Hits;
+  DWORD         m_Misses;
+  LONGLONG      m_llMissCost;     // Sum of the cost of all misses (QPC ticks).
+  LONGLONG      m_llSaved;        // Time saved by hits since the last LogStatistics call (QPC ticks).
+  DWORD         m_HitsSinceLog;
+};
@@ -134,6 +134,7 @@ HRESULT EVRCustomPresenter::RenegotiateMediaType()
 
   IMFMediaType *pMixerType = NULL;
   IMFMediaType *pOptimalType = NULL;
+  UINT64 optimalHash = 0;
   IMFVideoMediaType *pVideoType = NULL;
 
   CheckPointer(m_pMixer, MF_E_INVALIDREQUEST);
@@ -155,19 +156,12 @@ HRESULT EVRCustomPresenter::RenegotiateMediaType()
 
     // From now on, if anything in this loop fails, try the next type, until we succeed or the mixer runs out of types.
 
-    // Step 2. Check if we support this media type. 
-    hr = IsMediaTypeSupported(pMixerType);
+    // Step 2 + 3. Check if we support this media type and adjust the mixer's type to match our requirements.
+    // Types we have seen before are answered from the negotiation cache.
+    hr = GetOptimalVideoType(pMixerType, &pOptimalType, &optimalHash);
     if (FAILED(hr))
     {
-      Log("EVRCustomPresenter::RenegotiateMediaType EVRCustomPresenter::IsMediaTypeSupported failed");
-      continue;
-    }
-
-    // Step 3. Adjust the mixer's type to match our requirements.
-    hr = CreateOptimalVideoType(pMixerType, &pOptimalType);
-    if (FAILED(hr))
-    {
-      Log("EVRCustomPresenter::RenegotiateMediaType EVRCustomPresenter::CreateOptimalVideoType failed");
+      Log("EVRCustomPresenter::RenegotiateMediaType EVRCustomPresenter::GetOptimalVideoType failed");
       continue;
     }
 
@@ -180,7 +174,7 @@ HRESULT EVRCustomPresenter::RenegotiateMediaType()
     }
 
     // Step 5. Try to set the media type on ourselves.
-    hr = SetMediaType(pOptimalType);
+    hr = SetMediaType(pOptimalType, &optimalHash);
     if (FAILED(hr))
     {
       Log("EVRCustomPresenter::RenegotiateMediaType EVRCustomPresenter::SetMediaType failed");
@@ -197,6 +191,12 @@ HRESULT EVRCustomPresenter::RenegotiateMediaType()
       continue;
     }
 
+    // Step 7. Select the deinterlacing mode. A failure is not fatal, the mixer keeps its default mode.
+    (void)ConfigureDeinterlacing(m_pMixer);
+
+    // Step 8. Check whether the mixer can drop output frames without rendering them (frame-step fast path).
+    m_bMixerCanDiscard = FrameStep::CanDiscard(m_pMixer);
+
     // valid media type found and output set, exit loop
     bFoundMediaType = TRUE;
   }
@@ -205,6 +205,8 @@ HRESULT EVRCustomPresenter::RenegotiateMediaType()
   SAFE_RELEASE(pOptimalType);
   SAFE_RELEASE(pVideoType);
 
+  m_MediaTypeCache.LogStatistics();
+
   return hr;
 }
 
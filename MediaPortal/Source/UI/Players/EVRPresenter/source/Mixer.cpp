@@ -16,6 +16,8 @@
 // You should have received a copy of the GNU General Public License
 // along with MediaPortal 2. If not, see <http://www.gnu.org/licenses/>.
 
+#include <mfapi.h>
+
 #include "EVRCustomPresenter.h"
 
 // Initializes the mixer. Called from InitServicePointers.
@@ -73,3 +75,86 @@ HRESULT EVRCustomPresenter::SetMixerSourceRect(IMFTransform *pMixer, const MFVid
   return hr;
 }
 
+
+// Selects the mixer's video processor mode for the deinterlacing mode. The available modes depend on the
+// mixer's input type, so this is called after each successful media type negotiation.
+HRESULT EVRCustomPresenter::ConfigureDeinterlacing(IMFTransform *pMixer)
+{
+  CheckPointer(pMixer, E_POINTER);
+
+  if (m_DeinterlaceMode == DEINTERLACE_NONE)
+  {
+    return S_OK;
+  }
+
+  HRESULT hr = S_OK;
+  IMFVideoProcessor *pProcessor = NULL;
+  GUID *pModes = NULL;
+  UINT nModes = 0;
+  GUID mode = GUID_NULL;
+
+  hr = MFGetService(pMixer, MR_VIDEO_MIXER_SERVICE, __uuidof(IMFVideoProcessor), (void**)&pProcessor);
+  CHECK_HR(hr, "EVRCustomPresenter::ConfigureDeinterlacing could not get IMFVideoProcessor");
+
+  switch (m_DeinterlaceMode)
+  {
+  case DEINTERLACE_WEAVE:
+    // The progressive device does not deinterlace, it weaves the fields.
+    mode = DXVA2_VideoProcProgressiveDevice;
+    break;
+
+  case DEINTERLACE_BOB:
+    mode = DXVA2_VideoProcBobDevice;
+    break;
+
+  default:
+    // The driver lists its modes in order of quality. Use the first one that is a real driver mode
+    // (motion adaptive or motion compensated), fall back to bob if there is none.
+    mode = DXVA2_VideoProcBobDevice;
+    if (SUCCEEDED(pProcessor->GetAvailableVideoProcessorModes(&nModes, &pModes)))
+    {
+      for (UINT i = 0; i < nModes; i++)
+      {
+        if (!IsEqualGUID(pModes[i], DXVA2_VideoProcProgressiveDevice) &&
+          !IsEqualGUID(pModes[i], DXVA2_VideoProcBobDevice) &&
+          !IsEqualGUID(pModes[i], DXVA2_VideoProcSoftwareDevice))
+        {
+          mode = pModes[i];
+          break;
+        }
+      }
+      CoTaskMemFree(pModes);
+    }
+    break;
+  }
+
+  hr = pProcessor->SetVideoProcessorMode(&mode);
+  if (FAILED(hr))
+  {
+    Log("EVRCustomPresenter::ConfigureDeinterlacing IMFVideoProcessor::SetVideoProcessorMode() failed: 0x%x", hr);
+  }
+
+  SAFE_RELEASE(pProcessor);
+  return hr;
+}
+
+
+// Returns TRUE if the mixer outputs one frame per field, i.e. frames have to be presented at twice the frame rate.
+BOOL EVRCustomPresenter::IsFieldRateOutput()
+{
+  if (m_pMixer == NULL || m_DeinterlaceMode == DEINTERLACE_NONE || m_DeinterlaceMode == DEINTERLACE_WEAVE)
+  {
+    return FALSE;
+  }
+
+  IMFMediaType *pInputType = NULL;
+  if (FAILED(m_pMixer->GetInputCurrentType(0, &pInputType)))
+  {
+    return FALSE;
+  }
+
+  UINT32 mode = MFGetAttributeUINT32(pInputType, MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive);
+  SAFE_RELEASE(pInputType);
+
+  return IsFieldRateMode(m_DeinterlaceMode, mode);
+}
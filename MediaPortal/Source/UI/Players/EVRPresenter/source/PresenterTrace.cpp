@@ -0,0 +1,148 @@
+// Copyright (C) 2007-2014 Team MediaPortal
+// http://www.team-mediaportal.com
+//
+// This file is part of MediaPortal 2
+//
+// MediaPortal 2 is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// MediaPortal 2 is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with MediaPortal 2. If not, see <http://www.gnu.org/licenses/>.
+
+#include "EVRPresenter.h"
+#include "PresenterTrace.h"
+
+// Constructor
+PresenterTrace::PresenterTrace() :
+m_hFile(INVALID_HANDLE_VALUE),
+m_hMapping(NULL),
+m_pHeader(NULL),
+m_pRecords(NULL)
+{
+}
+
+
+// Destructor
+PresenterTrace::~PresenterTrace()
+{
+  Close();
+}
+
+
+// Creates (or reuses) the trace file and maps it into memory.
+HRESULT PresenterTrace::Open()
+{
+  if (IsOpen())
+  {
+    return S_OK;
+  }
+
+  HRESULT hr = S_OK;
+  TCHAR fileName[MAX_PATH];
+  DWORD dwSize = sizeof(TraceFileHeader) + TRACE_CAPACITY * sizeof(TraceRecord);
+
+  LogPath(fileName, "trace");
+
+  // Other processes may read the file while we are writing it, but only one presenter writes at a time.
+  m_hFile = CreateFile(fileName, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (m_hFile == INVALID_HANDLE_VALUE)
+  {
+    hr = HRESULT_FROM_WIN32(GetLastError());
+    Log("PresenterTrace::Open could not open trace file: 0x%x", hr);
+    return hr;
+  }
+
+  m_hMapping = CreateFileMapping(m_hFile, NULL, PAGE_READWRITE, 0, dwSize, NULL);
+  if (m_hMapping == NULL)
+  {
+    hr = HRESULT_FROM_WIN32(GetLastError());
+    Log("PresenterTrace::Open CreateFileMapping() failed: 0x%x", hr);
+    Close();
+    return hr;
+  }
+
+  BYTE *pView = (BYTE*)MapViewOfFile(m_hMapping, FILE_MAP_WRITE, 0, 0, dwSize);
+  if (pView == NULL)
+  {
+    hr = HRESULT_FROM_WIN32(GetLastError());
+    Log("PresenterTrace::Open MapViewOfFile() failed: 0x%x", hr);
+    Close();
+    return hr;
+  }
+
+  m_pHeader = (TraceFileHeader*)pView;
+  m_pRecords = (TraceRecord*)(pView + sizeof(TraceFileHeader));
+
+  // Start a new trace. Records of a previous run stay in the file, but a reader only looks at the
+  // last writeIndex records (at most capacity), which are all written by this run.
+  ZeroMemory(m_pHeader, sizeof(TraceFileHeader));
+  m_pHeader->magic = TRACE_MAGIC;
+  m_pHeader->version = TRACE_VERSION;
+  m_pHeader->headerSize = sizeof(TraceFileHeader);
+  m_pHeader->recordSize = sizeof(TraceRecord);
+  m_pHeader->capacity = TRACE_CAPACITY;
+  m_pHeader->processId = GetCurrentProcessId();
+  GetSystemTimeAsFileTime((FILETIME*)&m_pHeader->startTime);
+
+  Log("PresenterTrace::Open tracing to %s", fileName);
+  return hr;
+}
+
+
+// Unmaps and closes the trace file.
+void PresenterTrace::Close()
+{
+  if (m_pHeader)
+  {
+    UnmapViewOfFile(m_pHeader);
+    m_pHeader = NULL;
+    m_pRecords = NULL;
+  }
+  if (m_hMapping)
+  {
+    CloseHandle(m_hMapping);
+    m_hMapping = NULL;
+  }
+  if (m_hFile != INVALID_HANDLE_VALUE)
+  {
+    CloseHandle(m_hFile);
+    m_hFile = INVALID_HANDLE_VALUE;
+  }
+}
+
+
+// Appends a record to the ring.
+void PresenterTrace::Write(TRACE_DECISION decision, LONGLONG timestamp, LONGLONG sampleTime, LONGLONG clockTime,
+                           LONGLONG delta, LONGLONG presentDuration, LONG freeSamples, LONG sleepMs)
+{
+  if (m_pHeader == NULL)
+  {
+    return;
+  }
+
+  LONGLONG index = InterlockedIncrement64(&m_pHeader->writeIndex) - 1;
+  TraceRecord& record = m_pRecords[index & (TRACE_CAPACITY - 1)];
+
+  // Invalidate the slot while we overwrite it.
+  record.sequence = 0;
+  MemoryBarrier();
+
+  record.timestamp = timestamp;
+  record.sampleTime = sampleTime;
+  record.clockTime = clockTime;
+  record.delta = delta;
+  record.presentDuration = presentDuration;
+  record.decision = decision;
+  record.freeSamples = freeSamples;
+  record.sleepMs = sleepMs;
+
+  MemoryBarrier();
+  record.sequence = (DWORD)(index + 1);
+}
@@ -0,0 +1,49 @@
+// Copyright (C) 2007-2014 Team MediaPortal
+// http://www.team-mediaportal.com
+//
+// This file is part of MediaPortal 2
+//
+// MediaPortal 2 is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// MediaPortal 2 is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with MediaPortal 2. If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <windows.h>
+
+#include "PresenterTraceFormat.h"
+
+// Writes the binary trace of the scheduler's decisions (see PresenterTraceFormat.h) into a memory-mapped
+// ring file, Evr.trace next to the log.
+//
+// Tracing is off until EvrEnableTrace is called. tools\EvrTraceDump prints a trace file as CSV.
+
+class PresenterTrace
+{
+public:
+  PresenterTrace();
+  virtual ~PresenterTrace();
+
+  HRESULT Open();
+  void    Close();
+  BOOL    IsOpen() const { return m_pHeader != NULL; }
+
+  // Appends a record. Safe to call from any thread; does nothing if the trace is not open.
+  void    Write(TRACE_DECISION decision, LONGLONG timestamp, LONGLONG sampleTime, LONGLONG clockTime,
+                LONGLONG delta, LONGLONG presentDuration, LONG freeSamples, LONG sleepMs);
+
+private:
+  HANDLE            m_hFile;
+  HANDLE            m_hMapping;
+  TraceFileHeader   *m_pHeader;
+  TraceRecord       *m_pRecords;
+};
@@ -0,0 +1,87 @@
+// Copyright (C) 2007-2014 Team MediaPortal
+// http://www.team-mediaportal.com
+//
+// This file is part of MediaPortal 2
+//
+// MediaPortal 2 is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// MediaPortal 2 is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with MediaPortal 2. If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <stdint.h>
+
+// File format of the presenter's binary trace (Evr.trace). This header needs nothing from Windows, so
+// that tools\EvrTraceDump also builds on other hosts. The format is stable: a change to the layout
+// below must increment TRACE_VERSION.
+//
+// The trace is a ring file that is written through a memory mapping, so it survives a crash and can be
+// read by other processes while the presenter is running.
+//
+// File layout (little endian, all fields naturally aligned, no padding):
+//   TraceFileHeader                      (64 bytes)
+//   TraceRecord[header.capacity]         (64 bytes each)
+//
+// Records are written to slot (index % capacity), where index is taken from header.writeIndex by an
+// atomic increment. A record is complete when its sequence field equals the low 32 bits of index + 1;
+// a reader should skip records with an unexpected sequence, they are being overwritten. The slots of
+// the last min(writeIndex, capacity) indices hold the records of the current run.
+//
+// Times are in 100 ns units. startTime is a FILETIME, i.e. counted from 1601-01-01 UTC.
+
+const uint32_t TRACE_MAGIC = 0x54525645;   // 'EVRT'
+const uint32_t TRACE_VERSION = 1;
+const uint32_t TRACE_CAPACITY = 65536;     // Number of records, must be a power of two.
+
+// Scheduler decisions
+enum TRACE_DECISION
+{
+  TRACE_PRESENT = 0,          // Sample presented in time.
+  TRACE_PRESENT_LATE,         // Sample was late, presented anyway.
+  TRACE_PRESENT_IMMEDIATE,    // Sample presented without scheduling (no clock, no time stamp).
+  TRACE_SLEEP,                // Sample too early, scheduler goes to sleep.
+  TRACE_DROP                  // Sample discarded.
+};
+
+#pragma pack(push, 8)
+
+struct TraceFileHeader
+{
+  uint32_t          magic;            // TRACE_MAGIC
+  uint32_t          version;          // TRACE_VERSION
+  uint32_t          headerSize;       // sizeof(TraceFileHeader)
+  uint32_t          recordSize;       // sizeof(TraceRecord)
+  uint32_t          capacity;         // Number of record slots
+  uint32_t          processId;        // Process that writes the trace
+  int64_t           startTime;        // FILETIME (UTC) when the trace was started
+  volatile int64_t  writeIndex;       // Number of records written so far
+  uint8_t           reserved[24];
+};
+
+struct TraceRecord
+{
+  int64_t           timestamp;        // Time of the decision (QPC based)
+  int64_t           sampleTime;       // Presentation time of the sample
+  int64_t           clockTime;        // Presentation clock time at the decision
+  int64_t           delta;            // sampleTime - clockTime, reversed for negative rates
+  int64_t           presentDuration;  // Time spent in PresentSample, 0 if not presented
+  uint32_t          decision;         // TRACE_DECISION
+  int32_t           freeSamples;      // Free samples in the presenter's sample pool
+  int32_t           sleepMs;          // Scheduler sleep time for TRACE_SLEEP (ms)
+  uint32_t          sequence;         // Low 32 bits of (index + 1); written last
+  uint8_t           reserved[8];
+};
+
+#pragma pack(pop)
+
+static_assert(sizeof(TraceFileHeader) == 64, "the trace file header is 64 bytes");
+static_assert(sizeof(TraceRecord) == 64, "a trace record is 64 bytes");
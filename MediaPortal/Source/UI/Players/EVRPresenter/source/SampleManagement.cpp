@@ -75,6 +75,17 @@ HRESULT EVRCustomPresenter::ProcessOutput()
   // Make sure we have a pointer to the mixer.
   CheckPointer(m_pMixer, MF_E_INVALIDREQUEST);
 
+  // Frame-step fast path: let the mixer drop intermediate frames without rendering them.
+  if (!m_bRepaint && m_bMixerCanDiscard && IsIntermediateFrameStep())
+  {
+    hr = SkipFrameStepOutput();
+    if (hr != S_FALSE)
+    {
+      return hr;
+    }
+    hr = S_OK; // The mixer could not discard the frame. Get it the normal way.
+  }
+
   // Try to get a free sample from the video sample pool.
   hr = m_SamplePool.GetSample(&pSample);
   if (hr == MF_E_SAMPLEALLOCATOR_EMPTY)
@@ -162,6 +173,24 @@ HRESULT EVRCustomPresenter::ProcessOutput()
       NotifyEvent(EC_PROCESSING_LATENCY, (LONG_PTR)&latencyTime, 0);
     }
 
+    // Intermediate frames of a frame-step are never shown. Return them to the pool right away
+    // instead of tracking them and waiting for the sample-free callback.
+    if (!bRepaint && IsIntermediateFrameStep())
+    {
+      m_FrameStep.CountFrame();
+      m_bPrerolled = TRUE;
+      m_scheduler.TraceDrop(pSample);
+
+      hr = m_SamplePool.ReturnSample(pSample);
+      if (FAILED(hr))
+      {
+        Log("EVRCustomPresenter::ProcessOutput SamplePool::ReturnSample() failed");
+      }
+      SAFE_RELEASE(dataBuffer.pEvents);
+      SAFE_RELEASE(pSample);
+      return hr;
+    }
+
     // Set up notification for when the sample is released.
     hr = TrackSample(pSample);
     if (FAILED(hr))
@@ -235,6 +264,25 @@ HRESULT EVRCustomPresenter::DeliverSample(IMFSample *pSample, BOOL bRepaint)
   {
     // The Direct3D device was re-set. Notify the EVR.
     NotifyEvent(EC_DISPLAY_CHANGED, S_OK, 0);
+
+    // The format checks of previous negotiations were made against the old device. The cache is
+    // guarded by the presenter lock.
+    CAutoLock lock(this);
+    m_MediaTypeCache.Clear();
+  }
+  else if (IsScrubbing() && !bRepaint)
+  {
+    // Remember the frame, so we can show it immediately if the user scrubs back to this position.
+    LONGLONG hnsTime = 0;
+    LONGLONG hnsDuration = 0;
+    if (SUCCEEDED(pSample->GetSampleTime(&hnsTime)))
+    {
+      if (FAILED(pSample->GetSampleDuration(&hnsDuration)))
+      {
+        hnsDuration = m_scheduler.FrameDuration();
+      }
+      (void)m_pD3DPresentEngine->CacheScrubFrame(pSample, hnsTime, hnsDuration);
+    }
   }
 
   return hr;
@@ -12,7 +12,7 @@
 #include "EVRCustomPresenter.h"
 
 // Constructor
-SamplePool::SamplePool() : m_bInitialized(FALSE), m_cPending(0)
+SamplePool::SamplePool() : m_bInitialized(FALSE), m_cPending(0), m_cFree(0)
 {
 }
 
@@ -55,6 +55,7 @@ HRESULT SamplePool::GetSample(IMFSample **ppSample)
   }
 
   m_cPending++;
+  m_cFree--;
 
   // Give the sample to the caller.
   *ppSample = pSample;
@@ -81,6 +82,7 @@ HRESULT SamplePool::ReturnSample(IMFSample *pSample)
   CHECK_HR(hr, "EVRCustomPresenter::ReturnSample VideoSampleList::InsertBack() failed");
 
   m_cPending--;
+  m_cFree++;
 
   return hr;
 }
@@ -137,6 +139,7 @@ HRESULT SamplePool::Initialize(VideoSampleList& samples)
 
     pos = samples.Next(pos);
     SAFE_RELEASE(pSample);
+    m_cFree++;
   }
 
   m_bInitialized = TRUE;
@@ -158,6 +161,7 @@ HRESULT SamplePool::Clear()
   m_VideoSampleQueue.Clear();
   m_bInitialized = FALSE;
   m_cPending = 0;
+  m_cFree = 0;
 
   return hr;
 }
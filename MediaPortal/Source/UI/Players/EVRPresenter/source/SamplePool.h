@@ -25,6 +25,7 @@ public:
   HRESULT GetSample(IMFSample **ppSample);    // Does not block.
   HRESULT ReturnSample(IMFSample *pSample);   
   BOOL    AreSamplesPending();
+  LONG    GetFreeCount() const { return m_cFree; }   // Does not lock; for statistics only.
 
 private:
   CritSec           m_lock;
@@ -33,5 +34,6 @@ private:
 
   BOOL              m_bInitialized;
   DWORD             m_cPending;
+  volatile LONG     m_cFree;
 };
 
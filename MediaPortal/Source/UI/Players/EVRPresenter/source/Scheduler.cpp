@@ -36,6 +36,8 @@ const DWORD SCHEDULER_TIMEOUT = 5000;
 // Constructor
 Scheduler::Scheduler() :
 m_pCB(NULL),
+m_pTrace(NULL),
+m_pSamplePool(NULL),
 m_pClock(NULL),
 m_dwThreadID(0),
 m_hSchedulerThread(NULL),
@@ -314,9 +316,13 @@ bool Scheduler::ProcessSample(LONG *plNextSleep)
   LONGLONG hnsPresentationTime = 0;
   LONGLONG hnsTimeNow = 0;
   MFTIME   hnsSystemTime = 0;
+  LONGLONG hnsDelta = 0;
+  LONGLONG decisionTime = 0;
+  LONGLONG presentDuration = 0;
 
   BOOL bPresentNow = TRUE;
   BOOL bIsLate = FALSE;
+  BOOL bScheduled = FALSE;
   LONG lNextSleep = 0;
 
   IMFSample *pSample;
@@ -336,10 +342,11 @@ bool Scheduler::ProcessSample(LONG *plNextSleep)
     if (SUCCEEDED(hr))
     {
       hr = m_pClock->GetCorrelatedTime(0, &hnsTimeNow, &hnsSystemTime);
+      bScheduled = TRUE;
 
       // Calculate the time until the sample's presentation time. 
       // A negative value means the sample is late.
-      LONGLONG hnsDelta = hnsPresentationTime - hnsTimeNow;
+      hnsDelta = hnsPresentationTime - hnsTimeNow;
 
       // Usually we use 1/4th of frame time for scheduling, except for the case where GUI rendering takes already more than this value.
       LONGLONG hnsCompareThreshold = max(m_PerFrame_1_4th, m_averageFrameRenderDuration);
@@ -379,10 +386,12 @@ bool Scheduler::ProcessSample(LONG *plNextSleep)
   if (bPresentNow)
   {
     LONGLONG startTime = GetCurrentTimestamp();
+    decisionTime = startTime;
 
     hr = m_pCB->PresentSample(pSample, hnsPresentationTime);
 
     LONGLONG delta = GetCurrentTimestamp() - startTime;
+    presentDuration = delta;
 
     // Calculate exponential moving average
     m_averageFrameRenderDuration = (m_alpha * delta) + (1.0 - m_alpha) * m_averageFrameRenderDuration;
@@ -393,12 +402,55 @@ bool Scheduler::ProcessSample(LONG *plNextSleep)
     hr = m_ScheduledSamples.PutBack(pSample);
   }
 
+  if (m_pTrace && m_pTrace->IsOpen())
+  {
+    TRACE_DECISION decision = !bScheduled ? TRACE_PRESENT_IMMEDIATE : bIsLate ? TRACE_PRESENT_LATE : bPresentNow ? TRACE_PRESENT : TRACE_SLEEP;
+    if (decisionTime == 0)
+    {
+      decisionTime = GetCurrentTimestamp();
+    }
+    m_pTrace->Write(decision, decisionTime, hnsPresentationTime, hnsTimeNow, hnsDelta, presentDuration,
+      m_pSamplePool ? m_pSamplePool->GetFreeCount() : -1, lNextSleep);
+  }
+
   *plNextSleep = lNextSleep;
 
   SAFE_RELEASE(pSample);
   return true;
 }
 
+// Writes a TRACE_DROP record for a sample that is discarded without being presented.
+void Scheduler::TraceDrop(IMFSample *pSample)
+{
+  if (m_pTrace == NULL || !m_pTrace->IsOpen())
+  {
+    return;
+  }
+
+  LONGLONG hnsPresentationTime = 0;
+  LONGLONG hnsTimeNow = 0;
+  MFTIME   hnsSystemTime = 0;
+
+  if (pSample)
+  {
+    (void)pSample->GetSampleTime(&hnsPresentationTime);
+  }
+  if (m_pClock)
+  {
+    (void)m_pClock->GetCorrelatedTime(0, &hnsTimeNow, &hnsSystemTime);
+  }
+
+  LONGLONG hnsDelta = hnsPresentationTime - hnsTimeNow;
+  if (m_fRate < 0)
+  {
+    hnsDelta = -hnsDelta;
+  }
+
+  m_pTrace->Write(TRACE_DROP, GetCurrentTimestamp(), hnsPresentationTime, hnsTimeNow, hnsDelta, 0,
+    m_pSamplePool ? m_pSamplePool->GetFreeCount() : -1, 0);
+}
+
+
 // ThreadProc for the scheduler thread.
 DWORD WINAPI Scheduler::SchedulerThreadProc(LPVOID lpParameter)
 {
@@ -453,6 +505,15 @@ DWORD Scheduler::SchedulerThreadProcPrivate()
 
       case eFlush:
         // Flushing: Clear the sample queue and set the event.
+        if (m_pTrace && m_pTrace->IsOpen())
+        {
+          IMFSample *pSample = NULL;
+          while (m_ScheduledSamples.Dequeue(&pSample) == S_OK)
+          {
+            TraceDrop(pSample);
+            SAFE_RELEASE(pSample);
+          }
+        }
         m_ScheduledSamples.Clear();
         lWait = INFINITE;
         SetEvent(m_hFlushEvent);
@@ -10,9 +10,11 @@
 //////////////////////////////////////////////////////////////////////////
 
 struct SchedulerCallback;
+class SamplePool;
 
 #include "ThreadSafeQueue.h"
 #include "EVRPresenter.h"
+#include "PresenterTrace.h"
 
 const MFTIME ONE_SECOND = 10000000; // One second in hns
 const LONG   ONE_MSEC = 1000;       // One msec in hns 
@@ -28,6 +30,13 @@ public:
     m_pCB = pCB;
   }
 
+  // Sets the trace that receives the scheduling decisions (weak references; do not delete).
+  void SetTrace(PresenterTrace *pTrace, SamplePool *pSamplePool)
+  {
+    m_pTrace = pTrace;
+    m_pSamplePool = pSamplePool;
+  }
+
   void SetFrameRate(const MFRatio& fps);
   void SetClockRate(float fRate) { m_fRate = fRate; }
 
@@ -38,6 +47,7 @@ public:
   HRESULT StopScheduler();
 
   HRESULT ScheduleSample(IMFSample *pSample, BOOL bPresentNow);
+  void TraceDrop(IMFSample *pSample);
   HRESULT ProcessSamplesInQueue(LONG *plNextSleep);
   bool ProcessSample(LONG *plNextSleep);
   HRESULT Flush();
@@ -64,6 +74,8 @@ private:
 
   IMFClock            *m_pClock;  // Presentation clock. Can be NULL.
   SchedulerCallback   *m_pCB;     // Weak reference; do not delete.
+  PresenterTrace      *m_pTrace;  // Weak reference; do not delete.
+  SamplePool          *m_pSamplePool; // Weak reference, only used for tracing.
 
   DWORD         m_dwThreadID;
   HANDLE        m_hSchedulerThread;
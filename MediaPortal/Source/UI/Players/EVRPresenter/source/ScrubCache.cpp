@@ -0,0 +1,293 @@
+// Copyright (C) 2007-2014 Team MediaPortal
+// http://www.team-mediaportal.com
+//
+// This file is part of MediaPortal 2
+//
+// MediaPortal 2 is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// MediaPortal 2 is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with MediaPortal 2. If not, see <http://www.gnu.org/licenses/>.
+
+#include <assert.h>
+
+#include "EVRPresenter.h"
+#include "ScrubCache.h"
+
+
+// Checks if a surface exists and has the given size.
+static BOOL HasSize(IDirect3DSurface9 *pSurface, UINT width, UINT height)
+{
+  D3DSURFACE_DESC desc;
+  return pSurface && SUCCEEDED(pSurface->GetDesc(&desc)) && (desc.Width == width) && (desc.Height == height);
+}
+
+
+// Constructor
+ScrubCache::ScrubCache() :
+m_cEntries(0),
+m_cbUsed(0),
+m_UseCounter(0),
+m_pScaleTarget(NULL),
+m_pReadback(NULL),
+m_pPreview(NULL),
+m_Hits(0),
+m_Misses(0),
+m_Stored(0),
+m_Evicted(0)
+{
+  ZeroMemory(m_Entries, sizeof(m_Entries));
+}
+
+
+// Destructor
+ScrubCache::~ScrubCache()
+{
+  Clear();
+  ReleaseDeviceResources();
+}
+
+
+// Returns the index of the entry that covers the presentation time, or -1.
+int ScrubCache::Find(LONGLONG hnsTime)
+{
+  for (DWORD i = 0; i < m_cEntries; i++)
+  {
+    if ((hnsTime >= m_Entries[i].time) && (hnsTime < m_Entries[i].time + m_Entries[i].duration))
+    {
+      return (int)i;
+    }
+  }
+  return -1;
+}
+
+
+// Returns TRUE if there is a frame for the given presentation time.
+BOOL ScrubCache::Contains(LONGLONG hnsTime)
+{
+  return Find(hnsTime) >= 0;
+}
+
+
+// Removes an entry. The last entry is moved into its place.
+void ScrubCache::Remove(DWORD index)
+{
+  assert(index < m_cEntries);
+
+  Entry& entry = m_Entries[index];
+  m_cbUsed -= entry.width * entry.height * sizeof(WORD);
+  delete[] entry.pPixels;
+
+  m_cEntries--;
+  entry = m_Entries[m_cEntries];
+  ZeroMemory(&m_Entries[m_cEntries], sizeof(Entry));
+}
+
+
+// Evicts least recently used entries until cbNeeded bytes and one slot are available.
+void ScrubCache::Evict(DWORD cbNeeded)
+{
+  while ((m_cEntries > 0) && ((m_cEntries == SCRUB_CACHE_MAX_ENTRIES) || (m_cbUsed + cbNeeded > SCRUB_CACHE_BUDGET)))
+  {
+    DWORD victim = 0;
+    for (DWORD i = 1; i < m_cEntries; i++)
+    {
+      if (m_Entries[i].lastUsed < m_Entries[victim].lastUsed)
+      {
+        victim = i;
+      }
+    }
+    Remove(victim);
+    m_Evicted++;
+  }
+}
+
+
+// Downscales the surface on the GPU, reads it back and stores it as RGB565.
+HRESULT ScrubCache::Store(IDirect3DDevice9Ex *pDevice, IDirect3DSurface9 *pSurface, LONGLONG hnsTime, LONGLONG hnsDuration)
+{
+  CheckPointer(pDevice, E_POINTER);
+  CheckPointer(pSurface, E_POINTER);
+
+  HRESULT hr = S_OK;
+  D3DSURFACE_DESC desc;
+  D3DLOCKED_RECT lr;
+
+  if (Contains(hnsTime))
+  {
+    return S_FALSE;
+  }
+
+  hr = pSurface->GetDesc(&desc);
+  CHECK_HR(hr, "ScrubCache::Store IDirect3DSurface9::GetDesc() failed");
+
+  // Keep the aspect ratio of the surface; never scale up.
+  UINT width = min(desc.Width, SCRUB_THUMBNAIL_WIDTH);
+  UINT height = max(1, MulDiv(desc.Height, width, desc.Width));
+  DWORD cbPixels = width * height * sizeof(WORD);
+
+  if (!HasSize(m_pScaleTarget, width, height))
+  {
+    SAFE_RELEASE(m_pScaleTarget);
+    SAFE_RELEASE(m_pReadback);
+
+    hr = pDevice->CreateRenderTarget(width, height, D3DFMT_X8R8G8B8, D3DMULTISAMPLE_NONE, 0, FALSE, &m_pScaleTarget, NULL);
+    CHECK_HR(hr, "ScrubCache::Store IDirect3DDevice9Ex::CreateRenderTarget() failed");
+
+    hr = pDevice->CreateOffscreenPlainSurface(width, height, D3DFMT_X8R8G8B8, D3DPOOL_SYSTEMMEM, &m_pReadback, NULL);
+    CHECK_HR(hr, "ScrubCache::Store IDirect3DDevice9Ex::CreateOffscreenPlainSurface() failed");
+  }
+
+  hr = pDevice->StretchRect(pSurface, NULL, m_pScaleTarget, NULL, D3DTEXF_LINEAR);
+  CHECK_HR(hr, "ScrubCache::Store IDirect3DDevice9Ex::StretchRect() failed");
+
+  hr = pDevice->GetRenderTargetData(m_pScaleTarget, m_pReadback);
+  CHECK_HR(hr, "ScrubCache::Store IDirect3DDevice9Ex::GetRenderTargetData() failed");
+
+  Evict(cbPixels);
+
+  WORD *pPixels = new WORD[width * height];
+  if (pPixels == NULL)
+  {
+    return E_OUTOFMEMORY;
+  }
+
+  hr = m_pReadback->LockRect(&lr, NULL, D3DLOCK_READONLY);
+  if (FAILED(hr))
+  {
+    delete[] pPixels;
+    CHECK_HR(hr, "ScrubCache::Store IDirect3DSurface9::LockRect() failed");
+  }
+
+  for (UINT y = 0; y < height; y++)
+  {
+    const DWORD *pSrc = (const DWORD*)((const BYTE*)lr.pBits + y * lr.Pitch);
+    WORD *pDst = pPixels + y * width;
+    for (UINT x = 0; x < width; x++)
+    {
+      DWORD c = pSrc[x];
+      pDst[x] = (WORD)(((c >> 8) & 0xf800) | ((c >> 5) & 0x07e0) | ((c >> 3) & 0x001f));
+    }
+  }
+
+  m_pReadback->UnlockRect();
+
+  Entry& entry = m_Entries[m_cEntries++];
+  entry.time = hnsTime;
+  entry.duration = max(hnsDuration, 1);
+  entry.width = width;
+  entry.height = height;
+  entry.pPixels = pPixels;
+  entry.lastUsed = ++m_UseCounter;
+
+  m_cbUsed += cbPixels;
+  m_Stored++;
+
+  return hr;
+}
+
+
+// Looks up a frame and uploads it into the preview texture.
+HRESULT ScrubCache::Lookup(IDirect3DDevice9Ex *pDevice, LONGLONG hnsTime, IDirect3DTexture9 **ppTexture)
+{
+  CheckPointer(pDevice, E_POINTER);
+  CheckPointer(ppTexture, E_POINTER);
+
+  HRESULT hr = S_OK;
+  D3DSURFACE_DESC desc;
+  D3DLOCKED_RECT lr;
+
+  *ppTexture = NULL;
+
+  int index = Find(hnsTime);
+  if (index < 0)
+  {
+    m_Misses++;
+    return S_FALSE;
+  }
+
+  Entry& entry = m_Entries[index];
+  entry.lastUsed = ++m_UseCounter;
+  m_Hits++;
+
+  if (m_pPreview == NULL || FAILED(m_pPreview->GetLevelDesc(0, &desc)) || (desc.Width != entry.width) || (desc.Height != entry.height))
+  {
+    SAFE_RELEASE(m_pPreview);
+
+    hr = pDevice->CreateTexture(entry.width, entry.height, 1, D3DUSAGE_DYNAMIC, D3DFMT_X8R8G8B8, D3DPOOL_DEFAULT, &m_pPreview, NULL);
+    CHECK_HR(hr, "ScrubCache::Lookup IDirect3DDevice9Ex::CreateTexture() failed");
+  }
+
+  // Discard: the previous preview may still be in use by the renderer.
+  hr = m_pPreview->LockRect(0, &lr, NULL, D3DLOCK_DISCARD);
+  CHECK_HR(hr, "ScrubCache::Lookup IDirect3DTexture9::LockRect() failed");
+
+  for (UINT y = 0; y < entry.height; y++)
+  {
+    const WORD *pSrc = entry.pPixels + y * entry.width;
+    DWORD *pDst = (DWORD*)((BYTE*)lr.pBits + y * lr.Pitch);
+    for (UINT x = 0; x < entry.width; x++)
+    {
+      DWORD r = (pSrc[x] >> 11) & 0x1f;
+      DWORD g = (pSrc[x] >> 5) & 0x3f;
+      DWORD b = pSrc[x] & 0x1f;
+      pDst[x] = 0xff000000 | (((r << 3) | (r >> 2)) << 16) | (((g << 2) | (g >> 4)) << 8) | ((b << 3) | (b >> 2));
+    }
+  }
+
+  m_pPreview->UnlockRect(0);
+
+  *ppTexture = m_pPreview;
+  (*ppTexture)->AddRef();
+
+  return S_OK;
+}
+
+
+// Forgets all frames.
+void ScrubCache::Clear()
+{
+  for (DWORD i = 0; i < m_cEntries; i++)
+  {
+    delete[] m_Entries[i].pPixels;
+  }
+  ZeroMemory(m_Entries, sizeof(m_Entries));
+  m_cEntries = 0;
+  m_cbUsed = 0;
+}
+
+
+// Releases the Direct3D objects.
+void ScrubCache::ReleaseDeviceResources()
+{
+  SAFE_RELEASE(m_pScaleTarget);
+  SAFE_RELEASE(m_pReadback);
+  SAFE_RELEASE(m_pPreview);
+}
+
+
+// Writes the cache statistics to the log.
+void ScrubCache::LogStatistics()
+{
+  DWORD lookups = m_Hits + m_Misses;
+  if ((lookups == 0) && (m_Stored == 0))
+  {
+    return;
+  }
+
+  Log("ScrubCache: %u hits, %u misses (hit rate %.1f%%), %u frames stored, %u evicted, %u frames using %.1f of %u KB",
+    m_Hits, m_Misses, (lookups > 0) ? 100.0 * m_Hits / lookups : 0.0, m_Stored, m_Evicted,
+    m_cEntries, m_cbUsed / 1024.0, SCRUB_CACHE_BUDGET / 1024);
+
+  m_Hits = 0;
+  m_Misses = 0;
+  m_Stored = 0;
+  m_Evicted = 0;
+}
@@ -0,0 +1,90 @@
+// Copyright (C) 2007-2014 Team MediaPortal
+// http://www.team-mediaportal.com
+//
+// This file is part of MediaPortal 2
+//
+// MediaPortal 2 is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// MediaPortal 2 is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with MediaPortal 2. If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <d3d9.h>
+
+const DWORD SCRUB_CACHE_MAX_ENTRIES = 512;                // Maximum number of cached frames.
+const DWORD SCRUB_CACHE_BUDGET = 32 * 1024 * 1024;        // Memory budget for the pixel data (bytes).
+const UINT  SCRUB_THUMBNAIL_WIDTH = 320;                  // Width of the cached frames (pixels).
+
+// Keeps downscaled copies of the frames shown while scrubbing (rate 0), keyed by presentation time.
+// When the user scrubs back to a position we have already seen, the cached frame can be shown at once,
+// before the source has sought and the mixer has delivered the full resolution frame.
+//
+// Frames are stored in system memory as RGB565, so the cache survives device resets and does not take
+// video memory. When the budget is exceeded, the least recently used frames are evicted.
+//
+// The cache is not thread safe; the presenter engine calls it while holding its object lock.
+class ScrubCache
+{
+public:
+  ScrubCache();
+  virtual ~ScrubCache();
+
+  // Returns TRUE if there is a frame for the given presentation time.
+  BOOL    Contains(LONGLONG hnsTime);
+
+  // Downscales the surface and stores a copy for the time span [hnsTime, hnsTime + hnsDuration).
+  HRESULT Store(IDirect3DDevice9Ex *pDevice, IDirect3DSurface9 *pSurface, LONGLONG hnsTime, LONGLONG hnsDuration);
+
+  // Looks up the frame for a presentation time. Returns S_OK and a texture with the frame on a hit,
+  // S_FALSE on a miss.
+  HRESULT Lookup(IDirect3DDevice9Ex *pDevice, LONGLONG hnsTime, IDirect3DTexture9 **ppTexture);
+
+  // Forgets all frames. Called when the video format changes.
+  void    Clear();
+
+  // Releases the Direct3D objects used for downscaling and uploading. The cached frames are kept.
+  void    ReleaseDeviceResources();
+
+  // Writes hit rate and memory usage to the log.
+  void    LogStatistics();
+
+private:
+  struct Entry
+  {
+    LONGLONG      time;           // Presentation time of the frame (hns)
+    LONGLONG      duration;       // Duration of the frame (hns)
+    UINT          width;
+    UINT          height;
+    WORD          *pPixels;       // RGB565, width * height
+    DWORD         lastUsed;       // Value of m_UseCounter at the last access (for LRU replacement)
+  };
+
+  int     Find(LONGLONG hnsTime);
+  void    Remove(DWORD index);
+  void    Evict(DWORD cbNeeded);
+
+  Entry               m_Entries[SCRUB_CACHE_MAX_ENTRIES];
+  DWORD               m_cEntries;
+  DWORD               m_cbUsed;           // Bytes of pixel data in the cache
+  DWORD               m_UseCounter;
+
+  // Direct3D objects, created on demand
+  IDirect3DSurface9   *m_pScaleTarget;    // Render target for downscaling
+  IDirect3DSurface9   *m_pReadback;       // System memory copy of m_pScaleTarget
+  IDirect3DTexture9   *m_pPreview;        // Dynamic texture for presenting a cached frame
+
+  // Statistics
+  DWORD               m_Hits;
+  DWORD               m_Misses;
+  DWORD               m_Stored;
+  DWORD               m_Evicted;
+};
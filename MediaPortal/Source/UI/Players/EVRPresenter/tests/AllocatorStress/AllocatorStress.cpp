@@ -0,0 +1,307 @@
+// Copyright (C) 2007-2014 Team MediaPortal
+// http://www.team-mediaportal.com
+//
+// This file is part of MediaPortal 2
+//
+// MediaPortal 2 is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// MediaPortal 2 is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with MediaPortal 2. If not, see <http://www.gnu.org/licenses/>.
+
+// Stress test of the lock-free free list of CBaseAllocator. Worker threads take and release samples
+// of a CMemAllocator that has fewer samples than there are threads, so most GetBuffer calls wait,
+// while another thread decommits and commits the allocator.
+//
+// Usage: AllocatorStress [seconds] [threads]
+//
+// A sample must never be handed to two threads at once, no waiting thread may be left asleep while
+// a sample is free, and after the run the allocator must hand out exactly its samples again.
+// Before the stress run, the arena of a CMemAllocator must be kept across commits when the buffers
+// still fit and use at least half of it, and only a real change of the properties may make Commit
+// recreate the samples. Whether large pages were granted when asked for is reported.
+// Returns the number of failed checks.
+
+#include <streams.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../TestCommon.h"
+
+
+static const long g_cBuffers = 4;
+static const long g_cbBuffer = 4096;
+
+static IMemAllocator *g_pAllocator = NULL;
+static volatile LONG g_bStop = FALSE;
+static volatile LONG g_lOutstanding = 0;
+static volatile LONG g_lOverlaps = 0;
+static volatile LONG g_lTooMany = 0;
+static volatile LONG g_lErrors = 0;
+static volatile LONG g_lSamples = 0;
+static volatile LONG g_lNotCommitted = 0;
+
+
+// The first LONG of a free sample's buffer is 0. The thread holding the sample puts its id there,
+// so a sample given to two threads at once is caught by the second one.
+static DWORD WINAPI WorkerThread(LPVOID pParam)
+{
+  LONG lId = (LONG)(INT_PTR)pParam;
+  while (!g_bStop)
+  {
+    IMediaSample *pSample = NULL;
+    HRESULT hr = g_pAllocator->GetBuffer(&pSample, NULL, NULL, 0);
+    if (hr == VFW_E_NOT_COMMITTED)
+    {
+      InterlockedIncrement(&g_lNotCommitted);
+      Sleep(0);
+      continue;
+    }
+    if (FAILED(hr) || pSample == NULL)
+    {
+      InterlockedIncrement(&g_lErrors);
+      continue;
+    }
+
+    if (InterlockedIncrement(&g_lOutstanding) > g_cBuffers)
+    {
+      InterlockedIncrement(&g_lTooMany);
+    }
+
+    BYTE *pBuffer = NULL;
+    pSample->GetPointer(&pBuffer);
+    volatile LONG *plOwner = (volatile LONG*)pBuffer;
+    if (InterlockedCompareExchange(plOwner, lId, 0) != 0)
+    {
+      InterlockedIncrement(&g_lOverlaps);
+    }
+    else
+    {
+      // hold it for a moment, now and then long enough for others to queue up
+      if ((lId + g_lSamples) % 16 == 0)
+        Sleep(0);
+      if (InterlockedCompareExchange(plOwner, 0, lId) != lId)
+      {
+        InterlockedIncrement(&g_lOverlaps);
+      }
+    }
+
+    InterlockedDecrement(&g_lOutstanding);
+    InterlockedIncrement(&g_lSamples);
+    pSample->Release();
+  }
+  return 0;
+}
+
+// Exposes the arena of a CMemAllocator
+class ArenaAllocator : public CMemAllocator
+{
+public:
+  ArenaAllocator(HRESULT *phr) : CMemAllocator(NAME("AllocatorStress arena"), NULL, phr) {}
+
+  LPBYTE Arena() const { return m_pBuffer; }
+  SIZE_T ArenaSize() const { return m_cbArena; }
+  BOOL Changed() const { return m_bChanged; }
+  BOOL LargePages() const { return m_bLargePages; }
+
+  HRESULT SetBuffers(long cBuffers, long cbBuffer, long cbPrefix)
+  {
+    ALLOCATOR_PROPERTIES props = { cBuffers, cbBuffer, 1, cbPrefix };
+    ALLOCATOR_PROPERTIES actual;
+    return SetProperties(&props, &actual);
+  }
+
+  // Commits with the properties set and decommits again; the arena stays
+  HRESULT CommitAndDecommit()
+  {
+    HRESULT hr = Commit();
+    if (SUCCEEDED(hr))
+      hr = Decommit();
+    return hr;
+  }
+};
+
+static void TestArenaReuse()
+{
+  HRESULT hr = S_OK;
+  ArenaAllocator *pAllocator = new ArenaAllocator(&hr);
+  pAllocator->AddRef();
+  CHECK(SUCCEEDED(hr));
+
+  // Buffers of 4 KB are spaced 4 KB apart, so n of them take n * 4 KB
+  CHECK(SUCCEEDED(pAllocator->SetBuffers(4, 4096, 0)));
+  CHECK(pAllocator->Changed());
+  CHECK(SUCCEEDED(pAllocator->CommitAndDecommit()));
+  CHECK(!pAllocator->Changed());
+  LPBYTE pArena = pAllocator->Arena();
+  CHECK(pArena != NULL);
+  CHECK(pAllocator->ArenaSize() == 4 * 4096);
+
+  // The same properties again change nothing
+  CHECK(SUCCEEDED(pAllocator->SetBuffers(4, 4096, 0)));
+  CHECK(!pAllocator->Changed());
+  CHECK(SUCCEEDED(pAllocator->CommitAndDecommit()));
+  CHECK(pAllocator->Arena() == pArena);
+
+  // Fewer buffers, or a prefix, still fit and use more than half of the arena
+  CHECK(SUCCEEDED(pAllocator->SetBuffers(3, 4096, 0)));
+  CHECK(pAllocator->Changed());
+  CHECK(SUCCEEDED(pAllocator->CommitAndDecommit()));
+  CHECK(pAllocator->Arena() == pArena);
+  CHECK(pAllocator->ArenaSize() == 4 * 4096);
+  CHECK(SUCCEEDED(pAllocator->SetBuffers(3, 4096, 64)));
+  CHECK(pAllocator->Changed());
+  CHECK(SUCCEEDED(pAllocator->CommitAndDecommit()));
+  CHECK(pAllocator->Arena() == pArena);
+  CHECK(SUCCEEDED(pAllocator->SetBuffers(3, 4096, 64)));
+  CHECK(!pAllocator->Changed());
+
+  // Less than half of the arena would be used
+  CHECK(SUCCEEDED(pAllocator->SetBuffers(1, 4096, 0)));
+  CHECK(SUCCEEDED(pAllocator->CommitAndDecommit()));
+  CHECK(pAllocator->ArenaSize() == 4096);
+
+  // The buffers don't fit
+  CHECK(SUCCEEDED(pAllocator->SetBuffers(8, 4096, 0)));
+  CHECK(SUCCEEDED(pAllocator->CommitAndDecommit()));
+  CHECK(pAllocator->ArenaSize() == 8 * 4096);
+
+  // Large pages only when asked for; whether we get them depends on the privileges of the process
+  CHECK(SUCCEEDED(pAllocator->SetBuffers(4, 1024 * 1024, 0)));
+  CHECK(SUCCEEDED(pAllocator->CommitAndDecommit()));
+  CHECK(!pAllocator->LargePages());
+  pAllocator->SetUseLargePages(TRUE);
+  CHECK(SUCCEEDED(pAllocator->SetBuffers(8, 1024 * 1024, 0)));
+  CHECK(SUCCEEDED(pAllocator->CommitAndDecommit()));
+  printf("arena of %Iu bytes, large pages %s\n", pAllocator->ArenaSize(),
+    pAllocator->LargePages() ? "granted" : "not granted");
+
+  pAllocator->Release();
+}
+
+
+// Decommits the allocator while samples are out and waiters are queued, then commits it again.
+static DWORD WINAPI CommitThread(LPVOID pParam)
+{
+  while (!g_bStop)
+  {
+    Sleep(5);
+    if (FAILED(g_pAllocator->Decommit()))
+      InterlockedIncrement(&g_lErrors);
+    Sleep(1);
+    if (FAILED(g_pAllocator->Commit()))
+      InterlockedIncrement(&g_lErrors);
+  }
+  return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+  SYSTEM_INFO si;
+  GetSystemInfo(&si);
+
+  int seconds = (argc > 1) ? atoi(argv[1]) : 5;
+  int threads = (argc > 2) ? atoi(argv[2]) : 2 * si.dwNumberOfProcessors;
+  if (seconds <= 0 || threads <= 0 || threads > MAXIMUM_WAIT_OBJECTS - 1)
+  {
+    printf("Usage: AllocatorStress [seconds] [threads]\n");
+    return 1;
+  }
+
+  CoInitializeEx(NULL, COINIT_MULTITHREADED);
+
+  TestArenaReuse();
+
+  HRESULT hr = S_OK;
+  CMemAllocator *pMemAllocator = new CMemAllocator(NAME("AllocatorStress"), NULL, &hr);
+  pMemAllocator->NonDelegatingQueryInterface(IID_IMemAllocator, (void**)&g_pAllocator);
+  CHECK(SUCCEEDED(hr) && g_pAllocator != NULL);
+  if (g_pAllocator == NULL)
+  {
+    CoUninitialize();
+    return TestResult();
+  }
+
+  ALLOCATOR_PROPERTIES props = { g_cBuffers, g_cbBuffer, 1, 0 };
+  ALLOCATOR_PROPERTIES actual;
+  CHECK(SUCCEEDED(g_pAllocator->SetProperties(&props, &actual)));
+  CHECK(SUCCEEDED(g_pAllocator->Commit()));
+
+  // clear the owner field of every sample
+  IMediaSample *apSamples[g_cBuffers];
+  for (int i = 0; i < g_cBuffers; i++)
+  {
+    BYTE *pBuffer = NULL;
+    CHECK(SUCCEEDED(g_pAllocator->GetBuffer(&apSamples[i], NULL, NULL, AM_GBF_NOWAIT)));
+    apSamples[i]->GetPointer(&pBuffer);
+    *(LONG*)pBuffer = 0;
+  }
+  for (int i = 0; i < g_cBuffers; i++)
+  {
+    apSamples[i]->Release();
+  }
+
+  HANDLE ahThreads[MAXIMUM_WAIT_OBJECTS];
+  for (int i = 0; i < threads; i++)
+  {
+    ahThreads[i] = CreateThread(NULL, 0, WorkerThread, (LPVOID)(INT_PTR)(i + 1), 0, NULL);
+  }
+  ahThreads[threads] = CreateThread(NULL, 0, CommitThread, NULL, 0, NULL);
+
+  // every second some samples must have gone round, otherwise the threads hang
+  LONG lLastSamples = 0;
+  for (int s = 0; s < seconds; s++)
+  {
+    Sleep(1000);
+    LONG lSamples = g_lSamples;
+    printf("%d s: %ld samples, %ld not committed\n", s + 1, lSamples, g_lNotCommitted);
+    CHECK(lSamples != lLastSamples);
+    lLastSamples = lSamples;
+  }
+
+  // wake the waiters by decommitting for good
+  InterlockedExchange(&g_bStop, TRUE);
+  WaitForSingleObject(ahThreads[threads], INFINITE);
+  g_pAllocator->Decommit();
+  DWORD dwWait = WaitForMultipleObjects(threads + 1, ahThreads, TRUE, 10000);
+  CHECK(dwWait != WAIT_TIMEOUT);
+  for (int i = 0; i <= threads; i++)
+  {
+    CloseHandle(ahThreads[i]);
+  }
+
+  CHECK(g_lOverlaps == 0);
+  CHECK(g_lTooMany == 0);
+  CHECK(g_lErrors == 0);
+  CHECK(g_lOutstanding == 0);
+
+  // no sample lost or duplicated: exactly g_cBuffers can be taken without waiting
+  CHECK(g_pAllocator->GetBuffer(&apSamples[0], NULL, NULL, AM_GBF_NOWAIT) == VFW_E_NOT_COMMITTED);
+  CHECK(SUCCEEDED(g_pAllocator->Commit()));
+  for (int i = 0; i < g_cBuffers; i++)
+  {
+    CHECK(SUCCEEDED(g_pAllocator->GetBuffer(&apSamples[i], NULL, NULL, AM_GBF_NOWAIT)));
+  }
+  IMediaSample *pExtra = NULL;
+  CHECK(g_pAllocator->GetBuffer(&pExtra, NULL, NULL, AM_GBF_NOWAIT) == VFW_E_TIMEOUT);
+  for (int i = 0; i < g_cBuffers; i++)
+  {
+    if (apSamples[i])
+      apSamples[i]->Release();
+  }
+  g_pAllocator->Decommit();
+  g_pAllocator->Release();
+
+  CoUninitialize();
+
+  printf("%ld samples in %d s\n", g_lSamples, seconds);
+  return TestResult();
+}
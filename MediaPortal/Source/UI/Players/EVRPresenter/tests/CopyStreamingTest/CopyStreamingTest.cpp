@@ -0,0 +1,184 @@
+// Copyright (C) 2007-2014 Team MediaPortal
+// http://www.team-mediaportal.com
+//
+// This file is part of MediaPortal 2
+//
+// MediaPortal 2 is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// MediaPortal 2 is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with MediaPortal 2. If not, see <http://www.gnu.org/licenses/>.
+
+// Tests CopyMemoryStreaming against memcpy and reports how fast both copy blocks of 64 KB to 32 MB.
+//
+// Usage: CopyStreamingTest [MB per size]
+//
+// Every block size around the streaming and parallel thresholds is copied at source and destination
+// offsets that leave it unaligned; the copy must equal the source and the bytes around the
+// destination must be left alone. Several threads copy large blocks at once, so that some of them
+// find the workers busy, and the workers are stopped and started again between copies.
+// Returns the number of failed checks.
+
+#include <streams.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../TestCommon.h"
+
+
+static const size_t cbGuard = 64;
+static const BYTE GUARD = 0xCD;
+
+static BYTE SourceAt(size_t i)
+{
+  return (BYTE)(i * 131 + 7);
+}
+
+// Copies cb bytes from offset srcOffset of a source block to offset dstOffset of a destination block
+// and checks the copy and the guard bytes around it
+static void CheckCopy(size_t cb, size_t srcOffset, size_t dstOffset)
+{
+  BYTE *pSrc = (BYTE*)malloc(cb + srcOffset);
+  BYTE *pDst = (BYTE*)malloc(cbGuard + dstOffset + cb + cbGuard);
+  if (pSrc == NULL || pDst == NULL)
+  {
+    CHECK(!"out of memory");
+    free(pSrc);
+    free(pDst);
+    return;
+  }
+  for (size_t i = 0; i < cb + srcOffset; i++)
+    pSrc[i] = SourceAt(i);
+  memset(pDst, GUARD, cbGuard + dstOffset + cb + cbGuard);
+
+  BYTE *pTarget = pDst + cbGuard + dstOffset;
+  CopyMemoryStreaming(pTarget, pSrc + srcOffset, cb);
+
+  CHECK(memcmp(pTarget, pSrc + srcOffset, cb) == 0);
+  BOOL bGuardsIntact = TRUE;
+  for (size_t i = 0; i < cbGuard + dstOffset; i++)
+    bGuardsIntact &= pDst[i] == GUARD;
+  for (size_t i = 0; i < cbGuard; i++)
+    bGuardsIntact &= pTarget[cb + i] == GUARD;
+  CHECK(bGuardsIntact);
+
+  free(pDst);
+  free(pSrc);
+}
+
+static void TestUnaligned()
+{
+  const size_t sizes[] =
+  {
+    1, 63, 64 * 1024, COPY_STREAMING_THRESHOLD - 1, COPY_STREAMING_THRESHOLD, COPY_STREAMING_THRESHOLD + 1,
+    1024 * 1024 + 17, COPY_PARALLEL_THRESHOLD - 1, COPY_PARALLEL_THRESHOLD, COPY_PARALLEL_THRESHOLD + 4097,
+    32 * 1024 * 1024 + 3
+  };
+  const size_t srcOffsets[] = { 0, 1, 15, 33 };
+  const size_t dstOffsets[] = { 0, 3, 31 };
+  for (DWORD i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+  {
+    for (DWORD j = 0; j < sizeof(srcOffsets) / sizeof(srcOffsets[0]); j++)
+    {
+      for (DWORD k = 0; k < sizeof(dstOffsets) / sizeof(dstOffsets[0]); k++)
+        CheckCopy(sizes[i], srcOffsets[j], dstOffsets[k]);
+    }
+  }
+}
+
+static DWORD WINAPI CopyThread(LPVOID pParam)
+{
+  DWORD dwThread = (DWORD)(INT_PTR)pParam;
+  for (DWORD i = 0; i < 10; i++)
+    CheckCopy(COPY_PARALLEL_THRESHOLD + 13, (dwThread + i) % 7, i % 5);
+  return 0;
+}
+
+// Only one copy at a time gets the workers; the others copy on their own thread
+static void TestConcurrentCopies()
+{
+  const DWORD cThreads = 4;
+  HANDLE hThreads[cThreads];
+  for (DWORD i = 0; i < cThreads; i++)
+    hThreads[i] = CreateThread(NULL, 0, CopyThread, (LPVOID)(INT_PTR)i, 0, NULL);
+  WaitForMultipleObjects(cThreads, hThreads, TRUE, INFINITE);
+  for (DWORD i = 0; i < cThreads; i++)
+    CloseHandle(hThreads[i]);
+}
+
+// The next copy after StopCopyWorkers starts them again
+static void TestStopWorkers()
+{
+  StopCopyWorkers();
+  StopCopyWorkers();
+  CheckCopy(2 * COPY_PARALLEL_THRESHOLD, 1, 1);
+  StopCopyWorkers();
+  CheckCopy(2 * COPY_PARALLEL_THRESHOLD, 0, 0);
+}
+
+
+// GB/s of cbTotal bytes copied in blocks of cb, with CopyMemoryStreaming or memcpy
+static double Rate(BYTE *pDst, const BYTE *pSrc, size_t cb, size_t cbTotal, BOOL bStreaming)
+{
+  size_t cCopies = max((size_t)1, cbTotal / cb);
+  TestTimer timer;
+  for (size_t i = 0; i < cCopies; i++)
+  {
+    if (bStreaming)
+      CopyMemoryStreaming(pDst, pSrc, cb);
+    else
+      memcpy(pDst, pSrc, cb);
+  }
+  double ns = timer.ElapsedNs();
+  return ns > 0 ? (double)cCopies * cb / ns : 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+  int cMB = (argc > 1) ? atoi(argv[1]) : 256;
+  if (cMB <= 0)
+  {
+    printf("Usage: CopyStreamingTest [MB per size]\n");
+    return 1;
+  }
+
+  TestUnaligned();
+  TestConcurrentCopies();
+  TestStopWorkers();
+
+  // Timing depends on the machine, so it is reported rather than checked
+  const size_t cbMax = 32 * 1024 * 1024;
+  BYTE *pSrc = (BYTE*)malloc(cbMax);
+  BYTE *pDst = (BYTE*)malloc(cbMax);
+  if (pSrc == NULL || pDst == NULL)
+  {
+    printf("out of memory\n");
+    return 1;
+  }
+  memset(pSrc, 1, cbMax);
+  memset(pDst, 2, cbMax);
+
+  printf("%10s %12s %12s\n", "KB", "memcpy GB/s", "stream GB/s");
+  for (size_t cb = 64 * 1024; cb <= cbMax; cb *= 2)
+  {
+    const size_t cbTotal = (size_t)cMB * 1024 * 1024;
+    double dMemcpy = Rate(pDst, pSrc, cb, cbTotal, FALSE);
+    double dStreaming = Rate(pDst, pSrc, cb, cbTotal, TRUE);
+    printf("%10lu %12.2f %12.2f\n", (unsigned long)(cb / 1024), dMemcpy, dStreaming);
+  }
+
+  StopCopyWorkers();
+  free(pDst);
+  free(pSrc);
+
+  return TestResult();
+}
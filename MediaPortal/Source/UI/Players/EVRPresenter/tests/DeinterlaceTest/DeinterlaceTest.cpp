@@ -0,0 +1,195 @@
+// Copyright (C) 2007-2014 Team MediaPortal
+// http://www.team-mediaportal.com
+//
+// This file is part of MediaPortal 2
+//
+// MediaPortal 2 is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// MediaPortal 2 is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with MediaPortal 2. If not, see <http://www.gnu.org/licenses/>.
+
+// Tests of the deinterlacing decisions of the presenter (Deinterlace.h): which interlace modes each
+// DEINTERLACE_MODE accepts, when frames are presented at the field rate and at which rate, and that a
+// mode change clears the negotiation cache.
+//
+// Usage: DeinterlaceTest
+//
+// Prints the failed checks and returns the number of failures.
+
+#include <stdio.h>
+#include <mfapi.h>
+
+#include "../../source/Deinterlace.h"
+
+#include "../TestCommon.h"
+
+
+// The cache logs through the presenter's log; the test has none.
+void Log(const char *fmt, ...)
+{
+}
+
+void LogAtLevel(LOG_LEVEL level, const char *fmt, ...)
+{
+}
+
+
+static const DEINTERLACE_MODE g_Modes[] =
+{
+  DEINTERLACE_NONE, DEINTERLACE_WEAVE, DEINTERLACE_BOB, DEINTERLACE_ADAPTIVE
+};
+
+static const UINT32 g_InterlaceModes[] =
+{
+  MFVideoInterlace_Unknown,
+  MFVideoInterlace_Progressive,
+  MFVideoInterlace_FieldInterleavedUpperFirst,
+  MFVideoInterlace_FieldInterleavedLowerFirst,
+  MFVideoInterlace_FieldSingleUpper,
+  MFVideoInterlace_FieldSingleLower,
+  MFVideoInterlace_MixedInterlaceOrProgressive
+};
+
+
+static BOOL IsFieldInterleaved(UINT32 interlaceMode)
+{
+  return (interlaceMode == MFVideoInterlace_FieldInterleavedUpperFirst) ||
+    (interlaceMode == MFVideoInterlace_FieldInterleavedLowerFirst);
+}
+
+static void TestInterlaceModes()
+{
+  for (DWORD m = 0; m < ARRAY_SIZE(g_Modes); m++)
+  {
+    DEINTERLACE_MODE mode = g_Modes[m];
+    for (DWORD i = 0; i < ARRAY_SIZE(g_InterlaceModes); i++)
+    {
+      UINT32 interlaceMode = g_InterlaceModes[i];
+
+      // Without deinterlacing only progressive types are presented, otherwise the mixer takes them all.
+      BOOL bSupported = (interlaceMode == MFVideoInterlace_Progressive) || (mode != DEINTERLACE_NONE);
+      CHECK(IsInterlaceModeSupported(mode, interlaceMode) == bSupported);
+
+      // Only bob and adaptive split frames with both fields, single fields and mixed streams keep
+      // their rate.
+      BOOL bFieldRate = ((mode == DEINTERLACE_BOB) || (mode == DEINTERLACE_ADAPTIVE)) && IsFieldInterleaved(interlaceMode);
+      CHECK(IsFieldRateMode(mode, interlaceMode) == bFieldRate);
+    }
+  }
+}
+
+static void TestPresentationRate()
+{
+  MFRatio pal = { 25, 1 };
+  MFRatio ntsc = { 30000, 1001 };
+
+  MFRatio rate = GetPresentationRate(pal, FALSE);
+  CHECK(rate.Numerator == 25 && rate.Denominator == 1);
+  rate = GetPresentationRate(pal, TRUE);
+  CHECK(rate.Numerator == 50 && rate.Denominator == 1);
+  rate = GetPresentationRate(ntsc, TRUE);
+  CHECK(rate.Numerator == 60000 && rate.Denominator == 1001);
+
+  // A numerator that cannot be doubled halves the denominator instead.
+  MFRatio large = { 0xF0000000, 2000 };
+  rate = GetPresentationRate(large, TRUE);
+  CHECK(rate.Numerator == 0xF0000000 && rate.Denominator == 1000);
+
+  // What SetMediaType gives the scheduler for an interleaved stream in each mode.
+  for (DWORD m = 0; m < ARRAY_SIZE(g_Modes); m++)
+  {
+    rate = GetPresentationRate(pal, IsFieldRateMode(g_Modes[m], MFVideoInterlace_FieldInterleavedUpperFirst));
+    UINT32 expected = (g_Modes[m] == DEINTERLACE_BOB || g_Modes[m] == DEINTERLACE_ADAPTIVE) ? 50 : 25;
+    CHECK(rate.Numerator == expected && rate.Denominator == 1);
+  }
+}
+
+
+static IMFMediaType* CreateInterlacedType()
+{
+  IMFMediaType *pType = NULL;
+  if (FAILED(MFCreateMediaType(&pType)))
+  {
+    return NULL;
+  }
+  pType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video);
+  pType->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_RGB32);
+  MFSetAttributeSize(pType, MF_MT_FRAME_SIZE, 720, 576);
+  MFSetAttributeRatio(pType, MF_MT_FRAME_RATE, 25, 1);
+  pType->SetUINT32(MF_MT_INTERLACE_MODE, MFVideoInterlace_FieldInterleavedUpperFirst);
+  return pType;
+}
+
+// Returns TRUE if the cache still has the verdict for pType.
+static BOOL IsCached(MediaTypeCache& cache, IMFMediaType *pType)
+{
+  UINT64 hash = 0;
+  MediaTypeCache::HashMediaType(pType, &hash);
+  HRESULT hrSupported = S_OK;
+  IMFMediaType *pOptimal = NULL;
+  BOOL bHit = (cache.Lookup(pType, hash, &hrSupported, &pOptimal) == S_OK);
+  SAFE_RELEASE(pOptimal);
+  return bHit;
+}
+
+static void TestModeChangeClearsCache()
+{
+  MediaTypeCache cache;
+  IMFMediaType *pType = CreateInterlacedType();
+  UINT64 hash = 0;
+  MediaTypeCache::HashMediaType(pType, &hash);
+
+  for (DWORD from = 0; from < ARRAY_SIZE(g_Modes); from++)
+  {
+    for (DWORD to = 0; to < ARRAY_SIZE(g_Modes); to++)
+    {
+      DEINTERLACE_MODE mode = g_Modes[from];
+
+      // The verdict of the interlaced type under the old mode.
+      cache.Insert(pType, hash, IsInterlaceModeSupported(mode, MFVideoInterlace_FieldInterleavedUpperFirst) ?
+        S_OK : MF_E_INVALIDMEDIATYPE, NULL, 0);
+      CHECK(IsCached(cache, pType));
+
+      CHECK(ChangeDeinterlaceMode(&mode, g_Modes[to], &cache) == S_OK);
+      CHECK(mode == g_Modes[to]);
+      CHECK(IsCached(cache, pType) == (from == to));
+      cache.Clear();
+    }
+  }
+
+  // An unknown mode is refused and changes nothing.
+  DEINTERLACE_MODE mode = DEINTERLACE_BOB;
+  cache.Insert(pType, hash, S_OK, NULL, 0);
+  CHECK(ChangeDeinterlaceMode(&mode, (DEINTERLACE_MODE)(DEINTERLACE_ADAPTIVE + 1), &cache) == E_INVALIDARG);
+  CHECK(ChangeDeinterlaceMode(&mode, (DEINTERLACE_MODE)-1, &cache) == E_INVALIDARG);
+  CHECK(mode == DEINTERLACE_BOB);
+  CHECK(IsCached(cache, pType));
+
+  SAFE_RELEASE(pType);
+}
+
+
+int main(int argc, char *argv[])
+{
+  if (FAILED(MFStartup(MF_VERSION, MFSTARTUP_LITE)))
+  {
+    printf("MFStartup failed\n");
+    return 1;
+  }
+
+  TestInterlaceModes();
+  TestPresentationRate();
+  TestModeChangeClearsCache();
+
+  MFShutdown();
+
+  return TestResult();
+}
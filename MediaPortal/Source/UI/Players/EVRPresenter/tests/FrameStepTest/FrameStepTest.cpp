@@ -0,0 +1,292 @@
+// Copyright (C) 2007-2014 Team MediaPortal
+// http://www.team-mediaportal.com
+//
+// This file is part of MediaPortal 2
+//
+// MediaPortal 2 is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// MediaPortal 2 is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with MediaPortal 2. If not, see <http://www.gnu.org/licenses/>.
+
+// Tests the frame-step fast path (FrameStep.h) against a stub mixer: intermediate frames of a multi-
+// frame step are discarded by the mixer without rendering, a mixer that refuses to discard falls back
+// to rendering them, and the steps count down to exactly the one frame that is shown.
+//
+// Usage: FrameStepTest
+//
+// Prints the failed checks and returns the number of failures.
+
+#include <stdio.h>
+#include <mfapi.h>
+#include <mferror.h>
+
+#include "../../source/FrameStep.h"
+
+#include "../TestCommon.h"
+
+
+void Log(const char *fmt, ...)
+{
+}
+
+void LogAtLevel(LOG_LEVEL level, const char *fmt, ...)
+{
+}
+
+
+// A mixer that reports a discardable output stream and answers discard requests with scripted results.
+class StubMixer : public IMFTransform
+{
+public:
+  DWORD   m_dwOutputFlags;
+  HRESULT m_hrDiscard[16];    // Result of the n-th discard request, S_OK beyond the script
+  DWORD   m_cDiscards;        // Discard requests
+  DWORD   m_cBadRequests;     // Discard requests that were not for one buffer without a sample
+
+  StubMixer() : m_dwOutputFlags(MFT_OUTPUT_STREAM_DISCARDABLE), m_cDiscards(0), m_cBadRequests(0)
+  {
+    for (DWORD i = 0; i < ARRAY_SIZE(m_hrDiscard); i++)
+    {
+      m_hrDiscard[i] = S_OK;
+    }
+  }
+
+  STDMETHODIMP QueryInterface(REFIID riid, void **ppv)
+  {
+    if (riid == IID_IUnknown || riid == __uuidof(IMFTransform))
+    {
+      *ppv = static_cast<IMFTransform*>(this);
+      return S_OK;
+    }
+    *ppv = NULL;
+    return E_NOINTERFACE;
+  }
+  STDMETHODIMP_(ULONG) AddRef() { return 2; }
+  STDMETHODIMP_(ULONG) Release() { return 1; }
+
+  STDMETHODIMP GetOutputStreamInfo(DWORD dwOutputStreamID, MFT_OUTPUT_STREAM_INFO *pStreamInfo)
+  {
+    ZeroMemory(pStreamInfo, sizeof(*pStreamInfo));
+    pStreamInfo->dwFlags = m_dwOutputFlags;
+    return S_OK;
+  }
+
+  STDMETHODIMP ProcessOutput(DWORD dwFlags, DWORD cOutputBufferCount, MFT_OUTPUT_DATA_BUFFER *pOutputSamples, DWORD *pdwStatus)
+  {
+    if (dwFlags != MFT_PROCESS_OUTPUT_DISCARD_WHEN_NO_BUFFER || cOutputBufferCount != 1 || pOutputSamples[0].pSample != NULL)
+    {
+      m_cBadRequests++;
+    }
+    HRESULT hr = (m_cDiscards < ARRAY_SIZE(m_hrDiscard)) ? m_hrDiscard[m_cDiscards] : S_OK;
+    m_cDiscards++;
+    return hr;
+  }
+
+  STDMETHODIMP GetStreamLimits(DWORD*, DWORD*, DWORD*, DWORD*) { return E_NOTIMPL; }
+  STDMETHODIMP GetStreamCount(DWORD*, DWORD*) { return E_NOTIMPL; }
+  STDMETHODIMP GetStreamIDs(DWORD, DWORD*, DWORD, DWORD*) { return E_NOTIMPL; }
+  STDMETHODIMP GetInputStreamInfo(DWORD, MFT_INPUT_STREAM_INFO*) { return E_NOTIMPL; }
+  STDMETHODIMP GetAttributes(IMFAttributes**) { return E_NOTIMPL; }
+  STDMETHODIMP GetInputStreamAttributes(DWORD, IMFAttributes**) { return E_NOTIMPL; }
+  STDMETHODIMP GetOutputStreamAttributes(DWORD, IMFAttributes**) { return E_NOTIMPL; }
+  STDMETHODIMP DeleteInputStream(DWORD) { return E_NOTIMPL; }
+  STDMETHODIMP AddInputStreams(DWORD, DWORD*) { return E_NOTIMPL; }
+  STDMETHODIMP GetInputAvailableType(DWORD, DWORD, IMFMediaType**) { return E_NOTIMPL; }
+  STDMETHODIMP GetOutputAvailableType(DWORD, DWORD, IMFMediaType**) { return E_NOTIMPL; }
+  STDMETHODIMP SetInputType(DWORD, IMFMediaType*, DWORD) { return E_NOTIMPL; }
+  STDMETHODIMP SetOutputType(DWORD, IMFMediaType*, DWORD) { return E_NOTIMPL; }
+  STDMETHODIMP GetInputCurrentType(DWORD, IMFMediaType**) { return E_NOTIMPL; }
+  STDMETHODIMP GetOutputCurrentType(DWORD, IMFMediaType**) { return E_NOTIMPL; }
+  STDMETHODIMP GetInputStatus(DWORD, DWORD*) { return E_NOTIMPL; }
+  STDMETHODIMP GetOutputStatus(DWORD*) { return E_NOTIMPL; }
+  STDMETHODIMP SetOutputBounds(LONGLONG, LONGLONG) { return E_NOTIMPL; }
+  STDMETHODIMP ProcessEvent(DWORD, IMFMediaEvent*) { return E_NOTIMPL; }
+  STDMETHODIMP ProcessMessage(MFT_MESSAGE_TYPE, ULONG_PTR) { return E_NOTIMPL; }
+  STDMETHODIMP ProcessInput(DWORD, IMFSample*, DWORD) { return E_NOTIMPL; }
+};
+
+
+// What the presenter does with the next frame of the mixer during a frame step (ProcessOutput and
+// DeliverFrameStepSample): try the fast path for intermediate frames, otherwise render the frame and
+// count it. Returns the result of the fast path, or S_OK if the frame was rendered.
+struct StepRun
+{
+  DWORD cRendered;      // Frames rendered into a sample
+  DWORD iShown;         // 1-based number of the frame that was shown, 0 if none yet
+  DWORD cShown;
+
+  StepRun() : cRendered(0), iShown(0), cShown(0) {}
+
+  HRESULT NextFrame(FrameStep& frameStep, IMFTransform *pMixer, BOOL *pbCanDiscard)
+  {
+    if (*pbCanDiscard && frameStep.IsIntermediate(FALSE))
+    {
+      HRESULT hr = frameStep.DiscardIntermediate(pMixer, pbCanDiscard);
+      if (hr != S_FALSE)
+      {
+        return hr;
+      }
+    }
+
+    cRendered++;
+    if (frameStep.IsIntermediate(FALSE))
+    {
+      // Returned to the pool right away.
+      frameStep.CountFrame();
+    }
+    else if (frameStep.CountFrame())
+    {
+      cShown++;
+      if (iShown == 0)
+      {
+        iShown = cRendered + frameStep.skipped;
+      }
+      frameStep.state = FRAMESTEP_SCHEDULED;
+    }
+    return S_OK;
+  }
+};
+
+static void StartStep(FrameStep& frameStep, DWORD cSteps)
+{
+  frameStep.state = FRAMESTEP_PENDING;
+  frameStep.steps = cSteps;
+  frameStep.skipped = 0;
+}
+
+
+static void TestCanDiscard()
+{
+  StubMixer mixer;
+  CHECK(FrameStep::CanDiscard(&mixer));
+  mixer.m_dwOutputFlags = MFT_OUTPUT_STREAM_LAZY_READ;
+  CHECK(FrameStep::CanDiscard(&mixer));
+  mixer.m_dwOutputFlags = MFT_OUTPUT_STREAM_WHOLE_SAMPLES;
+  CHECK(!FrameStep::CanDiscard(&mixer));
+}
+
+// Every intermediate frame is discarded by the mixer, only the last one is rendered and shown.
+static void TestDiscardPath()
+{
+  const DWORD cSteps = 10;
+  StubMixer mixer;
+  FrameStep frameStep;
+  BOOL bCanDiscard = FrameStep::CanDiscard(&mixer);
+  StepRun run;
+
+  StartStep(frameStep, cSteps);
+  for (DWORD i = 0; i < cSteps; i++)
+  {
+    CHECK(run.NextFrame(frameStep, &mixer, &bCanDiscard) == S_OK);
+  }
+
+  CHECK(mixer.m_cDiscards == cSteps - 1);
+  CHECK(mixer.m_cBadRequests == 0);
+  CHECK(frameStep.skipped == cSteps - 1);
+  CHECK(run.cRendered == 1);
+  CHECK(run.cShown == 1 && run.iShown == cSteps);
+  CHECK(frameStep.steps == 0);
+  CHECK(frameStep.state == FRAMESTEP_SCHEDULED);
+  CHECK(bCanDiscard);
+}
+
+// The mixer claims to be discardable but refuses the third request with E_INVALIDARG. The fast path is
+// switched off for good and the rest of the step is rendered, still ending on the right frame.
+static void TestInvalidArgFallback()
+{
+  const DWORD cSteps = 10;
+  StubMixer mixer;
+  mixer.m_hrDiscard[2] = E_INVALIDARG;
+  FrameStep frameStep;
+  BOOL bCanDiscard = TRUE;
+  StepRun run;
+
+  StartStep(frameStep, cSteps);
+  for (DWORD i = 0; i < cSteps; i++)
+  {
+    CHECK(run.NextFrame(frameStep, &mixer, &bCanDiscard) == S_OK);
+  }
+
+  CHECK(!bCanDiscard);
+  CHECK(mixer.m_cDiscards == 3);
+  CHECK(frameStep.skipped == 2);
+  CHECK(run.cRendered == cSteps - 2);
+  CHECK(run.cShown == 1 && run.iShown == cSteps);
+  CHECK(frameStep.steps == 0);
+
+  // The next step does not ask the mixer again.
+  StartStep(frameStep, 3);
+  run = StepRun();
+  for (int i = 0; i < 3; i++)
+  {
+    CHECK(run.NextFrame(frameStep, &mixer, &bCanDiscard) == S_OK);
+  }
+  CHECK(mixer.m_cDiscards == 3);
+  CHECK(run.cShown == 1 && run.iShown == 3);
+}
+
+// A mixer without input keeps the step count; any other error renders the frame the normal way.
+static void TestOtherResults()
+{
+  StubMixer mixer;
+  mixer.m_hrDiscard[0] = MF_E_TRANSFORM_NEED_MORE_INPUT;
+  mixer.m_hrDiscard[1] = MF_E_TRANSFORM_STREAM_CHANGE;
+  FrameStep frameStep;
+  BOOL bCanDiscard = TRUE;
+
+  StartStep(frameStep, 5);
+  CHECK(frameStep.DiscardIntermediate(&mixer, &bCanDiscard) == MF_E_TRANSFORM_NEED_MORE_INPUT);
+  CHECK(frameStep.steps == 5 && frameStep.skipped == 0 && bCanDiscard);
+
+  CHECK(frameStep.DiscardIntermediate(&mixer, &bCanDiscard) == S_FALSE);
+  CHECK(frameStep.steps == 5 && frameStep.skipped == 0 && bCanDiscard);
+
+  CHECK(frameStep.DiscardIntermediate(&mixer, &bCanDiscard) == S_OK);
+  CHECK(frameStep.steps == 4 && frameStep.skipped == 1);
+}
+
+// Only the frames of a started multi-frame step are intermediate.
+static void TestIntermediate()
+{
+  FrameStep frameStep;
+  CHECK(!frameStep.IsIntermediate(FALSE));
+
+  StartStep(frameStep, 1);
+  CHECK(!frameStep.IsIntermediate(FALSE));
+
+  StartStep(frameStep, 2);
+  CHECK(frameStep.IsIntermediate(FALSE));
+  CHECK(!frameStep.IsIntermediate(TRUE));   // Scrubbing drops by time stamp after mixing.
+
+  frameStep.state = FRAMESTEP_WAITING_START;
+  CHECK(!frameStep.IsIntermediate(FALSE));
+
+  // A single step shows the first frame without asking the mixer to discard.
+  StubMixer mixer;
+  BOOL bCanDiscard = TRUE;
+  StepRun run;
+  StartStep(frameStep, 1);
+  CHECK(run.NextFrame(frameStep, &mixer, &bCanDiscard) == S_OK);
+  CHECK(mixer.m_cDiscards == 0);
+  CHECK(run.cShown == 1 && run.iShown == 1);
+}
+
+
+int main(int argc, char *argv[])
+{
+  TestCanDiscard();
+  TestDiscardPath();
+  TestInvalidArgFallback();
+  TestOtherResults();
+  TestIntermediate();
+
+  return TestResult();
+}
@@ -0,0 +1,217 @@
+// Copyright (C) 2007-2014 Team MediaPortal
+// http://www.team-mediaportal.com
+//
+// This file is part of MediaPortal 2
+//
+// MediaPortal 2 is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// MediaPortal 2 is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with MediaPortal 2. If not, see <http://www.gnu.org/licenses/>.
+
+// Counts the task allocator calls that CMediaType makes in the loops of a pin connection (copying,
+// assigning and enumerating types) and times them. Format blocks up to MEDIATYPE_INLINE_FORMAT bytes
+// live inside the CMediaType, so copying such a type must not allocate at all, and no scenario may leak.
+//
+// Usage: MediaTypeAllocBench [iterations]
+//
+// The calls are counted with a malloc spy in a first pass and timed without it in a second pass.
+// Returns the number of failed checks.
+
+#include <streams.h>
+#include <dvdmedia.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../TestCommon.h"
+
+
+// Counts the calls to the task allocator. Only one thread allocates while it is registered.
+class CountingMallocSpy : public IMallocSpy
+{
+public:
+  LONG m_Allocs;
+  LONG m_Frees;
+  LONG m_Reallocs;
+
+  CountingMallocSpy() : m_Allocs(0), m_Frees(0), m_Reallocs(0) {}
+
+  void Reset() { m_Allocs = m_Frees = m_Reallocs = 0; }
+
+  STDMETHODIMP QueryInterface(REFIID riid, void **ppv)
+  {
+    if (riid == IID_IUnknown || riid == IID_IMallocSpy)
+    {
+      *ppv = static_cast<IMallocSpy*>(this);
+      return S_OK;
+    }
+    *ppv = NULL;
+    return E_NOINTERFACE;
+  }
+  STDMETHODIMP_(ULONG) AddRef() { return 2; }
+  STDMETHODIMP_(ULONG) Release() { return 1; }
+
+  STDMETHODIMP_(SIZE_T) PreAlloc(SIZE_T cbRequest) { m_Allocs++; return cbRequest; }
+  STDMETHODIMP_(void*) PostAlloc(void *pActual) { return pActual; }
+  STDMETHODIMP_(void*) PreFree(void *pRequest, BOOL fSpyed) { if (pRequest) m_Frees++; return pRequest; }
+  STDMETHODIMP_(void) PostFree(BOOL fSpyed) {}
+  STDMETHODIMP_(SIZE_T) PreRealloc(void *pRequest, SIZE_T cbRequest, void **ppNewRequest, BOOL fSpyed)
+  {
+    // Realloc(NULL) allocates and Realloc(p, 0) frees.
+    if (pRequest == NULL)
+      m_Allocs++;
+    else if (cbRequest == 0)
+      m_Frees++;
+    else
+      m_Reallocs++;
+    *ppNewRequest = pRequest;
+    return cbRequest;
+  }
+  STDMETHODIMP_(void*) PostRealloc(void *pActual, BOOL fSpyed) { return pActual; }
+  STDMETHODIMP_(void*) PreGetSize(void *pRequest, BOOL fSpyed) { return pRequest; }
+  STDMETHODIMP_(SIZE_T) PostGetSize(SIZE_T cbActual, BOOL fSpyed) { return cbActual; }
+  STDMETHODIMP_(void*) PreDidAlloc(void *pRequest, BOOL fSpyed) { return pRequest; }
+  STDMETHODIMP_(int) PostDidAlloc(void *pRequest, BOOL fSpyed, int fActual) { return fActual; }
+  STDMETHODIMP_(void) PreHeapMinimize() {}
+  STDMETHODIMP_(void) PostHeapMinimize() {}
+};
+
+static CountingMallocSpy g_Spy;
+
+
+// A video type as a decoder offers it: VIDEOINFOHEADER2 with colour masks, which fits inline.
+static void InitVideoType(CMediaType& mt, ULONG cbFormat)
+{
+  mt.InitMediaType();
+  mt.SetType(&MEDIATYPE_Video);
+  mt.SetSubtype(&MEDIASUBTYPE_NV12);
+  mt.SetFormatType(&FORMAT_VideoInfo2);
+  BYTE *pFormat = mt.AllocFormatBuffer(cbFormat);
+  if (pFormat)
+  {
+    ZeroMemory(pFormat, cbFormat);
+    VIDEOINFOHEADER2 *pvih = (VIDEOINFOHEADER2*)pFormat;
+    pvih->bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    pvih->bmiHeader.biWidth = 1920;
+    pvih->bmiHeader.biHeight = 1080;
+    pvih->dwPictAspectRatioX = 16;
+    pvih->dwPictAspectRatioY = 9;
+  }
+}
+
+typedef void (*SCENARIO)(const CMediaType& mt);
+
+// CBasePin::AgreeMediaType and CheckMediaType take copies of the types they look at.
+static void CopyType(const CMediaType& mt)
+{
+  CMediaType copy(mt);
+}
+
+// SetMediaType keeps the connection type by assignment.
+static void AssignType(const CMediaType& mt)
+{
+  CMediaType connection;
+  connection = mt;
+}
+
+// CEnumMediaTypes::Next hands the type to the caller, which frees it with DeleteMediaType. The
+// AM_MEDIA_TYPE and its format block cross the COM boundary, so there are two allocations whether
+// the format was inline (copied out by Detach) or not (allocated by the copy).
+static void EnumerateType(const CMediaType& mt)
+{
+  CMediaType offered(mt);
+  AM_MEDIA_TYPE *pmt = (AM_MEDIA_TYPE*)CoTaskMemAlloc(sizeof(AM_MEDIA_TYPE));
+  if (pmt && SUCCEEDED(offered.Detach(pmt)))
+  {
+    DeleteMediaType(pmt);
+  }
+  else
+  {
+    CoTaskMemFree(pmt);
+  }
+}
+
+struct Scenario
+{
+  const char  *pName;
+  SCENARIO    pfn;
+  ULONG       cbFormat;
+  LONG        expectedAllocs;   // per iteration
+};
+
+static const Scenario g_Scenarios[] =
+{
+  { "copy inline",       CopyType,      sizeof(VIDEOINFOHEADER2) + 3 * sizeof(DWORD), 0 },
+  { "assign inline",     AssignType,    sizeof(VIDEOINFOHEADER2) + 3 * sizeof(DWORD), 0 },
+  { "enumerate inline",  EnumerateType, sizeof(VIDEOINFOHEADER2) + 3 * sizeof(DWORD), 2 },
+  { "copy large",        CopyType,      sizeof(MPEG2VIDEOINFO) + 256,                 1 },
+  { "assign large",      AssignType,    sizeof(MPEG2VIDEOINFO) + 256,                 1 },
+  { "enumerate large",   EnumerateType, sizeof(MPEG2VIDEOINFO) + 256,                 2 },
+};
+
+
+int main(int argc, char *argv[])
+{
+  int iterations = (argc > 1) ? atoi(argv[1]) : 100000;
+  if (iterations <= 0)
+  {
+    printf("Usage: MediaTypeAllocBench [iterations]\n");
+    return 1;
+  }
+
+  CoInitializeEx(NULL, COINIT_MULTITHREADED);
+
+  LARGE_INTEGER liFrequency;
+  QueryPerformanceFrequency(&liFrequency);
+
+  printf("%-18s %10s %10s %10s %10s\n", "scenario", "allocs", "frees", "reallocs", "ns/iter");
+
+  for (int s = 0; s < (int)ARRAYSIZE(g_Scenarios); s++)
+  {
+    const Scenario& scenario = g_Scenarios[s];
+    CMediaType mt;
+    InitVideoType(mt, scenario.cbFormat);
+
+    // Counting pass
+    g_Spy.Reset();
+    if (FAILED(CoRegisterMallocSpy(&g_Spy)))
+    {
+      printf("CoRegisterMallocSpy failed\n");
+      CoUninitialize();
+      return 1;
+    }
+    for (int i = 0; i < iterations; i++)
+    {
+      scenario.pfn(mt);
+    }
+    CoRevokeMallocSpy();
+
+    // Timing pass
+    LARGE_INTEGER liStart, liEnd;
+    QueryPerformanceCounter(&liStart);
+    for (int i = 0; i < iterations; i++)
+    {
+      scenario.pfn(mt);
+    }
+    QueryPerformanceCounter(&liEnd);
+    double ns = (double)(liEnd.QuadPart - liStart.QuadPart) * 1e9 / liFrequency.QuadPart / iterations;
+
+    printf("%-18s %10.2f %10.2f %10.2f %10.1f\n", scenario.pName,
+      (double)g_Spy.m_Allocs / iterations, (double)g_Spy.m_Frees / iterations,
+      (double)g_Spy.m_Reallocs / iterations, ns);
+
+    CHECK(g_Spy.m_Allocs == g_Spy.m_Frees);
+    CHECK(g_Spy.m_Allocs == scenario.expectedAllocs * iterations);
+  }
+
+  CoUninitialize();
+
+  return TestResult();
+}
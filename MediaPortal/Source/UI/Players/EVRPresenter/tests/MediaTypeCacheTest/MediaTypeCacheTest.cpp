@@ -0,0 +1,266 @@
+// Copyright (C) 2007-2014 Team MediaPortal
+// http://www.team-mediaportal.com
+//
+// This file is part of MediaPortal 2
+//
+// MediaPortal 2 is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// MediaPortal 2 is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with MediaPortal 2. If not, see <http://www.gnu.org/licenses/>.
+
+// Tests of the media type comparison and the negotiation cache. Only the same object or
+// IMFMediaType::IsEqual may make two types equal; the negotiation hash may only tell them apart.
+//
+// Usage: MediaTypeCacheTest
+//
+// Prints the failed checks and returns the number of failures.
+
+#include <stdio.h>
+#include <mfapi.h>
+
+#include "../../source/MediaTypeCache.h"
+
+#include "../TestCommon.h"
+
+
+// The cache logs through the presenter's log; the test has none.
+void Log(const char *fmt, ...)
+{
+}
+
+void LogAtLevel(LOG_LEVEL level, const char *fmt, ...)
+{
+}
+
+
+static IMFMediaType* CreateVideoType(UINT32 width, UINT32 height)
+{
+  IMFMediaType *pType = NULL;
+  if (FAILED(MFCreateMediaType(&pType)))
+  {
+    return NULL;
+  }
+  pType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video);
+  pType->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_RGB32);
+  MFSetAttributeSize(pType, MF_MT_FRAME_SIZE, width, height);
+  MFSetAttributeRatio(pType, MF_MT_FRAME_RATE, 25, 1);
+  MFSetAttributeRatio(pType, MF_MT_PIXEL_ASPECT_RATIO, 1, 1);
+  pType->SetUINT32(MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive);
+  pType->SetUINT32(MF_MT_DEFAULT_STRIDE, width * 4);
+  return pType;
+}
+
+static IMFMediaType* CopyType(IMFMediaType *pType)
+{
+  IMFMediaType *pCopy = NULL;
+  if (FAILED(MFCreateMediaType(&pCopy)))
+  {
+    return NULL;
+  }
+  pType->CopyAllItems(pCopy);
+  return pCopy;
+}
+
+static UINT64 Hash(IMFMediaType *pType)
+{
+  UINT64 hash = 0;
+  MediaTypeCache::HashMediaType(pType, &hash);
+  return hash;
+}
+
+static BOOL AreEqual(IMFMediaType *pType1, IMFMediaType *pType2)
+{
+  return MediaTypeCache::AreTypesEqual(pType1, Hash(pType1), pType2, Hash(pType2));
+}
+
+static BOOL IsEqual(IMFMediaType *pType1, IMFMediaType *pType2)
+{
+  DWORD dwFlags = 0;
+  return pType1->IsEqual(pType2, &dwFlags) == S_OK;
+}
+
+
+static void TestNullAndIdentity()
+{
+  IMFMediaType *pType = CreateVideoType(1920, 1080);
+
+  CHECK(AreEqual(NULL, NULL));
+  CHECK(!AreEqual(pType, NULL));
+  CHECK(!AreEqual(NULL, pType));
+  CHECK(AreEqual(pType, pType));
+
+  SAFE_RELEASE(pType);
+}
+
+static void TestEqualCopies()
+{
+  IMFMediaType *pType = CreateVideoType(1920, 1080);
+  IMFMediaType *pCopy = CopyType(pType);
+
+  CHECK(AreEqual(pType, pCopy));
+  CHECK(AreEqual(pCopy, pType));
+  CHECK(Hash(pType) == Hash(pCopy));
+
+  SAFE_RELEASE(pCopy);
+  SAFE_RELEASE(pType);
+}
+
+static void TestSameHashIsNotEqual()
+{
+  IMFMediaType *pType = CreateVideoType(1920, 1080);
+  IMFMediaType *pOther = CopyType(pType);
+
+  // The stride is not a negotiation attribute, so the hash does not see it.
+  pOther->SetUINT32(MF_MT_DEFAULT_STRIDE, 1920 * 4 + 64);
+  CHECK(Hash(pType) == Hash(pOther));
+  CHECK(!AreEqual(pType, pOther));
+
+  // Neither does it see an additional attribute.
+  SAFE_RELEASE(pOther);
+  pOther = CopyType(pType);
+  pOther->SetUINT32(MF_MT_VIDEO_PRIMARIES, MFVideoPrimaries_BT709);
+  CHECK(Hash(pType) == Hash(pOther));
+  CHECK(!AreEqual(pType, pOther));
+  CHECK(!AreEqual(pOther, pType));
+
+  SAFE_RELEASE(pOther);
+  SAFE_RELEASE(pType);
+}
+
+static void TestDifferentTypes()
+{
+  IMFMediaType *pType = CreateVideoType(1920, 1080);
+  IMFMediaType *pOther = CreateVideoType(1280, 720);
+
+  CHECK(!AreEqual(pType, pOther));
+
+  SAFE_RELEASE(pOther);
+  SAFE_RELEASE(pType);
+}
+
+// Compares every pair of a set of types that differ in negotiation attributes, in other attributes or
+// in both against IMFMediaType::IsEqual. A hash mismatch must never reject a pair that IsEqual accepts.
+static void TestAgainstIsEqual()
+{
+  const int cTypes = 32;
+  IMFMediaType *types[cTypes];
+  for (int i = 0; i < cTypes; i++)
+  {
+    // Bit 0 and 1 change negotiation attributes, bit 2 and 3 others. Bit 4 changes nothing, so every
+    // type has an equal twin that is another object.
+    types[i] = CreateVideoType((i & 1) ? 1280 : 1920, (i & 1) ? 720 : 1080);
+    if (i & 2)
+    {
+      types[i]->SetUINT32(MF_MT_INTERLACE_MODE, MFVideoInterlace_MixedInterlaceOrProgressive);
+    }
+    if (i & 4)
+    {
+      types[i]->SetUINT32(MF_MT_DEFAULT_STRIDE, 8192);
+    }
+    if (i & 8)
+    {
+      types[i]->SetUINT32(MF_MT_VIDEO_PRIMARIES, MFVideoPrimaries_BT709);
+    }
+  }
+
+  int cEqual = 0;
+  for (int i = 0; i < cTypes; i++)
+  {
+    for (int j = 0; j < cTypes; j++)
+    {
+      BOOL bIsEqual = IsEqual(types[i], types[j]);
+      if (Hash(types[i]) != Hash(types[j]))
+      {
+        CHECK(!bIsEqual);
+      }
+      CHECK(AreEqual(types[i], types[j]) == bIsEqual);
+      if (bIsEqual)
+      {
+        cEqual++;
+      }
+    }
+  }
+  // Each type equals itself and its copy.
+  CHECK(cEqual == 2 * cTypes);
+
+  for (int i = 0; i < cTypes; i++)
+  {
+    SAFE_RELEASE(types[i]);
+  }
+}
+
+static void TestCacheConfirmsHashHits()
+{
+  MediaTypeCache cache;
+  IMFMediaType *pProposed = CreateVideoType(1920, 1080);
+  IMFMediaType *pOptimal = CopyType(pProposed);
+  pOptimal->SetUINT32(MF_MT_PAN_SCAN_ENABLED, FALSE);
+
+  UINT64 optimalHash = 0;
+  CHECK(cache.Insert(pProposed, Hash(pProposed), S_OK, pOptimal, 0, &optimalHash) == S_OK);
+  CHECK(optimalHash == Hash(pOptimal));
+
+  // Same hash, different type: a miss.
+  IMFMediaType *pOther = CopyType(pProposed);
+  pOther->SetUINT32(MF_MT_DEFAULT_STRIDE, 1920 * 4 + 64);
+  HRESULT hrSupported = E_FAIL;
+  IMFMediaType *pResult = NULL;
+  CHECK(cache.Lookup(pOther, Hash(pOther), &hrSupported, &pResult) == S_FALSE);
+  CHECK(pResult == NULL);
+
+  // Equal type: a hit with a copy of the optimal type.
+  IMFMediaType *pCopy = CopyType(pProposed);
+  optimalHash = 0;
+  CHECK(cache.Lookup(pCopy, Hash(pCopy), &hrSupported, &pResult, &optimalHash) == S_OK);
+  CHECK(hrSupported == S_OK);
+  CHECK(optimalHash == Hash(pOptimal));
+  CHECK(pResult != NULL && pResult != pOptimal);
+  CHECK(AreEqual(pResult, pOptimal));
+
+  // Changing the copy we got must not change what the cache hands out next.
+  if (pResult)
+  {
+    pResult->SetUINT32(MF_MT_DEFAULT_STRIDE, 1);
+  }
+  IMFMediaType *pResult2 = NULL;
+  CHECK(cache.Lookup(pCopy, Hash(pCopy), &hrSupported, &pResult2) == S_OK);
+  CHECK(pResult2 != NULL && pResult2 != pResult);
+  CHECK(AreEqual(pResult2, pOptimal));
+  CHECK(!AreEqual(pResult2, pResult));
+
+  SAFE_RELEASE(pResult2);
+  SAFE_RELEASE(pResult);
+  SAFE_RELEASE(pCopy);
+  SAFE_RELEASE(pOther);
+  SAFE_RELEASE(pOptimal);
+  SAFE_RELEASE(pProposed);
+}
+
+
+int main(int argc, char *argv[])
+{
+  if (FAILED(MFStartup(MF_VERSION, MFSTARTUP_LITE)))
+  {
+    printf("MFStartup failed\n");
+    return 1;
+  }
+
+  TestNullAndIdentity();
+  TestEqualCopies();
+  TestSameHashIsNotEqual();
+  TestDifferentTypes();
+  TestAgainstIsEqual();
+  TestCacheConfirmsHashHits();
+
+  MFShutdown();
+
+  return TestResult();
+}
@@ -0,0 +1,187 @@
+// Copyright (C) 2007-2014 Team MediaPortal
+// http://www.team-mediaportal.com
+//
+// This file is part of MediaPortal 2
+//
+// MediaPortal 2 is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// MediaPortal 2 is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with MediaPortal 2. If not, see <http://www.gnu.org/licenses/>.
+
+// Measures the cost of the MSR probes of the base classes (measure.h) and checks what they count. The
+// renderer probes every sample, so a probe should cost less than 20 ns; an integer probe only does a
+// few stores, start/stop and note also read the performance counter.
+//
+// Usage: MsrProbeBench [iterations] [threads]
+//
+// Reports the ns per probe on one thread, with all threads probing at once and while paused. The
+// times are reported, not checked; the counts, sums and ranges of the snapshot are. Returns the number
+// of failed checks.
+
+#include <streams.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "../TestCommon.h"
+
+
+const double TARGET_NS = 20.0;
+
+static int g_Iterations;
+static int g_idInteger;
+static int g_idStartStop;
+static int g_idNote;
+
+
+// Probes each kind g_Iterations times and returns the ns per probe in pNs[0..2]: integer, start/stop
+// (two probes per pair) and note.
+static void RunProbes(double *pNs)
+{
+  TestTimer timer;
+
+  for (int i = 0; i < g_Iterations; i++)
+  {
+    MSR_INTEGER(g_idInteger, i);
+  }
+  pNs[0] = timer.ElapsedNs() / g_Iterations;
+
+  timer.Start();
+  for (int i = 0; i < g_Iterations; i++)
+  {
+    MSR_START(g_idStartStop);
+    MSR_STOP(g_idStartStop);
+  }
+  pNs[1] = timer.ElapsedNs() / g_Iterations / 2;
+
+  timer.Start();
+  for (int i = 0; i < g_Iterations; i++)
+  {
+    MSR_NOTE(g_idNote);
+  }
+  pNs[2] = timer.ElapsedNs() / g_Iterations;
+}
+
+static DWORD WINAPI ProbeThread(LPVOID pv)
+{
+  RunProbes((double*)pv);
+  return 0;
+}
+
+static void Report(const char *pszCase, const double *pNs)
+{
+  static const char *s_pszProbe[] = { "MSR_INTEGER", "MSR_START/STOP", "MSR_NOTE" };
+  for (int i = 0; i < 3; i++)
+  {
+    printf("%-12s %-16s %8.1f ns/probe%s\n", pszCase, s_pszProbe[i], pNs[i], pNs[i] < TARGET_NS ? "" : "  (over target)");
+  }
+}
+
+static MSR_STATS* Snapshot()
+{
+  static MSR_STATS s_Stats[MSR_MAX_INCIDENTS];
+  CHECK(Msr_Snapshot(s_Stats, MSR_MAX_INCIDENTS) > g_idNote);
+  return s_Stats;
+}
+
+// The statistics of cThreads threads that each ran RunProbes once since the last reset.
+static void CheckCounts(int cThreads)
+{
+  MSR_STATS *pStats = Snapshot();
+  LONGLONG llCount = (LONGLONG)cThreads * g_Iterations;
+
+  const MSR_STATS& integer = pStats[g_idInteger];
+  CHECK(integer.llCount == llCount);
+  CHECK(integer.lSmallest == 0);
+  CHECK(integer.lLargest == g_Iterations - 1);
+  CHECK(fabs(integer.dAverage - (g_Iterations - 1) / 2.0) < 1e-6 * g_Iterations);
+  // The values are spread evenly, and a percentile is the top of a power of two bucket.
+  CHECK(integer.lP50 <= integer.lP95 && integer.lP95 <= integer.lP99);
+  CHECK(integer.lP50 >= g_Iterations / 2 - 1 && integer.lP50 / 2 <= g_Iterations / 2);
+
+  CHECK(pStats[g_idStartStop].llCount == llCount);
+  CHECK(pStats[g_idStartStop].lSmallest >= 0);
+
+  // The first note of a thread only starts the interval.
+  CHECK(pStats[g_idNote].llCount == llCount - cThreads);
+}
+
+
+int main(int argc, char *argv[])
+{
+  g_Iterations = (argc > 1) ? atoi(argv[1]) : 10000000;
+  int cThreads = (argc > 2) ? atoi(argv[2]) : 4;
+  if (g_Iterations <= 0 || cThreads <= 0 || cThreads > MAXIMUM_WAIT_OBJECTS)
+  {
+    printf("Usage: MsrProbeBench [iterations] [threads]\n");
+    return 1;
+  }
+
+  MSR_INIT();
+  g_idInteger = MSR_REGISTER(TEXT("MsrProbeBench: integer"));
+  g_idStartStop = MSR_REGISTER(TEXT("MsrProbeBench: start/stop"));
+  g_idNote = MSR_REGISTER(TEXT("MsrProbeBench: note"));
+  CHECK(g_idInteger != 0 && g_idStartStop != 0 && g_idNote != 0);
+  CHECK(MSR_REGISTER(TEXT("MsrProbeBench: integer")) == g_idInteger);
+
+  double ns[3];
+
+  // Warm up, so that the thread's block is attached before timing.
+  MSR_INTEGER(g_idInteger, 0);
+  MSR_CONTROL(MSR_RESET_ALL);
+
+  RunProbes(ns);
+  Report("1 thread", ns);
+  CheckCounts(1);
+
+  // Each thread counts into a block of its own, so the cost should not grow with the thread count.
+  MSR_CONTROL(MSR_RESET_ALL);
+  HANDLE hThreads[MAXIMUM_WAIT_OBJECTS];
+  double (*pThreadNs)[3] = new double[cThreads][3];
+  for (int i = 0; i < cThreads; i++)
+  {
+    hThreads[i] = CreateThread(NULL, 0, ProbeThread, pThreadNs[i], 0, NULL);
+    CHECK(hThreads[i] != NULL);
+  }
+  WaitForMultipleObjects(cThreads, hThreads, TRUE, INFINITE);
+  for (int i = 0; i < cThreads; i++)
+  {
+    CloseHandle(hThreads[i]);
+  }
+  for (int k = 0; k < 3; k++)
+  {
+    ns[k] = 0;
+    for (int i = 0; i < cThreads; i++)
+    {
+      ns[k] += pThreadNs[i][k] / cThreads;
+    }
+  }
+  delete[] pThreadNs;
+  char szCase[32];
+  sprintf_s(szCase, "%d threads", cThreads);
+  Report(szCase, ns);
+  CheckCounts(cThreads);
+
+  // Paused probes return before touching the counters.
+  MSR_CONTROL(MSR_RESET_ALL);
+  MSR_CONTROL(MSR_PAUSE);
+  RunProbes(ns);
+  MSR_CONTROL(MSR_RUN);
+  Report("paused", ns);
+  MSR_STATS *pStats = Snapshot();
+  CHECK(pStats[g_idInteger].llCount == 0);
+  CHECK(pStats[g_idStartStop].llCount == 0);
+  CHECK(pStats[g_idNote].llCount == 0);
+
+  MSR_TERMINATE();
+
+  return TestResult();
+}
@@ -0,0 +1,201 @@
+// Copyright (C) 2007-2014 Team MediaPortal
+// http://www.team-mediaportal.com
+//
+// This file is part of MediaPortal 2
+//
+// MediaPortal 2 is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// MediaPortal 2 is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with MediaPortal 2. If not, see <http://www.gnu.org/licenses/>.
+
+// Tests the node pool behind CBaseList and measures list node churn on it against the heap.
+//
+// Usage: NodePoolTest [operations]
+//
+// The release test checks that CBaseList::ReleaseNodePool frees every slab whose nodes are all free,
+// and none that still has a node in a list or in the cache of a list. The benchmark then adds and
+// removes bursts of nodes on lists without a cache, from 1 to 8 threads at once, and does the same with
+// heap blocks of the node size for comparison. Returns the number of failed checks.
+
+#include <streams.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../TestCommon.h"
+
+
+typedef CGenericList<int> CIntList;
+
+static const int cNodes = 10000;    // Several slabs of nodes
+static int g_Values[cNodes];
+
+// Adds the values in order, returns FALSE if a node could not be allocated
+static BOOL Fill(CIntList& list, int count)
+{
+  for (int i = 0; i < count; i++)
+  {
+    if (list.AddTail(&g_Values[i]) == NULL)
+    {
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+// Frees all nodes but the last one, which comes from the last slab the pool added. Only that slab may
+// stay, with the node still in its list.
+static void TestOneNodeKeepsItsSlab()
+{
+  // Slabs of the nodes of other lists in the process
+  const LONG lBase = CBaseList::ReleaseNodePool();
+  {
+    CIntList list(NAME("NodePoolTest"), 0);
+    CHECK(Fill(list, cNodes));
+    CHECK(CBaseList::ReleaseNodePool() > lBase + 1);
+
+    for (int i = 0; i < cNodes - 1; i++)
+    {
+      CHECK(list.RemoveHead() == &g_Values[i]);
+    }
+    CHECK(CBaseList::ReleaseNodePool() == lBase + 1);
+
+    // The node and its list still work
+    CHECK(list.GetCount() == 1);
+    CHECK(list.GetHead() == &g_Values[cNodes - 1]);
+    CHECK(list.AddHead(&g_Values[0]) != NULL);
+    CHECK(list.RemoveTail() == &g_Values[cNodes - 1]);
+    CHECK(list.RemoveHead() == &g_Values[0]);
+    CHECK(list.GetCount() == 0);
+  }
+
+  // Every node is free again, so are all the slabs
+  CHECK(CBaseList::ReleaseNodePool() == lBase);
+}
+
+// Nodes in the cache of a list belong to the list. Their slabs are kept until the list is gone.
+static void TestCachedNodesKeepTheirSlabs()
+{
+  const LONG lBase = CBaseList::ReleaseNodePool();
+  {
+    CIntList list(NAME("NodePoolTest"), DEFAULTCACHE);
+    CHECK(Fill(list, cNodes));
+    // The first nodes taken off stay in the cache, these are the ones from the last slab
+    while (list.RemoveTail() != NULL)
+    {
+    }
+    CHECK(CBaseList::ReleaseNodePool() > lBase);
+  }
+  CHECK(CBaseList::ReleaseNodePool() == lBase);
+}
+
+
+// Benchmark: every thread adds a burst of nodes to a list of its own and takes them off again. The
+// list has no cache, so every node comes from and goes back to the shared pool.
+struct ChurnThread
+{
+  HANDLE  hStart;
+  int     operations;
+  int     cBurst;
+  BOOL    bHeap;          // Heap blocks of the node size instead of list nodes
+  BOOL    bFailed;
+};
+
+static DWORD WINAPI ChurnThreadProc(LPVOID pv)
+{
+  ChurnThread *pThread = (ChurnThread *)pv;
+  WaitForSingleObject(pThread->hStart, INFINITE);
+
+  if (pThread->bHeap)
+  {
+    void **ppBlocks = new void*[pThread->cBurst];
+    for (int done = 0; done < pThread->operations; done += pThread->cBurst)
+    {
+      for (int i = 0; i < pThread->cBurst; i++)
+      {
+        ppBlocks[i] = malloc(3 * sizeof(void*));
+        pThread->bFailed |= (ppBlocks[i] == NULL);
+      }
+      for (int i = 0; i < pThread->cBurst; i++)
+      {
+        free(ppBlocks[i]);
+      }
+    }
+    delete [] ppBlocks;
+  }
+  else
+  {
+    CIntList list(NAME("NodePoolTest churn"), 0);
+    for (int done = 0; done < pThread->operations; done += pThread->cBurst)
+    {
+      pThread->bFailed |= !Fill(list, pThread->cBurst);
+      while (list.RemoveHead() != NULL)
+      {
+      }
+    }
+  }
+  return 0;
+}
+
+// Returns the time per node, allocation and free, in ns
+static double RunChurn(int cThreads, BOOL bHeap, int operations)
+{
+  const int cBurst = 1000;
+  HANDLE hStart = CreateEvent(NULL, TRUE, FALSE, NULL);
+  ChurnThread threads[8];
+  HANDLE handles[8];
+  for (int i = 0; i < cThreads; i++)
+  {
+    ChurnThread thread = { hStart, operations, cBurst, bHeap, FALSE };
+    threads[i] = thread;
+    handles[i] = CreateThread(NULL, 0, ChurnThreadProc, &threads[i], 0, NULL);
+  }
+
+  TestTimer timer;
+  SetEvent(hStart);
+  WaitForMultipleObjects(cThreads, handles, TRUE, INFINITE);
+  double ns = timer.ElapsedNs() / ((double)operations * cThreads);
+
+  for (int i = 0; i < cThreads; i++)
+  {
+    CHECK(!threads[i].bFailed);
+    CloseHandle(handles[i]);
+  }
+  CloseHandle(hStart);
+  return ns;
+}
+
+
+int main(int argc, char *argv[])
+{
+  int operations = (argc > 1) ? atoi(argv[1]) : 2000000;
+  if (operations <= 0)
+  {
+    printf("Usage: NodePoolTest [operations]\n");
+    return 1;
+  }
+
+  TestOneNodeKeepsItsSlab();
+  TestCachedNodesKeepTheirSlabs();
+
+  // Timing depends on the machine and the heap, so it is reported rather than checked
+  printf("%8s %16s %16s\n", "threads", "pool ns/node", "heap ns/node");
+  for (int cThreads = 1; cThreads <= 8; cThreads *= 2)
+  {
+    double nsPool = RunChurn(cThreads, FALSE, operations);
+    double nsHeap = RunChurn(cThreads, TRUE, operations);
+    printf("%8d %16.1f %16.1f\n", cThreads, nsPool, nsHeap);
+  }
+
+  // The benchmark grew the pool, the slabs go back now
+  printf("%d slab(s) in use after the benchmark\n", CBaseList::ReleaseNodePool());
+
+  return TestResult();
+}
@@ -0,0 +1,321 @@
+// Copyright (C) 2007-2014 Team MediaPortal
+// http://www.team-mediaportal.com
+//
+// This file is part of MediaPortal 2
+//
+// MediaPortal 2 is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// MediaPortal 2 is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with MediaPortal 2. If not, see <http://www.gnu.org/licenses/>.
+
+// Stress test of the COutputQueue ring and its flush generations. Several producers push samples
+// through a queue with a small ring into a counting downstream pin while another thread keeps
+// flushing the queue.
+//
+// Usage: OutputQueueStress [seconds] [producers]
+//
+// A sample whose Receive call returned before a flush began must be delivered before the downstream
+// EndFlush of that flush or not at all. Delivered samples of one producer must keep their order, and
+// every sample must go back to the allocator.
+//
+// Before that, a queue with adaptive batching gets a single sample and then a burst; the sample must
+// be sent when it reaches the age limit and the batch statistics must match what arrived.
+// Returns the number of failed checks.
+
+#include <streams.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../TestCommon.h"
+#include "../TestPin.h"
+
+
+static const int MAX_PRODUCERS = 16;
+// A sample is identified by its producer in the high byte and its number in the rest. At most
+// g_cBuffers samples are out at a time, so a window of records per producer is enough
+static const LONG SAMPLE_MASK = 0xFFFFFF;
+static const LONG RECORD_WINDOW = 4096;
+static const long g_cBuffers = 32;
+
+static IMemAllocator *g_pAllocator = NULL;
+static COutputQueue *g_pQueue = NULL;
+static volatile LONG g_bStop = FALSE;
+
+// flushes begun by the test and EndFlush calls seen downstream
+static volatile LONG g_lFlushesBegun = 0;
+static volatile LONG g_lEndFlushes = 0;
+
+// for the samples in the window, 1 + g_lFlushesBegun read after the Receive call returned, 0 until then
+static volatile LONG *g_pReturned[MAX_PRODUCERS];
+
+static LONG g_lDelivered = 0;
+static LONG g_lLate = 0;
+static LONG g_lOutOfOrder = 0;
+static LONG g_lLast[MAX_PRODUCERS];
+
+
+// The downstream pin of the flush test. Only the queue's thread delivers to it.
+class CountingPin : public TestInputPin
+{
+public:
+  STDMETHODIMP EndFlush() { InterlockedIncrement(&g_lEndFlushes); return S_OK; }
+
+  STDMETHODIMP Receive(IMediaSample *pSample)
+  {
+    BYTE *pBuffer = NULL;
+    pSample->GetPointer(&pBuffer);
+    DWORD dwId = *(DWORD*)pBuffer;
+    DWORD dwProducer = dwId >> 24;
+    LONG lSample = (LONG)(dwId & SAMPLE_MASK);
+
+    // EndFlush for a flush that began after Receive returned has started
+    LONG lReturned = g_pReturned[dwProducer][lSample % RECORD_WINDOW];
+    if (lReturned != 0 && g_lEndFlushes >= lReturned)
+      g_lLate++;
+
+    LONG lAhead = (lSample - g_lLast[dwProducer]) & SAMPLE_MASK;
+    if (lAhead == 0 || lAhead > SAMPLE_MASK / 2)
+      g_lOutOfOrder++;
+    g_lLast[dwProducer] = lSample;
+    g_lDelivered++;
+    return S_OK;
+  }
+};
+
+// The downstream pin of the batching test. Remembers when samples arrive and how large the batches are.
+class BatchPin : public TestInputPin
+{
+public:
+  volatile LONG m_lDelivered;
+  LONG          m_lBatches;
+  LONG          m_lLargestBatch;
+  DWORD         m_dwFirstDelivery;
+
+  BatchPin() : m_lDelivered(0), m_lBatches(0), m_lLargestBatch(0), m_dwFirstDelivery(0) {}
+
+  STDMETHODIMP ReceiveMultiple(IMediaSample **pSamples, long nSamples, long *nSamplesProcessed)
+  {
+    if (m_lDelivered == 0)
+      m_dwFirstDelivery = timeGetTime();
+    m_lBatches++;
+    if (nSamples > m_lLargestBatch)
+      m_lLargestBatch = nSamples;
+    InterlockedExchangeAdd(&m_lDelivered, nSamples);
+    *nSamplesProcessed = nSamples;
+    return S_OK;
+  }
+
+  // Waits up to dwTimeout ms for lCount samples in total
+  BOOL WaitForDelivered(LONG lCount, DWORD dwTimeout)
+  {
+    DWORD dwStart = timeGetTime();
+    while (m_lDelivered < lCount)
+    {
+      if (timeGetTime() - dwStart > dwTimeout)
+        return FALSE;
+      Sleep(1);
+    }
+    return TRUE;
+  }
+};
+
+static CountingPin g_Pin;
+
+
+static DWORD WINAPI ProducerThread(LPVOID pParam)
+{
+  DWORD dwProducer = (DWORD)(INT_PTR)pParam;
+  for (LONG lSample = 0; !g_bStop; lSample = (lSample + 1) & SAMPLE_MASK)
+  {
+    IMediaSample *pSample = NULL;
+    if (FAILED(g_pAllocator->GetBuffer(&pSample, NULL, NULL, 0)))
+    {
+      break;
+    }
+    BYTE *pBuffer = NULL;
+    pSample->GetPointer(&pBuffer);
+    *(DWORD*)pBuffer = (dwProducer << 24) | (DWORD)lSample;
+    pSample->SetActualDataLength(sizeof(DWORD));
+
+    // the sample that used this record before was released long ago. The queue takes over our
+    // reference
+    volatile LONG *plReturned = &g_pReturned[dwProducer][lSample % RECORD_WINDOW];
+    InterlockedExchange(plReturned, 0);
+    g_pQueue->Receive(pSample);
+    InterlockedExchange(plReturned, g_lFlushesBegun + 1);
+  }
+  return 0;
+}
+
+// Flushes the queue as a pin does on a seek, with the producers still running
+static DWORD WINAPI FlushThread(LPVOID pParam)
+{
+  while (!g_bStop)
+  {
+    Sleep(2);
+    InterlockedIncrement(&g_lFlushesBegun);
+    g_pQueue->BeginFlush();
+    g_pQueue->EndFlush();
+  }
+  return 0;
+}
+
+
+// Adaptive batching with a byte limit that is never reached: one sample queued to an idle queue must
+// still go out when it is dwMaxDelay old, and a burst must go out in batches of at most lBatchSize.
+// The margin allows for the thread being scheduled late; a lost wake-up never delivers at all
+static void RunBatchDelayTest()
+{
+  const LONG lBatchSize = 16;
+  const DWORD dwMaxDelay = 10;
+  const DWORD dwMargin = 100;
+
+  BatchPin pin;
+  HRESULT hr = S_OK;
+  COutputQueue *pQueue = new COutputQueue(&pin, &hr, FALSE, TRUE, lBatchSize, FALSE, 2 * lBatchSize);
+  CHECK(SUCCEEDED(hr));
+  CHECK(pQueue->SetBatchPolicy(0x7FFFFFFF, dwMaxDelay) == S_OK);
+
+  // let the thread park with an empty batch
+  Sleep(50);
+
+  IMediaSample *pSample = NULL;
+  CHECK(SUCCEEDED(g_pAllocator->GetBuffer(&pSample, NULL, NULL, 0)));
+  pSample->SetActualDataLength(1);
+  DWORD dwQueued = timeGetTime();
+  pQueue->Receive(pSample);
+
+  CHECK(pin.WaitForDelivered(1, dwMaxDelay + dwMargin));
+  DWORD dwLatency = pin.m_dwFirstDelivery - dwQueued;
+  printf("single sample delivered after %lu ms (limit %lu ms)\n", dwLatency, dwMaxDelay);
+  CHECK(pin.m_lDelivered == 1 && dwLatency <= dwMaxDelay + dwMargin);
+
+  // a burst of more samples than a batch holds
+  const LONG lBurst = 3 * lBatchSize + 5;
+  for (LONG i = 0; i < lBurst; i++)
+  {
+    CHECK(SUCCEEDED(g_pAllocator->GetBuffer(&pSample, NULL, NULL, 0)));
+    pSample->SetActualDataLength(1);
+    pQueue->Receive(pSample);
+  }
+  CHECK(pin.WaitForDelivered(1 + lBurst, 10 * (dwMaxDelay + dwMargin)));
+
+  LONG lBatches, lSamples;
+  DWORD dwAvgDelay;
+  pQueue->GetBatchStatistics(&lBatches, &lSamples, &dwAvgDelay);
+  printf("%ld samples in %ld batches, largest %ld, average delay %lu ms\n", lSamples, lBatches,
+    pin.m_lLargestBatch, dwAvgDelay);
+  CHECK(lSamples == 1 + lBurst);
+  CHECK(lSamples == pin.m_lDelivered);
+  CHECK(lBatches == pin.m_lBatches);
+  CHECK(lBatches >= 1 + (lBurst + lBatchSize - 1) / lBatchSize);
+  CHECK(pin.m_lLargestBatch <= lBatchSize);
+  CHECK(dwAvgDelay <= dwMaxDelay + dwMargin);
+
+  delete pQueue;
+}
+
+
+int main(int argc, char *argv[])
+{
+  int seconds = (argc > 1) ? atoi(argv[1]) : 5;
+  int producers = (argc > 2) ? atoi(argv[2]) : 4;
+  if (seconds <= 0 || producers <= 0 || producers > MAX_PRODUCERS)
+  {
+    printf("Usage: OutputQueueStress [seconds] [producers]\n");
+    return 1;
+  }
+
+  CoInitializeEx(NULL, COINIT_MULTITHREADED);
+
+  HRESULT hr = S_OK;
+  CMemAllocator *pMemAllocator = new CMemAllocator(NAME("OutputQueueStress"), NULL, &hr);
+  pMemAllocator->NonDelegatingQueryInterface(IID_IMemAllocator, (void**)&g_pAllocator);
+  ALLOCATOR_PROPERTIES props = { g_cBuffers, 64, 1, 0 };
+  ALLOCATOR_PROPERTIES actual;
+  CHECK(SUCCEEDED(g_pAllocator->SetProperties(&props, &actual)));
+  CHECK(SUCCEEDED(g_pAllocator->Commit()));
+
+  timeBeginPeriod(1);
+  RunBatchDelayTest();
+
+  // a ring of 8 slots with batches of 4, so the producers keep waiting for room
+  g_pQueue = new COutputQueue(&g_Pin, &hr, FALSE, TRUE, 4, FALSE, 8);
+  CHECK(SUCCEEDED(hr));
+
+  for (int p = 0; p < producers; p++)
+  {
+    g_pReturned[p] = new LONG[RECORD_WINDOW];
+    ZeroMemory((void*)g_pReturned[p], RECORD_WINDOW * sizeof(LONG));
+    g_lLast[p] = SAMPLE_MASK;
+  }
+
+  HANDLE ahThreads[MAX_PRODUCERS + 1];
+  for (int p = 0; p < producers; p++)
+  {
+    ahThreads[p] = CreateThread(NULL, 0, ProducerThread, (LPVOID)(INT_PTR)p, 0, NULL);
+  }
+  ahThreads[producers] = CreateThread(NULL, 0, FlushThread, NULL, 0, NULL);
+
+  LONG lLastDelivered = 0;
+  for (int s = 0; s < seconds; s++)
+  {
+    Sleep(1000);
+    LONG lDelivered = g_lDelivered;
+    printf("%d s: %ld delivered, %ld flushes\n", s + 1, lDelivered, g_lFlushesBegun);
+    CHECK(lDelivered != lLastDelivered);
+    lLastDelivered = lDelivered;
+  }
+
+  InterlockedExchange(&g_bStop, TRUE);
+  DWORD dwWait = WaitForMultipleObjects(producers + 1, ahThreads, TRUE, 10000);
+  CHECK(dwWait != WAIT_TIMEOUT);
+  if (dwWait == WAIT_TIMEOUT)
+  {
+    // threads are still using the queue
+    return TestResult();
+  }
+  for (int p = 0; p <= producers; p++)
+  {
+    CloseHandle(ahThreads[p]);
+  }
+
+  // the destructor waits for the thread, which releases whatever is left
+  delete g_pQueue;
+
+  CHECK(g_lLate == 0);
+  CHECK(g_lOutOfOrder == 0);
+
+  // every sample is back
+  IMediaSample *apSamples[g_cBuffers];
+  for (int i = 0; i < g_cBuffers; i++)
+  {
+    CHECK(SUCCEEDED(g_pAllocator->GetBuffer(&apSamples[i], NULL, NULL, AM_GBF_NOWAIT)));
+  }
+  for (int i = 0; i < g_cBuffers; i++)
+  {
+    if (apSamples[i])
+      apSamples[i]->Release();
+  }
+  g_pAllocator->Decommit();
+  g_pAllocator->Release();
+
+  for (int p = 0; p < producers; p++)
+  {
+    delete [] g_pReturned[p];
+  }
+  timeEndPeriod(1);
+  CoUninitialize();
+
+  printf("%ld delivered, %ld late, %ld out of order, %ld flushes\n", g_lDelivered, g_lLate,
+    g_lOutOfOrder, g_lFlushesBegun);
+  return TestResult();
+}
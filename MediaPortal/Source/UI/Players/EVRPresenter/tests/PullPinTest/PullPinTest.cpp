@@ -0,0 +1,515 @@
+// Copyright (C) 2007-2014 Team MediaPortal
+// http://www.team-mediaportal.com
+//
+// This file is part of MediaPortal 2
+//
+// MediaPortal 2 is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// MediaPortal 2 is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with MediaPortal 2. If not, see <http://www.gnu.org/licenses/>.
+
+// Tests the pipelined reads of CPullPin against a reader with injected latency, and reports the
+// throughput and the time the pull thread waited for reads.
+//
+// Usage: PullPinTest [MB per run]
+//
+// The stub reader completes each request after a latency of its own, so requests complete out of
+// order. The pin must deliver the samples in file order, contiguous and with the right data, never
+// have more requests outstanding than its window, grow the window while the reader is slow and shrink
+// it again once the reads are ready in time. Returns the number of failed checks.
+
+#include <streams.h>
+#include <pullpin.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <deque>
+#include <vector>
+
+#include "../TestCommon.h"
+
+
+static const LONG cbBuffer = 64 * 1024;
+static const LONG cBuffers = PULLPIN_MAX_READAHEAD;
+
+// The byte at a file position
+static BYTE DataAt(LONGLONG llPos)
+{
+  return (BYTE)(llPos ^ (llPos >> 8) ^ (llPos >> 16));
+}
+
+
+// How the reader answers request i: the first cSlowReads after dwLatency ms, every third of them
+// dwJitter ms later still, which overtakes it with the next two. The rest complete in Request.
+struct ReaderLatency
+{
+  LONG  cSlowReads;
+  DWORD dwLatency;
+  DWORD dwJitter;
+
+  DWORD Of(LONG lRequest) const
+  {
+    if (lRequest >= cSlowReads)
+    {
+      return 0;
+    }
+    return dwLatency + ((lRequest % 3 == 0) ? dwJitter : 0);
+  }
+};
+
+// An IAsyncReader on a file of the given length whose data is DataAt(). A worker thread completes the
+// requests when they are due; a flush cancels the ones still pending.
+class StubReader : public IAsyncReader
+{
+public:
+  StubReader(LONGLONG llLength, const ReaderLatency& latency) :
+    m_llLength(llLength),
+    m_Latency(latency),
+    m_lRequests(0),
+    m_lOutstanding(0),
+    m_lMaxOutstanding(0),
+    m_lOutOfOrder(0),
+    m_lLastCompleted(-1),
+    m_bFlushing(FALSE),
+    m_bExit(FALSE)
+  {
+    InitializeCriticalSection(&m_Lock);
+    InitializeConditionVariable(&m_cvWork);
+    InitializeConditionVariable(&m_cvDone);
+    m_hThread = CreateThread(NULL, 0, WorkerThread, this, 0, NULL);
+  }
+
+  ~StubReader()
+  {
+    EnterCriticalSection(&m_Lock);
+    m_bExit = TRUE;
+    WakeAllConditionVariable(&m_cvWork);
+    LeaveCriticalSection(&m_Lock);
+    WaitForSingleObject(m_hThread, INFINITE);
+    CloseHandle(m_hThread);
+    DeleteCriticalSection(&m_Lock);
+  }
+
+  LONG MaxOutstanding() const { return m_lMaxOutstanding; }
+  LONG OutOfOrder() const { return m_lOutOfOrder; }
+
+  STDMETHODIMP QueryInterface(REFIID riid, void **ppv)
+  {
+    if (riid == IID_IUnknown || riid == IID_IAsyncReader)
+    {
+      *ppv = static_cast<IAsyncReader*>(this);
+      return S_OK;
+    }
+    *ppv = NULL;
+    return E_NOINTERFACE;
+  }
+  STDMETHODIMP_(ULONG) AddRef() { return 2; }
+  STDMETHODIMP_(ULONG) Release() { return 1; }
+
+  STDMETHODIMP RequestAllocator(IMemAllocator *pPreferred, ALLOCATOR_PROPERTIES *pProps, IMemAllocator **ppActual)
+  {
+    HRESULT hr = S_OK;
+    CMemAllocator *pAlloc = new CMemAllocator(NAME("PullPinTest allocator"), NULL, &hr);
+    if (pAlloc == NULL)
+    {
+      return E_OUTOFMEMORY;
+    }
+    pAlloc->AddRef();
+
+    ALLOCATOR_PROPERTIES request = { cBuffers, cbBuffer, 1, 0 };
+    ALLOCATOR_PROPERTIES actual;
+    hr = pAlloc->SetProperties(&request, &actual);
+    if (FAILED(hr))
+    {
+      pAlloc->Release();
+      return hr;
+    }
+    *ppActual = pAlloc;
+    return S_OK;
+  }
+
+  STDMETHODIMP Request(IMediaSample *pSample, DWORD_PTR dwUser)
+  {
+    ReaderLock lock(this);
+    if (m_bFlushing)
+    {
+      return VFW_E_WRONG_STATE;
+    }
+
+    DWORD dwLatency = m_Latency.Of(m_lRequests);
+    Read read = { pSample, dwUser, timeGetTime() + dwLatency };
+    if (dwLatency == 0)
+    {
+      Complete(read);
+    }
+    else
+    {
+      m_Pending.push_back(read);
+      WakeAllConditionVariable(&m_cvWork);
+    }
+    m_lRequests++;
+    if (++m_lOutstanding > m_lMaxOutstanding)
+    {
+      m_lMaxOutstanding = m_lOutstanding;
+    }
+    return S_OK;
+  }
+
+  STDMETHODIMP WaitForNext(DWORD dwTimeout, IMediaSample **ppSample, DWORD_PTR *pdwUser)
+  {
+    ReaderLock lock(this);
+    *ppSample = NULL;
+    for (;;)
+    {
+      if (!m_Completed.empty())
+      {
+        *ppSample = m_Completed.front().pSample;
+        *pdwUser = m_Completed.front().dwUser;
+        m_Completed.pop_front();
+        m_lOutstanding--;
+        return m_bFlushing ? VFW_E_WRONG_STATE : S_OK;
+      }
+      if (m_bFlushing)
+      {
+        return VFW_E_WRONG_STATE;
+      }
+      if (dwTimeout == 0)
+      {
+        return VFW_E_TIMEOUT;
+      }
+      SleepConditionVariableCS(&m_cvDone, &m_Lock, INFINITE);
+    }
+  }
+
+  STDMETHODIMP SyncReadAligned(IMediaSample *pSample)
+  {
+    ReaderLock lock(this);
+    Fill(pSample);
+    return S_OK;
+  }
+
+  STDMETHODIMP SyncRead(LONGLONG llPosition, LONG lLength, BYTE *pBuffer)
+  {
+    for (LONG i = 0; i < lLength; i++)
+    {
+      pBuffer[i] = DataAt(llPosition + i);
+    }
+    return S_OK;
+  }
+
+  STDMETHODIMP Length(LONGLONG *pTotal, LONGLONG *pAvailable)
+  {
+    *pTotal = *pAvailable = m_llLength;
+    return S_OK;
+  }
+
+  STDMETHODIMP BeginFlush()
+  {
+    ReaderLock lock(this);
+    m_bFlushing = TRUE;
+    while (!m_Pending.empty())
+    {
+      m_Completed.push_back(m_Pending.back());
+      m_Pending.pop_back();
+    }
+    WakeAllConditionVariable(&m_cvDone);
+    return S_OK;
+  }
+
+  STDMETHODIMP EndFlush()
+  {
+    ReaderLock lock(this);
+    m_bFlushing = FALSE;
+    return S_OK;
+  }
+
+private:
+  struct Read
+  {
+    IMediaSample  *pSample;
+    DWORD_PTR     dwUser;
+    DWORD         dwDue;
+  };
+
+  // Locks the reader state for the scope
+  class ReaderLock
+  {
+  public:
+    ReaderLock(StubReader *pReader) : m_pLock(&pReader->m_Lock) { EnterCriticalSection(m_pLock); }
+    ~ReaderLock() { LeaveCriticalSection(m_pLock); }
+  private:
+    CRITICAL_SECTION *m_pLock;
+  };
+
+  void Fill(IMediaSample *pSample)
+  {
+    REFERENCE_TIME tStart, tStop;
+    pSample->GetTime(&tStart, &tStop);
+    LONGLONG llPos = tStart / UNITS;
+    LONG lLength = (LONG)(min(tStop / UNITS, m_llLength) - llPos);
+    BYTE *pData = NULL;
+    pSample->GetPointer(&pData);
+    SyncRead(llPos, lLength, pData);
+    pSample->SetActualDataLength(lLength);
+  }
+
+  void Complete(const Read& read)
+  {
+    if ((LONG)read.dwUser < m_lLastCompleted)
+    {
+      m_lOutOfOrder++;
+    }
+    m_lLastCompleted = (LONG)read.dwUser;
+    Fill(read.pSample);
+    m_Completed.push_back(read);
+    WakeAllConditionVariable(&m_cvDone);
+  }
+
+  static DWORD WINAPI WorkerThread(LPVOID pv)
+  {
+    StubReader *pReader = (StubReader *)pv;
+    ReaderLock lock(pReader);
+    while (!pReader->m_bExit)
+    {
+      if (pReader->m_Pending.empty())
+      {
+        SleepConditionVariableCS(&pReader->m_cvWork, &pReader->m_Lock, INFINITE);
+        continue;
+      }
+
+      size_t iFirst = 0;
+      for (size_t i = 1; i < pReader->m_Pending.size(); i++)
+      {
+        if ((LONG)(pReader->m_Pending[i].dwDue - pReader->m_Pending[iFirst].dwDue) < 0)
+        {
+          iFirst = i;
+        }
+      }
+      LONG lWait = (LONG)(pReader->m_Pending[iFirst].dwDue - timeGetTime());
+      if (lWait > 0)
+      {
+        SleepConditionVariableCS(&pReader->m_cvWork, &pReader->m_Lock, lWait);
+        continue;
+      }
+
+      Read read = pReader->m_Pending[iFirst];
+      pReader->m_Pending.erase(pReader->m_Pending.begin() + iFirst);
+      pReader->Complete(read);
+    }
+    return 0;
+  }
+
+  LONGLONG            m_llLength;
+  ReaderLatency       m_Latency;
+  LONG                m_lRequests;
+  LONG                m_lOutstanding;       // Requested and not collected with WaitForNext
+  LONG                m_lMaxOutstanding;
+  LONG                m_lOutOfOrder;        // Completions before one that was requested earlier
+  LONG                m_lLastCompleted;
+  BOOL                m_bFlushing;
+  BOOL                m_bExit;
+  std::vector<Read>   m_Pending;
+  std::deque<Read>    m_Completed;
+  CRITICAL_SECTION    m_Lock;
+  CONDITION_VARIABLE  m_cvWork;
+  CONDITION_VARIABLE  m_cvDone;
+  HANDLE              m_hThread;
+};
+
+
+// Checks what it receives and keeps track of the window
+class TestPullPin : public CPullPin
+{
+public:
+  TestPullPin() :
+    m_hDone(CreateEvent(NULL, TRUE, FALSE, NULL)),
+    m_llNext(0),
+    m_lSamples(0),
+    m_lBadSamples(0),
+    m_lMaxDepth(0),
+    m_hrError(S_OK)
+  {
+  }
+
+  ~TestPullPin()
+  {
+    CloseHandle(m_hDone);
+  }
+
+  HRESULT Receive(IMediaSample *pSample)
+  {
+    REFERENCE_TIME tStart, tStop;
+    BYTE *pData = NULL;
+    pSample->GetPointer(&pData);
+    BOOL bGood = (pSample->GetTime(&tStart, &tStop) == S_OK) && (tStart == m_llNext * UNITS) &&
+      (pSample->GetActualDataLength() == (LONG)(tStop / UNITS - m_llNext)) &&
+      ((m_lSamples == 0) == (pSample->IsDiscontinuity() == S_OK));
+    for (LONG i = 0; bGood && i < pSample->GetActualDataLength(); i++)
+    {
+      bGood = (pData[i] == DataAt(m_llNext + i));
+    }
+    if (!bGood)
+    {
+      m_lBadSamples++;
+    }
+    m_llNext = tStop / UNITS;
+    m_lSamples++;
+
+    LONG lDepth;
+    LONGLONG llBytes;
+    DWORD dwTime, dwStallTime;
+    GetReadAheadStatistics(&lDepth, &llBytes, &dwTime, &dwStallTime);
+    if (lDepth > m_lMaxDepth)
+    {
+      m_lMaxDepth = lDepth;
+    }
+    return S_OK;
+  }
+
+  HRESULT EndOfStream()
+  {
+    SetEvent(m_hDone);
+    return S_OK;
+  }
+
+  void OnError(HRESULT hr)
+  {
+    m_hrError = hr;
+    SetEvent(m_hDone);
+  }
+
+  HRESULT BeginFlush() { return S_OK; }
+  HRESULT EndFlush() { return S_OK; }
+
+  HANDLE    m_hDone;
+  LONGLONG  m_llNext;         // File position of the next sample
+  LONG      m_lSamples;
+  LONG      m_lBadSamples;    // Out of order, not contiguous or with the wrong data
+  LONG      m_lMaxDepth;      // Largest window seen
+  HRESULT   m_hrError;
+};
+
+
+struct RunResult
+{
+  LONG      lMaxDepth;
+  LONG      lFinalDepth;
+  LONG      lMaxOutstanding;
+  LONG      lOutOfOrder;
+  double    dMBps;
+  DWORD     dwStallTime;
+};
+
+// Pulls a whole file through the pin and checks what arrived
+static RunResult Run(LONGLONG llLength, const ReaderLatency& latency, LONG lMaxReadAhead)
+{
+  RunResult result = { 0 };
+  StubReader reader(llLength, latency);
+  TestPullPin pin;
+
+  CHECK(pin.SetReadAhead(lMaxReadAhead) == S_OK);
+  CHECK(pin.Connect(&reader, NULL, FALSE) == S_OK);
+
+  TestTimer timer;
+  CHECK(pin.Active() == S_OK);
+  CHECK(WaitForSingleObject(pin.m_hDone, 60000) == WAIT_OBJECT_0);
+  double ns = timer.ElapsedNs();
+
+  CHECK(pin.m_hrError == S_OK);
+  CHECK(pin.m_lBadSamples == 0);
+  CHECK(pin.m_llNext == llLength);
+  CHECK(pin.m_lSamples == (LONG)((llLength + cbBuffer - 1) / cbBuffer));
+
+  LONGLONG llBytes;
+  DWORD dwTime;
+  CHECK(pin.GetReadAheadStatistics(&result.lFinalDepth, &llBytes, &dwTime, &result.dwStallTime) == S_OK);
+  CHECK(llBytes == llLength);
+
+  pin.Inactive();
+  pin.Disconnect();
+
+  result.lMaxDepth = pin.m_lMaxDepth;
+  result.lMaxOutstanding = reader.MaxOutstanding();
+  result.lOutOfOrder = reader.OutOfOrder();
+  result.dMBps = ns > 0 ? llLength / (1024.0 * 1024.0) / (ns / 1e9) : 0;
+  return result;
+}
+
+
+// A slow reader that completes out of order: delivered in order, the window grows up to the limit and
+// no further.
+static void TestOutOfOrder()
+{
+  const LONGLONG llLength = 200 * cbBuffer + 1000;
+  ReaderLatency latency = { LONG_MAX, 2, 6 };
+
+  RunResult result = Run(llLength, latency, 0);
+  CHECK(result.lOutOfOrder > 0);
+  CHECK(result.lMaxDepth > 2);
+  CHECK(result.lMaxDepth <= cBuffers);
+  CHECK(result.lMaxOutstanding <= result.lMaxDepth);
+
+  result = Run(llLength, latency, 4);
+  CHECK(result.lMaxDepth <= 4);
+  CHECK(result.lMaxOutstanding <= 4);
+
+  result = Run(llLength, latency, 1);
+  CHECK(result.lMaxOutstanding == 1);
+  CHECK(result.lOutOfOrder == 0);
+}
+
+// The reader is slow for the first reads, then every read is ready when the pin asks for it. The
+// window grows, then shrinks by one every PULLPIN_SHRINK_AFTER reads back to 2.
+static void TestGrowAndShrink()
+{
+  const LONG cSlowReads = 100;
+  const LONGLONG llLength = (cSlowReads + PULLPIN_SHRINK_AFTER * (PULLPIN_MAX_READAHEAD + 1)) * (LONGLONG)cbBuffer;
+  ReaderLatency latency = { cSlowReads, 3, 3 };
+
+  RunResult result = Run(llLength, latency, 0);
+  CHECK(result.lMaxDepth > 2);
+  CHECK(result.lFinalDepth == 2);
+}
+
+
+int main(int argc, char *argv[])
+{
+  int cMB = (argc > 1) ? atoi(argv[1]) : 16;
+  if (cMB <= 0)
+  {
+    printf("Usage: PullPinTest [MB per run]\n");
+    return 1;
+  }
+
+  timeBeginPeriod(1);
+
+  TestOutOfOrder();
+  TestGrowAndShrink();
+
+  // Timing depends on the machine and the timer resolution, so it is reported rather than checked
+  const DWORD latencies[] = { 0, 1, 4 };
+  const LONG windows[] = { 1, 2, 4, 16 };
+  printf("%10s %8s %10s %12s %10s\n", "latency ms", "window", "MB/s", "stalled ms", "max window");
+  for (DWORD i = 0; i < sizeof(latencies) / sizeof(latencies[0]); i++)
+  {
+    for (DWORD j = 0; j < sizeof(windows) / sizeof(windows[0]); j++)
+    {
+      ReaderLatency latency = { LONG_MAX, latencies[i], latencies[i] };
+      RunResult result = Run((LONGLONG)cMB * 1024 * 1024, latency, windows[j]);
+      printf("%10lu %8ld %10.1f %12lu %10ld\n", latencies[i], windows[j], result.dMBps, result.dwStallTime,
+        result.lMaxDepth);
+    }
+  }
+
+  timeEndPeriod(1);
+
+  return TestResult();
+}
@@ -0,0 +1,191 @@
+// Copyright (C) 2007-2014 Team MediaPortal
+// http://www.team-mediaportal.com
+//
+// This file is part of MediaPortal 2
+//
+// MediaPortal 2 is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// MediaPortal 2 is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with MediaPortal 2. If not, see <http://www.gnu.org/licenses/>.
+
+// Stress test of the lock-free CQueue ring. Several producers and consumers share a queue of four
+// slots, so the ring wraps all the time and both sides keep parking and waking each other.
+//
+// Usage: QueueStress [items per producer] [producers] [consumers]
+//
+// Every item must arrive exactly once, a consumer must see the items of one producer in the order
+// they were put, and the run must not hang. Returns the number of failed checks.
+
+#include <streams.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../TestCommon.h"
+
+
+// An item is the producer in the high byte and its sequence number in the rest
+static const DWORD ITEM_STOP = 0xFFFFFFFF;
+static const int MAX_PRODUCERS = 16;
+static const int MAX_CONSUMERS = 16;
+
+static CQueue<DWORD> *g_pQueue = NULL;
+static int g_Items = 0;
+static volatile LONG *g_pReceived[MAX_PRODUCERS];
+static volatile LONG g_lOutOfOrder = 0;
+static volatile LONG g_lBadItems = 0;
+
+
+// Producers with an even index use the blocking put, the others poll with the non-blocking one, so
+// both paths race with each other.
+static DWORD WINAPI ProducerThread(LPVOID pParam)
+{
+  DWORD dwProducer = (DWORD)(INT_PTR)pParam;
+  for (int i = 0; i < g_Items; i++)
+  {
+    DWORD dwItem = (dwProducer << 24) | (DWORD)i;
+    if (dwProducer % 2 == 0)
+    {
+      g_pQueue->PutQueueObject(dwItem);
+    }
+    else
+    {
+      while (!g_pQueue->TryPutQueueObject(dwItem))
+      {
+        Sleep(0);
+      }
+    }
+  }
+  return 0;
+}
+
+static DWORD WINAPI ConsumerThread(LPVOID pParam)
+{
+  int aLast[MAX_PRODUCERS];
+  for (int p = 0; p < MAX_PRODUCERS; p++)
+  {
+    aLast[p] = -1;
+  }
+
+  for (;;)
+  {
+    DWORD dwItem = g_pQueue->GetQueueObject();
+    if (dwItem == ITEM_STOP)
+    {
+      break;
+    }
+    DWORD dwProducer = dwItem >> 24;
+    int i = (int)(dwItem & 0xFFFFFF);
+    if (dwProducer >= MAX_PRODUCERS || g_pReceived[dwProducer] == NULL || i >= g_Items)
+    {
+      InterlockedIncrement(&g_lBadItems);
+      continue;
+    }
+    if (i <= aLast[dwProducer])
+    {
+      InterlockedIncrement(&g_lOutOfOrder);
+    }
+    aLast[dwProducer] = i;
+
+    InterlockedIncrement(&g_pReceived[dwProducer][i]);
+  }
+  return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+  int items = (argc > 1) ? atoi(argv[1]) : 250000;
+  int producers = (argc > 2) ? atoi(argv[2]) : 4;
+  int consumers = (argc > 3) ? atoi(argv[3]) : 4;
+  if (items <= 0 || items > 0xFFFFFF || producers <= 0 || producers > MAX_PRODUCERS ||
+    consumers <= 0 || consumers > MAX_CONSUMERS)
+  {
+    printf("Usage: QueueStress [items per producer] [producers] [consumers]\n");
+    return 1;
+  }
+
+  g_Items = items;
+  g_pQueue = new CQueue<DWORD>(4);
+  for (int p = 0; p < producers; p++)
+  {
+    g_pReceived[p] = new LONG[items];
+    ZeroMemory((void*)g_pReceived[p], items * sizeof(LONG));
+  }
+
+  LARGE_INTEGER liFrequency, liStart, liEnd;
+  QueryPerformanceFrequency(&liFrequency);
+  QueryPerformanceCounter(&liStart);
+
+  HANDLE ahProducers[MAX_PRODUCERS];
+  HANDLE ahConsumers[MAX_CONSUMERS];
+  for (int c = 0; c < consumers; c++)
+  {
+    ahConsumers[c] = CreateThread(NULL, 0, ConsumerThread, NULL, 0, NULL);
+  }
+  for (int p = 0; p < producers; p++)
+  {
+    ahProducers[p] = CreateThread(NULL, 0, ProducerThread, (LPVOID)(INT_PTR)p, 0, NULL);
+  }
+
+  // a lost wake-up leaves a thread parked for good
+  DWORD dwWait = WaitForMultipleObjects(producers, ahProducers, TRUE, 60000);
+  CHECK(dwWait != WAIT_TIMEOUT);
+  for (int c = 0; c < consumers; c++)
+  {
+    g_pQueue->PutQueueObject(ITEM_STOP);
+  }
+  dwWait = WaitForMultipleObjects(consumers, ahConsumers, TRUE, 60000);
+  CHECK(dwWait != WAIT_TIMEOUT);
+
+  QueryPerformanceCounter(&liEnd);
+
+  if (dwWait == WAIT_TIMEOUT)
+  {
+    // threads are still using the queue
+    return TestResult();
+  }
+
+  for (int p = 0; p < producers; p++)
+  {
+    CloseHandle(ahProducers[p]);
+  }
+  for (int c = 0; c < consumers; c++)
+  {
+    CloseHandle(ahConsumers[c]);
+  }
+
+  CHECK(g_lBadItems == 0);
+  CHECK(g_lOutOfOrder == 0);
+  int lost = 0, duplicated = 0;
+  for (int p = 0; p < producers; p++)
+  {
+    for (int i = 0; i < items; i++)
+    {
+      if (g_pReceived[p][i] == 0)
+        lost++;
+      else if (g_pReceived[p][i] > 1)
+        duplicated++;
+    }
+    delete [] g_pReceived[p];
+  }
+  CHECK(lost == 0);
+  CHECK(duplicated == 0);
+
+  DWORD dwItem;
+  CHECK(!g_pQueue->TryGetQueueObject(&dwItem));
+  delete g_pQueue;
+
+  double seconds = (double)(liEnd.QuadPart - liStart.QuadPart) / liFrequency.QuadPart;
+  printf("%d items through a 4 slot queue in %.2f s, %.0f ns per item\n", items * producers, seconds,
+    seconds * 1e9 / ((double)items * producers));
+  printf("%d lost, %d duplicated\n", lost, duplicated);
+  return TestResult();
+}
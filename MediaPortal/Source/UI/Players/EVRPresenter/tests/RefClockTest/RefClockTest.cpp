@@ -0,0 +1,259 @@
+// Copyright (C) 2007-2014 Team MediaPortal
+// http://www.team-mediaportal.com
+//
+// This file is part of MediaPortal 2
+//
+// MediaPortal 2 is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// MediaPortal 2 is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with MediaPortal 2. If not, see <http://www.gnu.org/licenses/>.
+
+// Tests how CBaseReferenceClock applies SetTimeDelta. The clock runs on a fake CClockCounter that only
+// moves when the test advances it, so the private time can be checked to the 100 ns unit.
+//
+// Usage: RefClockTest
+//
+// Corrections up to MAX_SLEW_DELTA are slewed in at 1/SLEW_RATE_DIVISOR of the elapsed time, the rest
+// of a larger one is applied at once. GetTime must never go backwards, also when the clock is set back.
+// Returns the number of failed checks.
+
+#include <streams.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../TestCommon.h"
+
+
+// The fake counter counts in reference time units. Defining both methods here keeps the linker from
+// taking the performance counter from the base classes library.
+static LONGLONG g_llCounter = 1000000000;
+
+LONGLONG CClockCounter::Now()
+{
+  return g_llCounter;
+}
+
+LONGLONG CClockCounter::Frequency()
+{
+  return UNITS;
+}
+
+
+static const REFERENCE_TIME ONE_MS = UNITS / MILLISECONDS;
+
+// A clock with a schedule of its own, so it does not start an advise thread
+class TestClock : public CBaseReferenceClock
+{
+public:
+  TestClock(CAMSchedule *pSchedule, HRESULT *phr) :
+    CBaseReferenceClock(NAME("TestClock"), NULL, phr, pSchedule)
+  {
+  }
+
+  ~TestClock()
+  {
+  }
+};
+
+// Reads GetTime and checks that it never goes backwards
+class TimeReader
+{
+public:
+  TimeReader(TestClock& clock) : m_Clock(clock), m_rtLast(0), m_cHeld(0)
+  {
+  }
+
+  REFERENCE_TIME Read()
+  {
+    REFERENCE_TIME rtTime = 0;
+    HRESULT hr = m_Clock.GetTime(&rtTime);
+    CHECK(hr == S_OK || hr == S_FALSE);
+    CHECK(rtTime >= m_rtLast);
+    if (hr == S_FALSE)
+    {
+      CHECK(rtTime == m_rtLast);
+      m_cHeld++;
+    }
+    m_rtLast = rtTime;
+    return rtTime;
+  }
+
+  int Held() const { return m_cHeld; }
+
+private:
+  TestClock&      m_Clock;
+  REFERENCE_TIME  m_rtLast;
+  int             m_cHeld;      // Reads that returned the previous time
+};
+
+static REFERENCE_TIME Clamp(REFERENCE_TIME rt, REFERENCE_TIME rtLimit)
+{
+  return rt > rtLimit ? rtLimit : (rt < -rtLimit ? -rtLimit : rt);
+}
+
+
+// Applies one correction and follows the clock in 1 ms counter steps until it has converged. The part
+// up to MAX_SLEW_DELTA is slewed in at elapsed / SLEW_RATE_DIVISOR, the rest is a jump.
+static void RunDelta(REFERENCE_TIME rtDelta)
+{
+  HANDLE hEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+  CAMSchedule *pSchedule = new CAMSchedule(hEvent);
+  HRESULT hr = S_OK;
+  TestClock *pClock = new TestClock(pSchedule, &hr);
+  CHECK(SUCCEEDED(hr));
+
+  TimeReader reader(*pClock);
+  g_llCounter += 100 * ONE_MS;
+  reader.Read();
+
+  const REFERENCE_TIME rtStart = pClock->GetPrivateTime();
+  const REFERENCE_TIME rtSlew = Clamp(rtDelta, MAX_SLEW_DELTA);
+  const REFERENCE_TIME rtJump = rtDelta - rtSlew;
+  CHECK(pClock->SetTimeDelta(rtDelta) == S_OK);
+  CHECK(pClock->GetPrivateTime() == rtStart + rtJump);
+
+  // Converged after SLEW_RATE_DIVISOR times the slewed part
+  const REFERENCE_TIME rtConverge = (rtSlew > 0 ? rtSlew : -rtSlew) * SLEW_RATE_DIVISOR;
+  REFERENCE_TIME rtPrev = pClock->GetPrivateTime();
+  for (REFERENCE_TIME rtElapsed = ONE_MS; rtElapsed <= rtConverge + 10 * ONE_MS; rtElapsed += ONE_MS)
+  {
+    g_llCounter += ONE_MS;
+    REFERENCE_TIME rtPrivate = pClock->GetPrivateTime();
+    CHECK(rtPrivate == rtStart + rtJump + rtElapsed + Clamp(rtSlew, rtElapsed / SLEW_RATE_DIVISOR));
+
+    // The rate stays within 1/SLEW_RATE_DIVISOR of the counter
+    REFERENCE_TIME rtStep = rtPrivate - rtPrev;
+    CHECK(rtStep >= ONE_MS - ONE_MS / SLEW_RATE_DIVISOR && rtStep <= ONE_MS + ONE_MS / SLEW_RATE_DIVISOR);
+    rtPrev = rtPrivate;
+
+    reader.Read();
+  }
+  CHECK(rtPrev == rtStart + rtConverge + 10 * ONE_MS + rtDelta);
+
+  // Set back by more than a step, GetTime holds until the private time caught up. Slewed back, it
+  // only runs slower.
+  if (rtJump <= -ONE_MS)
+  {
+    CHECK(reader.Held() > 0);
+  }
+  else if (rtJump >= 0)
+  {
+    CHECK(reader.Held() == 0);
+  }
+
+  delete pClock;
+  delete pSchedule;
+  CloseHandle(hEvent);
+}
+
+static void TestDeltas()
+{
+  const REFERENCE_TIME deltas[] =
+  {
+    10 * ONE_MS, -10 * ONE_MS,
+    MAX_SLEW_DELTA, -MAX_SLEW_DELTA,
+    MAX_SLEW_DELTA + 1, -MAX_SLEW_DELTA - 1,
+    200 * ONE_MS, -200 * ONE_MS,
+    3 * UNITS, -3 * UNITS,
+  };
+  for (DWORD i = 0; i < sizeof(deltas) / sizeof(deltas[0]); i++)
+  {
+    RunDelta(deltas[i]);
+  }
+}
+
+// A correction that arrives while another one is slewed in adds to what is left of it, and the sum is
+// limited to MAX_SLEW_DELTA again.
+static void TestAccumulate()
+{
+  HANDLE hEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+  CAMSchedule *pSchedule = new CAMSchedule(hEvent);
+  HRESULT hr = S_OK;
+  TestClock *pClock = new TestClock(pSchedule, &hr);
+
+  const REFERENCE_TIME rtStart = pClock->GetPrivateTime();
+  pClock->SetTimeDelta(30 * ONE_MS);
+  g_llCounter += 16 * ONE_MS;
+  CHECK(pClock->GetPrivateTime() == rtStart + 17 * ONE_MS);
+
+  // 29 ms left and 30 ms more: 9 ms jump, 50 ms to slew
+  pClock->SetTimeDelta(30 * ONE_MS);
+  CHECK(pClock->GetPrivateTime() == rtStart + 26 * ONE_MS);
+  g_llCounter += MAX_SLEW_DELTA * SLEW_RATE_DIVISOR;
+  CHECK(pClock->GetPrivateTime() == rtStart + 16 * ONE_MS + MAX_SLEW_DELTA * SLEW_RATE_DIVISOR + 60 * ONE_MS);
+
+  // Opposite corrections cancel
+  const REFERENCE_TIME rtBefore = pClock->GetPrivateTime();
+  pClock->SetTimeDelta(20 * ONE_MS);
+  pClock->SetTimeDelta(-20 * ONE_MS);
+  g_llCounter += 10 * ONE_MS;
+  CHECK(pClock->GetPrivateTime() == rtBefore + 10 * ONE_MS);
+
+  delete pClock;
+  delete pSchedule;
+  CloseHandle(hEvent);
+}
+
+// Random corrections and counter steps. The correction still pending, the difference between the
+// counter plus all corrections and the private time, never exceeds MAX_SLEW_DELTA, GetTime never goes
+// backwards, and once the corrections stop the clock converges on the sum.
+static void TestRandomWalk()
+{
+  HANDLE hEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+  CAMSchedule *pSchedule = new CAMSchedule(hEvent);
+  HRESULT hr = S_OK;
+  TestClock *pClock = new TestClock(pSchedule, &hr);
+  TimeReader reader(*pClock);
+
+  const LONGLONG llCounterStart = g_llCounter;
+  const REFERENCE_TIME rtStart = pClock->GetPrivateTime();
+  REFERENCE_TIME rtSum = 0;
+  srand(1);
+  for (int i = 0; i < 20000; i++)
+  {
+    if (rand() % 4 == 0)
+    {
+      REFERENCE_TIME rtDelta = (REFERENCE_TIME)(rand() % 601 - 300) * ONE_MS / 2;
+      pClock->SetTimeDelta(rtDelta);
+      rtSum += rtDelta;
+    }
+    else
+    {
+      REFERENCE_TIME rtPrev = pClock->GetPrivateTime();
+      REFERENCE_TIME rtStep = (rand() % 200) * ONE_MS / 10;
+      g_llCounter += rtStep;
+      REFERENCE_TIME rtAdvance = pClock->GetPrivateTime() - rtPrev;
+      CHECK(rtAdvance >= rtStep - rtStep / SLEW_RATE_DIVISOR - 1 && rtAdvance <= rtStep + rtStep / SLEW_RATE_DIVISOR + 1);
+    }
+
+    REFERENCE_TIME rtPending = rtStart + (g_llCounter - llCounterStart) + rtSum - pClock->GetPrivateTime();
+    CHECK(rtPending >= -MAX_SLEW_DELTA && rtPending <= MAX_SLEW_DELTA);
+    reader.Read();
+  }
+
+  g_llCounter += MAX_SLEW_DELTA * SLEW_RATE_DIVISOR;
+  CHECK(pClock->GetPrivateTime() == rtStart + (g_llCounter - llCounterStart) + rtSum);
+  reader.Read();
+
+  delete pClock;
+  delete pSchedule;
+  CloseHandle(hEvent);
+}
+
+
+int main(int argc, char *argv[])
+{
+  TestDeltas();
+  TestAccumulate();
+  TestRandomWalk();
+
+  return TestResult();
+}
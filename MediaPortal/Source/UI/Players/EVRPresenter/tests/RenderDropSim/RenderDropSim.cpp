@@ -0,0 +1,272 @@
+// Copyright (C) 2007-2014 Team MediaPortal
+// http://www.team-mediaportal.com
+//
+// This file is part of MediaPortal 2
+//
+// MediaPortal 2 is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// MediaPortal 2 is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with MediaPortal 2. If not, see <http://www.gnu.org/licenses/>.
+
+// Simulates the frame dropping of CBaseVideoRenderer: ShouldDrawSampleNow is fed synthetic render
+// cost traces on a simulated clock, with the render cost predicted from the moving average and no
+// hysteresis as before, and from the recent history with several pairs of hysteresis factors.
+//
+// Usage: RenderDropSim [frames per trace]
+//
+// The decoder always has the next frame ready and does not handle quality messages, so the
+// renderer schedules a frame as soon as it has drawn the last one and only it drops frames. For each
+// trace and heuristic the frames dropped, the runs of drops, the changes of mind about whether
+// rendering is the bottleneck and the lateness of the frames drawn are reported. A cheap trace must
+// not drop, an overloaded one must, and with the default factors the renderer must change its mind
+// less often than without hysteresis on a cost near the threshold.
+// Returns the number of failed checks.
+
+#include <streams.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../TestCommon.h"
+
+
+static const REFERENCE_TIME FRAME_TIME = UNITS / 25;
+static const REFERENCE_TIME ONE_MS = UNITS / 1000;
+
+
+// A reference clock the simulation sets
+class SimClock : public IReferenceClock
+{
+public:
+  REFERENCE_TIME m_rtNow;
+
+  SimClock() : m_rtNow(0) {}
+
+  STDMETHODIMP QueryInterface(REFIID riid, void **ppv)
+  {
+    if (riid == IID_IUnknown || riid == IID_IReferenceClock)
+    {
+      *ppv = static_cast<IReferenceClock*>(this);
+      return S_OK;
+    }
+    *ppv = NULL;
+    return E_NOINTERFACE;
+  }
+  STDMETHODIMP_(ULONG) AddRef() { return 2; }
+  STDMETHODIMP_(ULONG) Release() { return 1; }
+
+  STDMETHODIMP GetTime(REFERENCE_TIME *pTime) { *pTime = m_rtNow; return S_OK; }
+  STDMETHODIMP AdviseTime(REFERENCE_TIME baseTime, REFERENCE_TIME streamTime, HEVENT hEvent, DWORD_PTR *pdwAdviseCookie) { return E_NOTIMPL; }
+  STDMETHODIMP AdvisePeriodic(REFERENCE_TIME startTime, REFERENCE_TIME periodTime, HSEMAPHORE hSemaphore, DWORD_PTR *pdwAdviseCookie) { return E_NOTIMPL; }
+  STDMETHODIMP Unadvise(DWORD_PTR dwAdviseCookie) { return E_NOTIMPL; }
+};
+
+
+struct Heuristic
+{
+  const char *pName;
+  BOOL  bAverageOnly;         // predict from m_trRenderAvg, as before PredictRenderTime
+  int   iEnter;
+  int   iLeave;
+};
+
+static const Heuristic heuristics[] =
+{
+  { "average 3x (old)", TRUE,  3, 3 },
+  { "predicted 3x",     FALSE, 3, 3 },
+  { "predicted 2x/3x",  FALSE, 2, 3 },
+  { "predicted 3x/4x",  FALSE, RENDER_BOUND_ENTER, RENDER_BOUND_LEAVE },
+  { "predicted 3x/5x",  FALSE, 3, 5 },
+  { "predicted 4x/5x",  FALSE, 4, 5 },
+};
+static const int OLD = 0;
+static const int DEFAULT = 3;
+
+// A renderer without a window: the simulation draws for it
+class SimRenderer : public CBaseVideoRenderer
+{
+public:
+  LONG m_cBoundChanges;       // changes of m_bRenderBound
+
+  SimRenderer(const Heuristic& heuristic, HRESULT *phr) :
+    CBaseVideoRenderer(GUID_NULL, NAME("RenderDropSim"), NULL, phr),
+    m_cBoundChanges(0),
+    m_bAverageOnly(heuristic.bAverageOnly)
+  {
+    m_iRenderBoundEnter = heuristic.iEnter;
+    m_iRenderBoundLeave = heuristic.iLeave;
+  }
+
+  HRESULT CheckMediaType(const CMediaType *pmt) { return S_OK; }
+  HRESULT DoRenderSample(IMediaSample *pMediaSample) { return S_OK; }
+
+  // Nobody upstream handles quality
+  HRESULT SendQuality(REFERENCE_TIME trLate, REFERENCE_TIME trRealStream) { return E_FAIL; }
+
+  int PredictRenderTime(IMediaSample *pMediaSample)
+  {
+    if (m_bAverageOnly)
+      return m_trRenderAvg;
+    return CBaseVideoRenderer::PredictRenderTime(pMediaSample);
+  }
+
+  HRESULT Schedule(IMediaSample *pMediaSample, REFERENCE_TIME *prtStart, REFERENCE_TIME *prtEnd)
+  {
+    BOOL bWasBound = m_bRenderBound;
+    HRESULT hr = ShouldDrawSampleNow(pMediaSample, prtStart, prtEnd);
+    if (m_bRenderBound != bWasBound)
+      m_cBoundChanges++;
+    return hr;
+  }
+
+private:
+  BOOL m_bAverageOnly;
+};
+
+
+// Render cost traces in ms. Noise comes from a fixed generator, so every heuristic sees the same costs.
+enum TRACE { TRACE_CHEAP, TRACE_NEAR_THRESHOLD, TRACE_HICCUPS, TRACE_BURSTY, TRACE_STEP, TRACE_OVERLOADED, TRACE_COUNT };
+static const char *traceNames[TRACE_COUNT] = { "cheap", "near threshold", "hiccups", "bursty", "step", "overloaded" };
+
+static int Noise(DWORD *pdwSeed, int iRange)
+{
+  *pdwSeed = *pdwSeed * 1103515245 + 12345;
+  return (int)((*pdwSeed >> 16) % (2 * iRange + 1)) - iRange;
+}
+
+static int CostAt(TRACE trace, int iFrame, int cFrames, DWORD *pdwSeed)
+{
+  switch (trace)
+  {
+  case TRACE_CHEAP:
+    return 5 + Noise(pdwSeed, 2);
+  case TRACE_NEAR_THRESHOLD:
+    // a third of the frame time is 13.3 ms
+    return 13 + Noise(pdwSeed, 4);
+  case TRACE_HICCUPS:
+    // the same with the odd frame that takes 100 ms, after which we are late
+    return (iFrame % 50 == 49) ? 100 : 13 + Noise(pdwSeed, 4);
+  case TRACE_BURSTY:
+    return (iFrame % 5 == 0) ? 45 : 8 + Noise(pdwSeed, 1);
+  case TRACE_STEP:
+    return (iFrame >= cFrames / 3 && iFrame < 2 * cFrames / 3) ? 50 : 10 + Noise(pdwSeed, 1);
+  default:
+    return 45 + Noise(pdwSeed, 5);
+  }
+}
+
+
+struct SimResult
+{
+  LONG    cDrawn;
+  LONG    cDropped;
+  LONG    cDropRuns;          // runs of consecutive drops
+  LONG    cBoundChanges;
+  double  dMeanLate;          // ms from the time stamp to the end of drawing
+  double  dMaxLate;
+};
+
+static SimResult Simulate(TRACE trace, const Heuristic& heuristic, int cFrames)
+{
+  SimResult result = { 0 };
+  HRESULT hr = S_OK;
+  SimRenderer *pRenderer = new SimRenderer(heuristic, &hr);
+  pRenderer->AddRef();
+  SimClock clock;
+  CHECK(pRenderer->SetSyncSource(&clock) == S_OK);
+  CMediaSample sample(NAME("RenderDropSim sample"), NULL, &hr, NULL, 0);
+
+  DWORD dwSeed = 1;
+  BOOL bDropping = FALSE;
+  double dTotalLate = 0;
+  for (int i = 0; i < cFrames; i++)
+  {
+    const int iCost = CostAt(trace, i, cFrames, &dwSeed);
+    const REFERENCE_TIME rtStamp = i * FRAME_TIME;
+    REFERENCE_TIME rtStart = rtStamp;
+    REFERENCE_TIME rtEnd = rtStamp + FRAME_TIME;
+
+    hr = pRenderer->Schedule(&sample, &rtStart, &rtEnd);
+    if (FAILED(hr))
+    {
+      result.cDropped++;
+      if (!bDropping)
+        result.cDropRuns++;
+      bDropping = TRUE;
+      continue;
+    }
+    bDropping = FALSE;
+
+    // S_FALSE: wait until it is due
+    if (hr == S_FALSE && rtStart > clock.m_rtNow)
+      clock.m_rtNow = rtStart;
+    clock.m_rtNow += iCost * ONE_MS;
+    pRenderer->RecordRenderTime(iCost * (int)ONE_MS);
+
+    double dLate = (double)(clock.m_rtNow - rtStamp) / ONE_MS;
+    dTotalLate += dLate;
+    if (dLate > result.dMaxLate)
+      result.dMaxLate = dLate;
+    result.cDrawn++;
+  }
+
+  result.cBoundChanges = pRenderer->m_cBoundChanges;
+  result.dMeanLate = result.cDrawn > 0 ? dTotalLate / result.cDrawn : 0;
+
+  pRenderer->SetSyncSource(NULL);
+  pRenderer->Release();
+  return result;
+}
+
+
+int main(int argc, char *argv[])
+{
+  int cFrames = (argc > 1) ? atoi(argv[1]) : 1500;
+  if (cFrames <= 0)
+  {
+    printf("Usage: RenderDropSim [frames per trace]\n");
+    return 1;
+  }
+
+  printf("%-16s %-18s %8s %8s %8s %8s %10s %10s\n", "trace", "heuristic", "drawn", "dropped", "runs",
+    "changes", "late ms", "max ms");
+  const int cHeuristics = sizeof(heuristics) / sizeof(heuristics[0]);
+  for (int t = 0; t < TRACE_COUNT; t++)
+  {
+    SimResult results[cHeuristics];
+    for (int h = 0; h < cHeuristics; h++)
+    {
+      results[h] = Simulate((TRACE)t, heuristics[h], cFrames);
+      const SimResult& r = results[h];
+      printf("%-16s %-18s %8ld %8ld %8ld %8ld %10.1f %10.1f\n", traceNames[t], heuristics[h].pName, r.cDrawn,
+        r.cDropped, r.cDropRuns, r.cBoundChanges, r.dMeanLate, r.dMaxLate);
+      CHECK(r.cDrawn + r.cDropped == cFrames);
+    }
+
+    switch (t)
+    {
+    case TRACE_CHEAP:
+      CHECK(results[OLD].cDropped == 0);
+      CHECK(results[DEFAULT].cDropped == 0);
+      break;
+    case TRACE_NEAR_THRESHOLD:
+      CHECK(results[DEFAULT].cBoundChanges < results[OLD].cBoundChanges);
+      break;
+    case TRACE_OVERLOADED:
+      // Drawing every frame would fall further behind with each one
+      CHECK(results[OLD].cDropped > 0);
+      CHECK(results[DEFAULT].cDropped > 0);
+      CHECK(results[DEFAULT].dMaxLate < 1000);
+      break;
+    }
+  }
+
+  return TestResult();
+}
@@ -0,0 +1,368 @@
+// Copyright (C) 2007-2014 Team MediaPortal
+// http://www.team-mediaportal.com
+//
+// This file is part of MediaPortal 2
+//
+// MediaPortal 2 is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// MediaPortal 2 is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with MediaPortal 2. If not, see <http://www.gnu.org/licenses/>.
+
+// Tests the advise heap of CAMSchedule against a model of the scheduled advises and measures how its
+// operations scale with the number of advises.
+//
+// Usage: ScheduleTest [operations]
+//
+// The model test runs random advises, cancels and clock ticks and checks after each step that the next
+// advise time is the earliest one scheduled and that exactly the advises that are due fired. The cookie
+// test cancels advises whose cookies share a slot of the cookie table, in every position of the probe
+// sequence. The growth test schedules more advises than any of the tables start with, twice. The
+// benchmark then reports cancel and fire times for 10 to 10,000 advises. Returns the number of failed
+// checks.
+
+#include <streams.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <map>
+#include <vector>
+
+#include "../TestCommon.h"
+
+
+// rand() only has 15 bits with the Microsoft CRT
+static LONGLONG Rand(LONGLONG n)
+{
+  return ((((LONGLONG)rand() << 30) | ((LONGLONG)rand() << 15) | rand()) % n);
+}
+
+
+// What the schedule must behave like: the advises that are scheduled, each with an event of its own.
+struct ModelAdvise
+{
+  REFERENCE_TIME  time;
+  int             slot;
+};
+
+typedef std::map<DWORD_PTR, ModelAdvise> ModelMap;
+
+static REFERENCE_TIME ModelNext(const ModelMap& model)
+{
+  REFERENCE_TIME next = MAX_TIME;
+  for (ModelMap::const_iterator it = model.begin(); it != model.end(); ++it)
+  {
+    if (it->second.time < next)
+    {
+      next = it->second.time;
+    }
+  }
+  return next;
+}
+
+static BOOL IsSet(HANDLE hEvent)
+{
+  return WaitForSingleObject(hEvent, 0) == WAIT_OBJECT_0;
+}
+
+static void RunModelTest(int operations)
+{
+  const int cSlots = 256;
+  HANDLE events[cSlots];
+  std::vector<int> freeSlots;
+  for (int i = 0; i < cSlots; i++)
+  {
+    events[i] = CreateEvent(NULL, TRUE, FALSE, NULL);
+    freeSlots.push_back(i);
+  }
+  HANDLE hWake = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+  CAMSchedule schedule(hWake);
+  ModelMap model;
+  std::vector<DWORD_PTR> stale;   // Cookies of advises that fired or were cancelled
+  REFERENCE_TIME now = 0;
+
+  for (int op = 0; op < operations; op++)
+  {
+    int action = rand() % 100;
+    if (action < 45 && !freeSlots.empty())
+    {
+      int slot = freeSlots.back();
+      freeSlots.pop_back();
+      ModelAdvise advise = { now + Rand(10000), slot };
+      DWORD_PTR dwCookie = schedule.AddAdvisePacket(advise.time, 0, events[slot], FALSE);
+      CHECK(dwCookie != 0);
+      CHECK(model.find(dwCookie) == model.end());
+      model[dwCookie] = advise;
+    }
+    else if (action < 70 && !model.empty())
+    {
+      ModelMap::iterator it = model.begin();
+      std::advance(it, (int)Rand(model.size()));
+      CHECK(schedule.Unadvise(it->first) == S_OK);
+      CHECK(!IsSet(events[it->second.slot]));
+      freeSlots.push_back(it->second.slot);
+      stale.push_back(it->first);
+      model.erase(it);
+    }
+    else if (action < 80 && !stale.empty())
+    {
+      CHECK(schedule.Unadvise(stale[(size_t)Rand(stale.size())]) == S_FALSE);
+    }
+    else
+    {
+      now += Rand(1000);
+      REFERENCE_TIME next = schedule.Advise(now);
+      for (ModelMap::iterator it = model.begin(); it != model.end();)
+      {
+        BOOL bFired = IsSet(events[it->second.slot]);
+        CHECK(bFired == (it->second.time <= now));
+        if (bFired)
+        {
+          ResetEvent(events[it->second.slot]);
+          freeSlots.push_back(it->second.slot);
+          stale.push_back(it->first);
+          it = model.erase(it);
+        }
+        else
+        {
+          ++it;
+        }
+      }
+      CHECK(next == ModelNext(model));
+    }
+
+    if (stale.size() > 1024)
+    {
+      stale.erase(stale.begin(), stale.begin() + 512);
+    }
+
+    CHECK(schedule.GetAdviseCount() == model.size());
+    CHECK(schedule.GetNextAdviseTime() == ModelNext(model));
+  }
+
+  for (ModelMap::iterator it = model.begin(); it != model.end(); ++it)
+  {
+    CHECK(schedule.Unadvise(it->first) == S_OK);
+  }
+  CHECK(schedule.GetAdviseCount() == 0);
+
+  for (int i = 0; i < cSlots; i++)
+  {
+    CloseHandle(events[i]);
+  }
+  CloseHandle(hWake);
+}
+
+
+// Cookies are serial numbers and the first cookie table has 32 entries, so cookies 32 apart share a
+// home slot. Schedules four of them and one whose home slot they took, then cancels the one at
+// position iCancel of that probe sequence. The entries behind it have to be shifted back, or the
+// advises after it can no longer be found.
+static void RunCollisionCase(int iCancel)
+{
+  const int cCluster = 5;
+  HANDLE hWake = CreateEvent(NULL, FALSE, FALSE, NULL);
+  HANDLE hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+  CAMSchedule schedule(hWake);
+
+  DWORD_PTR cluster[cCluster];
+  for (int i = 0; i < cCluster; i++)
+  {
+    cluster[i] = schedule.AddAdvisePacket(1000 + i, 0, hEvent, FALSE);
+    if (i < cCluster - 2)
+    {
+      // Use up the cookies up to the next one with the same home slot
+      for (int j = 0; j < 31; j++)
+      {
+        schedule.Unadvise(schedule.AddAdvisePacket(2000, 0, hEvent, FALSE));
+      }
+    }
+  }
+  CHECK(cluster[1] == cluster[0] + 32);
+  CHECK(cluster[3] == cluster[0] + 96);
+  CHECK(cluster[4] == cluster[0] + 97);
+
+  CHECK(schedule.Unadvise(cluster[iCancel]) == S_OK);
+  CHECK(schedule.Unadvise(cluster[iCancel]) == S_FALSE);
+  CHECK(schedule.GetNextAdviseTime() == (iCancel == 0 ? 1001 : 1000));
+  for (int i = 0; i < cCluster; i++)
+  {
+    if (i != iCancel)
+    {
+      CHECK(schedule.Unadvise(cluster[i]) == S_OK);
+    }
+  }
+  CHECK(schedule.GetAdviseCount() == 0);
+  CHECK(!IsSet(hEvent));
+
+  CloseHandle(hEvent);
+  CloseHandle(hWake);
+}
+
+static void TestCookieCollisions()
+{
+  for (int i = 0; i < 5; i++)
+  {
+    RunCollisionCase(i);
+  }
+}
+
+
+// The heap, the cookie table and the packet list all start small. Schedules 1000 advises in
+// descending order, so each one goes to the root, lets them fire in steps and does it again with the
+// pooled packets.
+static void TestGrowth()
+{
+  const int cAdvises = 1000;
+  HANDLE hWake = CreateEvent(NULL, FALSE, FALSE, NULL);
+  HANDLE hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+  CAMSchedule schedule(hWake);
+
+  DWORD_PTR dwLastCookie = 0;
+  for (int round = 0; round < 2; round++)
+  {
+    for (int i = cAdvises; i > 0; i--)
+    {
+      DWORD_PTR dwCookie = schedule.AddAdvisePacket(i * 10, 0, hEvent, FALSE);
+      // Serial, also when the packet comes from the pool
+      CHECK(dwCookie == dwLastCookie + 1);
+      dwLastCookie = dwCookie;
+      CHECK(schedule.GetNextAdviseTime() == i * 10);
+    }
+    CHECK(schedule.GetAdviseCount() == (DWORD)cAdvises);
+
+    for (int i = 1; i <= cAdvises; i += 7)
+    {
+      // Due: the advises at 10 .. i * 10
+      REFERENCE_TIME next = schedule.Advise(i * 10);
+      CHECK(schedule.GetAdviseCount() == (DWORD)(cAdvises - i));
+      CHECK(next == (i < cAdvises ? (i + 1) * 10 : MAX_TIME));
+    }
+    schedule.Advise(cAdvises * 10);
+    CHECK(schedule.GetAdviseCount() == 0);
+    CHECK(IsSet(hEvent));
+    ResetEvent(hEvent);
+  }
+
+  CloseHandle(hEvent);
+  CloseHandle(hWake);
+}
+
+// A periodic advise fires once for each period that passed and stays scheduled.
+static void TestPeriodic()
+{
+  HANDLE hWake = CreateEvent(NULL, FALSE, FALSE, NULL);
+  HANDLE hSemaphore = CreateSemaphore(NULL, 0, 100, NULL);
+  HANDLE hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+  CAMSchedule schedule(hWake);
+
+  DWORD_PTR dwPeriodic = schedule.AddAdvisePacket(5, 10, hSemaphore, TRUE);
+  DWORD_PTR dwOnce = schedule.AddAdvisePacket(20, 0, hEvent, FALSE);
+  CHECK(schedule.GetNextAdviseTime() == 5);
+
+  // 5, 15, 25 and 35 are due
+  CHECK(schedule.Advise(35) == 45);
+  int cReleased = 0;
+  while (WaitForSingleObject(hSemaphore, 0) == WAIT_OBJECT_0)
+  {
+    cReleased++;
+  }
+  CHECK(cReleased == 4);
+  CHECK(IsSet(hEvent));
+  CHECK(schedule.GetAdviseCount() == 1);
+  CHECK(schedule.Unadvise(dwOnce) == S_FALSE);
+  CHECK(schedule.Unadvise(dwPeriodic) == S_OK);
+
+  CloseHandle(hEvent);
+  CloseHandle(hSemaphore);
+  CloseHandle(hWake);
+}
+
+
+// Times cancel and fire with n advises scheduled. Each advise that is cancelled or fires is replaced by
+// a new one at a random later time, as the clock of a running graph would see it.
+static double RunBenchmark(int n, int operations)
+{
+  HANDLE hWake = CreateEvent(NULL, FALSE, FALSE, NULL);
+  HANDLE hEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+  CAMSchedule schedule(hWake);
+  const LONGLONG range = 1000000000;
+
+  std::vector<DWORD_PTR> cookies(n);
+  for (int i = 0; i < n; i++)
+  {
+    cookies[i] = schedule.AddAdvisePacket(Rand(range), 0, hEvent, FALSE);
+  }
+
+  // cancel of a random advise and advise
+  TestTimer timer;
+  for (int i = 0; i < operations; i++)
+  {
+    DWORD_PTR& dwCookie = cookies[(int)(((LONGLONG)i * 7919) % n)];
+    schedule.Unadvise(dwCookie);
+    dwCookie = schedule.AddAdvisePacket(Rand(range), 0, hEvent, FALSE);
+  }
+  double nsCancel = timer.ElapsedNs() / operations;
+
+  // fire of the earliest advise and advise
+  timer.Start();
+  for (int i = 0; i < operations; i++)
+  {
+    REFERENCE_TIME now = schedule.GetNextAdviseTime();
+    schedule.Advise(now);
+    while (schedule.GetAdviseCount() < (DWORD)n)
+    {
+      schedule.AddAdvisePacket(now + Rand(range), 0, hEvent, FALSE);
+    }
+  }
+  double nsFire = timer.ElapsedNs() / operations;
+
+  printf("%8d %16.1f %16.1f\n", n, nsCancel, nsFire);
+
+  schedule.Advise(MAX_TIME - 1);
+  CloseHandle(hEvent);
+  CloseHandle(hWake);
+  return nsCancel + nsFire;
+}
+
+
+int main(int argc, char *argv[])
+{
+  int operations = (argc > 1) ? atoi(argv[1]) : 100000;
+  if (operations <= 0)
+  {
+    printf("Usage: ScheduleTest [operations]\n");
+    return 1;
+  }
+
+  srand(1);
+  RunModelTest(operations);
+  TestCookieCollisions();
+  TestGrowth();
+  TestPeriodic();
+
+  printf("%8s %16s %16s\n", "advises", "cancel+add ns", "fire+add ns");
+  double nsSmallest = 0;
+  double nsLargest = 0;
+  for (int n = 10; n <= 10000; n *= 10)
+  {
+    double ns = RunBenchmark(n, operations);
+    if (n == 10)
+      nsSmallest = ns;
+    nsLargest = ns;
+  }
+
+  // A list that is searched on every cancel and sorted insert costs about a thousand times as much
+  // with a thousand times the advises, the heap about 10 levels more. Timing depends on the machine, so
+  // this is reported rather than checked.
+  printf("%d times the advises cost %.1f times as much\n", 10000 / 10, nsLargest / nsSmallest);
+
+  return TestResult();
+}
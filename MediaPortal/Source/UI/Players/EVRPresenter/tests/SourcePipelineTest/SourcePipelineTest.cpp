@@ -0,0 +1,379 @@
+// Copyright (C) 2007-2014 Team MediaPortal
+// http://www.team-mediaportal.com
+//
+// This file is part of MediaPortal 2
+//
+// MediaPortal 2 is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// MediaPortal 2 is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with MediaPortal 2. If not, see <http://www.gnu.org/licenses/>.
+
+// Tests the pipelined filling of CSourceStream: a source whose fills take a while and finish out of
+// order streams into a checking downstream pin, with 0 to 8 fill workers.
+//
+// Usage: SourcePipelineTest [samples per run]
+//
+// The samples must arrive strictly in sequence and end where FillBufferPipelined returned S_FALSE or
+// an error, even though later fills have already finished, followed by one end of stream. While every
+// worker is blocked in a fill, CMD_PAUSE and CMD_RUN must be answered at once and CMD_STOP as soon as
+// the fills in progress return, without filling the buffers that were still queued; afterwards all
+// buffers must be back in the allocator. Then the sample rate is reported for each worker count.
+// Returns the number of failed checks.
+
+#include <streams.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+
+#include "../TestCommon.h"
+#include "../TestPin.h"
+
+
+static const LONG cBuffers = SOURCE_PIPELINE_DEPTH + 4;
+
+
+// Checks that the samples arrive in sequence. Only the stream thread delivers to it.
+class CheckingPin : public TestInputPin
+{
+public:
+  LONG    m_lNext;            // sequence of the next sample
+  LONG    m_lBadSamples;      // out of order or with the wrong length
+  volatile LONG m_lEndOfStream;
+  HANDLE  m_hEndOfStream;
+
+  CheckingPin() : m_lNext(0), m_lBadSamples(0), m_lEndOfStream(0)
+  {
+    m_hEndOfStream = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+    // Our own allocator, so the source does not need COM to create one
+    HRESULT hr = S_OK;
+    m_pAllocator = new CMemAllocator(NAME("SourcePipelineTest allocator"), NULL, &hr);
+    m_pAllocator->AddRef();
+  }
+
+  ~CheckingPin()
+  {
+    m_pAllocator->Release();
+    CloseHandle(m_hEndOfStream);
+  }
+
+  STDMETHODIMP QueryDirection(PIN_DIRECTION *pPinDir) { *pPinDir = PINDIR_INPUT; return S_OK; }
+  STDMETHODIMP ReceiveConnection(IPin *pConnector, const AM_MEDIA_TYPE *pmt) { return S_OK; }
+
+  STDMETHODIMP GetAllocator(IMemAllocator **ppAllocator)
+  {
+    m_pAllocator->AddRef();
+    *ppAllocator = m_pAllocator;
+    return S_OK;
+  }
+
+  STDMETHODIMP Receive(IMediaSample *pSample)
+  {
+    BYTE *pBuffer = NULL;
+    pSample->GetPointer(&pBuffer);
+    if (pSample->GetActualDataLength() != sizeof(LONG) || *(LONG*)pBuffer != m_lNext)
+      m_lBadSamples++;
+    m_lNext++;
+    return S_OK;
+  }
+
+  STDMETHODIMP EndOfStream()
+  {
+    InterlockedIncrement(&m_lEndOfStream);
+    SetEvent(m_hEndOfStream);
+    return S_OK;
+  }
+
+private:
+  CMemAllocator *m_pAllocator;
+};
+
+
+// Writes the sequence into each sample. A fill waits for the gate, if there is one, and takes up to
+// m_dwFillTime ms; with m_bJitter the time varies by sequence so that the fills finish out of order.
+class TestStream : public CSourceStream
+{
+public:
+  LONG    m_lCutoff;          // first sequence that is not filled
+  HRESULT m_hrCutoff;         // what its fill returns
+  DWORD   m_dwFillTime;
+  BOOL    m_bJitter;
+  HANDLE  m_hGate;
+  volatile LONG m_lStarted;   // fills begun
+
+  TestStream(CSource *pFilter, HRESULT *phr) :
+    CSourceStream(NAME("SourcePipelineTest stream"), phr, pFilter, L"Output"),
+    m_lCutoff(LONG_MAX),
+    m_hrCutoff(S_FALSE),
+    m_dwFillTime(0),
+    m_bJitter(FALSE),
+    m_hGate(NULL),
+    m_lStarted(0),
+    m_lSerial(0)
+  {
+  }
+
+  HRESULT Workers(int nWorkers) { return SetFillWorkers(nWorkers); }
+
+  // The filter stays stopped; the test drives the stream thread directly
+  HRESULT Start() { return Active(); }
+  HRESULT Finish() { return Inactive(); }
+
+  // Buffers the allocator can hand out right now
+  LONG FreeBuffers()
+  {
+    IMediaSample *apSamples[cBuffers];
+    LONG cFree = 0;
+    while (cFree < cBuffers && SUCCEEDED(m_pAllocator->GetBuffer(&apSamples[cFree], NULL, NULL, AM_GBF_NOWAIT)))
+      cFree++;
+    for (LONG i = 0; i < cFree; i++)
+      apSamples[i]->Release();
+    return cFree;
+  }
+
+protected:
+  HRESULT GetMediaType(CMediaType *pMediaType)
+  {
+    pMediaType->SetType(&MEDIATYPE_Stream);
+    pMediaType->SetSubtype(&MEDIASUBTYPE_NULL);
+    pMediaType->SetFormatType(&FORMAT_None);
+    return S_OK;
+  }
+
+  HRESULT DecideBufferSize(IMemAllocator *pAlloc, ALLOCATOR_PROPERTIES *pProps)
+  {
+    pProps->cBuffers = cBuffers;
+    pProps->cbBuffer = 4096;
+    ALLOCATOR_PROPERTIES actual;
+    HRESULT hr = pAlloc->SetProperties(pProps, &actual);
+    if (FAILED(hr))
+      return hr;
+    return (actual.cBuffers < cBuffers) ? E_FAIL : S_OK;
+  }
+
+  HRESULT FillBuffer(IMediaSample *pSample)
+  {
+    return FillBufferPipelined(pSample, m_lSerial++);
+  }
+
+  HRESULT FillBufferPipelined(IMediaSample *pSample, LONG lSequence)
+  {
+    InterlockedIncrement(&m_lStarted);
+    if (m_hGate)
+      WaitForSingleObject(m_hGate, INFINITE);
+    DWORD dwFillTime = m_bJitter ? (DWORD)(lSequence * 7) % (m_dwFillTime + 1) : m_dwFillTime;
+    if (dwFillTime)
+      Sleep(dwFillTime);
+
+    if (lSequence >= m_lCutoff)
+      return m_hrCutoff;
+
+    BYTE *pBuffer = NULL;
+    pSample->GetPointer(&pBuffer);
+    *(LONG*)pBuffer = lSequence;
+    pSample->SetActualDataLength(sizeof(LONG));
+    return S_OK;
+  }
+
+private:
+  LONG m_lSerial;             // sequence of the serial loop
+};
+
+class TestSource : public CSource
+{
+public:
+  TestSource(HRESULT *phr) : CSource(NAME("SourcePipelineTest"), NULL, GUID_NULL)
+  {
+    m_pStream = new TestStream(this, phr);
+  }
+
+  TestStream *m_pStream;      // deleted with the filter
+};
+
+
+// Sends a thread command from a thread of its own, so the test can time out waiting for the reply
+class CommandCall
+{
+public:
+  CommandCall(TestStream *pStream, HRESULT (CSourceStream::*pfnCommand)(void)) :
+    m_pStream(pStream),
+    m_pfnCommand(pfnCommand),
+    m_hr(E_PENDING)
+  {
+    m_hThread = CreateThread(NULL, 0, CommandThread, this, 0, NULL);
+  }
+
+  ~CommandCall()
+  {
+    WaitForSingleObject(m_hThread, INFINITE);
+    CloseHandle(m_hThread);
+  }
+
+  BOOL Wait(DWORD dwTimeout) { return WaitForSingleObject(m_hThread, dwTimeout) == WAIT_OBJECT_0; }
+  HRESULT Result() const { return m_hr; }
+
+private:
+  static DWORD WINAPI CommandThread(LPVOID pParam)
+  {
+    CommandCall *pThis = (CommandCall*)pParam;
+    pThis->m_hr = (pThis->m_pStream->*pThis->m_pfnCommand)();
+    return 0;
+  }
+
+  TestStream *m_pStream;
+  HRESULT (CSourceStream::*m_pfnCommand)(void);
+  HANDLE m_hThread;
+  volatile HRESULT m_hr;
+};
+
+
+// Streams until the fill of lCutoff returns hrCutoff and checks what arrived. Returns samples/s.
+static double Run(int nWorkers, LONG lCutoff, HRESULT hrCutoff, DWORD dwFillTime, BOOL bJitter)
+{
+  CheckingPin pin;
+  HRESULT hr = S_OK;
+  TestSource *pSource = new TestSource(&hr);
+  pSource->AddRef();
+  TestStream *pStream = pSource->m_pStream;
+  pStream->m_lCutoff = lCutoff;
+  pStream->m_hrCutoff = hrCutoff;
+  pStream->m_dwFillTime = dwFillTime;
+  pStream->m_bJitter = bJitter;
+
+  CHECK(pStream->Workers(nWorkers) == S_OK);
+  CHECK(pStream->Connect(&pin, NULL) == S_OK);
+
+  TestTimer timer;
+  CHECK(pStream->Start() == S_OK);
+  CHECK(WaitForSingleObject(pin.m_hEndOfStream, 60000) == WAIT_OBJECT_0);
+  double ns = timer.ElapsedNs();
+
+  CHECK(pin.m_lNext == lCutoff);
+  CHECK(pin.m_lBadSamples == 0);
+  CHECK(pStream->FreeBuffers() == cBuffers);
+  // The workers run ahead by the pipeline depth at most; the serial loop stops at the cutoff
+  if (nWorkers > 0)
+    CHECK(pStream->m_lStarted <= lCutoff + SOURCE_PIPELINE_DEPTH);
+  else
+    CHECK(pStream->m_lStarted == lCutoff + 1);
+
+  CHECK(pStream->Finish() == S_OK);
+  CHECK(pin.m_lEndOfStream == 1);
+  pStream->Disconnect();
+  pSource->Release();
+
+  return ns > 0 ? lCutoff / (ns / 1e9) : 0;
+}
+
+
+// Fills that finish out of order are delivered in order and the stream ends at the cutoff, whether
+// the stream ends with S_FALSE or an error, at the first sample or in the middle of the pipeline.
+static void TestInOrder()
+{
+  const int workers[] = { 0, 1, 4, 8 };
+  for (DWORD i = 0; i < sizeof(workers) / sizeof(workers[0]); i++)
+  {
+    Run(workers[i], 100, S_FALSE, 3, TRUE);
+    Run(workers[i], 37, E_FAIL, 3, TRUE);
+    Run(workers[i], 0, S_FALSE, 0, FALSE);
+  }
+}
+
+// All four workers block in a fill with the buffers behind them queued. Pause and run are answered
+// while they are blocked; stop is answered once the fills in progress return, and the queued buffers
+// are given back unfilled.
+static void TestCommandsWhileFilling()
+{
+  const int nWorkers = 4;
+  CheckingPin pin;
+  HRESULT hr = S_OK;
+  TestSource *pSource = new TestSource(&hr);
+  pSource->AddRef();
+  TestStream *pStream = pSource->m_pStream;
+  HANDLE hGate = CreateEvent(NULL, TRUE, FALSE, NULL);
+  pStream->m_hGate = hGate;
+
+  CHECK(pStream->Workers(nWorkers) == S_OK);
+  CHECK(pStream->Connect(&pin, NULL) == S_OK);
+  CHECK(pStream->Start() == S_OK);
+
+  for (int i = 0; i < 5000 && pStream->m_lStarted < nWorkers; i++)
+    Sleep(1);
+  CHECK(pStream->m_lStarted == nWorkers);
+
+  {
+    CommandCall pause(pStream, &CSourceStream::Pause);
+    BOOL bAnswered = pause.Wait(5000);
+    CHECK(bAnswered);
+    if (!bAnswered)
+      SetEvent(hGate);
+    CHECK(pause.Result() == S_OK);
+  }
+  {
+    CommandCall run(pStream, &CSourceStream::Run);
+    BOOL bAnswered = run.Wait(5000);
+    CHECK(bAnswered);
+    if (!bAnswered)
+      SetEvent(hGate);
+    CHECK(run.Result() == S_OK);
+  }
+
+  double ns = 0;
+  {
+    CommandCall stop(pStream, &CSourceStream::Stop);
+    CHECK(!stop.Wait(200));
+    TestTimer timer;
+    SetEvent(hGate);
+    CHECK(stop.Wait(5000));
+    ns = timer.ElapsedNs();
+    CHECK(stop.Result() == S_OK);
+  }
+
+  CHECK(pStream->m_lStarted == nWorkers);
+  CHECK(pin.m_lNext == 0);
+  CHECK(pin.m_lEndOfStream == 0);
+  CHECK(pStream->FreeBuffers() == cBuffers);
+  printf("stop answered %.2f ms after the fills were released\n", ns / 1e6);
+
+  CHECK(pStream->Finish() == S_OK);
+  pStream->Disconnect();
+  pSource->Release();
+  CloseHandle(hGate);
+}
+
+
+int main(int argc, char *argv[])
+{
+  int cSamples = (argc > 1) ? atoi(argv[1]) : 500;
+  if (cSamples <= 0)
+  {
+    printf("Usage: SourcePipelineTest [samples per run]\n");
+    return 1;
+  }
+
+  timeBeginPeriod(1);
+
+  TestInOrder();
+  TestCommandsWhileFilling();
+
+  // Timing depends on the machine and the timer resolution, so it is reported rather than checked
+  const int workers[] = { 0, 1, 2, 4, 8 };
+  printf("%8s %12s\n", "workers", "samples/s");
+  for (DWORD i = 0; i < sizeof(workers) / sizeof(workers[0]); i++)
+  {
+    double dRate = Run(workers[i], cSamples, S_FALSE, 2, FALSE);
+    printf("%8d %12.0f\n", workers[i], dRate);
+  }
+
+  timeEndPeriod(1);
+
+  return TestResult();
+}
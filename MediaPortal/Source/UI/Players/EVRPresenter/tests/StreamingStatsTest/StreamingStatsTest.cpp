@@ -0,0 +1,310 @@
+// Copyright (C) 2007-2014 Team MediaPortal
+// http://www.team-mediaportal.com
+//
+// This file is part of MediaPortal 2
+//
+// MediaPortal 2 is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// MediaPortal 2 is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with MediaPortal 2. If not, see <http://www.gnu.org/licenses/>.
+
+// Tests CStreamingStats: the mean and variance against a two-pass computation, the percentiles
+// against the sorted observations, and snapshots taken while another thread adds observations.
+//
+// Usage: StreamingStatsTest [observations]
+//
+// The running mean and variance must agree with the two-pass ones, also for observations far from
+// zero where the sum of squares loses every significant digit. A percentile may be off by the width
+// of its bucket, at most 1/8 of the true value. A reader running alongside the writer must only see
+// snapshots that some number of observations add up to. How long Add and GetStatistics take is
+// reported. Returns the number of failed checks.
+
+#include <streams.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "../TestCommon.h"
+
+
+static DWORD g_dwSeed = 1;
+
+static DWORD NextRandom()
+{
+  g_dwSeed = g_dwSeed * 1103515245 + 12345;
+  return g_dwSeed >> 16;
+}
+
+static LONG Random(LONG lLow, LONG lHigh)
+{
+  DWORD dwRandom = (NextRandom() << 16) | NextRandom();
+  return (LONG)((DWORD)lLow + dwRandom % ((DWORD)lHigh - (DWORD)lLow + 1));
+}
+
+static BOOL IsClose(double dValue, double dReference, double dRelative)
+{
+  return fabs(dValue - dReference) <= dRelative * fabs(dReference) + 1e-12;
+}
+
+static int CompareLong(const void *p1, const void *p2)
+{
+  LONG l1 = *(const LONG*)p1;
+  LONG l2 = *(const LONG*)p2;
+  return l1 < l2 ? -1 : l1 > l2 ? 1 : 0;
+}
+
+
+// Adds the observations and compares the statistics with a two-pass computation
+static void CheckMoments(const LONG *plValues, int cValues)
+{
+  CStreamingStats stats;
+  LONGLONG llSum = 0;
+  for (int i = 0; i < cValues; i++)
+  {
+    stats.Add(plValues[i]);
+    llSum += plValues[i];
+  }
+
+  double dMean = cValues > 0 ? (double)llSum / cValues : 0.0;
+  double dSquares = 0.0;
+  for (int i = 0; i < cValues; i++)
+    dSquares += (plValues[i] - dMean) * (plValues[i] - dMean);
+  double dVariance = cValues > 1 ? dSquares / (cValues - 1) : 0.0;
+
+  LONGLONG llCount = -1;
+  double dStatsMean = -1, dStatsVariance = -1;
+  stats.GetStatistics(&llCount, &dStatsMean, &dStatsVariance);
+  CHECK(llCount == cValues);
+  CHECK(IsClose(dStatsMean, dMean, 1e-12));
+  CHECK(IsClose(dStatsVariance, dVariance, 1e-9));
+}
+
+static void TestMoments(int cValues)
+{
+  LONG *plValues = new LONG[cValues];
+
+  CheckMoments(plValues, 0);
+
+  plValues[0] = -17;
+  CheckMoments(plValues, 1);
+
+  static const LONG lSmall[] = { 4, 8, 15, 16, 23, 42, -7, 0, 1, 9 };
+  CheckMoments(lSmall, sizeof(lSmall) / sizeof(lSmall[0]));
+
+  // a constant has no variance at all, not a rounding error's worth
+  for (int i = 0; i < cValues; i++)
+    plValues[i] = 42;
+  CheckMoments(plValues, cValues);
+  CStreamingStats constant;
+  for (int i = 0; i < 1000; i++)
+    constant.Add(-1000000);
+  LONGLONG llCount;
+  double dMean, dVariance;
+  constant.GetStatistics(&llCount, &dMean, &dVariance);
+  CHECK(dMean == -1000000.0 && dVariance == 0.0);
+
+  // far from zero: x*x is about 4e18, the variance about 8
+  for (int i = 0; i < cValues; i++)
+    plValues[i] = 2000000000 + i % 10;
+  CheckMoments(plValues, cValues);
+  for (int i = 0; i < cValues; i++)
+    plValues[i] = -2000000000 - (i * 7919) % 1000;
+  CheckMoments(plValues, cValues);
+
+  for (int i = 0; i < cValues; i++)
+    plValues[i] = Random(-2000000000, 2000000000);
+  CheckMoments(plValues, cValues);
+  for (int i = 0; i < cValues; i++)
+    plValues[i] = Random(0, 40);
+  CheckMoments(plValues, cValues);
+
+  delete [] plValues;
+}
+
+
+// The value at least iPercent of the sorted observations are less than or equal to
+static LONG Percentile(const LONG *plSorted, int cValues, int iPercent)
+{
+  LONGLONG llRank = ((LONGLONG)cValues * iPercent + 99) / 100;
+  if (llRank < 1)
+    llRank = 1;
+  return plSorted[llRank - 1];
+}
+
+static BOOL WithinBucket(LONG lValue, LONG lReference)
+{
+  LONGLONG llError = (LONGLONG)lValue - lReference;
+  if (llError < 0)
+    llError = -llError;
+  LONGLONG llMagnitude = lReference < 0 ? -(LONGLONG)lReference : lReference;
+  return 8 * llError <= llMagnitude;
+}
+
+static void CheckPercentiles(LONG *plValues, int cValues)
+{
+  CStreamingStats stats;
+  for (int i = 0; i < cValues; i++)
+    stats.Add(plValues[i]);
+  qsort(plValues, cValues, sizeof(LONG), CompareLong);
+
+  static const int percents[] = { 0, 1, 50, 95, 99, 100 };
+  const int cPercents = sizeof(percents) / sizeof(percents[0]);
+  for (int i = 0; i < cPercents; i++)
+  {
+    LONG lReference = Percentile(plValues, cValues, percents[i]);
+    LONG lValue = stats.GetPercentile(percents[i]);
+    if (!WithinBucket(lValue, lReference))
+      printf("P%d of %d observations: %ld, sorted %ld\n", percents[i], cValues, lValue, lReference);
+    CHECK(WithinBucket(lValue, lReference));
+  }
+}
+
+static void TestPercentiles(int cValues)
+{
+  CStreamingStats empty;
+  CHECK(empty.GetPercentile(50) == 0);
+
+  // Every magnitude the buckets cover, one at a time
+  CStreamingStats single;
+  const LONG lLimit = 1L << STATS_MAX_LOG2;
+  for (LONG l = -lLimit; l < lLimit; l += (l > -64 && l < 64) ? 1 : 37)
+  {
+    single.Reset();
+    single.Add(l);
+    CHECK(WithinBucket(single.GetPercentile(50), l));
+  }
+
+  LONG *plValues = new LONG[cValues];
+
+  for (int i = 0; i < cValues; i++)
+    plValues[i] = Random(-1000000, 1000000);
+  CheckPercentiles(plValues, cValues);
+
+  // frame lateness: mostly a few mSec, with a long tail
+  for (int i = 0; i < cValues; i++)
+    plValues[i] = Random(0, 8) + (Random(0, 99) == 0 ? Random(20, 500) : 0);
+  CheckPercentiles(plValues, cValues);
+
+  for (int i = 0; i < cValues; i++)
+    plValues[i] = -Random(1, 100000);
+  CheckPercentiles(plValues, cValues);
+
+  for (int i = 0; i < cValues; i++)
+    plValues[i] = 40;
+  CheckPercentiles(plValues, cValues);
+
+  delete [] plValues;
+}
+
+
+struct WriterParam
+{
+  CStreamingStats *pStats;
+  LONG cValues;
+  volatile LONG lDone;
+};
+
+// Adds 0, 1, 2, ... so that a snapshot of n observations must have the mean (n-1)/2
+static DWORD WINAPI WriterThread(LPVOID pParam)
+{
+  WriterParam *pWriter = (WriterParam*)pParam;
+  for (LONG i = 0; i < pWriter->cValues; i++)
+    pWriter->pStats->Add(i);
+  InterlockedExchange(&pWriter->lDone, 1);
+  return 0;
+}
+
+static void TestConcurrentReader(int cValues)
+{
+  CStreamingStats stats;
+  WriterParam writer = { &stats, cValues, 0 };
+  HANDLE hThread = CreateThread(NULL, 0, WriterThread, &writer, 0, NULL);
+  CHECK(hThread != NULL);
+  if (hThread == NULL)
+    return;
+
+  LONGLONG llLastCount = 0;
+  LONG lLastMax = 0;
+  LONG cSnapshots = 0, cTorn = 0;
+  while (writer.lDone == 0)
+  {
+    LONGLONG llCount;
+    double dMean, dVariance;
+    stats.GetStatistics(&llCount, &dMean, &dVariance);
+    cSnapshots++;
+
+    // n observations 0..n-1 have the mean (n-1)/2 and the sample variance n(n+1)/12
+    if (llCount < llLastCount)
+      cTorn++;
+    else if (llCount > 0 && !IsClose(dMean, (llCount - 1) / 2.0, 1e-9))
+      cTorn++;
+    else if (llCount > 1 && !IsClose(dVariance, llCount * (llCount + 1) / 12.0, 1e-6))
+      cTorn++;
+    llLastCount = llCount;
+
+    // bucket counts only go up, so the largest value seen cannot go down
+    LONG lMax = stats.GetPercentile(100);
+    if (lMax < lLastMax)
+      cTorn++;
+    lLastMax = lMax;
+  }
+  WaitForSingleObject(hThread, INFINITE);
+  CloseHandle(hThread);
+
+  printf("%ld snapshots while writing, %ld inconsistent\n", cSnapshots, cTorn);
+  CHECK(cTorn == 0);
+
+  LONGLONG llCount;
+  double dMean, dVariance;
+  stats.GetStatistics(&llCount, &dMean, &dVariance);
+  CHECK(llCount == cValues);
+  CHECK(IsClose(dMean, (cValues - 1) / 2.0, 1e-9));
+}
+
+
+int main(int argc, char *argv[])
+{
+  int cValues = (argc > 1) ? atoi(argv[1]) : 1000000;
+  if (cValues <= 0)
+  {
+    printf("Usage: StreamingStatsTest [observations]\n");
+    return 1;
+  }
+
+  TestMoments(cValues);
+  TestPercentiles(cValues);
+  TestConcurrentReader(cValues);
+
+  // Timing depends on the machine, so it is reported rather than checked
+  CStreamingStats stats;
+  TestTimer timer;
+  for (int i = 0; i < cValues; i++)
+    stats.Add(i & 1023);
+  double dAddNs = timer.ElapsedNs() / cValues;
+
+  LONGLONG llCount;
+  double dMean, dVariance;
+  timer.Start();
+  for (int i = 0; i < cValues; i++)
+    stats.GetStatistics(&llCount, &dMean, &dVariance);
+  double dGetNs = timer.ElapsedNs() / cValues;
+
+  timer.Start();
+  LONG lSum = 0;
+  for (int i = 0; i < 10000; i++)
+    lSum += stats.GetPercentile(95);
+  double dPercentileNs = timer.ElapsedNs() / 10000;
+
+  printf("Add %.1f ns, GetStatistics %.1f ns, GetPercentile %.1f ns (%ld)\n", dAddNs, dGetNs, dPercentileNs,
+    lSum / 10000);
+
+  return TestResult();
+}
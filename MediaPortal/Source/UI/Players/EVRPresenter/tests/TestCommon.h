@@ -0,0 +1,73 @@
+// Copyright (C) 2007-2014 Team MediaPortal
+// http://www.team-mediaportal.com
+//
+// This file is part of MediaPortal 2
+//
+// MediaPortal 2 is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// MediaPortal 2 is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with MediaPortal 2. If not, see <http://www.gnu.org/licenses/>.
+
+// Checks and timing shared by the console test programs. Each program is a single source file that
+// includes this header once, counts its failed checks in g_Failures and returns TestResult().
+
+#ifndef TESTCOMMON_H
+#define TESTCOMMON_H
+
+#include <windows.h>
+#include <stdio.h>
+
+static int g_Failures = 0;
+
+#define CHECK(expr) \
+  do { \
+    if (!(expr)) \
+    { \
+      printf("%s(%d): check failed: %s\n", __FILE__, __LINE__, #expr); \
+      g_Failures++; \
+    } \
+  } while (0)
+
+// Prints the summary line; the result is the exit code of the program
+static int TestResult()
+{
+  printf("%d check(s) failed\n", g_Failures);
+  return g_Failures;
+}
+
+// Wall-clock time from the performance counter
+class TestTimer
+{
+public:
+  TestTimer()
+  {
+    QueryPerformanceFrequency(&m_liFrequency);
+    Start();
+  }
+
+  void Start()
+  {
+    QueryPerformanceCounter(&m_liStart);
+  }
+
+  double ElapsedNs() const
+  {
+    LARGE_INTEGER liNow;
+    QueryPerformanceCounter(&liNow);
+    return (double)(liNow.QuadPart - m_liStart.QuadPart) * 1e9 / m_liFrequency.QuadPart;
+  }
+
+private:
+  LARGE_INTEGER m_liFrequency;
+  LARGE_INTEGER m_liStart;
+};
+
+#endif
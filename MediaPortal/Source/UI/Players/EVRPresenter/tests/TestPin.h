@@ -0,0 +1,88 @@
+// Copyright (C) 2007-2014 Team MediaPortal
+// http://www.team-mediaportal.com
+//
+// This file is part of MediaPortal 2
+//
+// MediaPortal 2 is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// MediaPortal 2 is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with MediaPortal 2. If not, see <http://www.gnu.org/licenses/>.
+
+// A downstream input pin for the console tests. Every method succeeds or returns E_NOTIMPL; a test
+// derives from it and overrides what it looks at. The pin is not reference counted, it lives as long
+// as the test.
+
+#ifndef TESTPIN_H
+#define TESTPIN_H
+
+#include <streams.h>
+
+class TestInputPin : public IPin, public IMemInputPin
+{
+public:
+  virtual ~TestInputPin() {}
+
+  STDMETHODIMP QueryInterface(REFIID riid, void **ppv)
+  {
+    if (riid == IID_IUnknown || riid == IID_IPin)
+      *ppv = static_cast<IPin*>(this);
+    else if (riid == IID_IMemInputPin)
+      *ppv = static_cast<IMemInputPin*>(this);
+    else
+    {
+      *ppv = NULL;
+      return E_NOINTERFACE;
+    }
+    return S_OK;
+  }
+  STDMETHODIMP_(ULONG) AddRef() { return 2; }
+  STDMETHODIMP_(ULONG) Release() { return 1; }
+
+  // IPin
+  STDMETHODIMP Connect(IPin *pReceivePin, const AM_MEDIA_TYPE *pmt) { return E_NOTIMPL; }
+  STDMETHODIMP ReceiveConnection(IPin *pConnector, const AM_MEDIA_TYPE *pmt) { return E_NOTIMPL; }
+  STDMETHODIMP Disconnect() { return E_NOTIMPL; }
+  STDMETHODIMP ConnectedTo(IPin **pPin) { return E_NOTIMPL; }
+  STDMETHODIMP ConnectionMediaType(AM_MEDIA_TYPE *pmt) { return E_NOTIMPL; }
+  STDMETHODIMP QueryPinInfo(PIN_INFO *pInfo) { return E_NOTIMPL; }
+  STDMETHODIMP QueryDirection(PIN_DIRECTION *pPinDir) { return E_NOTIMPL; }
+  STDMETHODIMP QueryId(LPWSTR *Id) { return E_NOTIMPL; }
+  STDMETHODIMP QueryAccept(const AM_MEDIA_TYPE *pmt) { return E_NOTIMPL; }
+  STDMETHODIMP EnumMediaTypes(IEnumMediaTypes **ppEnum) { return E_NOTIMPL; }
+  STDMETHODIMP QueryInternalConnections(IPin **apPin, ULONG *nPin) { return E_NOTIMPL; }
+  STDMETHODIMP EndOfStream() { return S_OK; }
+  STDMETHODIMP BeginFlush() { return S_OK; }
+  STDMETHODIMP EndFlush() { return S_OK; }
+  STDMETHODIMP NewSegment(REFERENCE_TIME tStart, REFERENCE_TIME tStop, double dRate) { return S_OK; }
+
+  // IMemInputPin
+  STDMETHODIMP GetAllocator(IMemAllocator **ppAllocator) { return VFW_E_NO_ALLOCATOR; }
+  STDMETHODIMP NotifyAllocator(IMemAllocator *pAllocator, BOOL bReadOnly) { return S_OK; }
+  STDMETHODIMP GetAllocatorRequirements(ALLOCATOR_PROPERTIES *pProps) { return E_NOTIMPL; }
+  STDMETHODIMP ReceiveCanBlock() { return S_OK; }
+  STDMETHODIMP Receive(IMediaSample *pSample) { return S_OK; }
+
+  STDMETHODIMP ReceiveMultiple(IMediaSample **pSamples, long nSamples, long *nSamplesProcessed)
+  {
+    HRESULT hr = S_OK;
+    long i;
+    for (i = 0; i < nSamples; i++)
+    {
+      hr = Receive(pSamples[i]);
+      if (hr != S_OK)
+        break;
+    }
+    *nSamplesProcessed = i;
+    return hr;
+  }
+};
+
+#endif
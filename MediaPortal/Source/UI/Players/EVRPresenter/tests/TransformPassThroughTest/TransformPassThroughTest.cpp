@@ -0,0 +1,393 @@
+// Copyright (C) 2007-2014 Team MediaPortal
+// http://www.team-mediaportal.com
+//
+// This file is part of MediaPortal 2
+//
+// MediaPortal 2 is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// MediaPortal 2 is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with MediaPortal 2. If not, see <http://www.gnu.org/licenses/>.
+
+// Tests the zero-copy pass-through of CTransformFilter: when the input samples may be delivered on
+// the output pin, and that the samples the filter passes through arrive as they are and are counted
+// apart from the ones it copies.
+//
+// Usage: TransformPassThroughTest [samples per run]
+//
+// CanPassThroughAllocators must accept a shared allocator, even for read-only samples, and input
+// buffers that are writable, at least as big, aligned at least as much and with at least the prefix
+// of the output allocator; it must refuse the others. Then the copy and pass-through rates are
+// reported for 1 MB samples. Returns the number of failed checks.
+
+#include <streams.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../TestCommon.h"
+#include "../TestPin.h"
+
+
+static ALLOCATOR_PROPERTIES Props(long cBuffers, long cbBuffer, long cbAlign, long cbPrefix)
+{
+  ALLOCATOR_PROPERTIES props = { cBuffers, cbBuffer, cbAlign, cbPrefix };
+  return props;
+}
+
+static CMediaType StreamType()
+{
+  CMediaType mt;
+  mt.SetType(&MEDIATYPE_Stream);
+  mt.SetSubtype(&MEDIASUBTYPE_NULL);
+  mt.SetFormatType(&FORMAT_None);
+  return mt;
+}
+
+static CMemAllocator* CreateAllocator(ALLOCATOR_PROPERTIES props)
+{
+  HRESULT hr = S_OK;
+  CMemAllocator *pAlloc = new CMemAllocator(NAME("TransformPassThroughTest allocator"), NULL, &hr);
+  pAlloc->AddRef();
+  ALLOCATOR_PROPERTIES actual;
+  CHECK(SUCCEEDED(pAlloc->SetProperties(&props, &actual)));
+  return pAlloc;
+}
+
+
+// The output pin of the upstream filter; the transform's input pin only asks for its direction
+class UpstreamPin : public TestInputPin
+{
+public:
+  STDMETHODIMP QueryDirection(PIN_DIRECTION *pPinDir) { *pPinDir = PINDIR_OUTPUT; return S_OK; }
+};
+
+// Offers m_pAllocator to the transform's output pin and checks what arrives. The first byte of a
+// sample is its number and its length is 100 bytes more.
+class DownstreamPin : public TestInputPin
+{
+public:
+  IMemAllocator *m_pAllocator;
+  IMediaSample  *m_pUpstreamSample;   // the sample the test is sending
+  LONG    m_lReceived;
+  LONG    m_lBadSamples;
+  BOOL    m_bLastPassed;              // the last sample was the upstream one
+
+  DownstreamPin() :
+    m_pAllocator(NULL),
+    m_pUpstreamSample(NULL),
+    m_lReceived(0),
+    m_lBadSamples(0),
+    m_bLastPassed(FALSE)
+  {
+  }
+
+  STDMETHODIMP QueryDirection(PIN_DIRECTION *pPinDir) { *pPinDir = PINDIR_INPUT; return S_OK; }
+  STDMETHODIMP ReceiveConnection(IPin *pConnector, const AM_MEDIA_TYPE *pmt) { return S_OK; }
+
+  STDMETHODIMP GetAllocator(IMemAllocator **ppAllocator)
+  {
+    m_pAllocator->AddRef();
+    *ppAllocator = m_pAllocator;
+    return S_OK;
+  }
+
+  STDMETHODIMP Receive(IMediaSample *pSample)
+  {
+    BYTE *pBuffer = NULL;
+    pSample->GetPointer(&pBuffer);
+    if (pSample->GetActualDataLength() != 100 + pBuffer[0])
+      m_lBadSamples++;
+    m_bLastPassed = (pSample == m_pUpstreamSample);
+    m_lReceived++;
+    return S_OK;
+  }
+};
+
+// Copies the samples, or passes every other one through if allowed
+class TestTransform : public CTransformFilter
+{
+public:
+  ALLOCATOR_PROPERTIES m_OutProps;
+  BOOL  m_bPassEven;          // PassThrough takes the even samples
+  LONG  m_lPassThroughCalls;
+
+  TestTransform(const ALLOCATOR_PROPERTIES& outProps) :
+    CTransformFilter(NAME("TransformPassThroughTest"), NULL, GUID_NULL),
+    m_OutProps(outProps),
+    m_bPassEven(TRUE),
+    m_lPassThroughCalls(0)
+  {
+  }
+
+  HRESULT CheckInputType(const CMediaType *mtIn)
+  {
+    return (*mtIn->Type() == MEDIATYPE_Stream) ? S_OK : VFW_E_TYPE_NOT_ACCEPTED;
+  }
+
+  HRESULT CheckTransform(const CMediaType *mtIn, const CMediaType *mtOut) { return S_OK; }
+
+  HRESULT DecideBufferSize(IMemAllocator *pAllocator, ALLOCATOR_PROPERTIES *pProps)
+  {
+    *pProps = m_OutProps;
+    ALLOCATOR_PROPERTIES actual;
+    return pAllocator->SetProperties(pProps, &actual);
+  }
+
+  HRESULT GetMediaType(int iPosition, CMediaType *pMediaType)
+  {
+    if (iPosition < 0)
+      return E_INVALIDARG;
+    if (iPosition > 0)
+      return VFW_S_NO_MORE_ITEMS;
+    *pMediaType = StreamType();
+    return S_OK;
+  }
+
+  HRESULT Transform(IMediaSample *pIn, IMediaSample *pOut)
+  {
+    BYTE *pSrc = NULL;
+    BYTE *pDst = NULL;
+    pIn->GetPointer(&pSrc);
+    pOut->GetPointer(&pDst);
+    LONG cbData = pIn->GetActualDataLength();
+    CopyMemory(pDst, pSrc, cbData);
+    pOut->SetActualDataLength(cbData);
+    return S_OK;
+  }
+
+  HRESULT PassThrough(IMediaSample *pSample)
+  {
+    m_lPassThroughCalls++;
+    BYTE *pBuffer = NULL;
+    pSample->GetPointer(&pBuffer);
+    return (m_bPassEven && pBuffer[0] % 2 == 0) ? S_OK : S_FALSE;
+  }
+};
+
+
+// The transform connected between the stub pins: upstream notifies it of pInAlloc, downstream offers
+// pOutAlloc, which may be the same allocator. Without pOutAlloc the output stays unconnected.
+class Chain
+{
+public:
+  TestTransform *m_pFilter;
+  IMemInputPin  *m_pMemInput;
+  UpstreamPin   m_Upstream;
+  DownstreamPin m_Downstream;
+
+  Chain(CMemAllocator *pInAlloc, BOOL bReadOnly, CMemAllocator *pOutAlloc, const ALLOCATOR_PROPERTIES& outProps) :
+    m_pMemInput(NULL)
+  {
+    m_pFilter = new TestTransform(outProps);
+    m_pFilter->AddRef();
+    m_pInput = m_pFilter->GetPin(0);
+    m_pOutput = m_pFilter->GetPin(1);
+
+    CMediaType mt = StreamType();
+    CHECK(m_pInput->ReceiveConnection(&m_Upstream, &mt) == S_OK);
+    CHECK(m_pInput->QueryInterface(IID_IMemInputPin, (void**)&m_pMemInput) == S_OK);
+    CHECK(m_pMemInput->NotifyAllocator(pInAlloc, bReadOnly) == S_OK);
+    if (pOutAlloc)
+    {
+      m_Downstream.m_pAllocator = pOutAlloc;
+      CHECK(m_pOutput->Connect(&m_Downstream, &mt) == S_OK);
+    }
+  }
+
+  ~Chain()
+  {
+    m_pFilter->Stop();
+    m_pMemInput->Release();
+    m_pOutput->Disconnect();
+    m_pInput->Disconnect();
+    m_pFilter->Release();
+  }
+
+private:
+  CBasePin *m_pInput;
+  CBasePin *m_pOutput;
+};
+
+
+static BOOL CanPassThrough(ALLOCATOR_PROPERTIES inProps, BOOL bReadOnly, ALLOCATOR_PROPERTIES outProps,
+  BOOL bSameAllocator)
+{
+  CMemAllocator *pInAlloc = CreateAllocator(inProps);
+  CMemAllocator *pOutAlloc = pInAlloc;
+  if (bSameAllocator)
+    pOutAlloc->AddRef();
+  else
+    pOutAlloc = CreateAllocator(outProps);
+
+  BOOL bCanPassThrough;
+  {
+    Chain chain(pInAlloc, bReadOnly, pOutAlloc, outProps);
+    bCanPassThrough = chain.m_pFilter->CanPassThroughAllocators();
+  }
+  pOutAlloc->Release();
+  pInAlloc->Release();
+  return bCanPassThrough;
+}
+
+static void TestCanPassThroughAllocators()
+{
+  const ALLOCATOR_PROPERTIES out = Props(4, 4096, 16, 0);
+
+  // The same allocator, whatever the input pin was told
+  CHECK(CanPassThrough(out, FALSE, out, TRUE));
+  CHECK(CanPassThrough(out, TRUE, out, TRUE));
+
+  // Compatible allocators
+  CHECK(CanPassThrough(out, FALSE, out, FALSE));
+  CHECK(CanPassThrough(Props(2, 8192, 64, 32), FALSE, out, FALSE));
+
+  // Upstream may still read a read-only sample
+  CHECK(!CanPassThrough(out, TRUE, out, FALSE));
+
+  // Smaller or less aligned input buffers
+  CHECK(!CanPassThrough(Props(4, 2048, 16, 0), FALSE, out, FALSE));
+  CHECK(!CanPassThrough(Props(4, 4096, 8, 0), FALSE, out, FALSE));
+
+  // A shorter prefix than the output allocator's
+  const ALLOCATOR_PROPERTIES outPrefix = Props(4, 4096, 16, 16);
+  CHECK(!CanPassThrough(Props(4, 4096, 16, 8), FALSE, outPrefix, FALSE));
+  CHECK(CanPassThrough(Props(4, 4096, 16, 16), FALSE, outPrefix, FALSE));
+
+  // No output allocator yet
+  CMemAllocator *pInAlloc = CreateAllocator(out);
+  {
+    Chain chain(pInAlloc, FALSE, NULL, out);
+    CHECK(!chain.m_pFilter->CanPassThroughAllocators());
+  }
+  pInAlloc->Release();
+}
+
+
+// Streams 20 samples. Where pass-through is allowed the even ones go through as they are, except the
+// one that changes the media type; the statistics must count the bytes of each kind.
+static void TestStreaming(BOOL bReadOnly)
+{
+  const ALLOCATOR_PROPERTIES props = Props(4, 4096, 16, 0);
+  CMemAllocator *pInAlloc = CreateAllocator(props);
+  CMemAllocator *pOutAlloc = CreateAllocator(props);
+  {
+    Chain chain(pInAlloc, bReadOnly, pOutAlloc, props);
+    CHECK(pInAlloc->Commit() == S_OK);
+    CHECK(chain.m_pFilter->Pause() == S_OK);
+
+    const LONG cSamples = 20;
+    const LONG lTypeChange = 10;
+    LONGLONG llCopied = 0;
+    LONGLONG llPassed = 0;
+    for (LONG i = 0; i < cSamples; i++)
+    {
+      IMediaSample *pSample = NULL;
+      CHECK(SUCCEEDED(pInAlloc->GetBuffer(&pSample, NULL, NULL, 0)));
+      BYTE *pBuffer = NULL;
+      pSample->GetPointer(&pBuffer);
+      pBuffer[0] = (BYTE)i;
+      pSample->SetActualDataLength(100 + i);
+      if (i == lTypeChange)
+      {
+        CMediaType mt = StreamType();
+        pSample->SetMediaType(&mt);
+      }
+
+      chain.m_Downstream.m_pUpstreamSample = pSample;
+      CHECK(chain.m_pMemInput->Receive(pSample) == S_OK);
+      pSample->Release();
+
+      BOOL bPassed = !bReadOnly && i != lTypeChange && i % 2 == 0;
+      CHECK(chain.m_Downstream.m_lReceived == i + 1);
+      CHECK(chain.m_Downstream.m_bLastPassed == bPassed);
+      if (bPassed)
+        llPassed += 100 + i;
+      else
+        llCopied += 100 + i;
+    }
+    CHECK(chain.m_Downstream.m_lBadSamples == 0);
+    CHECK(chain.m_pFilter->m_lPassThroughCalls == (bReadOnly ? 0 : cSamples - 1));
+
+    CHECK(chain.m_pFilter->Stop() == S_OK);
+    LONGLONG llBytesCopied = 0;
+    LONGLONG llBytesPassed = 0;
+    DWORD dwTime = 0;
+    CHECK(chain.m_pFilter->GetTransferStatistics(&llBytesCopied, &llBytesPassed, &dwTime) == S_OK);
+    CHECK(llBytesCopied == llCopied);
+    CHECK(llBytesPassed == llPassed);
+  }
+  pOutAlloc->Release();
+  pInAlloc->Release();
+}
+
+
+// Streams cSamples samples of 1 MB, all copied or all passed through, and returns MB/s as counted
+// by the filter
+static double Throughput(LONG cSamples, BOOL bPassThrough)
+{
+  const LONG cbSample = 1024 * 1024;
+  const ALLOCATOR_PROPERTIES props = Props(2, cbSample, 16, 0);
+  CMemAllocator *pInAlloc = CreateAllocator(props);
+  CMemAllocator *pOutAlloc = CreateAllocator(props);
+  double dMBps = 0;
+  {
+    Chain chain(pInAlloc, FALSE, pOutAlloc, props);
+    chain.m_pFilter->m_bPassEven = bPassThrough;
+    CHECK(pInAlloc->Commit() == S_OK);
+    CHECK(chain.m_pFilter->Pause() == S_OK);
+
+    TestTimer timer;
+    for (LONG i = 0; i < cSamples; i++)
+    {
+      IMediaSample *pSample = NULL;
+      CHECK(SUCCEEDED(pInAlloc->GetBuffer(&pSample, NULL, NULL, 0)));
+      BYTE *pBuffer = NULL;
+      pSample->GetPointer(&pBuffer);
+      pBuffer[0] = 0;
+      pSample->SetActualDataLength(cbSample);
+      chain.m_pMemInput->Receive(pSample);
+      pSample->Release();
+    }
+    double ns = timer.ElapsedNs();
+    CHECK(chain.m_pFilter->Stop() == S_OK);
+
+    LONGLONG llBytesCopied = 0;
+    LONGLONG llBytesPassed = 0;
+    DWORD dwTime = 0;
+    CHECK(chain.m_pFilter->GetTransferStatistics(&llBytesCopied, &llBytesPassed, &dwTime) == S_OK);
+    CHECK((bPassThrough ? llBytesPassed : llBytesCopied) == (LONGLONG)cSamples * cbSample);
+    dMBps = ns > 0 ? (llBytesCopied + llBytesPassed) / (1024.0 * 1024.0) / (ns / 1e9) : 0;
+  }
+  pOutAlloc->Release();
+  pInAlloc->Release();
+  return dMBps;
+}
+
+
+int main(int argc, char *argv[])
+{
+  int cSamples = (argc > 1) ? atoi(argv[1]) : 500;
+  if (cSamples <= 0)
+  {
+    printf("Usage: TransformPassThroughTest [samples per run]\n");
+    return 1;
+  }
+
+  TestCanPassThroughAllocators();
+  TestStreaming(FALSE);
+  TestStreaming(TRUE);
+
+  // Timing depends on the machine, so it is reported rather than checked
+  printf("%14s %10s\n", "", "MB/s");
+  printf("%14s %10.0f\n", "copied", Throughput(cSamples, FALSE));
+  printf("%14s %10.0f\n", "passed through", Throughput(cSamples, TRUE));
+
+  return TestResult();
+}
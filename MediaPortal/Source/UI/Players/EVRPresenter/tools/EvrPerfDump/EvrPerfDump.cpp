@@ -0,0 +1,328 @@
+// Copyright (C) 2007-2014 Team MediaPortal
+// http://www.team-mediaportal.com
+//
+// This file is part of MediaPortal 2
+//
+// MediaPortal 2 is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// MediaPortal 2 is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with MediaPortal 2. If not, see <http://www.gnu.org/licenses/>.
+
+// Offline reader for the binary perflog capture (Evr.perf). Prints the records as CSV, followed by the
+// number of records of each event and the mean and longest time between the begin and end of the
+// events that have them.
+//
+// Usage: EvrPerfDump [-summary] [perf file]
+//
+// On Windows the file in the MP2 client log folder is read if no file name is given; elsewhere the
+// file name is required. The tool reads the fields at the offsets documented in
+// source\BaseClasses\perfsink.h and only depends on the C library, so a capture can also be read on
+// other hosts (see the Makefile).
+
+#define __STDC_FORMAT_MACROS
+#ifdef _WIN32
+#include <windows.h>
+#include <Shlobj.h>
+#endif
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <strings.h>
+#define _stricmp strcasecmp
+#endif
+
+// PERFLOG_SINK_FILE_HEADER and PERFLOG_SINK_RECORD, see perfsink.h
+const uint32_t PERF_MAGIC = 0x474C5050;   // 'PPLG'
+const uint32_t PERF_VERSION = 1;
+const uint32_t PERF_HEADER_SIZE = 48;
+const uint32_t PERF_RECORD_SIZE = 128;
+const uint32_t PERF_MAX_NAME = 24;
+const uint32_t PERF_MAX_DATA = 56;
+
+// Events told apart by the summary, and begin events still waiting for their end
+const int MAX_EVENTS = 256;
+const int MAX_OPEN = 1024;
+
+
+struct PerfRecord
+{
+  int64_t   timestamp;
+  uint32_t  threadId;
+  uint32_t  level;
+  char      phase;
+  uint32_t  dataSize;
+  uint64_t  id;
+  char      name[64];               // the name of a mark, or the GUID of an ETW event
+  bool      bMark;
+  int64_t   value;                  // marks only
+  const uint8_t *pData;
+};
+
+struct EventSummary
+{
+  char      name[64];
+  uint32_t  count;
+  uint32_t  pairs;                  // begin/end pairs matched
+  double    totalUs;
+  double    maxUs;
+};
+
+struct OpenEvent
+{
+  uint32_t  threadId;
+  uint64_t  id;
+  int       event;
+  int64_t   timestamp;
+};
+
+
+static uint32_t Read32(const uint8_t *p)
+{
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t Read64(const uint8_t *p)
+{
+  return (uint64_t)Read32(p) | ((uint64_t)Read32(p + 4) << 32);
+}
+
+static void DecodeRecord(const uint8_t *p, PerfRecord *pRecord)
+{
+  pRecord->timestamp = (int64_t)Read64(p);
+  pRecord->threadId = Read32(p + 12);
+  pRecord->level = Read32(p + 16);
+  pRecord->phase = (char)p[20];
+  pRecord->dataSize = p[21] < PERF_MAX_DATA ? p[21] : PERF_MAX_DATA;
+  pRecord->id = Read64(p + 40);
+  pRecord->pData = p + 72;
+
+  pRecord->bMark = (p[48] != '\0');
+  if (pRecord->bMark)
+  {
+    memcpy(pRecord->name, p + 48, PERF_MAX_NAME);
+    pRecord->name[PERF_MAX_NAME] = '\0';
+    pRecord->value = (int64_t)Read64(p + 72);
+  }
+  else
+  {
+    const uint8_t *g = p + 24;
+    snprintf(pRecord->name, sizeof(pRecord->name), "{%08X-%04X-%04X-%02X%02X-%02X%02X%02X%02X%02X%02X}",
+      Read32(g), (unsigned)(g[4] | (g[5] << 8)), (unsigned)(g[6] | (g[7] << 8)),
+      g[8], g[9], g[10], g[11], g[12], g[13], g[14], g[15]);
+    pRecord->value = 0;
+  }
+}
+
+
+#ifdef _WIN32
+static void DefaultPerfPath(char *dest, size_t cch)
+{
+  char folder[MAX_PATH];
+  SHGetSpecialFolderPathA(NULL, folder, CSIDL_COMMON_APPDATA, FALSE);
+  sprintf_s(dest, cch, "%s\\Team MediaPortal\\MP2-Client\\Log\\Evr.perf", folder);
+}
+#endif
+
+
+static void PrintUsage()
+{
+#ifdef _WIN32
+  fprintf(stderr, "Usage: EvrPerfDump [-summary] [perf file]\n");
+#else
+  fprintf(stderr, "Usage: EvrPerfDump [-summary] perf file\n");
+#endif
+  fprintf(stderr, "  -summary  Only print the event counts and durations, not the records.\n");
+}
+
+
+static int FindEvent(EventSummary *pEvents, int *pcEvents, const char *name)
+{
+  for (int i = 0; i < *pcEvents; i++)
+  {
+    if (strcmp(pEvents[i].name, name) == 0)
+    {
+      return i;
+    }
+  }
+  if (*pcEvents == MAX_EVENTS)
+  {
+    return -1;
+  }
+  EventSummary& summary = pEvents[(*pcEvents)++];
+  memset(&summary, 0, sizeof(summary));
+  snprintf(summary.name, sizeof(summary.name), "%s", name);
+  return *pcEvents - 1;
+}
+
+
+int main(int argc, char *argv[])
+{
+  bool bSummaryOnly = false;
+  const char *fileName = NULL;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (_stricmp(argv[i], "-summary") == 0)
+    {
+      bSummaryOnly = true;
+    }
+    else if (argv[i][0] == '-' || fileName != NULL)
+    {
+      PrintUsage();
+      return 2;
+    }
+    else
+    {
+      fileName = argv[i];
+    }
+  }
+  if (fileName == NULL)
+  {
+#ifdef _WIN32
+    static char defaultName[MAX_PATH];
+    DefaultPerfPath(defaultName, MAX_PATH);
+    fileName = defaultName;
+#else
+    PrintUsage();
+    return 2;
+#endif
+  }
+
+  FILE *pFile = fopen(fileName, "rb");
+  if (pFile == NULL)
+  {
+    fprintf(stderr, "Cannot open %s: %s\n", fileName, strerror(errno));
+    return 1;
+  }
+
+  // Fields appended to the header or the records in later versions are skipped.
+  uint8_t header[PERF_HEADER_SIZE];
+  bool bValid = (fread(header, sizeof(header), 1, pFile) == 1) && (Read32(header) == PERF_MAGIC) &&
+    (Read32(header + 4) == PERF_VERSION) && (Read32(header + 8) >= PERF_HEADER_SIZE) &&
+    (Read32(header + 12) >= PERF_RECORD_SIZE);
+  const uint32_t headerSize = bValid ? Read32(header + 8) : 0;
+  const uint32_t recordSize = bValid ? Read32(header + 12) : 0;
+  const uint32_t recordCount = bValid ? Read32(header + 16) : 0;
+  bValid = bValid && (fseek(pFile, headerSize, SEEK_SET) == 0);
+
+  // Read all records at once, the file is a few MB at most.
+  uint8_t *pRecords = NULL;
+  if (bValid && recordCount > 0)
+  {
+    pRecords = (uint8_t*)malloc((size_t)recordCount * recordSize);
+    bValid = (pRecords != NULL) && (fread(pRecords, recordSize, recordCount, pFile) == recordCount);
+  }
+  fclose(pFile);
+  if (!bValid)
+  {
+    fprintf(stderr, "%s is not a perflog capture of version %u\n", fileName, PERF_VERSION);
+    free(pRecords);
+    return 1;
+  }
+
+  const int64_t frequency = (int64_t)Read64(header + 24);
+  const int64_t startCounter = (int64_t)Read64(header + 32);
+  printf("# %s: process %u, %u records, %" PRId64 " dropped, %" PRId64 " counts/s\n",
+    fileName, Read32(header + 20), recordCount, (int64_t)Read64(header + 40), frequency);
+  const double usPerCount = frequency > 0 ? 1e6 / frequency : 0;
+
+  if (!bSummaryOnly)
+  {
+    printf("time_us,thread,phase,level,name,id,value\n");
+  }
+
+  static EventSummary events[MAX_EVENTS];
+  static OpenEvent openEvents[MAX_OPEN];
+  int cEvents = 0, cOpen = 0;
+  uint32_t unmatched = 0;
+
+  for (uint32_t i = 0; i < recordCount; i++)
+  {
+    PerfRecord record;
+    DecodeRecord(pRecords + (size_t)i * recordSize, &record);
+
+    if (!bSummaryOnly)
+    {
+      printf("%.1f,%u,%c,%u,%s,", (record.timestamp - startCounter) * usPerCount, record.threadId,
+        record.phase, record.level, record.name);
+      if (record.bMark)
+      {
+        printf("0x%" PRIX64 ",%" PRId64 "\n", record.id, record.value);
+      }
+      else
+      {
+        // The payload layout depends on the GUID, so it is printed as hex bytes.
+        printf(",");
+        for (uint32_t b = 0; b < record.dataSize; b++)
+        {
+          printf("%02X", record.pData[b]);
+        }
+        printf("\n");
+      }
+    }
+
+    int event = FindEvent(events, &cEvents, record.name);
+    if (event < 0)
+    {
+      continue;
+    }
+    events[event].count++;
+
+    // An end closes the latest begin of the same event on the same thread and object.
+    if (record.phase == 'B' && cOpen < MAX_OPEN)
+    {
+      OpenEvent& begin = openEvents[cOpen++];
+      begin.threadId = record.threadId;
+      begin.id = record.id;
+      begin.event = event;
+      begin.timestamp = record.timestamp;
+    }
+    else if (record.phase == 'E')
+    {
+      int j = cOpen - 1;
+      while (j >= 0 && (openEvents[j].threadId != record.threadId || openEvents[j].id != record.id ||
+        openEvents[j].event != event))
+      {
+        j--;
+      }
+      if (j < 0)
+      {
+        unmatched++;
+        continue;
+      }
+      double us = (record.timestamp - openEvents[j].timestamp) * usPerCount;
+      events[event].pairs++;
+      events[event].totalUs += us;
+      if (us > events[event].maxUs)
+      {
+        events[event].maxUs = us;
+      }
+      memmove(&openEvents[j], &openEvents[j + 1], (cOpen - j - 1) * sizeof(OpenEvent));
+      cOpen--;
+    }
+  }
+
+  printf("# event,count,pairs,mean_us,max_us\n");
+  for (int i = 0; i < cEvents; i++)
+  {
+    const EventSummary& summary = events[i];
+    printf("# %s,%u,%u,%.1f,%.1f\n", summary.name, summary.count, summary.pairs,
+      summary.pairs > 0 ? summary.totalUs / summary.pairs : 0.0, summary.maxUs);
+  }
+  printf("# %d begin(s) without end, %u end(s) without begin\n", cOpen, unmatched);
+
+  free(pRecords);
+  return 0;
+}
@@ -0,0 +1,213 @@
+// Copyright (C) 2007-2014 Team MediaPortal
+// http://www.team-mediaportal.com
+//
+// This file is part of MediaPortal 2
+//
+// MediaPortal 2 is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// MediaPortal 2 is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with MediaPortal 2. If not, see <http://www.gnu.org/licenses/>.
+
+// Offline reader for the presenter's binary trace (Evr.trace). Prints the records of the last run as
+// CSV, followed by a summary of the scheduling decisions.
+//
+// Usage: EvrTraceDump [-summary] [trace file]
+//
+// On Windows the trace in the MP2 client log folder is read if no file name is given; elsewhere the
+// file name is required. The file may be read while the presenter is still writing it; records that
+// are being overwritten are skipped. The tool only depends on the C library and the file format in
+// PresenterTraceFormat.h, so a trace can also be read on other hosts (see the Makefile).
+
+#define __STDC_FORMAT_MACROS
+#ifdef _WIN32
+#include <windows.h>
+#include <Shlobj.h>
+#endif
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../../source/PresenterTraceFormat.h"
+
+#ifndef _WIN32
+#include <strings.h>
+#define _stricmp strcasecmp
+#endif
+
+static const char* const g_DecisionNames[] = { "present", "late", "immediate", "sleep", "drop" };
+const uint32_t DECISION_COUNT = sizeof(g_DecisionNames) / sizeof(g_DecisionNames[0]);
+
+// Seconds between the FILETIME epoch (1601) and the Unix epoch (1970).
+const int64_t FILETIME_UNIX_EPOCH = 11644473600LL;
+
+
+#ifdef _WIN32
+static void DefaultTracePath(char *dest, size_t cch)
+{
+  char folder[MAX_PATH];
+  SHGetSpecialFolderPathA(NULL, folder, CSIDL_COMMON_APPDATA, FALSE);
+  sprintf_s(dest, cch, "%s\\Team MediaPortal\\MP2-Client\\Log\\Evr.trace", folder);
+}
+#endif
+
+
+static void PrintUsage()
+{
+#ifdef _WIN32
+  fprintf(stderr, "Usage: EvrTraceDump [-summary] [trace file]\n");
+#else
+  fprintf(stderr, "Usage: EvrTraceDump [-summary] trace file\n");
+#endif
+  fprintf(stderr, "  -summary  Only print the decision counts, not the records.\n");
+}
+
+
+// Formats a FILETIME as local time.
+static void FormatFileTime(int64_t fileTime, char *dest, size_t cch)
+{
+  time_t t = (time_t)(fileTime / 10000000 - FILETIME_UNIX_EPOCH);
+  struct tm local;
+#ifdef _WIN32
+  bool bValid = (localtime_s(&local, &t) == 0);
+#else
+  bool bValid = (localtime_r(&t, &local) != NULL);
+#endif
+  if (!bValid || (strftime(dest, cch, "%Y-%m-%d %H:%M:%S", &local) == 0))
+  {
+    snprintf(dest, cch, "?");
+  }
+}
+
+
+int main(int argc, char *argv[])
+{
+  bool bSummaryOnly = false;
+  const char *fileName = NULL;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (_stricmp(argv[i], "-summary") == 0)
+    {
+      bSummaryOnly = true;
+    }
+    else if (argv[i][0] == '-' || fileName != NULL)
+    {
+      PrintUsage();
+      return 2;
+    }
+    else
+    {
+      fileName = argv[i];
+    }
+  }
+  if (fileName == NULL)
+  {
+#ifdef _WIN32
+    static char defaultName[MAX_PATH];
+    DefaultTracePath(defaultName, MAX_PATH);
+    fileName = defaultName;
+#else
+    PrintUsage();
+    return 2;
+#endif
+  }
+
+  // The C library opens the file with shared write access, which the presenter needs while it writes.
+  FILE *pFile = fopen(fileName, "rb");
+  if (pFile == NULL)
+  {
+    fprintf(stderr, "Cannot open %s: %s\n", fileName, strerror(errno));
+    return 1;
+  }
+
+  TraceFileHeader header;
+  bool bValid = (fread(&header, sizeof(header), 1, pFile) == 1) && (header.magic == TRACE_MAGIC) &&
+    (header.version == TRACE_VERSION) && (header.headerSize == sizeof(TraceFileHeader)) &&
+    (header.recordSize == sizeof(TraceRecord)) && (header.capacity != 0) && (header.writeIndex >= 0);
+
+  // Read all slots at once, the file is a few MB at most.
+  TraceRecord *pRecords = NULL;
+  if (bValid)
+  {
+    pRecords = (TraceRecord*)malloc((size_t)header.capacity * sizeof(TraceRecord));
+    bValid = (pRecords != NULL) && (fread(pRecords, sizeof(TraceRecord), header.capacity, pFile) == header.capacity);
+  }
+  fclose(pFile);
+  if (!bValid)
+  {
+    fprintf(stderr, "%s is not a presenter trace of version %u\n", fileName, TRACE_VERSION);
+    free(pRecords);
+    return 1;
+  }
+
+  int64_t end = header.writeIndex;
+  int64_t begin = (end > (int64_t)header.capacity) ? end - header.capacity : 0;
+
+  char startTime[32];
+  FormatFileTime(header.startTime, startTime, sizeof(startTime));
+  printf("# %s: process %u, started %s, %" PRId64 " records written, %" PRId64 " in the file\n",
+    fileName, header.processId, startTime, end, end - begin);
+
+  if (!bSummaryOnly)
+  {
+    printf("index,time_ms,decision,sample_time_ms,clock_time_ms,delta_ms,present_ms,free_samples,sleep_ms\n");
+  }
+
+  uint32_t counts[DECISION_COUNT] = { 0 };
+  uint32_t skipped = 0;
+  int64_t firstTimestamp = 0;
+  bool bFirst = true;
+  int64_t maxLate = 0;
+
+  for (int64_t index = begin; index < end; index++)
+  {
+    // Check the sequence, the writer may have overwritten the record while we read it.
+    const TraceRecord& record = pRecords[index % header.capacity];
+    if ((record.sequence != (uint32_t)(index + 1)) || (record.decision >= DECISION_COUNT))
+    {
+      skipped++;
+      continue;
+    }
+
+    if (bFirst)
+    {
+      firstTimestamp = record.timestamp;
+      bFirst = false;
+    }
+
+    counts[record.decision]++;
+    if ((record.decision == TRACE_PRESENT_LATE) && (-record.delta > maxLate))
+    {
+      maxLate = -record.delta;
+    }
+
+    if (!bSummaryOnly)
+    {
+      printf("%" PRId64 ",%.3f,%s,%.3f,%.3f,%.3f,%.3f,%d,%d\n", index,
+        (record.timestamp - firstTimestamp) / 10000.0, g_DecisionNames[record.decision],
+        record.sampleTime / 10000.0, record.clockTime / 10000.0, record.delta / 10000.0,
+        record.presentDuration / 10000.0, record.freeSamples, record.sleepMs);
+    }
+  }
+
+  printf("# ");
+  for (uint32_t i = 0; i < DECISION_COUNT; i++)
+  {
+    printf("%s %u, ", g_DecisionNames[i], counts[i]);
+  }
+  printf("skipped %u, latest late sample %.3f ms\n", skipped, maxLate / 10000.0);
+
+  free(pRecords);
+  return 0;
+}
@@ -48,6 +48,46 @@ namespace MediaPortal.UI.Players.Video.Native
         EvrDeinit32(presenterInstance);
     }
 
+    /// <summary>
+    /// Sets the deinterlacing mode of the presenter (0 = none, 1 = weave, 2 = bob, 3 = adaptive).
+    /// </summary>
+    internal static int EvrSetDeinterlaceMode(IntPtr presenterInstance, int mode)
+    {
+      if (IntPtr.Size > 4)
+        return EvrSetDeinterlaceMode64(presenterInstance, mode);
+      return EvrSetDeinterlaceMode32(presenterInstance, mode);
+    }
+
+    /// <summary>
+    /// Starts the binary trace of the presenter's scheduling decisions (Evr.trace in the log folder).
+    /// </summary>
+    internal static int EvrEnableTrace(IntPtr presenterInstance)
+    {
+      if (IntPtr.Size > 4)
+        return EvrEnableTrace64(presenterInstance);
+      return EvrEnableTrace32(presenterInstance);
+    }
+
+    /// <summary>
+    /// Starts capturing the performance events of the DirectShow base classes in memory.
+    /// </summary>
+    internal static int EvrStartPerfLog()
+    {
+      if (IntPtr.Size > 4)
+        return EvrStartPerfLog64();
+      return EvrStartPerfLog32();
+    }
+
+    /// <summary>
+    /// Writes the captured performance events to Evr.perf.json and Evr.perf (binary) in the log folder and stops capturing.
+    /// </summary>
+    internal static int EvrSavePerfLog()
+    {
+      if (IntPtr.Size > 4)
+        return EvrSavePerfLog64();
+      return EvrSavePerfLog32();
+    }
+
     #region DLL imports
 
     [DllImport("x86\\EVRPresenter.dll", ExactSpelling = true, CharSet = CharSet.Auto, SetLastError = true, EntryPoint = "EvrInit")]
@@ -56,12 +96,36 @@ namespace MediaPortal.UI.Players.Video.Native
     [DllImport("x86\\EVRPresenter.dll", ExactSpelling = true, CharSet = CharSet.Auto, SetLastError = true, EntryPoint = "EvrDeinit")]
     private static extern void EvrDeinit32(IntPtr presenterInstance);
 
+    [DllImport("x86\\EVRPresenter.dll", ExactSpelling = true, CharSet = CharSet.Auto, SetLastError = true, EntryPoint = "EvrSetDeinterlaceMode")]
+    private static extern int EvrSetDeinterlaceMode32(IntPtr presenterInstance, int mode);
+
+    [DllImport("x86\\EVRPresenter.dll", ExactSpelling = true, CharSet = CharSet.Auto, SetLastError = true, EntryPoint = "EvrEnableTrace")]
+    private static extern int EvrEnableTrace32(IntPtr presenterInstance);
+
+    [DllImport("x86\\EVRPresenter.dll", ExactSpelling = true, CharSet = CharSet.Auto, SetLastError = true, EntryPoint = "EvrStartPerfLog")]
+    private static extern int EvrStartPerfLog32();
+
+    [DllImport("x86\\EVRPresenter.dll", ExactSpelling = true, CharSet = CharSet.Auto, SetLastError = true, EntryPoint = "EvrSavePerfLog")]
+    private static extern int EvrSavePerfLog32();
+
     [DllImport("x64\\EVRPresenter.dll", ExactSpelling = true, CharSet = CharSet.Auto, SetLastError = true, EntryPoint = "EvrInit")]
     private static extern int EvrInit64(IEVRPresentCallback callback, IntPtr dwD3DDevice, IBaseFilter evrFilter, IntPtr monitor, out IntPtr presenterInstance);
 
     [DllImport("x64\\EVRPresenter.dll", ExactSpelling = true, CharSet = CharSet.Auto, SetLastError = true, EntryPoint = "EvrDeinit")]
     private static extern void EvrDeinit64(IntPtr presenterInstance);
 
+    [DllImport("x64\\EVRPresenter.dll", ExactSpelling = true, CharSet = CharSet.Auto, SetLastError = true, EntryPoint = "EvrSetDeinterlaceMode")]
+    private static extern int EvrSetDeinterlaceMode64(IntPtr presenterInstance, int mode);
+
+    [DllImport("x64\\EVRPresenter.dll", ExactSpelling = true, CharSet = CharSet.Auto, SetLastError = true, EntryPoint = "EvrEnableTrace")]
+    private static extern int EvrEnableTrace64(IntPtr presenterInstance);
+
+    [DllImport("x64\\EVRPresenter.dll", ExactSpelling = true, CharSet = CharSet.Auto, SetLastError = true, EntryPoint = "EvrStartPerfLog")]
+    private static extern int EvrStartPerfLog64();
+
+    [DllImport("x64\\EVRPresenter.dll", ExactSpelling = true, CharSet = CharSet.Auto, SetLastError = true, EntryPoint = "EvrSavePerfLog")]
+    private static extern int EvrSavePerfLog64();
+
     #endregion
   }
 }
@@ -79,6 +79,7 @@ namespace MediaPortal.UI.Players.Video
 
     protected const string EVR_FILTER_NAME = "Enhanced Video Renderer";
     protected IntPtr _presenterInstance;
+    protected bool _evrPerfLogStarted;
 
     // The default name for "No subtitles available" or "Subtitles disabled".
     private const string NO_SUBTITLES = "[Playback.Players.No.Subtitles]";
@@ -246,8 +247,29 @@ namespace MediaPortal.UI.Players.Video
         throw new VideoPlayerException("Initializing of EVR failed");
       }
 
-      // Check if CC is added, in this case the EVR needs one more input pin
       VideoSettings settings = ServiceRegistration.Get<ISettingsManager>().Load<VideoSettings>();
+
+      // The mode has to be set before the mixer's output type is negotiated. A failure is not fatal, the presenter keeps rejecting interlaced types.
+      hr = EvrPresenterWrapper.EvrSetDeinterlaceMode(_presenterInstance, (int)settings.DeinterlaceMode);
+      if (hr != 0)
+        ServiceRegistration.Get<ILogger>().Warn("{0}: Setting EVR deinterlace mode {1} failed (0x{2:X8})", PlayerTitle, settings.DeinterlaceMode, hr);
+
+      if (settings.EnableEvrTrace)
+      {
+        hr = EvrPresenterWrapper.EvrEnableTrace(_presenterInstance);
+        if (hr != 0)
+          ServiceRegistration.Get<ILogger>().Warn("{0}: Starting the EVR trace failed (0x{1:X8})", PlayerTitle, hr);
+      }
+
+      if (settings.EnableEvrPerfLog)
+      {
+        hr = EvrPresenterWrapper.EvrStartPerfLog();
+        if (hr != 0)
+          ServiceRegistration.Get<ILogger>().Warn("{0}: Starting the EVR performance log failed (0x{1:X8})", PlayerTitle, hr);
+        _evrPerfLogStarted = hr == 0;
+      }
+
+      // Check if CC is added, in this case the EVR needs one more input pin
       var streamCount = _streamCount;
       if (settings.EnableAtscClosedCaptions)
       {
@@ -311,6 +333,11 @@ namespace MediaPortal.UI.Players.Video
     {
       if (_presenterInstance == IntPtr.Zero)
         return;
+      if (_evrPerfLogStarted)
+      {
+        EvrPresenterWrapper.EvrSavePerfLog();
+        _evrPerfLogStarted = false;
+      }
       EvrPresenterWrapper.EvrDeinit(_presenterInstance);
       _presenterInstance = IntPtr.Zero;
     }
@@ -33,6 +33,21 @@ using System.Xml.Serialization;
 
 namespace MediaPortal.UI.Players.Video.Settings
 {
+  /// <summary>
+  /// Deinterlacing modes of the EVR presenter. The values match the presenter's DEINTERLACE_MODE.
+  /// </summary>
+  public enum DeinterlaceMode
+  {
+    /// <summary>Interlaced types are rejected, the decoder has to deinterlace.</summary>
+    None = 0,
+    /// <summary>Both fields are weaved into one frame.</summary>
+    Weave = 1,
+    /// <summary>Each field is line-doubled and presented on its own.</summary>
+    Bob = 2,
+    /// <summary>The best (motion adaptive) mode of the driver.</summary>
+    Adaptive = 3
+  }
+
   /// <summary>
   /// VideoSettings class contains settings for VideoPlayers.
   /// </summary>
@@ -266,6 +281,25 @@ namespace MediaPortal.UI.Players.Video.Settings
     [Setting(SettingScope.User, false)]
     public bool PreferMultiChannelAudio { get; set; }
 
+    /// <summary>
+    /// Gets or sets how the EVR presenter handles interlaced video. With <see cref="Settings.DeinterlaceMode.None"/>
+    /// the EVR mixer only gets progressive output types and deinterlacing is left to the decoder.
+    /// </summary>
+    [Setting(SettingScope.User, DeinterlaceMode.None)]
+    public DeinterlaceMode DeinterlaceMode { get; set; }
+
+    /// <summary>
+    /// Gets or sets a flag if the EVR presenter should write a binary trace of its scheduling decisions (Evr.trace in the log folder).
+    /// </summary>
+    [Setting(SettingScope.User, false)]
+    public bool EnableEvrTrace { get; set; }
+
+    /// <summary>
+    /// Gets or sets a flag if the EVR presenter should capture the DirectShow base classes' performance events while playing (Evr.perf.json and Evr.perf in the log folder).
+    /// </summary>
+    [Setting(SettingScope.User, false)]
+    public bool EnableEvrPerfLog { get; set; }
+
     /// <summary>
     /// Gets or sets the preferred subtitle stream name for video playback.
     /// </summary>